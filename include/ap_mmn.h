@@ -613,6 +613,25 @@
  * 20191203.2 (2.5.1-dev)  Add ap_no2slash_ex() and merge_slashes to 
  *                         core_server_conf.
  * 20191203.3 (2.5.1-dev)  Add forward_100_continue{,_set} to proxy_dir_conf
+ * 20191203.4 (2.5.1-dev)  Add ap_proxy_splice_between_connections() and
+ *                         ap_proxy_splice_bytes() to mod_proxy.h
+ * 20191203.5 (2.5.1-dev)  Add proxy_tunnel_rec, ap_proxy_tunnel_create() and
+ *                         ap_proxy_tunnel_run() to mod_proxy.h
+ * 20191203.6 (2.5.1-dev)  Add idle_key, idle_next and idle to
+ *                         util_ldap_connection_t, and idle_connections,
+ *                         util_ldap_cache_shard_locks, util_ldap_cache_shards
+ *                         and util_ldap_cache_lock_stats to util_ldap_state_t
+ * 20191203.7 (2.5.1-dev)  Add util_trace.h: ap_trace_t, ap_trace_span_t,
+ *                         ap_trace_*() and the trace_span hook; add trace
+ *                         to core_request_config, trace_context and
+ *                         trace_sample to core_server_config
+ * 20191203.8 (2.5.1-dev)  Add ap_piped_log_write(), piped_log_buffer and
+ *                         piped_log_drop to core_server_config,
+ *                         piped_log_stalls and piped_log_drops to
+ *                         global_score
+ * 20191203.9 (2.5.1-dev)  Add prepare_lazy and prepared_max to dbd_cfg_t,
+ *                         priv to ap_dbd_t, and ap_dbd_prepared() (and its
+ *                         optional function) to mod_dbd.h
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503235UL /* "AP25" */
@@ -620,7 +639,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20191203
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 3                 /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 9                 /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
@@ -32,6 +32,7 @@
 #include "util_filter.h"
 #include "ap_expr.h"
 #include "apr_tables.h"
+#include "util_trace.h"
 
 #include "http_config.h"
 
@@ -440,6 +441,10 @@ typedef struct {
     /** Should addition of charset= be suppressed for this request?
      */
     int suppress_charset;
+
+    /** The trace context of the (initial) request, see ap_trace_get()
+     */
+    ap_trace_t trace;
 } core_request_config;
 
 /* Standard entries that are guaranteed to be accessible via
@@ -772,6 +777,18 @@ typedef struct {
     apr_int32_t  flush_max_pipelined;
     unsigned int strict_host_check;
     unsigned int merge_slashes;
+
+    /** Whether the W3C Trace Context is handled (TraceContext) */
+    int trace_context;
+    /** The ratio of the new traces sampled, in parts per million, or -1 */
+    int trace_sample;
+
+    /** The size of the children's buffers of the piped logs, or 0
+     *  (PipedLogBuffer, main server only) */
+    apr_size_t piped_log_buffer;
+    /** Whether the lines are dropped rather than waited for when the
+     *  buffer is full */
+    int piped_log_drop;
 } core_server_config;
 
 /* for AddOutputFiltersByType in core.c */
@@ -816,6 +816,23 @@ AP_DECLARE(apr_file_t *) ap_piped_log_read_fd(piped_log *pl);
  */
 AP_DECLARE(apr_file_t *) ap_piped_log_write_fd(piped_log *pl);
 
+/**
+ * Write a line to the piped log
+ * @param pl The piped log structure
+ * @param str The line, with its line feed
+ * @param len The length of the line
+ * @return APR_SUCCESS, or the error writing to the pipe
+ * @note In the children, when PipedLogBuffer is configured, the line is
+ *       copied to the buffer of the piped log and written to the pipe by
+ *       a thread of its own; once the buffer is full, the line is waited
+ *       for or dropped (and counted in the scoreboard) per its policy.
+ *       Otherwise, or if the line is longer than a quarter of the buffer,
+ *       it is written to the pipe directly, before the lines which may
+ *       still be in the buffer.
+ */
+AP_DECLARE(apr_status_t) ap_piped_log_write(piped_log *pl, const char *str,
+                                            apr_size_t len);
+
 /**
  * hook method to generate unique id for connection or request
  * @ingroup hooks
@@ -240,6 +240,16 @@ AP_DECLARE(void) ap_clear_auth_internal(void);
  */
 AP_DECLARE(void) ap_setup_auth_internal(apr_pool_t *ptemp);
 
+/**
+ * Setup the per-child state of the request processing, like the cache of
+ * merged <Location > and <If > configurations.
+ * @param p The child pool
+ * @param s The main server
+ * @note ap_request_child_init is not for use by modules; it is an
+ * internal core function
+ */
+void ap_request_child_init(apr_pool_t *p, server_rec *s);
+
 /**
  * Register an authentication or authorization provider with the global
  * provider pool.
@@ -130,6 +130,11 @@ typedef struct {
 #ifdef HAVE_TIMES
     struct tms times;
 #endif
+    /* lines of the children's piped log buffers (PipedLogBuffer) which
+     * had to wait for room, and which were dropped for the lack of it
+     */
+    apr_uint32_t piped_log_stalls;
+    apr_uint32_t piped_log_drops;
 } global_score;
 
 /* stuff which the parent generally writes and the children rarely read */
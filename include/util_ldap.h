@@ -27,6 +27,7 @@
 #include "apr_thread_mutex.h"
 #include "apr_thread_rwlock.h"
 #include "apr_tables.h"
+#include "apr_hash.h"
 #include "apr_time.h"
 #include "apr_version.h"
 #if APR_MAJOR_VERSION < 2
@@ -136,6 +137,10 @@ typedef struct util_ldap_connection_t {
     int must_rebind;                    /* The connection was last bound with other then binddn/bindpw */
     request_rec *r;                     /* request_rec used to find this util_ldap_connection_t */
     apr_time_t last_backend_conn;       /* the approximate time of the last backend LDAP requst */
+
+    const char *idle_key;               /* key of the server in st->idle_connections */
+    struct util_ldap_connection_t *idle_next; /* next idle connection to this server */
+    int idle;                           /* Is this connection in st->idle_connections */
 } util_ldap_connection_t;
 
 typedef struct util_ldap_config_t {
@@ -181,6 +186,16 @@ typedef struct util_ldap_state_t {
     apr_interval_time_t connection_pool_ttl;
     int retries;                        /* number of retries for failed bind/search/compare */
     apr_interval_time_t retry_delay;    /* delay between retries of failed bind/search/compare */
+
+    apr_hash_t *idle_connections;       /* server key => util_ldap_connection_t list */
+
+    /* The main cache lock (util_ldap_cache_lock) protects the URL cache
+     * and the shared memory allocator, the shard locks protect the search
+     * and compare caches of the URLs that hash to them.
+     */
+    apr_global_mutex_t **util_ldap_cache_shard_locks;
+    int util_ldap_cache_shards;
+    struct util_ald_lock_stats_t *util_ldap_cache_lock_stats; /* main, shards */
 } util_ldap_state_t;
 
 /* Used to store arrays of attribute labels/values. */
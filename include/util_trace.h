@@ -0,0 +1,207 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  util_trace.h
+ * @brief W3C Trace Context propagation and request spans
+ *
+ * @defgroup APACHE_CORE_TRACE Trace context and spans
+ * @ingroup  APACHE_CORE
+ * @{
+ */
+
+#ifndef APACHE_UTIL_TRACE_H
+#define APACHE_UTIL_TRACE_H
+
+#include "apr.h"
+#include "apr_time.h"
+#include "httpd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Length in bytes of a trace id */
+#define AP_TRACE_ID_LEN         16
+/** Length in bytes of a span id */
+#define AP_TRACE_SPAN_ID_LEN    8
+/** Length of a (version 00) traceparent header value, without the NUL */
+#define AP_TRACEPARENT_LEN      55
+
+/** The sampled bit of the trace flags */
+#define AP_TRACE_FLAG_SAMPLED   0x01
+
+/** Span kinds, with the values of OpenTelemetry's SpanKind */
+#define AP_TRACE_SPAN_INTERNAL  1
+#define AP_TRACE_SPAN_SERVER    2
+#define AP_TRACE_SPAN_CLIENT    3
+
+/**
+ * @brief A span: a timed operation within a trace
+ *
+ * Spans are provided by their callers (on the stack, or embedded in some
+ * per-request structure), so that beginning and ending an unsampled span
+ * costs no allocation.
+ */
+typedef struct ap_trace_span_t {
+    /** The trace this span belongs to */
+    unsigned char trace_id[AP_TRACE_ID_LEN];
+    /** The id of this span */
+    unsigned char span_id[AP_TRACE_SPAN_ID_LEN];
+    /** The id of the parent span, all zeros for a root span */
+    unsigned char parent_id[AP_TRACE_SPAN_ID_LEN];
+    /** The name of the operation, must live as long as the request */
+    const char *name;
+    /** What the operation is about (a URL, a key...), or NULL */
+    const char *target;
+    /** A short outcome of the operation (e.g. "hit"), or NULL */
+    const char *outcome;
+    /** When the span began and ended (0 until then) */
+    apr_time_t start;
+    apr_time_t end;
+    /** One of AP_TRACE_SPAN_* */
+    int kind;
+    /** The HTTP status of the operation, or 0 */
+    int status;
+    /** Whether the span is recorded (and given to the trace_span hook) */
+    unsigned int sampled:1;
+} ap_trace_span_t;
+
+/**
+ * @brief The trace context of a request
+ *
+ * It is held in the core's request config of the initial request, the
+ * subrequests and internal redirects share it.
+ */
+typedef struct ap_trace_t {
+    /** The span of the request itself, whose parent is the caller's one */
+    ap_trace_span_t span;
+    /** The tracestate received with the traceparent, or NULL */
+    const char *tracestate;
+    /** The trace flags received or decided */
+    unsigned char flags;
+    /** Whether tracing is enabled for this request */
+    unsigned int active:1;
+    /** Whether the request came with a valid traceparent, its tracestate
+     *  is forwarded only then */
+    unsigned int remote:1;
+    /** The traceparent for the outgoing calls */
+    char traceparent[AP_TRACEPARENT_LEN + 1];
+} ap_trace_t;
+
+/**
+ * Parse a traceparent header value
+ * @param val The header value
+ * @param trace_id Where to store the trace id
+ * @param parent_id Where to store the parent (span) id
+ * @param flags Where to store the trace flags
+ * @return 1 if the value is valid, 0 otherwise (the outputs are then
+ *         undefined)
+ * @note Values of a later version than 00 are accepted as long as they
+ *       start with the fields of version 00, per the specification.
+ */
+AP_DECLARE(int) ap_trace_parse_traceparent(const char *val,
+                                           unsigned char *trace_id,
+                                           unsigned char *parent_id,
+                                           unsigned char *flags);
+
+/**
+ * Format a (version 00) traceparent header value
+ * @param buf Where to write it, AP_TRACEPARENT_LEN + 1 bytes long
+ * @param trace_id The trace id
+ * @param span_id The span id (parent id for the receiver)
+ * @param flags The trace flags
+ */
+AP_DECLARE(void) ap_trace_format_traceparent(char *buf,
+                                             const unsigned char *trace_id,
+                                             const unsigned char *span_id,
+                                             unsigned char flags);
+
+/**
+ * Get the trace context of a request
+ * @param r The request (or any of its subrequests or internal redirects)
+ * @return The trace context, or NULL if tracing is not enabled for it
+ */
+AP_DECLARE(ap_trace_t *) ap_trace_get(request_rec *r);
+
+/**
+ * Begin a span of a request
+ * @param r The request
+ * @param span The span, provided by the caller
+ * @param parent The parent span, or NULL for the request's span
+ * @param name The name of the span
+ * @param kind One of AP_TRACE_SPAN_*
+ * @return Whether the span is sampled
+ * @note Nothing is allocated; nothing but span->sampled is set when the
+ *       request is not traced, or the span not sampled and not of the
+ *       client kind (whose id is propagated anyway).
+ * @note The traceparent of the outgoing calls (ap_trace_traceparent())
+ *       names the last client span begun.
+ */
+AP_DECLARE(int) ap_trace_span_begin(request_rec *r, ap_trace_span_t *span,
+                                    const ap_trace_span_t *parent,
+                                    const char *name, int kind);
+
+/**
+ * End a span of a request, and run the trace_span hook if it is sampled
+ * @param r The request
+ * @param span The span
+ * @param status The HTTP status of the operation, or 0
+ * @note Ending a span twice is harmless, the second time is a noop.
+ */
+AP_DECLARE(void) ap_trace_span_end(request_rec *r, ap_trace_span_t *span,
+                                   int status);
+
+/**
+ * Get the traceparent to send with an outgoing call of a request
+ * @param r The request
+ * @return The header value, or NULL if tracing is not enabled for the
+ *         request; it lives as long as the request
+ */
+AP_DECLARE(const char *) ap_trace_traceparent(request_rec *r);
+
+/**
+ * Set up the trace context of a request from its headers (or a new
+ * trace), as configured for its server
+ * @param r The request
+ * @note For the core's post_read_request hook
+ */
+AP_CORE_DECLARE(void) ap_trace_request_begin(request_rec *r);
+
+/**
+ * End the span of a request
+ * @param r The request
+ * @note For the core's log_transaction hook
+ */
+AP_CORE_DECLARE(void) ap_trace_request_end(request_rec *r);
+
+/**
+ * Hook for span exporters, run when a sampled span ends
+ * @ingroup hooks
+ * @param r The request the span belongs to
+ * @param span The span
+ * @note Runs in the thread of the request, the exporters are expected to
+ *       buffer the spans and write them out in batches.
+ */
+AP_DECLARE_HOOK(void, trace_span,
+                (request_rec *r, const ap_trace_span_t *span))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* !APACHE_UTIL_TRACE_H */
+/** @} */
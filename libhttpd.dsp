@@ -625,6 +625,14 @@ SOURCE=.\server\util_time.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\server\util_trace.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\include\util_trace.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\include\util_varbuf.h
 # End Source File
 # Begin Source File
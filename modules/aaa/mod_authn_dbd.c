@@ -37,6 +37,7 @@ typedef struct {
 /* optional function - look it up once in post_config */
 static ap_dbd_t *(*authn_dbd_acquire_fn)(request_rec*) = NULL;
 static void (*authn_dbd_prepare_fn)(server_rec*, const char*, const char*) = NULL;
+static apr_dbd_prepared_t *(*authn_dbd_prepared_fn)(ap_dbd_t*, const char*) = NULL;
 static APR_OPTIONAL_FN_TYPE(ap_authn_cache_store) *authn_cache_store = NULL;
 #define AUTHN_CACHE_STORE(r,user,realm,data) \
     if (authn_cache_store != NULL) \
@@ -72,6 +73,7 @@ static const char *authn_dbd_prepare(cmd_parms *cmd, void *cfg, const char *quer
             return "You must load mod_dbd to enable AuthDBD functions";
         }
         authn_dbd_acquire_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_acquire);
+        authn_dbd_prepared_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_prepared);
     }
     label = apr_psprintf(cmd->pool, "authn_dbd_%d", ++label_num);
 
@@ -118,7 +120,7 @@ static authn_status authn_dbd_password(request_rec *r, const char *user,
         return AUTH_GENERAL_ERROR;
     }
 
-    statement = apr_hash_get(dbd->prepared, conf->user, APR_HASH_KEY_STRING);
+    statement = authn_dbd_prepared_fn(dbd, conf->user);
     if (statement == NULL) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01655)
                       "A prepared statement could not be found for "
@@ -213,7 +215,7 @@ static authn_status authn_dbd_realm(request_rec *r, const char *user,
                       "No AuthDBDUserRealmQuery has been specified");
         return AUTH_GENERAL_ERROR;
     }
-    statement = apr_hash_get(dbd->prepared, conf->realm, APR_HASH_KEY_STRING);
+    statement = authn_dbd_prepared_fn(dbd, conf->realm);
     if (statement == NULL) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01660)
                       "A prepared statement could not be found for "
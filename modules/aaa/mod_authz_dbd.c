@@ -52,6 +52,7 @@ typedef struct {
 
 static ap_dbd_t *(*dbd_handle)(request_rec*) = NULL;
 static void (*dbd_prepare)(server_rec*, const char*, const char*) = NULL;
+static apr_dbd_prepared_t *(*dbd_prepared)(ap_dbd_t*, const char*) = NULL;
 
 static const char *const noerror = "???";
 
@@ -90,6 +91,7 @@ static const char *authz_dbd_prepare(cmd_parms *cmd, void *cfg,
             return "You must load mod_dbd to enable AuthzDBD functions";
         }
         dbd_handle = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_acquire);
+        dbd_prepared = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_prepared);
     }
     label = apr_psprintf(cmd->pool, "authz_dbd_%d", ++label_num);
 
@@ -139,7 +141,7 @@ static int authz_dbd_login(request_rec *r, authz_dbd_cfg *cfg,
         return HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    query = apr_hash_get(dbd->prepared, cfg->query, APR_HASH_KEY_STRING);
+    query = dbd_prepared(dbd, cfg->query);
     if (query == NULL) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01643)
                       "Error retrieving Query for %s!", action);
@@ -168,8 +170,7 @@ static int authz_dbd_login(request_rec *r, authz_dbd_cfg *cfg,
     }
 
     if (!newuri && cfg->redir_query) {
-        query = apr_hash_get(dbd->prepared, cfg->redir_query,
-                             APR_HASH_KEY_STRING);
+        query = dbd_prepared(dbd, cfg->redir_query);
         if (query == NULL) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01646)
                           "authz_dbd: no redirect query!");
@@ -234,7 +235,7 @@ static int authz_dbd_group_query(request_rec *r, authz_dbd_cfg *cfg,
         return HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    query = apr_hash_get(dbd->prepared, cfg->query, APR_HASH_KEY_STRING);
+    query = dbd_prepared(dbd, cfg->query);
     if (query == NULL) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01650)
                       "Error retrieving query for dbd-group!");
@@ -211,7 +211,7 @@ void cache_accept_headers(cache_handle_t *h, request_rec *r, apr_table_t *top,
  * This function returns OK if successful, DECLINED if no
  * cached entity fits the bill.
  */
-int cache_select(cache_request_rec *cache, request_rec *r)
+static int select_entity(cache_request_rec *cache, request_rec *r)
 {
     cache_provider_list *list;
     apr_status_t rv;
@@ -426,6 +426,24 @@ int cache_select(cache_request_rec *cache, request_rec *r)
     return DECLINED;
 }
 
+/* The selection, as a span of the request's trace */
+int cache_select(cache_request_rec *cache, request_rec *r)
+{
+    ap_trace_span_t span;
+    int rv;
+
+    ap_trace_span_begin(r, &span, NULL, "cache lookup",
+                        AP_TRACE_SPAN_INTERNAL);
+    rv = select_entity(cache, r);
+    if (span.sampled) {
+        span.target = cache ? cache->key : NULL;
+        span.outcome = (rv == OK) ? "hit"
+                     : (cache && cache->stale_handle) ? "stale" : "miss";
+        ap_trace_span_end(r, &span, (rv == OK || rv == DECLINED) ? 0 : rv);
+    }
+    return rv;
+}
+
 static apr_status_t cache_canonicalise_key(request_rec *r, apr_pool_t* p,
                                            const char *path, const char *query,
                                            apr_uri_t *parsed_uri,
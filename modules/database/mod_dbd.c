@@ -25,6 +25,8 @@
 #include "apr_hash.h"
 #include "apr_tables.h"
 #include "apr_lib.h"
+#include "apr_ring.h"
+#include "apr_atomic.h"
 #include "apr_dbd.h"
 
 #define APR_WANT_MEMFUNC
@@ -36,6 +38,7 @@
 #include "http_log.h"
 #include "http_request.h"
 #include "mod_dbd.h"
+#include "mod_status.h"
 
 extern module AP_MODULE_DECLARE_DATA dbd_module;
 
@@ -63,6 +66,38 @@ struct dbd_group_t {
     int destroyed;
 #else
     ap_dbd_t *rec;
+#endif
+    /* statistics (this child) */
+    apr_uint32_t acquired;
+    apr_uint32_t failed;
+    apr_uint32_t opened;
+    apr_uint32_t prepared;
+    apr_uint32_t evicted;
+};
+
+/* A statement prepared by DBDPrepareLazy, in its own pool so that it can
+ * be released alone when DBDPreparedMax is reached.
+ */
+typedef struct dbd_stmt_t dbd_stmt_t;
+
+struct dbd_stmt_t {
+    APR_RING_ENTRY(dbd_stmt_t) link;
+    const char *label;
+    apr_dbd_prepared_t *stmt;
+    apr_pool_t *pool;
+};
+
+typedef struct dbd_private_t dbd_private_t;
+
+struct dbd_private_t {
+    dbd_group_t *group;
+    apr_pool_t *pool;           /* parent of the statements' pools */
+    apr_hash_t *stmts;          /* label => dbd_stmt_t, if lazy */
+    APR_RING_HEAD(dbd_stmt_list, dbd_stmt_t) lru; /* most recent first */
+    int nstmts;
+    int keep_stmts;             /* set if they can't be released */
+#if !APR_HAS_THREADS
+    int users;                  /* of the shared connection */
 #endif
 };
 
@@ -72,7 +107,8 @@ typedef struct {
 } svr_cfg;
 
 typedef enum { cmd_name, cmd_params, cmd_persist,
-               cmd_min, cmd_keep, cmd_max, cmd_exp
+               cmd_min, cmd_keep, cmd_max, cmd_exp,
+               cmd_lazy, cmd_prepared_max
 } cmd_parts;
 
 static apr_pool_t *config_pool;
@@ -109,6 +145,8 @@ static void *create_dbd_config(apr_pool_t *pool, server_rec *s)
     cfg->queries = apr_hash_make(pool);
     cfg->init_queries = apr_array_make(pool, DEFAULT_SQL_INIT_ARRAY_SIZE,
                                        sizeof(const char *));
+    cfg->prepare_lazy = -1;
+    cfg->prepared_max = -1;
 
     return svr;
 }
@@ -133,6 +171,10 @@ static void *merge_dbd_config(apr_pool_t *pool, void *basev, void *addv)
     new->queries = apr_hash_overlay(pool, add->queries, base->queries);
     new->init_queries = apr_array_append(pool, add->init_queries,
                                          base->init_queries);
+    new->prepare_lazy = (add->prepare_lazy != -1) ? add->prepare_lazy
+                                                  : base->prepare_lazy;
+    new->prepared_max = (add->prepared_max != -1) ? add->prepared_max
+                                                  : base->prepared_max;
 
     return svr;
 }
@@ -200,7 +242,6 @@ static const char *dbd_param(cmd_parms *cmd, void *dconf, const char *val)
     return NULL;
 }
 
-#if APR_HAS_THREADS
 static const char *dbd_param_int(cmd_parms *cmd, void *dconf, const char *val)
 {
     svr_cfg *svr = ap_get_module_config(cmd->server->module_config,
@@ -215,6 +256,10 @@ static const char *dbd_param_int(cmd_parms *cmd, void *dconf, const char *val)
     }
 
     switch ((long) cmd->info) {
+    case cmd_prepared_max:
+        cfg->prepared_max = atoi(val);
+        break;
+#if APR_HAS_THREADS
     case cmd_min:
         cfg->nmin = atoi(val);
         cfg->set |= NMIN_SET;
@@ -231,11 +276,11 @@ static const char *dbd_param_int(cmd_parms *cmd, void *dconf, const char *val)
         cfg->exptime = atoi(val);
         cfg->set |= EXPTIME_SET;
         break;
+#endif
     }
 
     return NULL;
 }
-#endif
 
 static const char *dbd_param_flag(cmd_parms *cmd, void *dconf, int flag)
 {
@@ -246,6 +291,9 @@ static const char *dbd_param_flag(cmd_parms *cmd, void *dconf, int flag)
     case cmd_persist:
         svr->cfg->persist = flag;
         break;
+    case cmd_lazy:
+        svr->cfg->prepare_lazy = flag;
+        break;
     }
 
     return NULL;
@@ -287,6 +335,12 @@ static const command_rec dbd_cmds[] = {
                    "statement inherited from main server) and label"),
     AP_INIT_TAKE1("DBDInitSQL", dbd_init_sql, NULL, RSRC_CONF,
                    "SQL statement to be executed after connection is created"),
+    AP_INIT_FLAG("DBDPrepareLazy", dbd_param_flag, (void*)cmd_lazy, RSRC_CONF,
+                 "Prepare SQL statements on first use rather than when "
+                 "connecting"),
+    AP_INIT_TAKE1("DBDPreparedMax", dbd_param_int, (void*)cmd_prepared_max,
+                  RSRC_CONF, "Maximum number of statements kept prepared "
+                  "per connection with DBDPrepareLazy (0 for no limit)"),
 #if APR_HAS_THREADS
     AP_INIT_TAKE1("DBDMin", dbd_param_int, (void*)cmd_min, RSRC_CONF,
                   "Minimum number of connections"),
@@ -366,7 +420,9 @@ static int dbd_post_config(apr_pool_t *pconf, apr_pool_t *plog,
             int group_ok = 1;
 
             if (strcmp(cfg->name, group_cfg->name)
-                || strcmp(cfg->params, group_cfg->params)) {
+                || strcmp(cfg->params, group_cfg->params)
+                || cfg->prepare_lazy != group_cfg->prepare_lazy
+                || cfg->prepared_max != group_cfg->prepared_max) {
                 continue;
             }
 
@@ -438,6 +494,13 @@ static apr_status_t dbd_prepared_init(apr_pool_t *pool, dbd_cfg_t *cfg,
 
     rec->prepared = apr_hash_make(pool);
 
+    if (cfg->prepare_lazy == 1) {
+        /* ap_dbd_prepared() will do it */
+        rec->priv->stmts = apr_hash_make(pool);
+        APR_RING_INIT(&rec->priv->lru, dbd_stmt_t, link);
+        return APR_SUCCESS;
+    }
+
     for (hi = apr_hash_first(pool, cfg->queries); hi;
          hi = apr_hash_next(hi)) {
         const char *label, *query;
@@ -456,12 +519,83 @@ static apr_status_t dbd_prepared_init(apr_pool_t *pool, dbd_cfg_t *cfg,
         }
         else {
             apr_hash_set(rec->prepared, label, APR_HASH_KEY_STRING, stmt);
+            apr_atomic_inc32(&rec->priv->group->prepared);
         }
     }
 
     return APR_SUCCESS;
 }
 
+/* Release a statement on the database side.  Most drivers do it when the
+ * statement's pool is destroyed, but pgsql keeps the named statements
+ * until they are deallocated or the session ends.
+ */
+static apr_status_t dbd_stmt_deallocate(ap_dbd_t *rec, dbd_stmt_t *st)
+{
+    if (!strcmp(apr_dbd_name(rec->driver), "pgsql")) {
+        int nrows;
+
+        if (apr_dbd_query(rec->driver, rec->handle, &nrows,
+                          apr_pstrcat(st->pool, "DEALLOCATE ", st->label,
+                                      NULL))) {
+            return APR_EGENERAL;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+/* Release the least recently used statements of a connection beyond
+ * DBDPreparedMax.  This is only done when the connection is released and
+ * nobody else holds it, so that the statements handed out by
+ * ap_dbd_prepared() stay valid as long as they are used.  If a statement
+ * can't be released on the database side, its name can't be prepared
+ * again, so the connection keeps all its statements from then on.
+ */
+static void dbd_prepared_trim(ap_dbd_t *rec)
+{
+    dbd_private_t *priv = rec->priv;
+    int max = priv->group->cfg->prepared_max;
+
+    if (!priv->stmts || max <= 0 || priv->keep_stmts) {
+        return;
+    }
+
+    while (priv->nstmts > max) {
+        dbd_stmt_t *st = APR_RING_LAST(&priv->lru);
+
+        if (dbd_stmt_deallocate(rec, st) != APR_SUCCESS) {
+            const char *errmsg = apr_dbd_error(rec->driver, rec->handle,
+                                               APR_EGENERAL);
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0,
+                         priv->group->cfg->server, APLOGNO(10191)
+                         "failed to release SQL statement %s, keeping "
+                         "the statements of this connection: %s", st->label,
+                         (errmsg ? errmsg : "[???]"));
+            priv->keep_stmts = 1;
+            break;
+        }
+
+        APR_RING_REMOVE(st, link);
+        apr_hash_set(rec->prepared, st->label, APR_HASH_KEY_STRING, NULL);
+        apr_hash_set(priv->stmts, st->label, APR_HASH_KEY_STRING, NULL);
+        apr_pool_destroy(st->pool);
+        priv->nstmts--;
+        apr_atomic_inc32(&priv->group->evicted);
+    }
+}
+
+/* A connection is released by one of its holders */
+static void dbd_prepared_release(ap_dbd_t *rec)
+{
+#if !APR_HAS_THREADS
+    if (--rec->priv->users > 0) {
+        return;
+    }
+#endif
+    dbd_prepared_trim(rec);
+}
+
 static apr_status_t dbd_init_sql_init(apr_pool_t *pool, dbd_cfg_t *cfg,
                                       ap_dbd_t *rec)
 {
@@ -529,6 +663,8 @@ static apr_status_t dbd_construct(void **data_ptr,
     rec = apr_pcalloc(rec_pool, sizeof(ap_dbd_t));
 
     rec->pool = rec_pool;
+    rec->priv = apr_pcalloc(rec_pool, sizeof(dbd_private_t));
+    rec->priv->group = group;
 
     /* The driver is loaded at config time now, so this just checks a hash.
      * If that changes, the driver DSO could be registered to unload against
@@ -589,6 +725,7 @@ static apr_status_t dbd_construct(void **data_ptr,
         apr_pool_destroy(rec->pool);
         return rv;
     }
+    rec->priv->pool = prepared_pool;
 
     rv = dbd_prepared_init(prepared_pool, cfg, rec);
     if (rv != APR_SUCCESS) {
@@ -603,6 +740,8 @@ static apr_status_t dbd_construct(void **data_ptr,
 
     dbd_run_post_connect(prepared_pool, cfg, rec);
 
+    apr_atomic_inc32(&group->opened);
+
     *data_ptr = rec;
 
     return APR_SUCCESS;
@@ -758,8 +897,13 @@ DBD_DECLARE_NONSTD(void) ap_dbd_close(server_rec *s, ap_dbd_t *rec)
     }
 #if APR_HAS_THREADS
     else {
+        dbd_prepared_release(rec);
         apr_reslist_release(svr->group->reslist, rec);
     }
+#else
+    else if (rec == svr->group->rec) {
+        dbd_prepared_release(rec);
+    }
 #endif
 }
 
@@ -817,6 +961,7 @@ DBD_DECLARE_NONSTD(ap_dbd_t*) ap_dbd_open(apr_pool_t *pool, server_rec *s)
 #if APR_HAS_THREADS
     if (!group->reslist) {
         if (dbd_setup_lock(s, group) != APR_SUCCESS) {
+            apr_atomic_inc32(&group->failed);
             return NULL;
         }
     }
@@ -825,11 +970,13 @@ DBD_DECLARE_NONSTD(ap_dbd_t*) ap_dbd_open(apr_pool_t *pool, server_rec *s)
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02655)
                      "Failed to acquire DBD connection from pool!");
+        apr_atomic_inc32(&group->failed);
         return NULL;
     }
 
     if (dbd_check(pool, s, rec) != APR_SUCCESS) {
         apr_reslist_invalidate(group->reslist, rec);
+        apr_atomic_inc32(&group->failed);
         return NULL;
     }
 #else
@@ -848,12 +995,80 @@ DBD_DECLARE_NONSTD(ap_dbd_t*) ap_dbd_open(apr_pool_t *pool, server_rec *s)
     if (!rec) {
         dbd_construct((void*) &rec, group, group->pool);
         group->rec = rec;
+        if (!rec) {
+            apr_atomic_inc32(&group->failed);
+            return NULL;
+        }
     }
+
+    /* the statements are trimmed when the last user releases it */
+    rec->priv->users++;
 #endif
 
+    apr_atomic_inc32(&group->acquired);
+
     return rec;
 }
 
+DBD_DECLARE_NONSTD(apr_dbd_prepared_t*) ap_dbd_prepared(ap_dbd_t *rec,
+                                                        const char *label)
+{
+    dbd_private_t *priv = rec->priv;
+    dbd_cfg_t *cfg;
+    dbd_stmt_t *st;
+    const char *query;
+    apr_pool_t *pool;
+    apr_status_t rv;
+
+    if (!priv || !priv->stmts) {
+        return apr_hash_get(rec->prepared, label, APR_HASH_KEY_STRING);
+    }
+
+    st = apr_hash_get(priv->stmts, label, APR_HASH_KEY_STRING);
+    if (st) {
+        if (st != APR_RING_FIRST(&priv->lru)) {
+            APR_RING_REMOVE(st, link);
+            APR_RING_INSERT_HEAD(&priv->lru, st, dbd_stmt_t, link);
+        }
+        return st->stmt;
+    }
+
+    cfg = priv->group->cfg;
+    query = apr_hash_get(cfg->queries, label, APR_HASH_KEY_STRING);
+    if (!query || !strcmp(query, "")) {
+        return NULL;
+    }
+
+    rv = apr_pool_create(&pool, priv->pool);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, cfg->server, APLOGNO(10181)
+                     "Failed to create memory pool");
+        return NULL;
+    }
+    st = apr_pcalloc(pool, sizeof(dbd_stmt_t));
+    st->pool = pool;
+    st->label = apr_pstrdup(pool, label);
+
+    rv = apr_dbd_prepare(rec->driver, pool, rec->handle, query, st->label,
+                         &st->stmt);
+    if (rv) {
+        const char *errmsg = apr_dbd_error(rec->driver, rec->handle, rv);
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, cfg->server, APLOGNO(10182)
+                     "failed to prepare SQL statement %s: %s", label,
+                     (errmsg ? errmsg : "[???]"));
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+
+    apr_hash_set(priv->stmts, st->label, APR_HASH_KEY_STRING, st);
+    apr_hash_set(rec->prepared, st->label, APR_HASH_KEY_STRING, st->stmt);
+    APR_RING_INSERT_HEAD(&priv->lru, st, dbd_stmt_t, link);
+    priv->nstmts++;
+    apr_atomic_inc32(&priv->group->prepared);
+
+    return st->stmt;
+}
+
 #if APR_HAS_THREADS
 typedef struct {
     ap_dbd_t *rec;
@@ -863,6 +1078,7 @@ typedef struct {
 static apr_status_t dbd_release(void *data)
 {
     dbd_acquire_t *acq = data;
+    dbd_prepared_release(acq->rec);
     apr_reslist_release(acq->reslist, acq->rec);
     return APR_SUCCESS;
 }
@@ -923,6 +1139,37 @@ DBD_DECLARE_NONSTD(ap_dbd_t *) ap_dbd_cacquire(conn_rec *c)
     return acq->rec;
 }
 #else
+typedef struct {
+    ap_dbd_t *rec;
+    dbd_group_t *group;
+} dbd_acquire_t;
+
+static apr_status_t dbd_release(void *data)
+{
+    dbd_acquire_t *acq = data;
+
+    /* unless it was dropped (and its pool destroyed) by ap_dbd_open() */
+    if (acq->rec == acq->group->rec) {
+        dbd_prepared_release(acq->rec);
+    }
+    return APR_SUCCESS;
+}
+
+static void dbd_release_register(apr_pool_t *pool, server_rec *s,
+                                 ap_dbd_t *rec)
+{
+    svr_cfg *svr = ap_get_module_config(s->module_config, &dbd_module);
+
+    if (svr->cfg->persist) {
+        dbd_acquire_t *acq = apr_palloc(pool, sizeof(dbd_acquire_t));
+
+        acq->rec = rec;
+        acq->group = svr->group;
+        apr_pool_cleanup_register(pool, acq, dbd_release,
+                                  apr_pool_cleanup_null);
+    }
+}
+
 DBD_DECLARE_NONSTD(ap_dbd_t *) ap_dbd_acquire(request_rec *r)
 {
     ap_dbd_t *rec;
@@ -941,6 +1188,7 @@ DBD_DECLARE_NONSTD(ap_dbd_t *) ap_dbd_acquire(request_rec *r)
         rec = ap_dbd_open(r->pool, r->server);
         if (rec) {
             ap_set_module_config(r->request_config, &dbd_module, rec);
+            dbd_release_register(r->pool, r->server, rec);
         }
     }
 
@@ -955,6 +1203,7 @@ DBD_DECLARE_NONSTD(ap_dbd_t *) ap_dbd_cacquire(conn_rec *c)
         rec = ap_dbd_open(c->pool, c->base_server);
         if (rec) {
             ap_set_module_config(c->conn_config, &dbd_module, rec);
+            dbd_release_register(c->pool, c->base_server, rec);
         }
     }
 
@@ -962,6 +1211,74 @@ DBD_DECLARE_NONSTD(ap_dbd_t *) ap_dbd_cacquire(conn_rec *c)
 }
 #endif
 
+static int dbd_status_hook(request_rec *r, int flags)
+{
+    dbd_group_t *group;
+    int i;
+
+    if (!group_list) {
+        return OK;
+    }
+
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("<hr />\n<h1>DBD Connection Pools (this child)</h1>\n\n"
+                 "<table border=\"0\"><tr><th>Server</th><th>Driver</th>"
+#if APR_HAS_THREADS
+                 "<th>Busy</th><th>Max</th>"
+#endif
+                 "<th>Acquired</th><th>Failed</th><th>Opened</th>"
+                 "<th>Prepared</th><th>Evicted</th></tr>\n", r);
+    }
+    for (group = group_list, i = 0; group; group = group->next, i++) {
+        dbd_cfg_t *cfg = group->cfg;
+#if APR_HAS_THREADS
+        int busy = group->reslist ? apr_reslist_acquired_count(group->reslist)
+                                  : 0;
+#endif
+
+        if (!(flags & AP_STATUS_SHORT)) {
+            ap_rprintf(r, "<tr><td>%s</td><td>%s</td>",
+                       ap_escape_html(r->pool, cfg->server->server_hostname),
+                       ap_escape_html(r->pool, cfg->name));
+#if APR_HAS_THREADS
+            ap_rprintf(r, "<td>%d</td><td>%d</td>", busy, cfg->nmax);
+#endif
+            ap_rprintf(r, "<td>%u</td><td>%u</td><td>%u</td><td>%u</td>"
+                       "<td>%u</td></tr>\n",
+                       apr_atomic_read32(&group->acquired),
+                       apr_atomic_read32(&group->failed),
+                       apr_atomic_read32(&group->opened),
+                       apr_atomic_read32(&group->prepared),
+                       apr_atomic_read32(&group->evicted));
+        }
+        else {
+            ap_rprintf(r, "DBD[%d]Server: %s\n"
+                       "DBD[%d]Driver: %s\n",
+                       i, cfg->server->server_hostname, i, cfg->name);
+#if APR_HAS_THREADS
+            ap_rprintf(r, "DBD[%d]Busy: %d\n"
+                       "DBD[%d]Max: %d\n",
+                       i, busy, i, cfg->nmax);
+#endif
+            ap_rprintf(r, "DBD[%d]Acquired: %u\n"
+                       "DBD[%d]Failed: %u\n"
+                       "DBD[%d]Opened: %u\n"
+                       "DBD[%d]Prepared: %u\n"
+                       "DBD[%d]Evicted: %u\n",
+                       i, apr_atomic_read32(&group->acquired),
+                       i, apr_atomic_read32(&group->failed),
+                       i, apr_atomic_read32(&group->opened),
+                       i, apr_atomic_read32(&group->prepared),
+                       i, apr_atomic_read32(&group->evicted));
+        }
+    }
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("</table>\n", r);
+    }
+
+    return OK;
+}
+
 static void dbd_hooks(apr_pool_t *pool)
 {
     ap_hook_pre_config(dbd_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
@@ -973,9 +1290,12 @@ static void dbd_hooks(apr_pool_t *pool)
     APR_REGISTER_OPTIONAL_FN(ap_dbd_close);
     APR_REGISTER_OPTIONAL_FN(ap_dbd_acquire);
     APR_REGISTER_OPTIONAL_FN(ap_dbd_cacquire);
+    APR_REGISTER_OPTIONAL_FN(ap_dbd_prepared);
 
     APR_OPTIONAL_HOOK(dbd, post_connect, dbd_init_sql_init,
                       NULL, NULL, APR_HOOK_MIDDLE);
+    APR_OPTIONAL_HOOK(ap, status_hook, dbd_status_hook, NULL, NULL,
+                      APR_HOOK_MIDDLE);
 
     apr_dbd_init(pool);
 }
@@ -71,13 +71,20 @@ typedef struct {
 #endif
     apr_hash_t *queries;
     apr_array_header_t *init_queries;
+    int prepare_lazy;
+    int prepared_max;
 } dbd_cfg_t;
 
 typedef struct {
     apr_dbd_t *handle;
     const apr_dbd_driver_t *driver;
+    /* With DBDPrepareLazy, this only holds the statements prepared so far
+     * on this connection: use ap_dbd_prepared() to look statements up.
+     */
     apr_hash_t *prepared;
     apr_pool_t *pool;
+    /* private to mod_dbd, NULL if the connection wasn't opened by mod_dbd */
+    struct dbd_private_t *priv;
 } ap_dbd_t;
 
 /* Export functions to access the database */
@@ -108,12 +115,20 @@ DBD_DECLARE_NONSTD(ap_dbd_t*) ap_dbd_cacquire(conn_rec*);
  */
 DBD_DECLARE_NONSTD(void) ap_dbd_prepare(server_rec*, const char*, const char*);
 
+/* Look up the statement prepared with the given label on a connection,
+ * preparing it first if needed (DBDPrepareLazy).  The statement remains
+ * valid until the connection is released.  Returns NULL if there is no
+ * such statement or it failed to prepare.
+ */
+DBD_DECLARE_NONSTD(apr_dbd_prepared_t*) ap_dbd_prepared(ap_dbd_t*, const char*);
+
 /* Also export them as optional functions for modules that prefer it */
 APR_DECLARE_OPTIONAL_FN(ap_dbd_t*, ap_dbd_open, (apr_pool_t*, server_rec*));
 APR_DECLARE_OPTIONAL_FN(void, ap_dbd_close, (server_rec*, ap_dbd_t*));
 APR_DECLARE_OPTIONAL_FN(ap_dbd_t*, ap_dbd_acquire, (request_rec*));
 APR_DECLARE_OPTIONAL_FN(ap_dbd_t*, ap_dbd_cacquire, (conn_rec*));
 APR_DECLARE_OPTIONAL_FN(void, ap_dbd_prepare, (server_rec*, const char*, const char*));
+APR_DECLARE_OPTIONAL_FN(apr_dbd_prepared_t*, ap_dbd_prepared, (ap_dbd_t*, const char*));
 
 APR_DECLARE_EXTERNAL_HOOK(dbd, DBD, apr_status_t, post_connect,
                           (apr_pool_t *, dbd_cfg_t *, ap_dbd_t *))
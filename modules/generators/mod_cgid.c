@@ -99,6 +99,8 @@ static ap_unix_identity_t empty_ugid = { (uid_t)-1, (gid_t)-1, -1 };
 
 typedef struct { 
     apr_interval_time_t timeout;
+    int max_procs;          /* per script, 0 for unlimited */
+    unsigned int max_procs_set:1;
 } cgid_dirconf;
 
 /* The APR other-child API doesn't tell us how the daemon exited
@@ -214,6 +216,7 @@ typedef struct {
     apr_size_t uri_len;
     apr_size_t args_len;
     int loglevel; /* to stuff in server_rec */
+    int max_procs; /* CGIDScriptMaxProcesses */
 
 #ifdef AP_CGID_USE_RLIMIT
     cgid_rlimit_t limits;
@@ -487,6 +490,7 @@ static apr_status_t send_req(int fd, request_rec *r, char *argv0, char **env,
     apr_status_t stat;
     ap_unix_identity_t * ugid = ap_run_get_suexec_identity(r);
     core_dir_config *core_conf = ap_get_core_module_config(r->per_dir_config);
+    cgid_dirconf *dc = ap_get_module_config(r->per_dir_config, &cgid_module);
 
 
     if (ugid == NULL) {
@@ -506,6 +510,7 @@ static apr_status_t send_req(int fd, request_rec *r, char *argv0, char **env,
     req.uri_len = strlen(r->uri);
     req.args_len = r->args ? strlen(r->args) : 0;
     req.loglevel = r->server->log.level;
+    req.max_procs = (req_type == CGI_REQ) ? dc->max_procs : 0;
 
     /* Write the request header */
     if (req.args_len) {
@@ -598,6 +603,30 @@ static void cgid_child_errfn(apr_pool_t *pool, apr_status_t err,
     ap_log_error(APLOG_MARK, APLOG_ERR, err, r->server, APLOGNO(01241) "%s", description);
 }
 
+/* Whether the script can have one more process under CGIDScriptMaxProcesses,
+ * pids (of the script's processes) is updated to the live ones if needed.
+ * Scripts are reaped by the system (SIGCHLD is ignored), so a process that
+ * can't be signaled anymore is gone.
+ */
+static int script_procs_available(apr_array_header_t *pids, int max_procs)
+{
+    pid_t *pid = (pid_t *)pids->elts;
+    int i, n = 0;
+
+    if (pids->nelts < max_procs) {
+        return 1;
+    }
+    for (i = 0; i < pids->nelts; i++) {
+        /* EPERM for live processes of other (suexec) users */
+        if (kill(pid[i], 0) == 0 || errno == EPERM) {
+            pid[n++] = pid[i];
+        }
+    }
+    pids->nelts = n;
+
+    return n < max_procs;
+}
+
 static int cgid_server(void *data)
 {
     int sd, sd2, rc;
@@ -605,6 +634,7 @@ static int cgid_server(void *data)
     apr_pool_t *ptrans;
     server_rec *main_server = data;
     apr_hash_t *script_hash = apr_hash_make(pcgi);
+    apr_hash_t *script_procs = apr_hash_make(pcgi);
     apr_status_t rv;
 
     apr_pool_create(&ptrans, pcgi);
@@ -686,6 +716,7 @@ static int cgid_server(void *data)
         void *key;
         apr_socklen_t len;
         struct sockaddr_un unix_addr;
+        apr_array_header_t *pids = NULL;
 
         apr_pool_clear(ptrans);
 
@@ -741,6 +772,33 @@ static int cgid_server(void *data)
             continue;
         }
 
+        if (cgid_req.max_procs > 0) {
+            pids = apr_hash_get(script_procs, r->filename, APR_HASH_KEY_STRING);
+            if (!pids) {
+                pids = apr_array_make(pcgi, cgid_req.max_procs, sizeof(pid_t));
+                apr_hash_set(script_procs, apr_pstrdup(pcgi, r->filename),
+                             APR_HASH_KEY_STRING, pids);
+            }
+            if (!script_procs_available(pids, cgid_req.max_procs)) {
+                static const char unavailable[] =
+                    "Status: 503 Service Unavailable" CRLF CRLF;
+
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, main_server,
+                             APLOGNO(10180) "CGIDScriptMaxProcesses (%d) "
+                             "reached for %s", cgid_req.max_procs,
+                             r->filename);
+                /* The handler parses this as the script's output */
+                sock_write(sd2, unavailable, sizeof(unavailable) - 1);
+                close(sd2);
+                /* No process to clean up: forget any prior pid of this
+                 * connection, so that the handler gets none.
+                 */
+                apr_hash_set(script_hash, &cgid_req.conn_id,
+                             sizeof(cgid_req.conn_id), NULL);
+                continue;
+            }
+        }
+
         apr_os_file_put(&r->server->error_log, &errfileno, 0, r->pool);
         apr_os_file_put(&inout, &sd2, 0, r->pool);
 
@@ -862,6 +920,10 @@ static int cgid_server(void *data)
         }
         apr_hash_set(script_hash, key, sizeof(cgid_req.conn_id),
                      (void *)((long)procnew->pid));
+
+        if (pids && procnew->pid) {
+            APR_ARRAY_PUSH(pids, pid_t) = procnew->pid;
+        }
     }
     return -1; /* should be <= 0 to distinguish from startup errors */
 }
@@ -982,6 +1044,18 @@ static void *create_cgid_dirconf(apr_pool_t *p, char *dummy)
     return c;
 }
 
+static void *merge_cgid_dirconf(apr_pool_t *p, void *basev, void *addv)
+{
+    cgid_dirconf *base = (cgid_dirconf *) basev, *add = (cgid_dirconf *) addv;
+    cgid_dirconf *c = (cgid_dirconf *) apr_pcalloc(p, sizeof(cgid_dirconf));
+
+    c->timeout = add->timeout ? add->timeout : base->timeout;
+    c->max_procs = add->max_procs_set ? add->max_procs : base->max_procs;
+    c->max_procs_set = add->max_procs_set || base->max_procs_set;
+
+    return c;
+}
+
 static const char *set_scriptlog(cmd_parms *cmd, void *dummy, const char *arg)
 
 {
@@ -1046,6 +1120,19 @@ static const char *set_script_timeout(cmd_parms *cmd, void *dummy, const char *a
  
     return NULL;
 }
+static const char *set_script_max_procs(cmd_parms *cmd, void *dummy,
+                                        const char *arg)
+{
+    cgid_dirconf *dc = dummy;
+
+    dc->max_procs = atoi(arg);
+    if (dc->max_procs < 0) {
+        return "CGIDScriptMaxProcesses must be a positive number or 0";
+    }
+    dc->max_procs_set = 1;
+
+    return NULL;
+}
 static const command_rec cgid_cmds[] =
 {
     AP_INIT_TAKE1("ScriptLog", set_scriptlog, NULL, RSRC_CONF,
@@ -1060,6 +1147,10 @@ static const command_rec cgid_cmds[] =
     AP_INIT_TAKE1("CGIDScriptTimeout", set_script_timeout, NULL, RSRC_CONF | ACCESS_CONF,
                   "The amount of time to wait between successful reads from "
                   "the CGI script, in seconds."),
+    AP_INIT_TAKE1("CGIDScriptMaxProcesses", set_script_max_procs, NULL,
+                  RSRC_CONF | ACCESS_CONF,
+                  "The maximum number of processes running a given CGI "
+                  "script at the same time, 0 for unlimited."),
                   
     {NULL}
 };
@@ -1376,8 +1467,9 @@ static apr_status_t get_cgi_pid(request_rec *r,  cgid_server_conf *conf, pid_t *
         return stat;
     }
 
-    if (pid == 0) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01261)
+    if (*pid == 0) {
+        /* The script wasn't run (the daemon logged why), nothing to clean up */
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01261)
                       "daemon couldn't find CGI process for connection %lu",
                       r->connection->id);
         return APR_EGENERAL;
@@ -1848,10 +1940,6 @@ static int include_cmd(include_ctx_t *ctx, ap_filter_t *f,
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, "error determining cgi PID (for SSI)");
     }
 
-    apr_pool_cleanup_register(r->pool, info,
-                              cleanup_script,
-                              apr_pool_cleanup_null);
-
     /* We are putting the socket discriptor into an apr_file_t so that we can
      * use a pipe bucket to send the data to the client.  APR will create
      * a cleanup for the apr_file_t which will close the socket, so we'll
@@ -1971,7 +2059,7 @@ static void register_hook(apr_pool_t *p)
 AP_DECLARE_MODULE(cgid) = {
     STANDARD20_MODULE_STUFF,
     create_cgid_dirconf, /* dir config creater */
-    NULL, /* dir merger --- default is to override */
+    merge_cgid_dirconf, /* dir merger */
     create_cgid_config, /* server config */
     merge_cgid_config, /* merge server config */
     cgid_cmds, /* command table */
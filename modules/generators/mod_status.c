@@ -553,6 +553,20 @@ static int status_handler(request_rec *r)
     else
         ap_rprintf(r, "BusyWorkers: %d\nIdleWorkers: %d\n", busy, ready);
 
+    {
+        apr_uint32_t stalls = ap_scoreboard_image->global->piped_log_stalls;
+        apr_uint32_t drops = ap_scoreboard_image->global->piped_log_drops;
+
+        if (!short_report) {
+            if (stalls || drops)
+                ap_rprintf(r, "<dt>Piped logs: %u lines waited for room, "
+                              "%u lines dropped</dt>\n", stalls, drops);
+        }
+        else
+            ap_rprintf(r, "PipedLogStalls: %u\nPipedLogDrops: %u\n",
+                       stalls, drops);
+    }
+
     if (!short_report)
         ap_rputs("</dl>", r);
 
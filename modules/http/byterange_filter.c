@@ -286,13 +286,23 @@ static int ap_set_byterange(request_rec *r, apr_off_t clength,
 
 #define BYTERANGE_FMT "%" APR_OFF_T_FMT "-%" APR_OFF_T_FMT "/%" APR_OFF_T_FMT
 
+/*
+ * Copy the buckets of bb in the range [start, end] to bbout.
+ *
+ * The scan starts from *hint (at offset *hint_pos) if it is before start,
+ * and leaves there the first bucket of the range, so that ascending ranges
+ * don't rescan the brigade from the beginning.  File buckets are copied as
+ * segments of the file (no split), data is never copied.
+ */
 static apr_status_t copy_brigade_range(apr_bucket_brigade *bb,
                                        apr_bucket_brigade *bbout,
                                        apr_off_t start,
-                                       apr_off_t end)
+                                       apr_off_t end,
+                                       apr_bucket **hint,
+                                       apr_uint64_t *hint_pos)
 {
-    apr_bucket *first = NULL, *last = NULL, *out_first = NULL, *e;
-    apr_uint64_t pos = 0, off_first = 0, off_last = 0;
+    apr_bucket *first = NULL, *last = NULL, *e;
+    apr_uint64_t pos = 0, off_first = 0;
     apr_status_t rv;
     apr_uint64_t start64, end64;
     apr_off_t pofft = 0;
@@ -308,9 +318,12 @@ static apr_status_t copy_brigade_range(apr_bucket_brigade *bb,
     if (start < 0 || end < 0 || start64 > end64)
         return APR_EINVAL;
 
-    for (e = APR_BRIGADE_FIRST(bb);
-         e != APR_BRIGADE_SENTINEL(bb);
-         e = APR_BUCKET_NEXT(e))
+    e = APR_BRIGADE_FIRST(bb);
+    if (*hint && *hint_pos <= start64) {
+        e = *hint;
+        pos = *hint_pos;
+    }
+    for (; e != APR_BRIGADE_SENTINEL(bb); e = APR_BUCKET_NEXT(e))
     {
         apr_uint64_t elen64;
         /* we know that no bucket has undefined length (-1) */
@@ -322,7 +335,6 @@ static apr_status_t copy_brigade_range(apr_bucket_brigade *bb,
         }
         if (elen64 + pos > end64) {
             last = e;
-            off_last = pos;
             break;
         }
         pos += elen64;
@@ -330,51 +342,56 @@ static apr_status_t copy_brigade_range(apr_bucket_brigade *bb,
     if (!first || !last)
         return APR_EINVAL;
 
-    e = first;
-    while (1)
+    *hint = first;
+    *hint_pos = off_first;
+
+    for (e = first, pos = off_first; ; e = APR_BUCKET_NEXT(e))
     {
         apr_bucket *copy;
+        apr_uint64_t elen64 = (apr_uint64_t)e->length;
+        /* the part of e in the range is [skip, stop) */
+        apr_uint64_t skip = (start64 > pos) ? start64 - pos : 0;
+        apr_uint64_t stop = (end64 + 1 - pos < elen64) ? end64 + 1 - pos
+                                                       : elen64;
+
         AP_DEBUG_ASSERT(e != APR_BRIGADE_SENTINEL(bb));
         rv = apr_bucket_copy(e, &copy);
         if (rv != APR_SUCCESS) {
             apr_brigade_cleanup(bbout);
             return rv;
         }
-
         APR_BRIGADE_INSERT_TAIL(bbout, copy);
-        if (e == first) {
-            if (off_first != start64) {
-                rv = apr_bucket_split(copy, (apr_size_t)(start64 - off_first));
-                if (rv != APR_SUCCESS) {
-                    apr_brigade_cleanup(bbout);
-                    return rv;
-                }
-                out_first = APR_BUCKET_NEXT(copy);
-                apr_bucket_delete(copy);
+
+        if (skip || stop != elen64) {
+            if (APR_BUCKET_IS_FILE(copy)) {
+                /* a segment of the file, as apr_bucket_split() would do */
+                copy->start += (apr_off_t)skip;
+                copy->length = (apr_size_t)(stop - skip);
             }
             else {
-                out_first = copy;
-            }
-        }
-        if (e == last) {
-            if (e == first) {
-                off_last += start64 - off_first;
-                copy = out_first;
-            }
-            if (end64 - off_last != (apr_uint64_t)e->length) {
-                rv = apr_bucket_split(copy, (apr_size_t)(end64 + 1 - off_last));
-                if (rv != APR_SUCCESS) {
-                    apr_brigade_cleanup(bbout);
-                    return rv;
+                if (stop != elen64) {
+                    rv = apr_bucket_split(copy, (apr_size_t)stop);
+                    if (rv != APR_SUCCESS) {
+                        apr_brigade_cleanup(bbout);
+                        return rv;
+                    }
+                    apr_bucket_delete(APR_BUCKET_NEXT(copy));
                 }
-                copy = APR_BUCKET_NEXT(copy);
-                if (copy != APR_BRIGADE_SENTINEL(bbout)) {
-                    apr_bucket_delete(copy);
+                if (skip) {
+                    rv = apr_bucket_split(copy, (apr_size_t)skip);
+                    if (rv != APR_SUCCESS) {
+                        apr_brigade_cleanup(bbout);
+                        return rv;
+                    }
+                    copy = APR_BUCKET_NEXT(copy);
+                    apr_bucket_delete(APR_BUCKET_PREV(copy));
                 }
             }
+        }
+        if (e == last) {
             break;
         }
-        e = APR_BUCKET_NEXT(e);
+        pos += elen64;
     }
 
     AP_DEBUG_ASSERT(APR_SUCCESS == apr_brigade_length(bbout, 1, &pofft));
@@ -412,6 +429,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
     int found = 0;
     int num_ranges;
     char *bound_head = NULL;
+    apr_bucket *hint = NULL;
+    apr_uint64_t hint_pos = 0;
     apr_array_header_t *indexes;
     indexes_t *idx;
     int i;
@@ -493,7 +512,6 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
                                      CRLF "Content-range: bytes ",
                                      NULL);
         }
-        ap_xlate_proto_to_ascii(bound_head, strlen(bound_head));
     }
 
     tmpbb = apr_brigade_create(r->pool, c->bucket_alloc);
@@ -503,7 +521,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
         range_start = idx->start;
         range_end = idx->end;
 
-        rv = copy_brigade_range(bb, tmpbb, range_start, range_end);
+        rv = copy_brigade_range(bb, tmpbb, range_start, range_end,
+                                &hint, &hint_pos);
         if (rv != APR_SUCCESS ) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01584)
                           "copy_brigade_range() failed [%" APR_OFF_T_FMT
@@ -524,16 +543,14 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
         }
         else {
             char *ts;
-
-            e = apr_bucket_pool_create(bound_head, strlen(bound_head),
-                                       r->pool, c->bucket_alloc);
-            APR_BRIGADE_INSERT_TAIL(bsend, e);
-
-            ts = apr_psprintf(r->pool, BYTERANGE_FMT CRLF CRLF,
-                              range_start, range_end, clength);
-            ap_xlate_proto_to_ascii(ts, strlen(ts));
-            e = apr_bucket_pool_create(ts, strlen(ts), r->pool,
-                                       c->bucket_alloc);
+            apr_size_t len;
+
+            /* the boundary and part headers, in one bucket */
+            ts = apr_psprintf(r->pool, "%s" BYTERANGE_FMT CRLF CRLF,
+                              bound_head, range_start, range_end, clength);
+            len = strlen(ts);
+            ap_xlate_proto_to_ascii(ts, len);
+            e = apr_bucket_pool_create(ts, len, r->pool, c->bucket_alloc);
             APR_BRIGADE_INSERT_TAIL(bsend, e);
         }
 
@@ -44,6 +44,34 @@
  */
 static char bad_gateway_seen;
 
+/*
+ * Small chunks are held while the data passed downstream before couldn't
+ * be written yet (so they couldn't be either), up to this many bytes, to
+ * be sent as a single chunk with what comes next.
+ */
+#define CHUNK_HOLD_MAX APR_BUCKET_BUFF_SIZE
+
+/* Enough space for 16 hex digits and CRLF */
+#define CHUNK_HDR_SIZE 18
+
+/* Format the chunk header, in a buffer of CHUNK_HDR_SIZE bytes */
+static apr_size_t chunk_header(char *buf, apr_uint64_t bytes)
+{
+    static const char hex[] = "0123456789abcdef";
+    char tmp[16], *d = tmp + sizeof(tmp);
+    apr_size_t len;
+
+    do {
+        *--d = hex[bytes & 0xf];
+        bytes >>= 4;
+    } while (bytes);
+    len = tmp + sizeof(tmp) - d;
+    memcpy(buf, d, len);
+    buf[len++] = CR;
+    buf[len++] = LF;
+    return len;
+}
+
 apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b)
 {
     conn_rec *c = f->r->connection;
@@ -51,15 +79,13 @@ apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b)
     apr_bucket *e;
     apr_status_t rv;
 
+    /* Prepend the chunk data held from the previous call, if any */
+    ap_filter_reinstate_brigade(f, b, NULL);
+
     for (more = tmp = NULL; b; b = more, more = NULL) {
         apr_off_t bytes = 0;
         apr_bucket *eos = NULL;
         apr_bucket *flush = NULL;
-        /* XXX: chunk_hdr must remain at this scope since it is used in a
-         *      transient bucket.
-         */
-        char chunk_hdr[20]; /* enough space for the snprintf below */
-
 
         for (e = APR_BRIGADE_FIRST(b);
              e != APR_BRIGADE_SENTINEL(b);
@@ -121,36 +147,50 @@ apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b)
         }
 
         /*
-         * XXX: if there aren't very many bytes at this point it may
-         * be a good idea to set them aside and return for more,
-         * unless we haven't finished counting this brigade yet.
+         * If there aren't very many bytes at this point and they could not
+         * be written anyway, set them aside and return for more, unless
+         * we must send them now or haven't finished counting this brigade.
          */
+        if (bytes > 0 && bytes < CHUNK_HOLD_MAX
+                && !eos && !flush && !more
+                && ap_filter_should_yield(f)) {
+            return ap_filter_setaside_brigade(f, b);
+        }
+
         /* if there are content bytes, then wrap them in a chunk */
         if (bytes > 0) {
+            char *chunk_hdr;
             apr_size_t hdr_len;
             /*
              * Insert the chunk header, specifying the number of bytes in
-             * the chunk.
+             * the chunk, in a buffer from the bucket allocator (which is
+             * recycled and needs no copy when set aside downstream).
              */
-            hdr_len = apr_snprintf(chunk_hdr, sizeof(chunk_hdr),
-                                   "%" APR_UINT64_T_HEX_FMT CRLF, (apr_uint64_t)bytes);
+            chunk_hdr = apr_bucket_alloc(CHUNK_HDR_SIZE, c->bucket_alloc);
+            hdr_len = chunk_header(chunk_hdr, (apr_uint64_t)bytes);
             ap_xlate_proto_to_ascii(chunk_hdr, hdr_len);
-            e = apr_bucket_transient_create(chunk_hdr, hdr_len,
-                                            c->bucket_alloc);
+            e = apr_bucket_heap_create(chunk_hdr, hdr_len, apr_bucket_free,
+                                       c->bucket_alloc);
             APR_BRIGADE_INSERT_HEAD(b, e);
 
             /*
              * Insert the end-of-chunk CRLF before an EOS or
-             * FLUSH bucket, or appended to the brigade
+             * FLUSH bucket, or appended to the brigade; before an EOS
+             * it comes with the last-chunk marker below.
              */
-            e = apr_bucket_immortal_create(CRLF_ASCII, 2, c->bucket_alloc);
             if (eos != NULL) {
-                APR_BUCKET_INSERT_BEFORE(eos, e);
+                if (f->ctx) {
+                    e = apr_bucket_immortal_create(CRLF_ASCII, 2,
+                                                   c->bucket_alloc);
+                    APR_BUCKET_INSERT_BEFORE(eos, e);
+                }
             }
             else if (flush != NULL) {
+                e = apr_bucket_immortal_create(CRLF_ASCII, 2, c->bucket_alloc);
                 APR_BUCKET_INSERT_BEFORE(flush, e);
             }
             else {
+                e = apr_bucket_immortal_create(CRLF_ASCII, 2, c->bucket_alloc);
                 APR_BRIGADE_INSERT_TAIL(b, e);
             }
         }
@@ -171,15 +211,21 @@ apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b)
          * we do not create the last-chunk marker and set c->keepalive to
          * AP_CONN_CLOSE in the core output filter.
          *
-         * XXX: it would be nice to combine this with the end-of-chunk
-         * marker above, but this is a bit more straight-forward for
-         * now.
+         * The end-of-chunk CRLF of the last chunk, if any, comes first.
          */
         if (eos && !f->ctx) {
             /* XXX: (2) trailers ... does not yet exist */
-            e = apr_bucket_immortal_create(ZERO_ASCII CRLF_ASCII
-                                           /* <trailers> */
-                                           CRLF_ASCII, 5, c->bucket_alloc);
+            if (bytes > 0) {
+                e = apr_bucket_immortal_create(CRLF_ASCII
+                                               ZERO_ASCII CRLF_ASCII
+                                               /* <trailers> */
+                                               CRLF_ASCII, 7, c->bucket_alloc);
+            }
+            else {
+                e = apr_bucket_immortal_create(ZERO_ASCII CRLF_ASCII
+                                               /* <trailers> */
+                                               CRLF_ASCII, 5, c->bucket_alloc);
+            }
             APR_BUCKET_INSERT_BEFORE(eos, e);
         }
 
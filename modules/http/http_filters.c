@@ -80,10 +80,15 @@ typedef struct http_filter_ctx
         BODY_CHUNK_TRAILER /* trailers */
     } state;
     unsigned int eos_sent :1;
+    apr_bucket_brigade *bb;  /* chunked: peeked/consumed input */
+    apr_array_header_t *segs; /* chunked: data (> 0) and framing (< 0)
+                               * lengths of what was peeked */
 } http_ctx_t;
 
 /**
  * Parse a chunk line with optional extension, detect overflow.
+ * The parsing stops after the LF ending the chunk line, and *len is set to
+ * the number of bytes used from buffer.
  * There are several error cases:
  *  1) If the chunk link is misformatted, APR_EINVAL is returned.
  *  2) If the conversion would require too many bits, APR_EGENERAL is returned.
@@ -92,13 +97,46 @@ typedef struct http_filter_ctx
  * A negative chunk length always indicates an overflow error.
  */
 static apr_status_t parse_chunk_size(http_ctx_t *ctx, const char *buffer,
-                                     apr_size_t len, int linelimit, int strict)
+                                     apr_size_t *len, int linelimit, int strict)
 {
     apr_size_t i = 0;
 
-    while (i < len) {
-        char c = buffer[i];
+    while (i < *len) {
+        char c;
 
+#if !APR_CHARSET_EBCDIC
+        /* Fast path for the usual chunk line, hex digits and CRLF in the
+         * buffer, no extension: at most 15 digits can't overflow.
+         */
+        if (ctx->state == BODY_CHUNK) {
+            apr_size_t j, end = (*len - i > 15) ? i + 15 : *len;
+            apr_off_t size = 0;
+
+            for (j = i; j < end; ++j) {
+                c = buffer[j];
+                if (c >= '0' && c <= '9') {
+                    size = (size << 4) | (c - '0');
+                }
+                else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+                    size = (size << 4) | ((c | 0x20) - 'a' + 0xa);
+                }
+                else {
+                    break;
+                }
+            }
+            if (j > i && j + 1 < *len
+                    && buffer[j] == CR && buffer[j + 1] == LF) {
+                ctx->remaining = size;
+                ctx->chunk_used = 0;
+                ctx->chunk_bws = 0;
+                ctx->state = size ? BODY_CHUNK_DATA : BODY_CHUNK_TRAILER;
+                i = j + 2;
+                break;
+            }
+        }
+#endif
+
+        c = buffer[i];
         ap_xlate_proto_from_ascii(&c, 1);
 
         /* handle CRLF after the chunk */
@@ -157,6 +195,9 @@ static apr_status_t parse_chunk_size(http_ctx_t *ctx, const char *buffer,
             else {
                 ctx->state = BODY_CHUNK_TRAILER;
             }
+            /* end of the chunk line */
+            i++;
+            break;
         }
         else if (ctx->state == BODY_CHUNK_LF) {
             /*
@@ -238,8 +279,10 @@ static apr_status_t parse_chunk_size(http_ctx_t *ctx, const char *buffer,
         i++;
     }
 
+    *len = i;
+
     /* sanity check */
-    ctx->chunk_used += len;
+    ctx->chunk_used += i;
     if (ctx->chunk_used < 0 || ctx->chunk_used > linelimit) {
         return APR_ENOSPC;
     }
@@ -289,6 +332,208 @@ static apr_status_t read_chunked_trailers(http_ctx_t *ctx, ap_filter_t *f,
     return rv;
 }
 
+/* Add len bytes of data (> 0) or framing (< 0) to the segments to consume */
+static void push_segment(apr_array_header_t *segs, apr_off_t len)
+{
+    apr_off_t *last;
+
+    if (segs->nelts) {
+        last = &APR_ARRAY_IDX(segs, segs->nelts - 1, apr_off_t);
+        if ((*last > 0) == (len > 0)) {
+            *last += len;
+            return;
+        }
+    }
+    APR_ARRAY_PUSH(segs, apr_off_t) = len;
+}
+
+/* Consume the len bytes peeked and parsed by read_chunked(), move the data
+ * segments to b and drop the framing ones.
+ */
+static apr_status_t consume_chunked(http_ctx_t *ctx, ap_filter_t *f,
+                                    apr_bucket_brigade *b, apr_off_t len)
+{
+    apr_bucket_brigade *bb = ctx->bb;
+    apr_bucket *e, *after;
+    apr_off_t got = 0, total, *seg;
+    apr_status_t rv;
+    int i;
+
+    /* What was peeked is available, but may come in several reads */
+    while (got < len) {
+        rv = ap_get_brigade(f->next, bb, AP_MODE_READBYTES, APR_BLOCK_READ,
+                            len - got);
+        if (rv == APR_SUCCESS) {
+            rv = apr_brigade_length(bb, 1, &total);
+        }
+        if (rv == APR_SUCCESS && total == got) {
+            rv = APR_INCOMPLETE;
+        }
+        if (rv != APR_SUCCESS) {
+            apr_brigade_cleanup(bb);
+            return rv;
+        }
+        got = total;
+    }
+
+    for (i = 0; i < ctx->segs->nelts; ++i) {
+        seg = &APR_ARRAY_IDX(ctx->segs, i, apr_off_t);
+        rv = apr_brigade_partition(bb, (*seg > 0) ? *seg : -*seg, &after);
+        if (rv != APR_SUCCESS) {
+            apr_brigade_cleanup(bb);
+            return rv;
+        }
+        while ((e = APR_BRIGADE_FIRST(bb)) != after) {
+            if (*seg > 0) {
+                APR_BUCKET_REMOVE(e);
+                APR_BRIGADE_INSERT_TAIL(b, e);
+            }
+            else {
+                apr_bucket_delete(e);
+            }
+        }
+    }
+    apr_brigade_cleanup(bb);
+
+    return APR_SUCCESS;
+}
+
+/* Read the data of a chunked body (AP_MODE_READBYTES), up to readbytes of
+ * it and as many chunks as available.  The input is peeked first
+ * (AP_MODE_SPECULATIVE) to parse the chunk lines and delimit the data in
+ * place, then what was parsed is consumed in a single read: this never
+ * reads past the end of the body, and the data is never copied.
+ */
+static apr_status_t read_chunked(http_ctx_t *ctx, ap_filter_t *f,
+                                 apr_bucket_brigade *b,
+                                 apr_read_type_e block, apr_off_t readbytes,
+                                 int strict, int merge)
+{
+    request_rec *r = f->r;
+    apr_off_t produced = 0;
+    apr_status_t rv;
+
+    if (!ctx->bb) {
+        ctx->bb = apr_brigade_create(r->pool, f->c->bucket_alloc);
+        ctx->segs = apr_array_make(r->pool, 8, sizeof(apr_off_t));
+    }
+
+    /* Until we have some data, a chunk line may need more reads */
+    do {
+        apr_off_t consumed = 0;
+
+        rv = ap_get_brigade(f->next, ctx->bb, AP_MODE_SPECULATIVE, block,
+                            (readbytes > HUGE_STRING_LEN) ? readbytes
+                                                          : HUGE_STRING_LEN);
+
+        /* for timeout */
+        if (block == APR_NONBLOCK_READ
+                && ((rv == APR_SUCCESS && APR_BRIGADE_EMPTY(ctx->bb))
+                        || (APR_STATUS_IS_EAGAIN(rv)))) {
+            apr_brigade_cleanup(ctx->bb);
+            return APR_EAGAIN;
+        }
+        if (rv == APR_EOF) {
+            apr_brigade_cleanup(ctx->bb);
+            return APR_INCOMPLETE;
+        }
+        if (rv != APR_SUCCESS) {
+            apr_brigade_cleanup(ctx->bb);
+            return rv;
+        }
+
+        apr_array_clear(ctx->segs);
+        while (!APR_BRIGADE_EMPTY(ctx->bb)
+                && produced < readbytes
+                && ctx->state != BODY_CHUNK_TRAILER) {
+            apr_bucket *e = APR_BRIGADE_FIRST(ctx->bb);
+            const char *buffer;
+            apr_size_t len;
+
+            if (APR_BUCKET_IS_METADATA(e)) {
+                if (APR_BUCKET_IS_EOS(e)) {
+                    break;
+                }
+                apr_bucket_delete(e);
+                continue;
+            }
+            rv = apr_bucket_read(e, &buffer, &len, APR_BLOCK_READ);
+            if (rv != APR_SUCCESS) {
+                break;
+            }
+            if (!len) {
+                apr_bucket_delete(e);
+                continue;
+            }
+
+            if (ctx->state == BODY_CHUNK_DATA) {
+                if ((apr_off_t)len > ctx->remaining) {
+                    len = (apr_size_t)ctx->remaining;
+                }
+                if ((apr_off_t)len > readbytes - produced) {
+                    len = (apr_size_t)(readbytes - produced);
+                }
+                ctx->remaining -= len;
+                produced += len;
+                if (!ctx->remaining) {
+                    /* next chunk please */
+                    ctx->state = BODY_CHUNK_END;
+                    ctx->chunk_used = 0;
+                }
+                push_segment(ctx->segs, len);
+            }
+            else {
+                rv = parse_chunk_size(ctx, buffer, &len,
+                                      r->server->limit_req_fieldsize, strict);
+                if (rv != APR_SUCCESS) {
+                    ap_log_rerror(APLOG_MARK, APLOG_INFO, rv, r, APLOGNO(01590)
+                                  "Error reading/parsing chunk %s ",
+                                  (APR_ENOSPC == rv) ? "(overflow)" : "");
+                    break;
+                }
+                push_segment(ctx->segs, -(apr_off_t)len);
+            }
+            consumed += len;
+
+            if (len < e->length) {
+                apr_bucket_split(e, len);
+            }
+            apr_bucket_delete(e);
+        }
+        apr_brigade_cleanup(ctx->bb);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        if (!consumed) {
+            /* EOS or empty read */
+            return APR_INCOMPLETE;
+        }
+
+        rv = consume_chunked(ctx, f, b, consumed);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    } while (!produced && ctx->state != BODY_CHUNK_TRAILER);
+
+    /* We have a limit in effect. */
+    if (ctx->limit) {
+        ctx->limit_used += produced;
+        if (ctx->limit < ctx->limit_used) {
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(01591)
+                          "Read content length of "
+                          "%" APR_OFF_T_FMT " is larger than the "
+                          "configured limit of %" APR_OFF_T_FMT,
+                          ctx->limit_used, ctx->limit);
+            return APR_ENOSPC;
+        }
+    }
+
+    if (ctx->state == BODY_CHUNK_TRAILER) {
+        return read_chunked_trailers(ctx, f, b, merge);
+    }
+    return APR_SUCCESS;
+}
+
 /* This is the HTTP_INPUT filter for HTTP requests and responses from
  * proxied servers (mod_proxy).  It handles chunked and content-length
  * bodies.  This can only be inserted/used after the headers
@@ -453,6 +698,14 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
         return APR_SUCCESS;
     }
 
+    /* Chunked body, read the data of as many chunks as possible at once */
+    if (mode == AP_MODE_READBYTES && readbytes > 0
+            && ctx->state >= BODY_CHUNK && ctx->state <= BODY_CHUNK_END_LF) {
+        apr_brigade_cleanup(b);
+        return read_chunked(ctx, f, b, block, readbytes, strict,
+                            conf->merge_trailers == AP_MERGE_TRAILERS_ENABLE);
+    }
+
     do {
         apr_brigade_cleanup(b);
         again = 0; /* until further notice */
@@ -493,7 +746,7 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
                     rv = apr_bucket_read(e, &buffer, &len, APR_BLOCK_READ);
 
                     if (rv == APR_SUCCESS) {
-                        rv = parse_chunk_size(ctx, buffer, len,
+                        rv = parse_chunk_size(ctx, buffer, &len,
                                 f->r->server->limit_req_fieldsize, strict);
                     }
                     if (rv != APR_SUCCESS) {
@@ -737,11 +990,65 @@ static int check_headers_recursion(request_rec *r)
     return 0;
 }
 
+/* The response header is collected as iovecs (pointing to the strings of
+ * the request), and written at once in a single buffer of the right size
+ * by header_flush().
+ */
 typedef struct header_struct {
     apr_pool_t *pool;
     apr_bucket_brigade *bb;
+    apr_array_header_t *vec;    /* struct iovec */
+    apr_size_t len;             /* total length of vec */
 } header_struct;
 
+static void header_init(header_struct *h, request_rec *r,
+                        apr_bucket_brigade *bb)
+{
+    const apr_array_header_t *elts = apr_table_elts(r->headers_out);
+
+    h->pool = r->pool;
+    h->bb = bb;
+    /* status line, Date, Server and the fields, final CRLF */
+    h->vec = apr_array_make(r->pool, 4 * (elts->nelts + 3) + 1,
+                            sizeof(struct iovec));
+    h->len = 0;
+}
+
+static APR_INLINE void header_add(header_struct *h, const char *s,
+                                  apr_size_t len)
+{
+    struct iovec *v = apr_array_push(h->vec);
+
+    v->iov_base = (void *)s;
+    v->iov_len = len;
+    h->len += len;
+}
+
+/* Write what was collected in h to h->bb, as a single heap bucket */
+static void header_flush(header_struct *h)
+{
+    const struct iovec *v = (const struct iovec *)h->vec->elts;
+    const struct iovec *end = v + h->vec->nelts;
+    apr_bucket_alloc_t *list = h->bb->bucket_alloc;
+    char *buf, *p;
+
+    if (!h->len) {
+        return;
+    }
+
+    p = buf = apr_bucket_alloc(h->len, list);
+    for (; v < end; ++v) {
+        memcpy(p, v->iov_base, v->iov_len);
+        p += v->iov_len;
+    }
+    ap_xlate_proto_to_ascii(buf, h->len);
+    APR_BRIGADE_INSERT_TAIL(h->bb, apr_bucket_heap_create(buf, h->len,
+                                                          apr_bucket_free,
+                                                          list));
+    h->vec->nelts = 0;
+    h->len = 0;
+}
+
 /* Send a single HTTP header field to the client.  Note that this function
  * is used in calls to apr_table_do(), so don't change its interface.
  * It returns true unless there was a write error of some kind.
@@ -749,31 +1056,10 @@ typedef struct header_struct {
 static int form_header_field(header_struct *h,
                              const char *fieldname, const char *fieldval)
 {
-#if APR_CHARSET_EBCDIC
-    char *headfield;
-    apr_size_t len;
-
-    headfield = apr_pstrcat(h->pool, fieldname, ": ", fieldval, CRLF, NULL);
-    len = strlen(headfield);
-
-    ap_xlate_proto_to_ascii(headfield, len);
-    apr_brigade_write(h->bb, NULL, NULL, headfield, len);
-#else
-    struct iovec vec[4];
-    struct iovec *v = vec;
-    v->iov_base = (void *)fieldname;
-    v->iov_len = strlen(fieldname);
-    v++;
-    v->iov_base = ": ";
-    v->iov_len = sizeof(": ") - 1;
-    v++;
-    v->iov_base = (void *)fieldval;
-    v->iov_len = strlen(fieldval);
-    v++;
-    v->iov_base = CRLF;
-    v->iov_len = sizeof(CRLF) - 1;
-    apr_brigade_writev(h->bb, NULL, NULL, vec, 4);
-#endif /* !APR_CHARSET_EBCDIC */
+    header_add(h, fieldname, strlen(fieldname));
+    header_add(h, ": ", sizeof(": ") - 1);
+    header_add(h, fieldval, strlen(fieldval));
+    header_add(h, CRLF, sizeof(CRLF) - 1);
     return 1;
 }
 
@@ -829,6 +1115,46 @@ static int uniq_field_values(void *d, const char *key, const char *val)
     return 1;
 }
 
+/* apr_table_do() callback keeping the first two values of a field in d */
+static int find_field_values(void *d, const char *key, const char *val)
+{
+    const char **vals = d;
+
+    if (vals[0]) {
+        vals[1] = val;
+        return 0;
+    }
+    vals[0] = val;
+    return 1;
+}
+
+/* Whether val is a list of distinct tokens separated by single commas,
+ * as fixup_vary() would produce it.
+ */
+static int is_uniq_field_value(const char *val)
+{
+    const char *tok, *prev, *e;
+    apr_size_t len;
+
+    for (tok = val; ; tok = e + 1) {
+        for (e = tok; *e && *e != ',' && !apr_isspace(*e); ++e)
+            ;
+        len = e - tok;
+        if (!len || (*e && *e != ',')) {
+            return 0;
+        }
+        for (prev = val; prev < tok; prev += strcspn(prev, ",") + 1) {
+            if (!ap_cstr_casecmpn(prev, tok, len)
+                && (prev[len] == ',')) {
+                return 0;
+            }
+        }
+        if (!*e) {
+            return 1;
+        }
+    }
+}
+
 /*
  * Since some clients choke violently on multiple Vary fields, or
  * Vary fields with duplicate tokens, combine any multiples and remove
@@ -837,6 +1163,13 @@ static int uniq_field_values(void *d, const char *key, const char *val)
 static void fixup_vary(request_rec *r)
 {
     apr_array_header_t *varies;
+    const char *vals[2] = { NULL, NULL };
+
+    /* Nothing to do for a single field already in shape, the usual case */
+    apr_table_do(find_field_values, vals, r->headers_out, "Vary", NULL);
+    if (!vals[0] || (!vals[1] && is_uniq_field_value(vals[0]))) {
+        return;
+    }
 
     varies = apr_array_make(r->pool, 5, sizeof(char *));
 
@@ -862,8 +1195,6 @@ static apr_status_t send_all_header_fields(header_struct *h,
     const apr_array_header_t *elts;
     const apr_table_entry_t *t_elt;
     const apr_table_entry_t *t_end;
-    struct iovec *vec;
-    struct iovec *vec_next;
 
     elts = apr_table_elts(r->headers_out);
     if (elts->nelts == 0) {
@@ -871,26 +1202,12 @@ static apr_status_t send_all_header_fields(header_struct *h,
     }
     t_elt = (const apr_table_entry_t *)(elts->elts);
     t_end = t_elt + elts->nelts;
-    vec = (struct iovec *)apr_palloc(h->pool, 4 * elts->nelts *
-                                     sizeof(struct iovec));
-    vec_next = vec;
 
     /* For each field, generate
      *    name ": " value CRLF
      */
     do {
-        vec_next->iov_base = (void*)(t_elt->key);
-        vec_next->iov_len = strlen(t_elt->key);
-        vec_next++;
-        vec_next->iov_base = ": ";
-        vec_next->iov_len = sizeof(": ") - 1;
-        vec_next++;
-        vec_next->iov_base = (void*)(t_elt->val);
-        vec_next->iov_len = strlen(t_elt->val);
-        vec_next++;
-        vec_next->iov_base = CRLF;
-        vec_next->iov_len = sizeof(CRLF) - 1;
-        vec_next++;
+        form_header_field(h, t_elt->key, t_elt->val);
         t_elt++;
     } while (t_elt < t_end);
 
@@ -904,16 +1221,7 @@ static apr_status_t send_all_header_fields(header_struct *h,
         } while (t_elt < t_end);
     }
 
-#if APR_CHARSET_EBCDIC
-    {
-        apr_size_t len;
-        char *tmp = apr_pstrcatv(r->pool, vec, vec_next - vec, &len);
-        ap_xlate_proto_to_ascii(tmp, len);
-        return apr_brigade_write(h->bb, NULL, NULL, tmp, len);
-    }
-#else
-    return apr_brigade_writev(h->bb, NULL, NULL, vec, vec_next - vec);
-#endif
+    return APR_SUCCESS;
 }
 
 /* Confirm that the status line is well-formed and matches r->status.
@@ -996,16 +1304,14 @@ static void basic_http_header_check(request_rec *r,
 
 }
 
-/* fill "bb" with a barebones/initial HTTP response header */
-static void basic_http_header(request_rec *r, apr_bucket_brigade *bb,
+/* add a barebones/initial HTTP response header to "h" */
+static void basic_http_header(request_rec *r, header_struct *h,
                               const char *protocol)
 {
     char *date = NULL;
     const char *proxy_date = NULL;
     const char *server = NULL;
     const char *us = ap_get_server_banner();
-    header_struct h;
-    struct iovec vec[4];
 
     if (r->assbackwards) {
         /* there are no headers to send */
@@ -1014,28 +1320,10 @@ static void basic_http_header(request_rec *r, apr_bucket_brigade *bb,
 
     /* Output the HTTP/1.x Status-Line and the Date and Server fields */
 
-    vec[0].iov_base = (void *)protocol;
-    vec[0].iov_len  = strlen(protocol);
-    vec[1].iov_base = (void *)" ";
-    vec[1].iov_len  = sizeof(" ") - 1;
-    vec[2].iov_base = (void *)(r->status_line);
-    vec[2].iov_len  = strlen(r->status_line);
-    vec[3].iov_base = (void *)CRLF;
-    vec[3].iov_len  = sizeof(CRLF) - 1;
-#if APR_CHARSET_EBCDIC
-    {
-        char *tmp;
-        apr_size_t len;
-        tmp = apr_pstrcatv(r->pool, vec, 4, &len);
-        ap_xlate_proto_to_ascii(tmp, len);
-        apr_brigade_write(bb, NULL, NULL, tmp, len);
-    }
-#else
-    apr_brigade_writev(bb, NULL, NULL, vec, 4);
-#endif
-
-    h.pool = r->pool;
-    h.bb = bb;
+    header_add(h, protocol, strlen(protocol));
+    header_add(h, " ", sizeof(" ") - 1);
+    header_add(h, r->status_line, strlen(r->status_line));
+    header_add(h, CRLF, sizeof(CRLF) - 1);
 
     /*
      * keep the set-by-proxy server and date headers, otherwise
@@ -1059,12 +1347,12 @@ static void basic_http_header(request_rec *r, apr_bucket_brigade *bb,
         ap_recent_rfc822_date(date, r->request_time);
     }
 
-    form_header_field(&h, "Date", proxy_date ? proxy_date : date );
+    form_header_field(h, "Date", proxy_date ? proxy_date : date );
 
     if (!server && *us)
         server = us;
     if (server)
-        form_header_field(&h, "Server", server);
+        form_header_field(h, "Server", server);
 
     if (APLOGrtrace3(r)) {
         ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0, r,
@@ -1094,19 +1382,12 @@ static void basic_http_header(request_rec *r, apr_bucket_brigade *bb,
 AP_DECLARE(void) ap_basic_http_header(request_rec *r, apr_bucket_brigade *bb)
 {
     const char *protocol = NULL;
+    header_struct h;
 
     basic_http_header_check(r, &protocol);
-    basic_http_header(r, bb, protocol);
-}
-
-static void terminate_header(apr_bucket_brigade *bb)
-{
-    char crlf[] = CRLF;
-    apr_size_t buflen;
-
-    buflen = strlen(crlf);
-    ap_xlate_proto_to_ascii(crlf, buflen);
-    apr_brigade_write(bb, NULL, NULL, crlf, buflen);
+    header_init(&h, r, bb);
+    basic_http_header(r, &h, protocol);
+    header_flush(&h);
 }
 
 AP_DECLARE_NONSTD(int) ap_send_http_trace(request_rec *r)
@@ -1209,9 +1490,13 @@ AP_DECLARE_NONSTD(int) ap_send_http_trace(request_rec *r)
 #endif
     h.pool = r->pool;
     h.bb = bb;
+    h.vec = apr_array_make(r->pool, 4 * apr_table_elts(r->headers_in)->nelts
+                                    + 1, sizeof(struct iovec));
+    h.len = 0;
     apr_table_do((int (*) (void *, const char *, const char *))
                  form_header_field, (void *) &h, r->headers_in, NULL);
-    apr_brigade_puts(bb, NULL, NULL, CRLF_ASCII);
+    header_add(&h, CRLF, sizeof(CRLF) - 1);
+    header_flush(&h);
 
     /* If configured to accept a body, echo the body */
     if (bodylen) {
@@ -1421,10 +1706,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_http_header_filter(ap_filter_t *f,
     }
 
     b2 = apr_brigade_create(r->pool, c->bucket_alloc);
-    basic_http_header(r, b2, protocol);
-
-    h.pool = r->pool;
-    h.bb = b2;
+    header_init(&h, r, b2);
+    basic_http_header(r, &h, protocol);
 
     if (r->status == HTTP_NOT_MODIFIED) {
         apr_table_do((int (*)(void *, const char *, const char *)) form_header_field,
@@ -1447,7 +1730,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_http_header_filter(ap_filter_t *f,
         send_all_header_fields(&h, r);
     }
 
-    terminate_header(b2);
+    header_add(&h, CRLF, sizeof(CRLF) - 1);
+    header_flush(&h);
 
     if (header_only) {
         e = APR_BRIGADE_LAST(b);
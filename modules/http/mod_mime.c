@@ -68,6 +68,20 @@ typedef struct extension_info {
     char *output_filters;             /* Added with AddOutputFilter... */
 } extension_info;
 
+/* The AddType & co mappings of a merged config: instead of merging (copying
+ * and overlaying) the mappings of each config, the merges stack them up and
+ * the lookups walk them down from the most specific one, see
+ * find_extension_info().
+ */
+typedef struct mime_mappings {
+    apr_hash_t *extension_mappings;       /* Of this level, may be NULL */
+    apr_array_header_t *remove_mappings;  /* Of this level, may be NULL */
+    int remove_levels;                    /* How many levels (from this one)
+                                           * remove_mappings applies to,
+                                           * 0 for all */
+    const struct mime_mappings *next;     /* The level below */
+} mime_mappings;
+
 #define MULTIMATCH_UNSET      0
 #define MULTIMATCH_ANY        1
 #define MULTIMATCH_NEGOTIATED 2
@@ -80,6 +94,10 @@ typedef struct {
 
     apr_array_header_t *remove_mappings; /* A simple list, walked once */
 
+    /* Once merged, the two above are unused and these are looked up */
+    const mime_mappings *mappings;
+    int merged;
+
     char *default_language;     /* Language if no AddLanguage ext found */
 
     int multimatch;       /* Extensions to include in multiview matching
@@ -127,6 +145,8 @@ static void *create_mime_dir_config(apr_pool_t *p, char *dummy)
 
     new->extension_mappings = NULL;
     new->remove_mappings = NULL;
+    new->mappings = NULL;
+    new->merged = 0;
 
     new->default_language = NULL;
 
@@ -138,65 +158,62 @@ static void *create_mime_dir_config(apr_pool_t *p, char *dummy)
 
     return new;
 }
+
 /*
- * Overlay one hash table of extension_mappings onto another
+ * Stack the mappings of add on top of the ones of base.  Like when the
+ * mappings were merged, the Remove* directives of add apply to the configs
+ * it is merged onto, while those of an unmerged base are ignored.
  */
-static void *overlay_extension_mappings(apr_pool_t *p,
-                                        const void *key,
-                                        apr_ssize_t klen,
-                                        const void *overlay_val,
-                                        const void *base_val,
-                                        const void *data)
+static const mime_mappings *stack_mappings(apr_pool_t *p,
+                                           const mime_dir_config *base,
+                                           const mime_dir_config *add)
 {
-    const extension_info *overlay_info = (const extension_info *)overlay_val;
-    const extension_info *base_info = (const extension_info *)base_val;
-    extension_info *new_info = apr_pmemdup(p, base_info, sizeof(extension_info));
+    const mime_mappings *below, *m, *top = NULL, **next = &top;
+    int depth = 0;
 
-    if (overlay_info->forced_type) {
-        new_info->forced_type = overlay_info->forced_type;
-    }
-    if (overlay_info->encoding_type) {
-        new_info->encoding_type = overlay_info->encoding_type;
+    if (base->merged) {
+        below = base->mappings;
     }
-    if (overlay_info->language_type) {
-        new_info->language_type = overlay_info->language_type;
+    else if (base->extension_mappings) {
+        mime_mappings *level = apr_pcalloc(p, sizeof(*level));
+        level->extension_mappings = base->extension_mappings;
+        below = level;
     }
-    if (overlay_info->handler) {
-        new_info->handler = overlay_info->handler;
-    }
-    if (overlay_info->charset_type) {
-        new_info->charset_type = overlay_info->charset_type;
-    }
-    if (overlay_info->input_filters) {
-        new_info->input_filters = overlay_info->input_filters;
-    }
-    if (overlay_info->output_filters) {
-        new_info->output_filters = overlay_info->output_filters;
+    else {
+        below = NULL;
     }
 
-    return new_info;
-}
+    if (!add->merged) {
+        mime_mappings *level;
 
-/* Member is the offset within an extension_info of the pointer to reset
- */
-static void remove_items(apr_pool_t *p, apr_array_header_t *remove,
-                         apr_hash_t *mappings)
-{
-    attrib_info *suffix = (attrib_info *) remove->elts;
-    int i;
-    for (i = 0; i < remove->nelts; i++) {
-        extension_info *exinfo = apr_hash_get(mappings,
-                                              suffix[i].name,
-                                              APR_HASH_KEY_STRING);
-        if (exinfo && *(const char**)((char *)exinfo + suffix[i].offset)) {
-            extension_info *copyinfo = exinfo;
-            exinfo = apr_pmemdup(p, copyinfo, sizeof(*exinfo));
-            apr_hash_set(mappings, suffix[i].name,
-                         APR_HASH_KEY_STRING, exinfo);
-
-            *(const char**)((char *)exinfo + suffix[i].offset) = NULL;
+        if (!add->extension_mappings && !add->remove_mappings) {
+            return below;
         }
+        level = apr_palloc(p, sizeof(*level));
+        level->extension_mappings = add->extension_mappings;
+        level->remove_mappings = add->remove_mappings;
+        level->remove_levels = 0;
+        level->next = below;
+        return level;
+    }
+
+    /* Copy the levels of add above the ones of base, the removes of add's
+     * levels still applying to add's levels only.
+     */
+    for (m = add->mappings; m; m = m->next) {
+        ++depth;
     }
+    for (m = add->mappings; m; m = m->next, --depth) {
+        mime_mappings *level = apr_pmemdup(p, m, sizeof(*level));
+        if (level->remove_mappings && !level->remove_levels) {
+            level->remove_levels = depth;
+        }
+        *next = level;
+        next = &level->next;
+    }
+    *next = below;
+
+    return top;
 }
 
 static void *merge_mime_dir_configs(apr_pool_t *p, void *basev, void *addv)
@@ -205,34 +222,10 @@ static void *merge_mime_dir_configs(apr_pool_t *p, void *basev, void *addv)
     mime_dir_config *add = (mime_dir_config *)addv;
     mime_dir_config *new = apr_palloc(p, sizeof(mime_dir_config));
 
-    if (base->extension_mappings && add->extension_mappings) {
-        new->extension_mappings = apr_hash_merge(p, add->extension_mappings,
-                                                 base->extension_mappings,
-                                                 overlay_extension_mappings,
-                                                 NULL);
-    }
-    else {
-        if (base->extension_mappings == NULL) {
-            new->extension_mappings = add->extension_mappings;
-        }
-        else {
-            new->extension_mappings = base->extension_mappings;
-        }
-        /* We may not be merging the tables, but if we potentially will change
-         * an exinfo member, then we are about to trounce it anyways.
-         * We must have a copy for safety.
-         */
-        if (new->extension_mappings && add->remove_mappings) {
-            new->extension_mappings =
-                apr_hash_copy(p, new->extension_mappings);
-        }
-    }
-
-    if (new->extension_mappings) {
-        if (add->remove_mappings)
-            remove_items(p, add->remove_mappings, new->extension_mappings);
-    }
+    new->extension_mappings = NULL;
     new->remove_mappings = NULL;
+    new->mappings = stack_mappings(p, base, add);
+    new->merged = 1;
 
     new->default_language = add->default_language ?
         add->default_language : base->default_language;
@@ -481,8 +474,36 @@ static const command_rec mime_cmds[] =
     {NULL}
 };
 
+/* Content-Type mapped to an extension by the TypesConfig file, built once
+ * per config load and shared (read-only) by all the requests.
+ */
+typedef struct {
+    const char *type;
+    int simple;     /* Plain "type/subtype", no need to analyze_ct() it */
+} mime_type_info;
+
 static apr_hash_t *mime_type_extensions;
 
+static int is_token(char c);
+
+static int is_simple_ct(const char *ct)
+{
+    const char *slash = NULL;
+
+    for (; *ct; ++ct) {
+        if (*ct == '/') {
+            if (slash) {
+                return 0;
+            }
+            slash = ct;
+        }
+        else if (is_token(*ct) != 1) {
+            return 0;
+        }
+    }
+    return (slash && slash[1]);
+}
+
 static int mime_post_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s)
 {
     ap_configfile_t *f;
@@ -514,17 +535,20 @@ static int mime_post_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp,
     mime_type_extensions = apr_hash_make(p);
 
     while (!(ap_cfg_getline(l, MAX_STRING_LEN, f))) {
-        const char *ll = l, *ct;
+        const char *ll = l;
+        mime_type_info *info;
 
         if (l[0] == '#') {
             continue;
         }
-        ct = ap_getword_conf(p, &ll);
+        info = apr_palloc(p, sizeof(*info));
+        info->type = ap_getword_conf(p, &ll);
+        info->simple = is_simple_ct(info->type);
 
         while (ll[0]) {
             char *ext = ap_getword_conf(p, &ll);
             ap_str_tolower(ext);
-            apr_hash_set(mime_type_extensions, ext, APR_HASH_KEY_STRING, ct);
+            apr_hash_set(mime_type_extensions, ext, APR_HASH_KEY_STRING, info);
         }
     }
     ap_cfg_closefile(f);
@@ -801,6 +825,86 @@ static content_type *analyze_ct(request_rec *r, const char *s)
     return (ctp);
 }
 
+/*
+ * Lookup the AddType & co mapped to (lowercase) ext by conf, walking down
+ * the stacked mappings from the most specific ones: a field set by a level
+ * hides the ones below, and so does a Remove* directive for the levels it
+ * applies to.  Returns NULL if ext is mapped by no level, otherwise exinfo
+ * filled in.
+ */
+#define EXINFO_NFIELDS ((int)(sizeof(extension_info) / sizeof(char *)))
+
+static const extension_info *find_extension_info(const mime_dir_config *conf,
+                                                 const char *ext,
+                                                 extension_info *exinfo)
+{
+    const mime_mappings *m;
+    mime_mappings unmerged;
+    int removed[EXINFO_NFIELDS];  /* How many levels left a field is
+                                   * removed from, -1 for all */
+    unsigned int resolved = 0;
+    int found = 0, i;
+
+    if (conf->merged) {
+        m = conf->mappings;
+    }
+    else if (conf->extension_mappings) {
+        unmerged.extension_mappings = conf->extension_mappings;
+        unmerged.remove_mappings = NULL;
+        unmerged.next = NULL;
+        m = &unmerged;
+    }
+    else {
+        return NULL;
+    }
+
+    memset(exinfo, 0, sizeof(*exinfo));
+    memset(removed, 0, sizeof(removed));
+
+    for (; m; m = m->next) {
+        const extension_info *info;
+
+        if (m->remove_mappings) {
+            const attrib_info *suffix = (const attrib_info *)
+                                        m->remove_mappings->elts;
+            for (i = 0; i < m->remove_mappings->nelts; i++) {
+                int f = suffix[i].offset / (int)sizeof(char *);
+                if (!strcmp(suffix[i].name, ext) && removed[f] >= 0) {
+                    if (!m->remove_levels) {
+                        removed[f] = -1;
+                    }
+                    else if (removed[f] < m->remove_levels) {
+                        removed[f] = m->remove_levels;
+                    }
+                }
+            }
+        }
+
+        if (m->extension_mappings
+            && (info = apr_hash_get(m->extension_mappings, ext,
+                                    APR_HASH_KEY_STRING))) {
+            found = 1;
+
+            /* extension_info is only made of (char *) fields */
+            for (i = 0; i < EXINFO_NFIELDS; i++) {
+                char *value = ((char *const *)info)[i];
+                if (value && !removed[i] && !(resolved & (1u << i))) {
+                    ((char **)exinfo)[i] = value;
+                    resolved |= 1u << i;
+                }
+            }
+        }
+
+        for (i = 0; i < EXINFO_NFIELDS; i++) {
+            if (removed[i] > 0) {
+                removed[i]--;
+            }
+        }
+    }
+
+    return found ? exinfo : NULL;
+}
+
 /*
  * find_ct is the hook routine for determining content-type and other
  * MIME-related metadata.  It assumes that r->filename has already been
@@ -812,8 +916,9 @@ static int find_ct(request_rec *r)
     mime_dir_config *conf;
     apr_array_header_t *exception_list;
     char *ext;
-    const char *fn, *fntmp, *type, *charset = NULL, *resource_name;
+    const char *fn, *fntmp, *charset = NULL, *resource_name;
     int found_metadata = 0;
+    int simple_ct = 0;
 
     if (r->finfo.filetype == APR_DIR) {
         ap_set_content_type(r, DIR_MAGIC_TYPE);
@@ -875,9 +980,13 @@ static int find_ct(request_rec *r)
     /* Parse filename extensions which can be in any order
      */
     while (*fn && (ext = ap_getword(r->pool, &fn, '.'))) {
-        const extension_info *exinfo = NULL;
+        const extension_info *exinfo;
+        extension_info exinfo_buf;
+        const mime_type_info *type;
         int found;
+        char extbuf[32];
         char *extcase;
+        apr_size_t extlen;
         int skipct = (conf->ct_last_ext == CT_LAST_ON) && (*fn);
         int skipall = (conf->all_last_ext == ALL_LAST_ON) && (*fn);
 
@@ -891,20 +1000,26 @@ static int find_ct(request_rec *r)
 
         found = 0;
 
-        /* Save the ext in extcase before converting it to lower case.
+        /* Keep the ext in extcase and lookup its lower case version,
+         * using a stack buffer for the usual (short) extensions.
          */
-        extcase = apr_pstrdup(r->pool, ext);
+        extcase = ext;
+        extlen = strlen(extcase);
+        if (extlen < sizeof(extbuf)) {
+            ext = memcpy(extbuf, extcase, extlen + 1);
+        }
+        else {
+            ext = apr_pstrmemdup(r->pool, extcase, extlen);
+        }
         ap_str_tolower(ext);
 
-        if (conf->extension_mappings != NULL) {
-            exinfo = (extension_info*)apr_hash_get(conf->extension_mappings,
-                                                   ext, APR_HASH_KEY_STRING);
-        }
+        exinfo = find_extension_info(conf, ext, &exinfo_buf);
 
         if ((exinfo == NULL || !exinfo->forced_type) && !skipct) {
             if ((type = apr_hash_get(mime_type_extensions, ext,
                                      APR_HASH_KEY_STRING)) != NULL) {
-                ap_set_content_type(r, (char*) type);
+                ap_set_content_type(r, type->type);
+                simple_ct = type->simple;
                 found = 1;
             }
         }
@@ -914,6 +1029,7 @@ static int find_ct(request_rec *r)
             /* empty string is treated as special case for RemoveType */
             if ((exinfo->forced_type && *exinfo->forced_type) && !skipct) {
                 ap_set_content_type(r, exinfo->forced_type);
+                simple_ct = 0;
                 found = 1;
             }
 
@@ -1002,7 +1118,10 @@ static int find_ct(request_rec *r)
                        (void *)exception_list);
     }
 
-    if (r->content_type) {
+    /* A plain "type/subtype" from TypesConfig needs no further parsing,
+     * unless a charset is to be added.
+     */
+    if (r->content_type && !(simple_ct && !charset)) {
         content_type *ctp;
         int override = 0;
 
@@ -76,37 +76,178 @@ static const char *ldap_cache_mutex_type = "ldap-cache";
 static apr_status_t uldap_connection_unbind(void *param);
 
 
-static APR_INLINE apr_status_t ldap_cache_lock(util_ldap_state_t *st, request_rec *r) { 
-    apr_status_t rv = APR_SUCCESS;
-    if (st->util_ldap_cache_lock) { 
-        apr_status_t rv = apr_global_mutex_lock(st->util_ldap_cache_lock);
-        if (rv != APR_SUCCESS) { 
-            if (r) {
-                ap_log_rerror(APLOG_MARK, APLOG_CRIT, rv, r, APLOGNO(10134) "LDAP cache lock failed");
-            }
-            else { 
-                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(10134) "LDAP cache lock failed");
-            }
-            ap_assert(0);
+static void ldap_cache_mutex_lock(apr_global_mutex_t *mutex,
+                                  util_ald_lock_stats_t *stats,
+                                  request_rec *r)
+{
+    apr_time_t start = 0;
+    apr_status_t rv;
+
+    rv = apr_global_mutex_trylock(mutex);
+    if (rv != APR_SUCCESS) {
+        if (APR_STATUS_IS_EBUSY(rv)) {
+            start = apr_time_now();
+        }
+        rv = apr_global_mutex_lock(mutex);
+    }
+    if (rv != APR_SUCCESS) {
+        if (r) {
+            ap_log_rerror(APLOG_MARK, APLOG_CRIT, rv, r, APLOGNO(10134) "LDAP cache lock failed");
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(10134) "LDAP cache lock failed");
+        }
+        ap_assert(0);
+    }
+
+    if (stats) {
+        stats->acquired++;
+        if (start) {
+            stats->contended++;
+            stats->waited += apr_time_now() - start;
         }
     }
-    return rv; 
 }
-static APR_INLINE apr_status_t ldap_cache_unlock(util_ldap_state_t *st, request_rec *r) { 
-    apr_status_t rv = APR_SUCCESS;
-    if (st->util_ldap_cache_lock) { 
-        apr_status_t rv = apr_global_mutex_unlock(st->util_ldap_cache_lock);
-        if (rv != APR_SUCCESS) { 
-            if (r != NULL) {
-                ap_log_rerror(APLOG_MARK, APLOG_CRIT, rv, r, APLOGNO(10135) "LDAP cache unlock failed");
-            }
-            else { 
-                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(10135) "LDAP cache unlock failed");
-            }
-            ap_assert(0);
+
+static void ldap_cache_mutex_unlock(apr_global_mutex_t *mutex,
+                                    request_rec *r)
+{
+    apr_status_t rv = apr_global_mutex_unlock(mutex);
+
+    if (rv != APR_SUCCESS) {
+        if (r != NULL) {
+            ap_log_rerror(APLOG_MARK, APLOG_CRIT, rv, r, APLOGNO(10135) "LDAP cache unlock failed");
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(10135) "LDAP cache unlock failed");
         }
+        ap_assert(0);
+    }
+}
+
+/*
+ * The main cache lock protects the URL cache and the shared memory
+ * allocator.  The search and compare caches of each URL are protected by
+ * one of the shard locks, chosen by hashing the URL, so that lookups for
+ * different URLs don't wait for each other.  When both are needed the
+ * shard lock is taken first.  Without shard locks (not initialised yet),
+ * the main lock protects everything.
+ */
+static APR_INLINE void ldap_cache_lock(util_ldap_state_t *st, request_rec *r)
+{
+    if (st->util_ldap_cache_lock) {
+        ldap_cache_mutex_lock(st->util_ldap_cache_lock,
+                              st->util_ldap_cache_lock_stats, r);
+    }
+}
+
+static APR_INLINE void ldap_cache_unlock(util_ldap_state_t *st, request_rec *r)
+{
+    if (st->util_ldap_cache_lock) {
+        ldap_cache_mutex_unlock(st->util_ldap_cache_lock, r);
+    }
+}
+
+static APR_INLINE int ldap_cache_shard(util_ldap_state_t *st, const char *url)
+{
+    if (!st->util_ldap_cache_shards) {
+        return 0;
+    }
+    return (int)(util_ald_hash_string(1, url) % st->util_ldap_cache_shards);
+}
+
+static APR_INLINE void ldap_cache_shard_lock(util_ldap_state_t *st, int shard,
+                                             request_rec *r)
+{
+    if (!st->util_ldap_cache_shards) {
+        ldap_cache_lock(st, r);
+    }
+    else {
+        ldap_cache_mutex_lock(st->util_ldap_cache_shard_locks[shard],
+                              st->util_ldap_cache_lock_stats ?
+                              st->util_ldap_cache_lock_stats + 1 + shard : NULL,
+                              r);
+    }
+}
+
+static APR_INLINE void ldap_cache_shard_unlock(util_ldap_state_t *st, int shard,
+                                               request_rec *r)
+{
+    if (!st->util_ldap_cache_shards) {
+        ldap_cache_unlock(st, r);
+    }
+    else {
+        ldap_cache_mutex_unlock(st->util_ldap_cache_shard_locks[shard], r);
+    }
+}
+
+/* Insert into or remove from the search and compare caches of an URL,
+ * with its shard lock held: these (de)allocate shared memory.
+ */
+static void *ldap_cache_insert(util_ldap_state_t *st, request_rec *r,
+                               util_ald_cache_t *cache, void *payload)
+{
+    void *node;
+
+    if (st->util_ldap_cache_shards) {
+        ldap_cache_lock(st, r);
+    }
+    node = util_ald_cache_insert(cache, payload);
+    if (st->util_ldap_cache_shards) {
+        ldap_cache_unlock(st, r);
+    }
+
+    return node;
+}
+
+static void ldap_cache_remove(util_ldap_state_t *st, request_rec *r,
+                              util_ald_cache_t *cache, void *payload)
+{
+    if (st->util_ldap_cache_shards) {
+        ldap_cache_lock(st, r);
+    }
+    util_ald_cache_remove(cache, payload);
+    if (st->util_ldap_cache_shards) {
+        ldap_cache_unlock(st, r);
     }
-    return rv; 
+}
+
+/*
+ * Find the caches of an URL, creating them if needed.  The URL cache is
+ * only ever modified (and purged) with all the shard locks held, so that
+ * the caches of an URL can't go away while its shard lock is held.
+ */
+static util_url_node_t *ldap_cache_url_node(util_ldap_state_t *st,
+                                            request_rec *r, const char *url,
+                                            int create)
+{
+    util_url_node_t curnode, *curl;
+    int i;
+
+    curnode.url = url;
+
+    ldap_cache_lock(st, r);
+    curl = util_ald_cache_fetch(st->util_ldap_cache, &curnode);
+    ldap_cache_unlock(st, r);
+
+    if (curl || !create) {
+        return curl;
+    }
+
+    for (i = 0; i < st->util_ldap_cache_shards; i++) {
+        ldap_cache_mutex_lock(st->util_ldap_cache_shard_locks[i], NULL, r);
+    }
+    ldap_cache_lock(st, r);
+    curl = util_ald_cache_fetch(st->util_ldap_cache, &curnode);
+    if (curl == NULL) {
+        curl = util_ald_create_caches(st, url);
+    }
+    ldap_cache_unlock(st, r);
+    for (i = st->util_ldap_cache_shards; i-- > 0; ) {
+        ldap_cache_mutex_unlock(st->util_ldap_cache_shard_locks[i], r);
+    }
+
+    return curl;
 }
 
 static void util_ldap_strdup (char **str, const char *newstr)
@@ -187,9 +328,9 @@ static int util_ldap_handler(request_rec *r)
 
 /* ------------------------------------------------------------------ */
 /*
- * Closes an LDAP connection by unlocking it. The next time
- * uldap_connection_find() is called this connection will be
- * available for reuse.
+ * Closes an LDAP connection by unlocking it and putting it back in the
+ * idle list of its server. The next time uldap_connection_find() is
+ * called this connection will be available for reuse.
  */
 static void uldap_connection_close(util_ldap_connection_t *ldc)
 {
@@ -211,6 +352,23 @@ static void uldap_connection_close(util_ldap_connection_t *ldc)
 #if APR_HAS_THREADS
      apr_thread_mutex_unlock(ldc->lock);
 #endif
+
+     /* make it available to uldap_connection_find() again, most recently
+      * used first so that the bound ones are reused first
+      */
+#if APR_HAS_THREADS
+     apr_thread_mutex_lock(ldc->st->mutex);
+#endif
+     if (!ldc->idle) {
+         ldc->idle_next = apr_hash_get(ldc->st->idle_connections,
+                                       ldc->idle_key, APR_HASH_KEY_STRING);
+         apr_hash_set(ldc->st->idle_connections, ldc->idle_key,
+                      APR_HASH_KEY_STRING, ldc);
+         ldc->idle = 1;
+     }
+#if APR_HAS_THREADS
+     apr_thread_mutex_unlock(ldc->st->mutex);
+#endif
 }
 
 
@@ -741,8 +899,10 @@ static util_ldap_connection_t *
                                   const char *binddn, const char *bindpw,
                                   deref_options deref, int secure)
 {
-    struct util_ldap_connection_t *l, *p; /* To traverse the linked list */
+    struct util_ldap_connection_t *l, *p; /* To traverse the idle list */
+    struct util_ldap_connection_t *head;
     int secureflag = secure;
+    const char *key;
     apr_time_t now = apr_time_now();
 
     util_ldap_state_t *st =
@@ -751,28 +911,29 @@ static util_ldap_connection_t *
     util_ldap_config_t *dc =
         (util_ldap_config_t *) ap_get_module_config(r->per_dir_config, &ldap_module);
 
-#if APR_HAS_THREADS
-    /* mutex lock this function */
-    apr_thread_mutex_lock(st->mutex);
-#endif
-
     if (secure < APR_LDAP_NONE) {
         secureflag = st->secure;
     }
 
-    /* Search for an exact connection match in the list that is not
-     * being used.
+    /* Connections not in use are kept in st->idle_connections, a list per
+     * server, so that only the ones usable for this server are looked at.
      */
-    for (l=st->connections,p=NULL; l; l=l->next) {
+    key = apr_psprintf(r->pool, "%s:%d:%d:%d", host, port, (int)deref,
+                       secureflag);
+
 #if APR_HAS_THREADS
-        if (APR_SUCCESS == apr_thread_mutex_trylock(l->lock)) {
+    /* mutex lock this function */
+    apr_thread_mutex_lock(st->mutex);
 #endif
-        if (   (l->port == port) && (strcmp(l->host, host) == 0)
-            && ((!l->binddn && !binddn) || (l->binddn && binddn
+
+    head = apr_hash_get(st->idle_connections, key, APR_HASH_KEY_STRING);
+
+    /* Search for an exact connection match in the list. */
+    for (l=head,p=NULL; l; p=l,l=l->idle_next) {
+        if (   ((!l->binddn && !binddn) || (l->binddn && binddn
                                              && !strcmp(l->binddn, binddn)))
             && ((!l->bindpw && !bindpw) || (l->bindpw && bindpw
                                              && !strcmp(l->bindpw, bindpw)))
-            && (l->deref == deref) && (l->secure == secureflag)
             && !compare_client_certs(dc->client_certs, l->client_certs))
         {
             if (st->connection_pool_ttl > 0) {
@@ -790,28 +951,14 @@ static util_ldap_connection_t *
             }
             break;
         }
-#if APR_HAS_THREADS
-            /* If this connection didn't match the criteria, then we
-             * need to unlock the mutex so it is available to be reused.
-             */
-            apr_thread_mutex_unlock(l->lock);
-        }
-#endif
-        p = l;
     }
 
     /* If nothing found, search again, but we don't care about the
      * binddn and bindpw this time.
      */
     if (!l) {
-        for (l=st->connections,p=NULL; l; l=l->next) {
-#if APR_HAS_THREADS
-            if (APR_SUCCESS == apr_thread_mutex_trylock(l->lock)) {
-
-#endif
-            if ((l->port == port) && (strcmp(l->host, host) == 0) &&
-                (l->deref == deref) && (l->secure == secureflag) &&
-                !compare_client_certs(dc->client_certs, l->client_certs))
+        for (l=head,p=NULL; l; p=l,l=l->idle_next) {
+            if (!compare_client_certs(dc->client_certs, l->client_certs))
             {
                 if (st->connection_pool_ttl > 0) {
                     if (l->bound && (now - l->last_backend_conn) > st->connection_pool_ttl) {
@@ -834,15 +981,23 @@ static util_ldap_connection_t *
 
                 break;
             }
+        }
+    }
+
+    /* Take the connection found out of the idle list */
+    if (l) {
+        if (p) {
+            p->idle_next = l->idle_next;
+        }
+        else {
+            apr_hash_set(st->idle_connections, l->idle_key,
+                         APR_HASH_KEY_STRING, l->idle_next);
+        }
+        l->idle_next = NULL;
+        l->idle = 0;
 #if APR_HAS_THREADS
-                /* If this connection didn't match the criteria, then we
-                 * need to unlock the mutex so it is available to be reused.
-                 */
-                apr_thread_mutex_unlock(l->lock);
-            }
+        apr_thread_mutex_lock(l->lock);
 #endif
-            p = l;
-        }
     }
 
 /* artificially disable cache */
@@ -893,6 +1048,9 @@ static util_ldap_connection_t *
          */
         l->secure = secureflag;
 
+        /* the connections are never freed, the key can live in l->pool */
+        l->idle_key = apr_pstrdup(l->pool, key);
+
         /* save away a copy of the client cert list that is presently valid */
         l->client_certs = apr_array_copy_hdr(l->pool, dc->client_certs);
 
@@ -910,12 +1068,8 @@ static util_ldap_connection_t *
             }
         }
 
-        if (p) {
-            p->next = l;
-        }
-        else {
-            st->connections = l;
-        }
+        l->next = st->connections;
+        st->connections = l;
     }
 
 #if APR_HAS_THREADS
@@ -942,7 +1096,7 @@ static int uldap_cache_comparedn(request_rec *r, util_ldap_connection_t *ldc,
 {
     int result = 0;
     util_url_node_t *curl;
-    util_url_node_t curnode;
+    int shard;
     util_dn_compare_node_t *node;
     util_dn_compare_node_t newnode;
     int failures = 0;
@@ -954,14 +1108,8 @@ static int uldap_cache_comparedn(request_rec *r, util_ldap_connection_t *ldc,
                                                  &ldap_module);
 
     /* get cache entry (or create one) */
-    ldap_cache_lock(st, r);
-
-    curnode.url = url;
-    curl = util_ald_cache_fetch(st->util_ldap_cache, &curnode);
-    if (curl == NULL) {
-        curl = util_ald_create_caches(st, url);
-    }
-    ldap_cache_unlock(st, r);
+    curl = ldap_cache_url_node(st, r, url, 1);
+    shard = ldap_cache_shard(st, url);
 
     /* a simple compare? */
     if (!compare_dn_on_server) {
@@ -978,7 +1126,7 @@ static int uldap_cache_comparedn(request_rec *r, util_ldap_connection_t *ldc,
 
     if (curl) {
         /* no - it's a server side compare */
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
 
         /* is it in the compare cache? */
         newnode.reqdn = (char *)reqdn;
@@ -986,13 +1134,13 @@ static int uldap_cache_comparedn(request_rec *r, util_ldap_connection_t *ldc,
         if (node != NULL) {
             /* If it's in the cache, it's good */
             /* unlock this read lock */
-            ldap_cache_unlock(st, r);
+            ldap_cache_shard_unlock(st, shard, r);
             ldc->reason = "DN Comparison TRUE (cached)";
             return LDAP_COMPARE_TRUE;
         }
 
         /* unlock this read lock */
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
     }
 
 start_over:
@@ -1054,7 +1202,7 @@ start_over:
     else {
         if (curl) {
             /* compare successful - add to the compare cache */
-            ldap_cache_lock(st, r);
+            ldap_cache_shard_lock(st, shard, r);
             newnode.reqdn = (char *)reqdn;
             newnode.dn = (char *)dn;
 
@@ -1063,9 +1211,9 @@ start_over:
                 || (strcmp(reqdn, node->reqdn) != 0)
                 || (strcmp(dn, node->dn) != 0))
             {
-                util_ald_cache_insert(curl->dn_compare_cache, &newnode);
+                ldap_cache_insert(st, r, curl->dn_compare_cache, &newnode);
             }
-            ldap_cache_unlock(st, r);
+            ldap_cache_shard_unlock(st, shard, r);
         }
         ldc->reason = "DN Comparison TRUE (checked on server)";
         result = LDAP_COMPARE_TRUE;
@@ -1089,7 +1237,7 @@ static int uldap_cache_compare(request_rec *r, util_ldap_connection_t *ldc,
 {
     int result = 0;
     util_url_node_t *curl;
-    util_url_node_t curnode;
+    int shard;
     util_compare_node_t *compare_nodep;
     util_compare_node_t the_compare_node;
     apr_time_t curtime = 0; /* silence gcc -Wall */
@@ -1100,17 +1248,12 @@ static int uldap_cache_compare(request_rec *r, util_ldap_connection_t *ldc,
                                                  &ldap_module);
 
     /* get cache entry (or create one) */
-    ldap_cache_lock(st, r);
-    curnode.url = url;
-    curl = util_ald_cache_fetch(st->util_ldap_cache, &curnode);
-    if (curl == NULL) {
-        curl = util_ald_create_caches(st, url);
-    }
-    ldap_cache_unlock(st, r);
+    curl = ldap_cache_url_node(st, r, url, 1);
+    shard = ldap_cache_shard(st, url);
 
     if (curl) {
         /* make a comparison to the cache */
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
         curtime = apr_time_now();
 
         the_compare_node.dn = (char *)dn;
@@ -1127,7 +1270,7 @@ static int uldap_cache_compare(request_rec *r, util_ldap_connection_t *ldc,
             /* found it... */
             if (curtime - compare_nodep->lastcompare > st->compare_cache_ttl) {
                 /* ...but it is too old */
-                util_ald_cache_remove(curl->compare_cache, compare_nodep);
+                ldap_cache_remove(st, r, curl->compare_cache, compare_nodep);
             }
             else {
                 /* ...and it is good */
@@ -1149,7 +1292,7 @@ static int uldap_cache_compare(request_rec *r, util_ldap_connection_t *ldc,
                 /* record the result code to return with the reason... */
                 result = compare_nodep->result;
                 /* and unlock this read lock */
-                ldap_cache_unlock(st, r);
+                ldap_cache_shard_unlock(st, shard, r);
 
                 ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r, 
                               "ldap_compare_s(%pp, %s, %s, %s) = %s (cached)", 
@@ -1158,7 +1301,7 @@ static int uldap_cache_compare(request_rec *r, util_ldap_connection_t *ldc,
             }
         }
         /* unlock this read lock */
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
     }
 
 start_over:
@@ -1206,7 +1349,7 @@ start_over:
         (LDAP_NO_SUCH_ATTRIBUTE == result)) {
         if (curl) {
             /* compare completed; caching result */
-            ldap_cache_lock(st, r);
+            ldap_cache_shard_lock(st, shard, r);
             the_compare_node.lastcompare = curtime;
             the_compare_node.result = result;
             the_compare_node.sgl_processed = 0;
@@ -1224,8 +1367,8 @@ start_over:
             {
                 void *junk;
 
-                junk = util_ald_cache_insert(curl->compare_cache,
-                                             &the_compare_node);
+                junk = ldap_cache_insert(st, r, curl->compare_cache,
+                                         &the_compare_node);
                 if (junk == NULL) {
                     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01287)
                                   "cache_compare: Cache insertion failure.");
@@ -1235,7 +1378,7 @@ start_over:
                 compare_nodep->lastcompare = curtime;
                 compare_nodep->result = result;
             }
-            ldap_cache_unlock(st, r);
+            ldap_cache_shard_unlock(st, shard, r);
         }
 
         if (LDAP_COMPARE_TRUE == result) {
@@ -1454,7 +1597,7 @@ static int uldap_cache_check_subgroups(request_rec *r,
 {
     int result = LDAP_COMPARE_FALSE;
     util_url_node_t *curl;
-    util_url_node_t curnode;
+    int shard;
     util_compare_node_t *compare_nodep;
     util_compare_node_t the_compare_node;
     util_compare_subgroup_t *tmp_local_sgl = NULL;
@@ -1500,14 +1643,12 @@ static int uldap_cache_check_subgroups(request_rec *r,
      * 2. Find previously created cache entry and check if there is already a
      *    subgrouplist.
      */
-    ldap_cache_lock(st, r);
-    curnode.url = url;
-    curl = util_ald_cache_fetch(st->util_ldap_cache, &curnode);
-    ldap_cache_unlock(st, r);
+    curl = ldap_cache_url_node(st, r, url, 0);
+    shard = ldap_cache_shard(st, url);
 
     if (curl && curl->compare_cache) {
         /* make a comparison to the cache */
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
 
         the_compare_node.dn = (char *)dn;
         the_compare_node.attrib = (char *)"objectClass";
@@ -1549,7 +1690,7 @@ static int uldap_cache_check_subgroups(request_rec *r,
                 }
             }
         }
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
     }
 
     if (!tmp_local_sgl && !sgl_cached_empty) {
@@ -1568,7 +1709,7 @@ static int uldap_cache_check_subgroups(request_rec *r,
         /*
          * Find the generic group cache entry and add the sgl we just retrieved.
          */
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
 
         the_compare_node.dn = (char *)dn;
         the_compare_node.attrib = (char *)"objectClass";
@@ -1590,7 +1731,7 @@ static int uldap_cache_check_subgroups(request_rec *r,
             ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01291)
                           "Cache entry for %s doesn't exist", dn);
             the_compare_node.result = LDAP_COMPARE_TRUE;
-            util_ald_cache_insert(curl->compare_cache, &the_compare_node);
+            ldap_cache_insert(st, r, curl->compare_cache, &the_compare_node);
             compare_nodep = util_ald_cache_fetch(curl->compare_cache,
                                                  &the_compare_node);
             if (compare_nodep == NULL) {
@@ -1613,8 +1754,12 @@ static int uldap_cache_check_subgroups(request_rec *r,
                 }
             }
             else {
-                util_compare_subgroup_t *sgl_copy =
-                    util_ald_sgl_dup(curl->compare_cache, tmp_local_sgl);
+                util_compare_subgroup_t *sgl_copy;
+
+                if (st->util_ldap_cache_shards) {
+                    ldap_cache_lock(st, r);
+                }
+                sgl_copy = util_ald_sgl_dup(curl->compare_cache, tmp_local_sgl);
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(01293)
                              "Copying local SGL of len %d for group %s into cache",
                              tmp_local_sgl->len, dn);
@@ -1631,9 +1776,12 @@ static int uldap_cache_check_subgroups(request_rec *r,
                                  "Copy of SGL failed to obtain shared memory, "
                                  "couldn't update cache");
                 }
+                if (st->util_ldap_cache_shards) {
+                    ldap_cache_unlock(st, r);
+                }
             }
         }
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
       }
     }
 
@@ -1701,7 +1849,7 @@ static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
     int count;
     int failures = 0;
     util_url_node_t *curl;              /* Cached URL node */
-    util_url_node_t curnode;
+    int shard;                          /* Its cache lock shard */
     util_search_node_t *search_nodep;   /* Cached search node */
     util_search_node_t the_search_node;
     apr_time_t curtime;
@@ -1711,17 +1859,11 @@ static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
         &ldap_module);
 
     /* Get the cache node for this url */
-    ldap_cache_lock(st, r);
-    curnode.url = url;
-    curl = (util_url_node_t *)util_ald_cache_fetch(st->util_ldap_cache,
-                                                   &curnode);
-    if (curl == NULL) {
-        curl = util_ald_create_caches(st, url);
-    }
-    ldap_cache_unlock(st, r);
+    curl = ldap_cache_url_node(st, r, url, 1);
+    shard = ldap_cache_shard(st, url);
 
     if (curl) {
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
         the_search_node.username = filter;
         search_nodep = util_ald_cache_fetch(curl->search_cache,
                                             &the_search_node);
@@ -1738,7 +1880,7 @@ static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
              */
             if ((curtime - search_nodep->lastbind) > st->search_cache_ttl) {
                 /* ...but entry is too old */
-                util_ald_cache_remove(curl->search_cache, search_nodep);
+                ldap_cache_remove(st, r, curl->search_cache, search_nodep);
             }
             else if (   (search_nodep->bindpw)
                      && (search_nodep->bindpw[0] != '\0')
@@ -1753,13 +1895,13 @@ static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
                         (*retvals)[i] = apr_pstrdup(r->pool, search_nodep->vals[i]);
                     }
                 }
-                ldap_cache_unlock(st, r);
+                ldap_cache_shard_unlock(st, shard, r);
                 ldc->reason = "Authentication successful (cached)";
                 return LDAP_SUCCESS;
             }
         }
         /* unlock this read lock */
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
     }
 
     /*
@@ -1918,7 +2060,7 @@ start_over:
      * Add the new username to the search cache.
      */
     if (curl) {
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
         the_search_node.username = filter;
         the_search_node.dn = *binddn;
         the_search_node.bindpw = bindpw;
@@ -1936,20 +2078,20 @@ start_over:
             (strcmp(*binddn, search_nodep->dn) != 0)) {
 
             /* Nothing in cache, insert new entry */
-            util_ald_cache_insert(curl->search_cache, &the_search_node);
+            ldap_cache_insert(st, r, curl->search_cache, &the_search_node);
         }
         else if ((!search_nodep->bindpw) ||
             (strcmp(bindpw, search_nodep->bindpw) != 0)) {
 
             /* Entry in cache is invalid, remove it and insert new one */
-            util_ald_cache_remove(curl->search_cache, search_nodep);
-            util_ald_cache_insert(curl->search_cache, &the_search_node);
+            ldap_cache_remove(st, r, curl->search_cache, search_nodep);
+            ldap_cache_insert(st, r, curl->search_cache, &the_search_node);
         }
         else {
             /* Cache entry is valid, update lastbind */
             search_nodep->lastbind = the_search_node.lastbind;
         }
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
     }
     ldap_msgfree(res);
 
@@ -1977,7 +2119,7 @@ static int uldap_cache_getuserdn(request_rec *r, util_ldap_connection_t *ldc,
     int count;
     int failures = 0;
     util_url_node_t *curl;              /* Cached URL node */
-    util_url_node_t curnode;
+    int shard;                          /* Its cache lock shard */
     util_search_node_t *search_nodep;   /* Cached search node */
     util_search_node_t the_search_node;
     apr_time_t curtime;
@@ -1987,17 +2129,11 @@ static int uldap_cache_getuserdn(request_rec *r, util_ldap_connection_t *ldc,
         &ldap_module);
 
     /* Get the cache node for this url */
-    ldap_cache_lock(st, r);
-    curnode.url = url;
-    curl = (util_url_node_t *)util_ald_cache_fetch(st->util_ldap_cache,
-                                                   &curnode);
-    if (curl == NULL) {
-        curl = util_ald_create_caches(st, url);
-    }
-    ldap_cache_unlock(st, r);
+    curl = ldap_cache_url_node(st, r, url, 1);
+    shard = ldap_cache_shard(st, url);
 
     if (curl) {
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
         the_search_node.username = filter;
         search_nodep = util_ald_cache_fetch(curl->search_cache,
                                             &the_search_node);
@@ -2011,7 +2147,7 @@ static int uldap_cache_getuserdn(request_rec *r, util_ldap_connection_t *ldc,
              */
             if ((curtime - search_nodep->lastbind) > st->search_cache_ttl) {
                 /* ...but entry is too old */
-                util_ald_cache_remove(curl->search_cache, search_nodep);
+                ldap_cache_remove(st, r, curl->search_cache, search_nodep);
             }
             else {
                 /* ...and entry is valid */
@@ -2023,13 +2159,13 @@ static int uldap_cache_getuserdn(request_rec *r, util_ldap_connection_t *ldc,
                         (*retvals)[i] = apr_pstrdup(r->pool, search_nodep->vals[i]);
                     }
                 }
-                ldap_cache_unlock(st, r);
+                ldap_cache_shard_unlock(st, shard, r);
                 ldc->reason = "Search successful (cached)";
                 return LDAP_SUCCESS;
             }
         }
         /* unlock this read lock */
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
     }
 
     /*
@@ -2127,7 +2263,7 @@ start_over:
      * Add the new username to the search cache.
      */
     if (curl) {
-        ldap_cache_lock(st, r);
+        ldap_cache_shard_lock(st, shard, r);
         the_search_node.username = filter;
         the_search_node.dn = *binddn;
         the_search_node.bindpw = NULL;
@@ -2145,7 +2281,7 @@ start_over:
             (strcmp(*binddn, search_nodep->dn) != 0)) {
 
             /* Nothing in cache, insert new entry */
-            util_ald_cache_insert(curl->search_cache, &the_search_node);
+            ldap_cache_insert(st, r, curl->search_cache, &the_search_node);
         }
         /*
          * Don't update lastbind on entries with bindpw because
@@ -2156,7 +2292,7 @@ start_over:
             /* Cache entry is valid, update lastbind */
             search_nodep->lastbind = the_search_node.lastbind;
         }
-        ldap_cache_unlock(st, r);
+        ldap_cache_shard_unlock(st, shard, r);
     }
 
     ldap_msgfree(res);
@@ -2864,6 +3000,7 @@ static void *util_ldap_create_config(apr_pool_t *p, server_rec *s)
     st->compare_cache_ttl = 600 * APR_USEC_PER_SEC; /* 10 minutes */
     st->compare_cache_size = 1024;
     st->connections = NULL;
+    st->idle_connections = apr_hash_make(st->pool);
     st->ssl_supported = 0;
     st->global_certs = apr_array_make(p, 10, sizeof(apr_ldap_opt_tls_cert_t));
     st->secure = APR_LDAP_NONE;
@@ -2904,6 +3041,7 @@ static void *util_ldap_merge_config(apr_pool_t *p, void *basev,
     st->compare_cache_size = base->compare_cache_size;
 
     st->connections = NULL;
+    st->idle_connections = apr_hash_make(st->pool);
     st->ssl_supported = 0; /* not known until post-config and re-merged */
     st->global_certs = apr_array_append(p, base->global_certs,
                                            overrides->global_certs);
@@ -2985,7 +3123,7 @@ static int util_ldap_post_config(apr_pool_t *p, apr_pool_t *plog,
                                                  &ldap_module);
 
     apr_ldap_err_t *result_err = NULL;
-    int rc;
+    int rc, i;
 
     /* util_ldap_post_config() will be called twice. Don't bother
      * going through all of the initialization on the first call
@@ -3028,6 +3166,19 @@ static int util_ldap_post_config(apr_pool_t *p, apr_pool_t *plog,
             return result;
         }
 
+        st->util_ldap_cache_shard_locks =
+            apr_pcalloc(p, UTIL_LDAP_CACHE_SHARDS * sizeof(apr_global_mutex_t *));
+        for (i = 0; i < UTIL_LDAP_CACHE_SHARDS; i++) {
+            result = ap_global_mutex_create(&st->util_ldap_cache_shard_locks[i],
+                                            NULL, ldap_cache_mutex_type,
+                                            apr_psprintf(p, "shard%d", i),
+                                            s, p, 0);
+            if (result != APR_SUCCESS) {
+                return result;
+            }
+        }
+        st->util_ldap_cache_shards = UTIL_LDAP_CACHE_SHARDS;
+
         /* merge config in all vhost */
         s_vhost = s->next;
         while (s_vhost) {
@@ -3036,6 +3187,9 @@ static int util_ldap_post_config(apr_pool_t *p, apr_pool_t *plog,
                                             &ldap_module);
             st_vhost->util_ldap_cache = st->util_ldap_cache;
             st_vhost->util_ldap_cache_lock = st->util_ldap_cache_lock;
+            st_vhost->util_ldap_cache_shard_locks = st->util_ldap_cache_shard_locks;
+            st_vhost->util_ldap_cache_shards = st->util_ldap_cache_shards;
+            st_vhost->util_ldap_cache_lock_stats = st->util_ldap_cache_lock_stats;
 #if APR_HAS_SHARED_MEMORY
             st_vhost->cache_shm = st->cache_shm;
             st_vhost->cache_rmm = st->cache_rmm;
@@ -3134,6 +3288,7 @@ static void util_ldap_child_init(apr_pool_t *p, server_rec *s)
     apr_status_t sts;
     util_ldap_state_t *st = ap_get_module_config(s->module_config,
                                                  &ldap_module);
+    int i;
 
     if (!st->util_ldap_cache_lock) return;
 
@@ -3144,6 +3299,18 @@ static void util_ldap_child_init(apr_pool_t *p, server_rec *s)
                      "Failed to initialise global mutex %s in child process",
                      ldap_cache_mutex_type);
     }
+
+    for (i = 0; i < st->util_ldap_cache_shards; i++) {
+        apr_global_mutex_t **lock = &st->util_ldap_cache_shard_locks[i];
+
+        sts = apr_global_mutex_child_init(lock,
+                  apr_global_mutex_lockfile(*lock), p);
+        if (sts != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, sts, s, APLOGNO(10192)
+                         "Failed to initialise global mutex %s (shard %d) "
+                         "in child process", ldap_cache_mutex_type, i);
+        }
+    }
 }
 
 static const command_rec util_ldap_cmds[] = {
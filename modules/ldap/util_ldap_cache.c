@@ -429,6 +429,23 @@ apr_status_t util_ldap_cache_init(apr_pool_t *pool, util_ldap_state_t *st)
 
 #endif
 
+    /* The lock statistics, one for the main lock and one per shard */
+#if APR_HAS_SHARED_MEMORY
+    if (st->cache_rmm) {
+        apr_rmm_off_t block;
+
+        block = apr_rmm_calloc(st->cache_rmm, (UTIL_LDAP_CACHE_SHARDS + 1)
+                                              * sizeof(util_ald_lock_stats_t));
+        st->util_ldap_cache_lock_stats = block ?
+            (util_ald_lock_stats_t *)apr_rmm_addr_get(st->cache_rmm, block) :
+            NULL;
+    }
+    else
+#endif
+    st->util_ldap_cache_lock_stats = apr_pcalloc(st->pool,
+                                                 (UTIL_LDAP_CACHE_SHARDS + 1)
+                                                 * sizeof(util_ald_lock_stats_t));
+
     st->util_ldap_cache =
         util_ald_create_cache(st,
                               st->search_cache_size,
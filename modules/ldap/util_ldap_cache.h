@@ -73,6 +73,21 @@ struct util_ald_cache {
 
 };
 
+/*
+ * Statistics of a cache lock, kept with the caches and only updated
+ * while holding the lock they describe.
+ */
+typedef struct util_ald_lock_stats_t {
+    unsigned long acquired;             /* Number of times the lock was taken */
+    unsigned long contended;            /* Number of times it had to be waited for */
+    apr_interval_time_t waited;         /* Total time spent waiting for it */
+} util_ald_lock_stats_t;
+
+/* Number of locks sharing the search and compare caches of the URLs */
+#ifndef UTIL_LDAP_CACHE_SHARDS
+#define UTIL_LDAP_CACHE_SHARDS 8
+#endif
+
 #ifndef WIN32
 #define ALD_MM_FILE_MODE ( S_IRUSR|S_IWUSR )
 #else
@@ -672,6 +672,54 @@ char *util_ald_cache_display_stats(request_rec *r, util_ald_cache_t *cache, char
     return buf;
 }
 
+/*
+ * Display how often the cache locks were taken, and how long the requests
+ * had to wait for them when they were busy.  The counters are read
+ * without locking, they are only indicative.
+ */
+static void util_ald_lock_stats_display(request_rec *r, util_ldap_state_t *st)
+{
+    util_ald_lock_stats_t *stats = st->util_ldap_cache_lock_stats;
+    int i;
+
+    if (!stats) {
+        return;
+    }
+
+    ap_rputs("<p>\n"
+             "<table border='0'>\n"
+             "<tr bgcolor='#000000'>\n"
+             "<td><font size='-1' face='Arial,Helvetica' color='#ffffff'><b>Cache Lock</b></font></td>"
+             "<td><font size='-1' face='Arial,Helvetica' color='#ffffff'><b>Acquired</b></font></td>"
+             "<td colspan='2'><font size='-1' face='Arial,Helvetica' color='#ffffff'><b>Contended</b></font></td>"
+             "<td><font size='-1' face='Arial,Helvetica' color='#ffffff'><b>Total Wait</b></font></td>"
+             "<td><font size='-1' face='Arial,Helvetica' color='#ffffff'><b>Avg Wait</b></font></td>"
+             "</tr>\n", r);
+
+    for (i = 0; i <= st->util_ldap_cache_shards; i++) {
+        util_ald_lock_stats_t *ls = &stats[i];
+
+        ap_rprintf(r,
+                   "<tr valign='top'>"
+                   "<td nowrap>%s</td>"
+                   "<td align='right'>%lu</td>"
+                   "<td align='right'>%lu</td>"
+                   "<td align='right'>%.1f%%</td>"
+                   "<td align='right'>%.3fms</td>"
+                   "<td align='right'>%.3fms</td>"
+                   "</tr>\n",
+                   i ? apr_psprintf(r->pool, "Shard %d", i - 1) : "Main",
+                   ls->acquired, ls->contended,
+                   ls->acquired ? (double)ls->contended
+                                  / (double)ls->acquired * 100.0 : 0.0,
+                   (double)ls->waited / 1000.0,
+                   ls->contended ? (double)ls->waited / 1000.0
+                                   / (double)ls->contended : 0.0);
+    }
+
+    ap_rputs("</table>\n</p>\n", r);
+}
+
 char *util_ald_cache_display(request_rec *r, util_ldap_state_t *st)
 {
     unsigned long i,j;
@@ -897,6 +945,8 @@ char *util_ald_cache_display(request_rec *r, util_ldap_state_t *st)
         }
         ap_rputs(buf, r);
         ap_rputs("</table>\n</p>\n", r);
+
+        util_ald_lock_stats_display(r, st);
     }
 
     return buf;
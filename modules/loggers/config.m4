@@ -57,6 +57,7 @@ if test "x$enable_log_forensic" != "xno"; then
 fi   
 
 APACHE_MODULE(logio, input and output logging, , , most)
+APACHE_MODULE(log_otlp, export of the request spans as OTLP/JSON, , , most)
 
 APR_ADDTO(INCLUDES, [-I\$(top_srcdir)/$modpath_current])
 
@@ -243,6 +243,36 @@ typedef struct {
     apr_table_t *formats;
 } multi_log_state;
 
+/*
+ * errorlog_provider_data holds pointer to provider and its handle
+ * generated by provider initialization. It is used when logging using
+ * ap_errorlog_provider.
+ */
+typedef struct {
+    struct ap_errorlog_provider *provider;
+    void *handle;
+} errorlog_provider_data;
+
+/*
+ * Type of the log_writer created by ap_default_log_writer_init.
+ * It is used by ap_default_log_writer to determine the type of
+ * the log_writer.
+ */
+enum default_log_writer_type {
+    LOG_WRITER_FD,
+    LOG_WRITER_PIPE,
+    LOG_WRITER_PROVIDER
+};
+
+/*
+ * Abstract struct to allow multiple types of log writers to be created
+ * by ap_default_log_writer_init function.
+ */
+typedef struct {
+    enum default_log_writer_type type;
+    void *log_writer;
+} default_log_writer;
+
 /*
  * config_log_state holds the status of a single log file. fname might
  * be NULL, which means this module does no logging for this
@@ -254,7 +284,7 @@ typedef struct {
 
  */
 typedef struct {
-    apr_file_t *handle;
+    default_log_writer *handle;
     apr_size_t outcnt;
     char outbuf[LOG_BUFSIZE];
     apr_anylock_t mutex;
@@ -293,35 +323,6 @@ typedef struct {
     apr_array_header_t *conditions;
 } log_format_item;
 
-/*
- * errorlog_provider_data holds pointer to provider and its handle
- * generated by provider initialization. It is used when logging using
- * ap_errorlog_provider.
- */
-typedef struct {
-    struct ap_errorlog_provider *provider;
-    void *handle;
-} errorlog_provider_data;
-
-/*
- * Type of the log_writer created by ap_default_log_writer_init.
- * It is used by ap_default_log_writer to determine the type of
- * the log_writer.
- */
-enum default_log_writer_type {
-    LOG_WRITER_FD,
-    LOG_WRITER_PROVIDER
-};
-
-/*
- * Abstract struct to allow multiple types of log writers to be created
- * by ap_default_log_writer_init function.
- */
-typedef struct {
-    enum default_log_writer_type type;
-    void *log_writer;
-} default_log_writer;
-
 static char *pfmt(apr_pool_t *p, int i)
 {
     if (i <= 0) {
@@ -1132,11 +1133,50 @@ static const char *process_item(request_rec *r, request_rec *orig,
     return cp ? cp : "-";
 }
 
+/*
+ * Write a line (or a buffer of lines) with the writer opened by
+ * ap_default_log_writer_init; r is NULL when the buffered logs are
+ * flushed at exit.
+ */
+static apr_status_t default_log_write(request_rec *r,
+                                      default_log_writer *log_writer,
+                                      const char *str, apr_size_t len)
+{
+    apr_status_t rv;
+
+    if (log_writer->type == LOG_WRITER_FD) {
+        rv = apr_file_write_full((apr_file_t*)log_writer->log_writer, str,
+                                 len, NULL);
+    }
+    else if (log_writer->type == LOG_WRITER_PIPE) {
+        rv = ap_piped_log_write((piped_log *)log_writer->log_writer, str,
+                                len);
+    }
+    else {
+        errorlog_provider_data *data = log_writer->log_writer;
+        ap_errorlog_info info;
+        info.r             = r;
+        info.s             = r ? r->server : ap_server_conf;
+        info.c             = r ? r->connection : NULL;
+        info.pool          = r ? r->pool : NULL;
+        info.file          = NULL;
+        info.line          = 0;
+        info.status        = 0;
+        info.using_provider = 1;
+        info.startup       = 0;
+        info.format        = "";
+        rv = data->provider->writer(&info, data->handle,
+                                    str, len);
+    }
+
+    return rv;
+}
+
 static void flush_log(buffered_log *buf)
 {
     if (buf->outcnt && buf->handle != NULL) {
         /* XXX: error handling */
-        apr_file_write_full(buf->handle, buf->outbuf, buf->outcnt, NULL);
+        default_log_write(NULL, buf->handle, buf->outbuf, buf->outcnt);
         buf->outcnt = 0;
     }
 }
@@ -1652,7 +1692,6 @@ static apr_status_t ap_default_log_writer( request_rec *r,
     char *str;
     char *s;
     int i;
-    apr_status_t rv;
 
     /*
      * We do this memcpy dance because write() is atomic for len < PIPE_BUF,
@@ -1665,28 +1704,7 @@ static apr_status_t ap_default_log_writer( request_rec *r,
         s += strl[i];
     }
 
-    if (log_writer->type == LOG_WRITER_FD) {
-        rv = apr_file_write_full((apr_file_t*)log_writer->log_writer, str,
-                                 len, NULL);
-    }
-    else {
-        errorlog_provider_data *data = log_writer->log_writer;
-        ap_errorlog_info info;
-        info.r             = r;
-        info.s             = r->server;
-        info.c             = r->connection;
-        info.pool          = r->pool;
-        info.file          = NULL;
-        info.line          = 0;
-        info.status        = 0;
-        info.using_provider = 1;
-        info.startup       = 0;
-        info.format        = "";
-        rv = data->provider->writer(&info, data->handle,
-                                    str, len);
-    }
-
-    return rv;
+    return default_log_write(r, log_writer, str, len);
 }
 static void *ap_default_log_writer_init(apr_pool_t *p, server_rec *s,
                                         const char* name)
@@ -1711,12 +1729,12 @@ static void *ap_default_log_writer_init(apr_pool_t *p, server_rec *s,
            return NULL;
         }
 
-        log_writer = apr_pcalloc(p, sizeof(default_log_writer));
-        log_writer->type = LOG_WRITER_FD;
-        log_writer->log_writer = ap_piped_log_write_fd(pl);
-        if (!log_writer->log_writer) {
+        if (!ap_piped_log_write_fd(pl)) {
             return NULL;
         }
+        log_writer = apr_pcalloc(p, sizeof(default_log_writer));
+        log_writer->type = LOG_WRITER_PIPE;
+        log_writer->log_writer = pl;
         return log_writer;
     }
     else if ((provider = ap_lookup_provider(AP_ERRORLOG_PROVIDER_GROUP,
@@ -1810,7 +1828,7 @@ static apr_status_t ap_buffered_log_writer(request_rec *r,
             s += strl[i];
         }
         w = len;
-        rv = apr_file_write_full(buf->handle, str, w, NULL);
+        rv = default_log_write(r, buf->handle, str, w);
 
     }
     else {
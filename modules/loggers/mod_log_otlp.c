@@ -0,0 +1,826 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mod_log_otlp.c: export the sampled spans of the requests (see
+ * util_trace.h and the TraceContext directive) as OTLP/JSON, to a file or
+ * a Unix domain socket.
+ *
+ * Each thread formats its spans in a buffer of its own (its "ring",
+ * reused from the start once flushed), without locking; a batch is
+ * written out, as one ExportTraceServiceRequest per line, with a single
+ * write, when the ring holds TraceExportBatch spans, when its oldest span
+ * is older than TraceExportInterval, and when the thread or the child
+ * exits.  The age is checked when a span is recorded and, so that the
+ * rings of the idle threads are flushed too, by a thread of the child
+ * which wakes up every half interval.
+ *
+ * The export to a socket never waits for the collector: a batch which
+ * it is not ready to read is dropped.
+ */
+
+#include "apr_strings.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+
+#define APR_WANT_STRFUNC
+#define APR_WANT_MEMFUNC
+#define APR_WANT_IOVEC
+#include "apr_want.h"
+
+#if APR_HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+#if APR_HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include "ap_config.h"
+#include "ap_release.h"
+#include "httpd.h"
+#include "http_config.h"
+#include "http_core.h"
+#include "http_log.h"
+#include "util_trace.h"
+
+module AP_MODULE_DECLARE_DATA log_otlp_module;
+
+#define OTLP_RING_KEY           "mod_log_otlp-ring"
+#define OTLP_BATCH_DEFAULT      64
+#define OTLP_INTERVAL_DEFAULT   apr_time_from_sec(5)
+#define OTLP_FLUSH_PERIOD_MIN   apr_time_from_msec(100)
+
+/* The most a formatted span takes: the values of the attributes are
+ * truncated to the lengths below (once escaped), which with the fixed
+ * parts (about 700 bytes) keeps a span within this.
+ */
+#define OTLP_SPAN_MAX           2048
+#define OTLP_NAME_MAX           64
+#define OTLP_TARGET_MAX         768
+#define OTLP_HOST_MAX           128
+#define OTLP_SHORT_MAX          64
+
+/* The room a span is expected to take on average, for the size of the
+ * rings.
+ */
+#define OTLP_SPAN_AVG           512
+
+typedef struct otlp_ring_t {
+    struct otlp_ring_t *next;      /* in the free list */
+    struct otlp_ring_t *all;       /* in the list of all the rings */
+    char *buf;
+    apr_size_t len;
+    apr_size_t size;
+    int count;
+    apr_time_t oldest;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;     /* against the flush thread */
+#endif
+} otlp_ring_t;
+
+/* Configuration (global only) */
+static const char *export_path;
+static const char *export_sock_path;
+static int export_batch;
+static apr_interval_time_t export_interval;
+static const char *export_service;
+
+/* State of the child */
+static int export_active;
+static apr_file_t *export_file;
+static apr_socket_t *export_sock;
+static apr_pool_t *export_pool;
+static apr_pool_t *sock_pool;
+static struct iovec batch_head;
+static int export_failing;
+static otlp_ring_t *all_rings;
+static otlp_ring_t *free_rings;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *export_mutex;
+static apr_thread_cond_t *flush_cond;
+static apr_thread_t *flush_thread;
+static int flush_stop;
+#endif
+
+static APR_INLINE void export_lock(void)
+{
+#if APR_HAS_THREADS
+    if (export_mutex) {
+        apr_thread_mutex_lock(export_mutex);
+    }
+#endif
+}
+
+static APR_INLINE void export_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (export_mutex) {
+        apr_thread_mutex_unlock(export_mutex);
+    }
+#endif
+}
+
+static APR_INLINE void ring_lock(otlp_ring_t *ring)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(ring->mutex);
+#endif
+}
+
+static APR_INLINE void ring_unlock(otlp_ring_t *ring)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(ring->mutex);
+#endif
+}
+
+/*
+ * Formatting
+ */
+
+static APR_INLINE char *put(char *d, const char *s, apr_size_t len)
+{
+    memcpy(d, s, len);
+    return d + len;
+}
+#define PUT_LIT(d, s) put(d, s, sizeof(s) - 1)
+
+/* A JSON string's content, at most max bytes of it (escapes are not cut),
+ * the bytes which are not printable ASCII escaped as code points so that
+ * the output is always valid.
+ */
+static char *put_escaped(char *d, const char *s, apr_size_t max)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *c;
+    char *end = d + max;
+
+    for (c = (const unsigned char *)s; *c; ++c) {
+        if (*c >= 0x20 && *c < 0x7f && *c != '"' && *c != '\\') {
+            if (d == end) {
+                break;
+            }
+            *d++ = *c;
+        }
+        else if (*c == '"' || *c == '\\') {
+            if (end - d < 2) {
+                break;
+            }
+            *d++ = '\\';
+            *d++ = *c;
+        }
+        else {
+            if (end - d < 6) {
+                break;
+            }
+            d = PUT_LIT(d, "\\u00");
+            *d++ = hex[*c >> 4];
+            *d++ = hex[*c & 0xf];
+        }
+    }
+    return d;
+}
+
+static char *put_hex(char *d, const unsigned char *id, apr_size_t len)
+{
+    ap_bin2hex(id, len, d);
+    return d + 2 * len;
+}
+
+static char *put_time(char *d, apr_time_t t)
+{
+    /* nanoseconds, as a string (a 64-bit integer) */
+    d += apr_snprintf(d, 24, "%" APR_TIME_T_FMT "000", t);
+    return d;
+}
+
+/* The attributes are written one after the other in the array, the first
+ * one without a comma.
+ */
+static char *put_attr_str(char *d, const char *key, const char *val,
+                          apr_size_t max)
+{
+    if (!val) {
+        return d;
+    }
+    if (d[-1] != '[') {
+        *d++ = ',';
+    }
+    d = PUT_LIT(d, "{\"key\":\"");
+    d = put(d, key, strlen(key));
+    d = PUT_LIT(d, "\",\"value\":{\"stringValue\":\"");
+    d = put_escaped(d, val, max);
+    return PUT_LIT(d, "\"}}");
+}
+
+static char *put_attr_int(char *d, const char *key, int val)
+{
+    if (d[-1] != '[') {
+        *d++ = ',';
+    }
+    d = PUT_LIT(d, "{\"key\":\"");
+    d = put(d, key, strlen(key));
+    d = PUT_LIT(d, "\",\"value\":{\"intValue\":\"");
+    d += apr_snprintf(d, 12, "%d", val);
+    return PUT_LIT(d, "\"}}");
+}
+
+/* A span, at most OTLP_SPAN_MAX bytes */
+static char *format_span(char *d, request_rec *r, const ap_trace_span_t *span)
+{
+    static const unsigned char no_parent[AP_TRACE_SPAN_ID_LEN];
+    int error;
+
+    d = PUT_LIT(d, "{\"traceId\":\"");
+    d = put_hex(d, span->trace_id, AP_TRACE_ID_LEN);
+    d = PUT_LIT(d, "\",\"spanId\":\"");
+    d = put_hex(d, span->span_id, AP_TRACE_SPAN_ID_LEN);
+    if (memcmp(span->parent_id, no_parent, AP_TRACE_SPAN_ID_LEN)) {
+        d = PUT_LIT(d, "\",\"parentSpanId\":\"");
+        d = put_hex(d, span->parent_id, AP_TRACE_SPAN_ID_LEN);
+    }
+    d = PUT_LIT(d, "\",\"name\":\"");
+    d = put_escaped(d, span->name ? span->name : "", OTLP_NAME_MAX);
+    d = PUT_LIT(d, "\",\"kind\":");
+    *d++ = '0' + span->kind;
+    d = PUT_LIT(d, ",\"startTimeUnixNano\":\"");
+    d = put_time(d, span->start);
+    d = PUT_LIT(d, "\",\"endTimeUnixNano\":\"");
+    d = put_time(d, span->end);
+    d = PUT_LIT(d, "\",\"attributes\":[");
+
+    switch (span->kind) {
+    case AP_TRACE_SPAN_SERVER:
+        d = put_attr_str(d, "http.request.method", span->name, OTLP_SHORT_MAX);
+        d = put_attr_str(d, "http.target", span->target, OTLP_TARGET_MAX);
+        d = put_attr_str(d, "server.address", r->hostname, OTLP_HOST_MAX);
+        d = put_attr_str(d, "client.address", r->useragent_ip,
+                         OTLP_SHORT_MAX);
+        error = span->status >= 500;
+        break;
+    case AP_TRACE_SPAN_CLIENT:
+        d = put_attr_str(d, "http.request.method", r->method, OTLP_SHORT_MAX);
+        d = put_attr_str(d, "url.full", span->target, OTLP_TARGET_MAX);
+        error = span->status >= 400;
+        break;
+    default:
+        d = put_attr_str(d, "httpd.target", span->target, OTLP_TARGET_MAX);
+        error = span->status >= 400;
+        break;
+    }
+    d = put_attr_str(d, "httpd.outcome", span->outcome, OTLP_SHORT_MAX);
+    if (span->status) {
+        d = put_attr_int(d, "http.response.status_code", span->status);
+    }
+    *d++ = ']';
+
+    if (error) {
+        d = PUT_LIT(d, ",\"status\":{\"code\":2}");
+    }
+    *d++ = '}';
+    return d;
+}
+
+/*
+ * Export
+ */
+
+#if APR_HAVE_SYS_UN_H
+static apr_status_t export_connect(void)
+{
+    struct sockaddr_un sa;
+    apr_os_sock_t rawsock;
+    apr_socket_t *sock;
+    apr_status_t rv;
+    int ret;
+
+    apr_pool_clear(sock_pool);
+    rv = apr_socket_create(&sock, AF_UNIX, SOCK_STREAM, 0, sock_pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_os_sock_get(&rawsock, sock);
+    if (rv != APR_SUCCESS) {
+        apr_socket_close(sock);
+        return rv;
+    }
+
+    /* Non-blocking, from the connect on: a collector which is behind
+     * (or stuck) must not hold the threads, they all export through this
+     * socket.
+     */
+    apr_socket_timeout_set(sock, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    apr_cpystrn(sa.sun_path, export_sock_path, sizeof(sa.sun_path));
+    do {
+        ret = connect(rawsock, (struct sockaddr *)&sa, sizeof(sa));
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        rv = errno;
+        apr_socket_close(sock);
+        return rv;
+    }
+
+    export_sock = sock;
+    return APR_SUCCESS;
+}
+#endif
+
+/* Called with the mutex held */
+static apr_status_t export_send(struct iovec *vec, int nvec)
+{
+#if APR_HAVE_SYS_UN_H
+    apr_status_t rv;
+    apr_size_t n;
+    int sent = 0;
+
+    if (!export_sock && (rv = export_connect()) != APR_SUCCESS) {
+        return rv;
+    }
+    while (nvec) {
+        rv = apr_socket_sendv(export_sock, vec, nvec, &n);
+        if (rv != APR_SUCCESS) {
+            /* When the collector is behind (the socket's buffer is full)
+             * the batch is dropped.  Once half sent, or on an error, the
+             * collector sees a truncated line, and a new connection for
+             * the next batch.
+             */
+            if (sent || !APR_STATUS_IS_EAGAIN(rv)) {
+                apr_socket_close(export_sock);
+                export_sock = NULL;
+            }
+            return rv;
+        }
+        sent = 1;
+        while (nvec && n >= vec->iov_len) {
+            n -= vec->iov_len;
+            ++vec;
+            --nvec;
+        }
+        if (nvec) {
+            vec->iov_base = (char *)vec->iov_base + n;
+            vec->iov_len -= n;
+        }
+    }
+    return APR_SUCCESS;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
+/* Write a batch of spans: the resource's and scope's head, the spans, and
+ * the end of the document, at once.
+ */
+static void export_spans(const char *spans, apr_size_t len, int count)
+{
+    struct iovec vec[3];
+    apr_size_t written;
+    apr_status_t rv;
+
+    vec[0] = batch_head;
+    vec[1].iov_base = (void *)spans;
+    vec[1].iov_len = len;
+    vec[2].iov_base = "]}]}]}\n";
+    vec[2].iov_len = 7;
+
+    if (export_file) {
+        /* Unbuffered, in append mode: each batch is a single write */
+        rv = apr_file_writev_full(export_file, vec, 3, &written);
+    }
+    else {
+        export_lock();
+        rv = export_send(vec, 3);
+        export_unlock();
+    }
+
+    /* Log the failures (and the batches dropped) once, until the export
+     * works again */
+    if (rv != APR_SUCCESS) {
+        if (!export_failing) {
+            export_failing = 1;
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, ap_server_conf,
+                         APLOGNO(10186) "could not export %d spans to %s",
+                         count, export_file ? export_path : export_sock_path);
+        }
+    }
+    else {
+        export_failing = 0;
+    }
+}
+
+static void flush_ring(otlp_ring_t *ring)
+{
+    if (ring->count) {
+        export_spans(ring->buf, ring->len, ring->count);
+        ring->len = 0;
+        ring->count = 0;
+    }
+}
+
+#if APR_HAS_THREADS
+/* The thread exits: flush its ring and make it available for another */
+static apr_status_t release_ring(void *data)
+{
+    otlp_ring_t *ring = data;
+
+    if (export_active) {
+        ring_lock(ring);
+        flush_ring(ring);
+        ring_unlock(ring);
+        export_lock();
+        ring->next = free_rings;
+        free_rings = ring;
+        export_unlock();
+    }
+    return APR_SUCCESS;
+}
+
+static otlp_ring_t *get_ring(conn_rec *c)
+{
+    apr_thread_t *thd = c->current_thread;
+    otlp_ring_t *ring = NULL;
+
+    if (!thd) {
+        return NULL;
+    }
+    apr_thread_data_get((void **)&ring, OTLP_RING_KEY, thd);
+    if (!ring) {
+        export_lock();
+        if (free_rings) {
+            ring = free_rings;
+            free_rings = ring->next;
+        }
+        else {
+            apr_thread_mutex_t *mutex;
+
+            if (apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT,
+                                        export_pool) != APR_SUCCESS) {
+                export_unlock();
+                return NULL;
+            }
+            ring = apr_pcalloc(export_pool, sizeof(*ring));
+            ring->mutex = mutex;
+            ring->size = (apr_size_t)export_batch * OTLP_SPAN_AVG;
+            if (ring->size < 2 * OTLP_SPAN_MAX) {
+                ring->size = 2 * OTLP_SPAN_MAX;
+            }
+            ring->buf = apr_palloc(export_pool, ring->size);
+            ring->all = all_rings;
+            all_rings = ring;
+        }
+        export_unlock();
+        apr_thread_data_set(ring, OTLP_RING_KEY, release_ring, thd);
+    }
+    return ring;
+}
+#else
+static otlp_ring_t *get_ring(conn_rec *c)
+{
+    if (!all_rings) {
+        otlp_ring_t *ring = apr_pcalloc(export_pool, sizeof(*ring));
+
+        ring->size = (apr_size_t)export_batch * OTLP_SPAN_AVG;
+        if (ring->size < 2 * OTLP_SPAN_MAX) {
+            ring->size = 2 * OTLP_SPAN_MAX;
+        }
+        ring->buf = apr_palloc(export_pool, ring->size);
+        all_rings = ring;
+    }
+    return all_rings;
+}
+#endif
+
+static void otlp_trace_span(request_rec *r, const ap_trace_span_t *span)
+{
+    otlp_ring_t *ring;
+
+    if (!export_active) {
+        return;
+    }
+
+    ring = get_ring(r->connection);
+    if (!ring) {
+        /* A thread unknown to the MPM (or no ring could be made for it),
+         * export the span on its own */
+        char buf[OTLP_SPAN_MAX];
+
+        export_spans(buf, format_span(buf, r, span) - buf, 1);
+        return;
+    }
+
+    ring_lock(ring);
+    if (ring->count) {
+        ring->buf[ring->len++] = ',';
+    }
+    else {
+        ring->oldest = span->end;
+    }
+    ring->len = format_span(ring->buf + ring->len, r, span) - ring->buf;
+    ring->count++;
+
+    /* Room is kept for the next span (and its comma) */
+    if (ring->count >= export_batch
+        || ring->size - ring->len <= OTLP_SPAN_MAX
+        || span->end - ring->oldest >= export_interval) {
+        flush_ring(ring);
+    }
+    ring_unlock(ring);
+}
+
+#if APR_HAS_THREADS
+/* The flush thread of the child: every half interval, export the spans
+ * which waited long enough in the rings of the threads which are idle.
+ */
+static void * APR_THREAD_FUNC flush_thread_main(apr_thread_t *thd,
+                                                void *data)
+{
+    apr_interval_time_t period = export_interval / 2;
+    otlp_ring_t *ring;
+    apr_time_t now;
+
+    if (period < OTLP_FLUSH_PERIOD_MIN) {
+        period = OTLP_FLUSH_PERIOD_MIN;
+    }
+
+    apr_thread_mutex_lock(export_mutex);
+    while (!flush_stop) {
+        apr_thread_cond_timedwait(flush_cond, export_mutex, period);
+        if (flush_stop) {
+            break;
+        }
+        ring = all_rings;
+        apr_thread_mutex_unlock(export_mutex);
+
+        /* The rings are never removed from the list (before the thread is
+         * stopped), and a thread recording a span checks the age itself.
+         */
+        now = apr_time_now();
+        for (; ring; ring = ring->all) {
+            if (apr_thread_mutex_trylock(ring->mutex) == APR_SUCCESS) {
+                if (ring->count && now - ring->oldest >= export_interval) {
+                    flush_ring(ring);
+                }
+                apr_thread_mutex_unlock(ring->mutex);
+            }
+        }
+
+        apr_thread_mutex_lock(export_mutex);
+    }
+    apr_thread_mutex_unlock(export_mutex);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+#endif
+
+/*
+ * Hooks and configuration
+ */
+
+static int otlp_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                           apr_pool_t *ptemp)
+{
+    export_path = NULL;
+    export_sock_path = NULL;
+    export_batch = OTLP_BATCH_DEFAULT;
+    export_interval = OTLP_INTERVAL_DEFAULT;
+    export_service = "httpd";
+    export_file = NULL;
+    export_active = 0;
+    return OK;
+}
+
+/* The file is opened by the parent, before the children switch to the
+ * user they run as (like the other logs).
+ */
+static int otlp_open_logs(apr_pool_t *pconf, apr_pool_t *plog,
+                          apr_pool_t *ptemp, server_rec *s)
+{
+    apr_status_t rv;
+
+    if (!export_path) {
+        return OK;
+    }
+    rv = apr_file_open(&export_file, export_path,
+                       APR_FOPEN_WRITE | APR_FOPEN_APPEND | APR_FOPEN_CREATE,
+                       APR_OS_DEFAULT, pconf);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10187)
+                     "could not open the trace export file %s", export_path);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    return OK;
+}
+
+/* The child exits: stop the flush thread, then flush what is left in the
+ * rings.  This runs before the subpools of the child (the flush thread's)
+ * and the mutexes of the rings are destroyed.
+ */
+static apr_status_t otlp_child_exit(void *data)
+{
+    otlp_ring_t *ring;
+
+#if APR_HAS_THREADS
+    if (flush_thread) {
+        apr_status_t rv;
+
+        apr_thread_mutex_lock(export_mutex);
+        flush_stop = 1;
+        apr_thread_cond_signal(flush_cond);
+        apr_thread_mutex_unlock(export_mutex);
+        apr_thread_join(&rv, flush_thread);
+        flush_thread = NULL;
+    }
+#endif
+
+    for (ring = all_rings; ring; ring = ring->all) {
+        flush_ring(ring);
+    }
+    export_active = 0;
+    all_rings = free_rings = NULL;
+    return APR_SUCCESS;
+}
+
+static void otlp_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    char *head, *d;
+    apr_size_t len;
+
+    if (!export_file && !export_sock_path) {
+        return;
+    }
+
+    export_pool = pchild;
+    apr_pool_create(&sock_pool, pchild);
+    apr_pool_tag(sock_pool, "otlp_sock");
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&export_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                pchild) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(10188)
+                     "could not create the trace export mutex, "
+                     "spans will not be exported");
+        return;
+    }
+#endif
+
+    /* The head of each batch, with the resource's attributes */
+    len = strlen(export_service) * 6 + strlen(s->server_hostname) * 6 + 512;
+    d = head = apr_palloc(pchild, len);
+    d = PUT_LIT(d, "{\"resourceSpans\":[{\"resource\":{\"attributes\":[");
+    d = put_attr_str(d, "service.name", export_service, len);
+    d = put_attr_str(d, "host.name", s->server_hostname, len);
+    d = PUT_LIT(d, "]},\"scopeSpans\":[{\"scope\":{\"name\":\"httpd\","
+                   "\"version\":\"" AP_SERVER_BASEREVISION "\"},\"spans\":[");
+    batch_head.iov_base = head;
+    batch_head.iov_len = d - head;
+
+    all_rings = free_rings = NULL;
+    export_sock = NULL;
+    export_failing = 0;
+    export_active = 1;
+    apr_pool_pre_cleanup_register(pchild, NULL, otlp_child_exit);
+
+#if APR_HAS_THREADS
+    /* Without an interval each span is exported once recorded */
+    flush_thread = NULL;
+    flush_stop = 0;
+    if (export_interval > 0
+        && (apr_thread_cond_create(&flush_cond, pchild) != APR_SUCCESS
+            || apr_thread_create(&flush_thread, NULL, flush_thread_main,
+                                 NULL, pchild) != APR_SUCCESS)) {
+        flush_thread = NULL;
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10193)
+                     "could not start the trace export flush thread, the "
+                     "spans of the idle threads will wait for the next ones "
+                     "to be exported");
+    }
+#endif
+}
+
+static const char *set_export(cmd_parms *cmd, void *dummy, const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err) {
+        return err;
+    }
+    if (!strncmp(arg, "unix:", 5)) {
+#if APR_HAVE_SYS_UN_H
+        struct sockaddr_un sa;
+
+        export_sock_path = ap_runtime_dir_relative(cmd->pool, arg + 5);
+        if (!export_sock_path
+            || strlen(export_sock_path) >= sizeof(sa.sun_path)) {
+            return apr_pstrcat(cmd->pool, "Invalid TraceExport socket path ",
+                               arg + 5, NULL);
+        }
+        export_path = NULL;
+#else
+        return "TraceExport to a Unix domain socket is not supported on "
+               "this platform";
+#endif
+    }
+    else {
+        export_path = ap_server_root_relative(cmd->pool, arg);
+        if (!export_path) {
+            return apr_pstrcat(cmd->pool, "Invalid TraceExport file path ",
+                               arg, NULL);
+        }
+        export_sock_path = NULL;
+    }
+    return NULL;
+}
+
+static const char *set_export_batch(cmd_parms *cmd, void *dummy,
+                                    const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err) {
+        return err;
+    }
+    export_batch = atoi(arg);
+    if (export_batch < 1 || export_batch > 4096) {
+        return "TraceExportBatch must be between 1 and 4096";
+    }
+    return NULL;
+}
+
+static const char *set_export_interval(cmd_parms *cmd, void *dummy,
+                                       const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_interval_time_t interval;
+
+    if (err) {
+        return err;
+    }
+    if (ap_timeout_parameter_parse(arg, &interval, "s") != APR_SUCCESS
+        || interval < 0) {
+        return "TraceExportInterval must be a duration (default unit: "
+               "seconds)";
+    }
+    export_interval = interval;
+    return NULL;
+}
+
+static const char *set_export_service(cmd_parms *cmd, void *dummy,
+                                      const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err) {
+        return err;
+    }
+    export_service = arg;
+    return NULL;
+}
+
+static const command_rec log_otlp_cmds[] =
+{
+    AP_INIT_TAKE1("TraceExport", set_export, NULL, RSRC_CONF,
+        "The file, or unix:/path of the socket, to export the spans to"),
+    AP_INIT_TAKE1("TraceExportBatch", set_export_batch, NULL, RSRC_CONF,
+        "The number of spans a thread exports at once (default 64)"),
+    AP_INIT_TAKE1("TraceExportInterval", set_export_interval, NULL, RSRC_CONF,
+        "The age at which the spans are exported (default 5s), "
+        "checked every half of it"),
+    AP_INIT_TAKE1("TraceExportService", set_export_service, NULL, RSRC_CONF,
+        "The service.name of the spans exported (default httpd)"),
+    {NULL}
+};
+
+static void register_hooks(apr_pool_t *p)
+{
+    ap_hook_pre_config(otlp_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_open_logs(otlp_open_logs, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(otlp_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_trace_span(otlp_trace_span, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(log_otlp) =
+{
+    STANDARD20_MODULE_STUFF,
+    NULL,                       /* create per-dir config */
+    NULL,                       /* merge per-dir config */
+    NULL,                       /* server config */
+    NULL,                       /* merge server config */
+    log_otlp_cmds,              /* command apr_table_t */
+    register_hooks              /* register hooks */
+};
@@ -22,6 +22,7 @@
 APLOG_USE_MODULE(lua);
 static APR_OPTIONAL_FN_TYPE(ap_dbd_close) *lua_ap_dbd_close = NULL;
 static APR_OPTIONAL_FN_TYPE(ap_dbd_open) *lua_ap_dbd_open = NULL;
+static APR_OPTIONAL_FN_TYPE(ap_dbd_prepared) *lua_ap_dbd_prepared = NULL;
 
 
 
@@ -630,8 +631,16 @@ int lua_db_prepared(lua_State* L)
         tag = lua_tostring(L, 3);
         
         /* Look for the statement */
-        pstatement = apr_hash_get(db->dbdhandle->prepared, tag, 
-                APR_HASH_KEY_STRING);
+        if (lua_ap_dbd_prepared == NULL) {
+            lua_ap_dbd_prepared = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_prepared);
+        }
+        if (lua_ap_dbd_prepared != NULL) {
+            pstatement = lua_ap_dbd_prepared(db->dbdhandle, tag);
+        }
+        else {
+            pstatement = apr_hash_get(db->dbdhandle->prepared, tag,
+                    APR_HASH_KEY_STRING);
+        }
         
         if (pstatement == NULL) {
             lua_pushnil(L);
@@ -25,6 +25,10 @@
 #include "apr_strings.h"
 #include "apr_file_io.h"
 #include "apr_lib.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -48,6 +52,7 @@
 typedef struct {
     int forcelangpriority;
     apr_array_header_t *language_priority;
+    int multiviews_cache;       /* -1 if unset */
 } neg_dir_config;
 
 /* forcelangpriority flags
@@ -73,6 +78,7 @@ static void *create_neg_dir_config(apr_pool_t *p, char *dummy)
 
     new->forcelangpriority = FLP_UNDEF;
     new->language_priority = NULL;
+    new->multiviews_cache = -1;
     return new;
 }
 
@@ -90,6 +96,9 @@ static void *merge_neg_dir_configs(apr_pool_t *p, void *basev, void *addv)
     new->language_priority = add->language_priority
                                 ? add->language_priority
                                 : base->language_priority;
+    new->multiviews_cache = (add->multiviews_cache != -1)
+                                ? add->multiviews_cache
+                                : base->multiviews_cache;
     return new;
 }
 
@@ -139,6 +148,14 @@ static const char *set_force_priority(cmd_parms *cmd, void *n_, const char *w)
     return NULL;
 }
 
+static const char *set_multiviews_cache(cmd_parms *cmd, void *n_, int arg)
+{
+    neg_dir_config *n = n_;
+
+    n->multiviews_cache = arg;
+    return NULL;
+}
+
 static const char *cache_negotiated_docs(cmd_parms *cmd, void *dummy,
                                          int arg)
 {
@@ -164,6 +181,10 @@ static const command_rec negotiation_cmds[] =
                     OR_FILEINFO,
                     "Force LanguagePriority elections, either None, or "
                     "Fallback and/or Prefer"),
+    AP_INIT_FLAG("MultiviewsCache", set_multiviews_cache, NULL,
+                 RSRC_CONF|ACCESS_CONF,
+                 "Either 'on' to remember the variants found by MultiViews "
+                 "until their directory changes, or 'off' (default)"),
     {NULL}
 };
 
@@ -208,6 +229,7 @@ typedef struct var_rec {
     apr_array_header_t *content_languages; /* list of lang. for this variant */
     const char *content_charset;
     const char *description;
+    const char *handler;        /* handler of the MultiViews variant */
 
     /* The next five items give the quality values for the dimensions
      * of negotiation for this variant. They are obtained from the
@@ -286,6 +308,7 @@ static void clean_var_rec(var_rec *mime_info)
     mime_info->content_languages = NULL;
     mime_info->content_charset = "";
     mime_info->description = "";
+    mime_info->handler = NULL;
 
     mime_info->is_pseudo_html = 0;
     mime_info->level = 0.0f;
@@ -335,6 +358,189 @@ static void set_vlist_validator(request_rec *r, request_rec *vlistr)
      */
 }
 
+/*****************************************************************
+ *
+ * Caching the variants, per process.
+ *
+ * Type maps are parsed once and their variants kept until the map file
+ * changes (mtime or size).  With MultiviewsCache, the variants found by
+ * MultiViews (the type, language, encoding etc. of each file, as the
+ * subrequests found them) are kept until the directory changes (mtime),
+ * so that negotiating them doesn't take a directory scan and a
+ * subrequest per file; the chosen variant still gets its subrequest.
+ *
+ * An entry is referenced by the cache and by each request using its
+ * variants, it's destroyed with the last reference once replaced.
+ */
+
+/* Entries beyond this number are not cached */
+#ifndef NEG_CACHE_MAX
+#define NEG_CACHE_MAX 1024
+#endif
+
+/* Don't trust an mtime this recent (seconds) to tell all the changes */
+#define NEG_CACHE_MIN_AGE 2
+
+typedef struct {
+    const char *key;
+    apr_pool_t *pool;
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_array_header_t *vars;   /* var_recs, without sub_req */
+    int anymatch;               /* MultiViews: some files matched */
+    int has_body;               /* type map: some variants are in the map */
+    int refs;
+} neg_cache_entry;
+
+static apr_hash_t *neg_cache;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *neg_cache_mutex;
+#endif
+
+static void neg_cache_lock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(neg_cache_mutex);
+#endif
+}
+
+static void neg_cache_unlock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(neg_cache_mutex);
+#endif
+}
+
+static apr_status_t neg_cache_release(void *data)
+{
+    neg_cache_entry *entry = data;
+    int destroy;
+
+    neg_cache_lock();
+    destroy = (--entry->refs == 0);
+    neg_cache_unlock();
+
+    if (destroy) {
+        apr_pool_destroy(entry->pool);
+    }
+    return APR_SUCCESS;
+}
+
+/* Find a valid entry and reference it for the lifetime of r, or NULL */
+static neg_cache_entry *neg_cache_get(request_rec *r, const char *key,
+                                      apr_time_t mtime, apr_off_t size)
+{
+    neg_cache_entry *entry;
+
+    if (!neg_cache) {
+        return NULL;
+    }
+
+    neg_cache_lock();
+    entry = apr_hash_get(neg_cache, key, APR_HASH_KEY_STRING);
+    if (entry && (entry->mtime != mtime || entry->size != size)) {
+        entry = NULL;
+    }
+    if (entry) {
+        entry->refs++;
+    }
+    neg_cache_unlock();
+
+    if (entry) {
+        apr_pool_cleanup_register(r->pool, entry, neg_cache_release,
+                                  apr_pool_cleanup_null);
+    }
+    return entry;
+}
+
+/* Copy the variants in a new entry, and (re)place it in the cache */
+static void neg_cache_set(request_rec *r, const char *key,
+                          apr_time_t mtime, apr_off_t size,
+                          apr_array_header_t *vars, int multi, int anymatch)
+{
+    neg_cache_entry *entry, *old;
+    var_rec *src;
+    apr_pool_t *p;
+    int i, j;
+
+    if (!neg_cache
+        || apr_time_sec(r->request_time) - apr_time_sec(mtime)
+           < NEG_CACHE_MIN_AGE) {
+        return;
+    }
+    if (apr_pool_create(&p, NULL) != APR_SUCCESS) {
+        return;
+    }
+    apr_pool_tag(p, "negotiation_cache");
+
+    entry = apr_pcalloc(p, sizeof(*entry));
+    entry->key = apr_pstrdup(p, key);
+    entry->pool = p;
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->refs = 1;
+    entry->anymatch = anymatch;
+    entry->vars = apr_array_make(p, vars->nelts ? vars->nelts : 1,
+                                 sizeof(var_rec));
+
+    src = (var_rec *)vars->elts;
+    for (i = 0; i < vars->nelts; ++i) {
+        var_rec *var = (var_rec *)apr_array_push(entry->vars);
+
+        *var = src[i];
+        var->sub_req = NULL;
+        var->mime_type = apr_pstrdup(p, var->mime_type);
+        var->file_name = apr_pstrdup(p, var->file_name);
+        var->content_encoding = apr_pstrdup(p, var->content_encoding);
+        var->content_charset = apr_pstrdup(p, var->content_charset);
+        var->description = apr_pstrdup(p, var->description);
+        var->handler = apr_pstrdup(p, var->handler);
+        if (var->content_languages) {
+            apr_array_header_t *langs = var->content_languages;
+
+            var->content_languages = apr_array_make(p, langs->nelts
+                                                       ? langs->nelts : 1,
+                                                    sizeof(char *));
+            for (j = 0; j < langs->nelts; ++j) {
+                APR_ARRAY_PUSH(var->content_languages, const char *) =
+                    apr_pstrdup(p, APR_ARRAY_IDX(langs, j, const char *));
+            }
+        }
+        if (multi) {
+            /* the files may change without their directory changing */
+            var->bytes = -1;
+        }
+        else if (var->body) {
+            entry->has_body = 1;
+        }
+    }
+
+    neg_cache_lock();
+    old = apr_hash_get(neg_cache, key, APR_HASH_KEY_STRING);
+    if (old || apr_hash_count(neg_cache) < NEG_CACHE_MAX) {
+        if (old) {
+            /* the hash would keep the old key */
+            apr_hash_set(neg_cache, old->key, APR_HASH_KEY_STRING, NULL);
+        }
+        apr_hash_set(neg_cache, entry->key, APR_HASH_KEY_STRING, entry);
+        entry = NULL;
+        if (old && --old->refs) {
+            old = NULL;
+        }
+    }
+    else {
+        old = NULL;
+    }
+    neg_cache_unlock();
+
+    if (old) {
+        apr_pool_destroy(old->pool);
+    }
+    if (entry) {
+        apr_pool_destroy(p);
+    }
+}
+
 
 /*****************************************************************
  *
@@ -562,12 +768,61 @@ static apr_array_header_t *do_languages_line(apr_pool_t *p,
  * Handling header lines from clients...
  */
 
+/* The Accept* header lines are usually the same for all the requests of a
+ * connection, so the last ones parsed (and their accept_recs) are kept
+ * with the connection, up to NEG_ACCEPT_PARSE_MAX different lines each.
+ */
+#define NEG_ACCEPT_PARSE_MAX 8
+
+enum {
+    NEG_ACCEPT, NEG_ACCEPT_ENCODING, NEG_ACCEPT_LANGUAGE, NEG_ACCEPT_CHARSET,
+    NEG_ACCEPT_HEADERS
+};
+
+static const char *const neg_accept_headers[NEG_ACCEPT_HEADERS] = {
+    "Accept", "Accept-Encoding", "Accept-Language", "Accept-Charset"
+};
+
+typedef struct {
+    const char *lines[NEG_ACCEPT_HEADERS];
+    apr_array_header_t *recs[NEG_ACCEPT_HEADERS];
+    int parsed[NEG_ACCEPT_HEADERS];
+} neg_conn_config;
+
+/* The (read only) accept_recs of a header line of r */
+static apr_array_header_t *do_accept_header_line(request_rec *r, int which)
+{
+    conn_rec *c = r->connection;
+    neg_conn_config *ncc;
+    const char *line = apr_table_get(r->headers_in, neg_accept_headers[which]);
+
+    if (!line) {
+        return NULL;
+    }
+
+    ncc = ap_get_module_config(c->conn_config, &negotiation_module);
+    if (!ncc) {
+        ncc = apr_pcalloc(c->pool, sizeof(*ncc));
+        ap_set_module_config(c->conn_config, &negotiation_module, ncc);
+    }
+    if (ncc->lines[which] && !strcmp(ncc->lines[which], line)) {
+        return ncc->recs[which];
+    }
+    if (ncc->parsed[which] >= NEG_ACCEPT_PARSE_MAX) {
+        return do_header_line(r->pool, line);
+    }
+
+    ncc->parsed[which]++;
+    ncc->lines[which] = apr_pstrdup(c->pool, line);
+    ncc->recs[which] = do_header_line(c->pool, line);
+    return ncc->recs[which];
+}
+
 static negotiation_state *parse_accept_headers(request_rec *r)
 {
     negotiation_state *new =
         (negotiation_state *) apr_pcalloc(r->pool, sizeof(negotiation_state));
     accept_rec *elts;
-    apr_table_t *hdrs = r->headers_in;
     int i;
 
     new->pool = r->pool;
@@ -577,7 +832,11 @@ static negotiation_state *parse_accept_headers(request_rec *r)
 
     new->dir_name = ap_make_dirstr_parent(r->pool, r->filename);
 
-    new->accepts = do_header_line(r->pool, apr_table_get(hdrs, "Accept"));
+    /* copied, maybe_add_default_accepts() adds to it */
+    new->accepts = do_accept_header_line(r, NEG_ACCEPT);
+    if (new->accepts) {
+        new->accepts = apr_array_copy(r->pool, new->accepts);
+    }
 
     /* calculate new->accept_q value */
     if (new->accepts) {
@@ -590,12 +849,9 @@ static negotiation_state *parse_accept_headers(request_rec *r)
         }
     }
 
-    new->accept_encodings =
-        do_header_line(r->pool, apr_table_get(hdrs, "Accept-Encoding"));
-    new->accept_langs =
-        do_header_line(r->pool, apr_table_get(hdrs, "Accept-Language"));
-    new->accept_charsets =
-        do_header_line(r->pool, apr_table_get(hdrs, "Accept-Charset"));
+    new->accept_encodings = do_accept_header_line(r, NEG_ACCEPT_ENCODING);
+    new->accept_langs = do_accept_header_line(r, NEG_ACCEPT_LANGUAGE);
+    new->accept_charsets = do_accept_header_line(r, NEG_ACCEPT_CHARSET);
 
     /* This is possibly overkill for some servers, heck, we have
      * only 33 index.html variants in docs/docroot (today).
@@ -941,6 +1197,10 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
     enum header_state hstate;
     struct var_rec mime_info;
     int has_content;
+    int want_map = (map != NULL);
+    int cacheable, parse_error = 0;
+    const char *key = NULL;
+    neg_cache_entry *entry = NULL;
 
     if (!map)
         map = &map_;
@@ -948,6 +1208,20 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
     /* We are not using multiviews */
     neg->count_multiviews_variants = 0;
 
+    cacheable = ((rr->finfo.valid & (APR_FINFO_MTIME | APR_FINFO_SIZE))
+                 == (APR_FINFO_MTIME | APR_FINFO_SIZE));
+    if (cacheable) {
+        key = apr_pstrcat(neg->pool, "T", rr->filename, NULL);
+        entry = neg_cache_get(r, key, rr->finfo.mtime, rr->finfo.size);
+    }
+
+    /* The map file is needed only to serve the variants it contains */
+    if (entry && !(want_map && entry->has_body)) {
+        apr_array_cat(neg->avail_vars, entry->vars);
+        set_vlist_validator(r, rr);
+        return OK;
+    }
+
     if ((status = apr_file_open(map, rr->filename, APR_READ | APR_BUFFERED,
                 APR_OS_DEFAULT, neg->pool)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00683)
@@ -960,6 +1234,12 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
         }
     }
 
+    if (entry) {
+        apr_array_cat(neg->avail_vars, entry->vars);
+        set_vlist_validator(r, rr);
+        return OK;
+    }
+
     clean_var_rec(&mime_info);
     has_content = 0;
 
@@ -998,6 +1278,7 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
                                   "Parse error in type map, Content-Length: "
                                   "'%s' in %s is invalid.",
                                   body1, r->filename);
+                    parse_error = 1;
                     break;
                 }
                 mime_info.bytes = number;
@@ -1033,6 +1314,7 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
                                   "Syntax error in type map, no end tag '%s' "
                                   "found in %s for Body: content.",
                                   tag, r->filename);
+                     parse_error = 1;
                      break;
                 }
                 mime_info.bytes = len;
@@ -1054,6 +1336,11 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
     if (map_)
         apr_file_close(map_);
 
+    if (cacheable && !parse_error) {
+        neg_cache_set(r, key, rr->finfo.mtime, rr->finfo.size,
+                      neg->avail_vars, 0, 0);
+    }
+
     set_vlist_validator(r, rr);
 
     return OK;
@@ -1096,6 +1383,8 @@ static int read_types_multi(negotiation_state *neg)
     struct accept_rec accept_info;
     void *new_var;
     int anymatch = 0;
+    const char *key = NULL;
+    apr_finfo_t dirinfo;
 
     clean_var_rec(&mime_info);
 
@@ -1111,6 +1400,25 @@ static int read_types_multi(negotiation_state *neg)
     ++filp;
     prefix_len = strlen(filp);
 
+    /* The variants found last time, if the directory didn't change
+     * (per server, their configuration may differ)
+     */
+    if (neg->conf->multiviews_cache > 0
+        && apr_stat(&dirinfo, neg->dir_name, APR_FINFO_MTIME,
+                    neg->pool) == APR_SUCCESS) {
+        neg_cache_entry *entry;
+
+        key = apr_psprintf(neg->pool, "M%pp:%s", r->server, r->filename);
+        entry = neg_cache_get(r, key, dirinfo.mtime, 0);
+        if (entry) {
+            apr_array_cat(neg->avail_vars, entry->vars);
+            neg->count_multiviews_variants = entry->vars->nelts;
+            anymatch = entry->anymatch;
+            key = NULL;
+            goto found;
+        }
+    }
+
     if ((status = apr_dir_open(&dirp, neg->dir_name,
                                neg->pool)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00686)
@@ -1260,6 +1568,7 @@ static int read_types_multi(negotiation_state *neg)
 
         mime_info.sub_req = sub_req;
         mime_info.file_name = apr_pstrdup(neg->pool, dirent.name);
+        mime_info.handler = sub_req->handler;
         if (sub_req->content_encoding) {
             mime_info.content_encoding = sub_req->content_encoding;
         }
@@ -1280,6 +1589,7 @@ static int read_types_multi(negotiation_state *neg)
 
     apr_dir_close(dirp);
 
+found:
     /* We found some file names that matched.  None could be served.
      * Rather than fall out to autoindex or some other mapper, this
      * request must die.
@@ -1289,6 +1599,9 @@ static int read_types_multi(negotiation_state *neg)
                       "Negotiation: discovered file(s) matching request: %s"
                       " (None could be negotiated).",
                       r->filename);
+        if (key) {
+            neg_cache_set(r, key, dirinfo.mtime, 0, neg->avail_vars, 1, 1);
+        }
         return HTTP_NOT_FOUND;
     }
 
@@ -1305,6 +1618,10 @@ static int read_types_multi(negotiation_state *neg)
     qsort((void *) neg->avail_vars->elts, neg->avail_vars->nelts,
           sizeof(var_rec), (int (*)(const void *, const void *)) variantsortf);
 
+    if (key && anymatch) {
+        neg_cache_set(r, key, dirinfo.mtime, 0, neg->avail_vars, 1, 1);
+    }
+
     return OK;
 }
 
@@ -2575,7 +2892,7 @@ static void set_neg_headers(request_rec *r, negotiation_state *neg,
          * (without breaking things if the type map specifies a
          * content-length, which currently leads to the correct result).
          */
-        if (!(variant->sub_req && variant->sub_req->handler)
+        if (!variant->handler
             && (len = find_content_length(neg, variant)) >= 0) {
 
             *((const char **) apr_array_push(arr)) = " {length ";
@@ -3178,8 +3495,8 @@ static int fix_encoding(request_rec *r)
         enc += 2;
     }
 
-    if ((accept_encodings = do_header_line(r->pool,
-             apr_table_get(r->headers_in, "Accept-Encoding"))) == NULL) {
+    if ((accept_encodings = do_accept_header_line(r,
+                                                  NEG_ACCEPT_ENCODING)) == NULL) {
         return DECLINED;
     }
 
@@ -3206,8 +3523,26 @@ static int fix_encoding(request_rec *r)
     return DECLINED;
 }
 
+static void neg_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    rv = apr_thread_mutex_create(&neg_cache_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10184)
+                     "could not create the negotiation cache mutex, "
+                     "variants will not be cached");
+        return;
+    }
+#endif
+
+    neg_cache = apr_hash_make(p);
+}
+
 static void register_hooks(apr_pool_t *p)
 {
+    ap_hook_child_init(neg_child_init,NULL,NULL,APR_HOOK_MIDDLE);
     ap_hook_fixups(fix_encoding,NULL,NULL,APR_HOOK_MIDDLE);
     ap_hook_type_checker(handle_multi,NULL,NULL,APR_HOOK_FIRST);
     ap_hook_handler(handle_map_file,NULL,NULL,APR_HOOK_MIDDLE);
@@ -107,6 +107,7 @@
 
 static ap_dbd_t *(*dbd_acquire)(request_rec*) = NULL;
 static void (*dbd_prepare)(server_rec*, const char*, const char*) = NULL;
+static apr_dbd_prepared_t *(*dbd_prepared)(ap_dbd_t*, const char*) = NULL;
 static const char* really_last_key = "rewrite_really_last";
 
 /*
@@ -1405,7 +1406,7 @@ static char *lookup_map_dbd(request_rec *r, char *key, const char *label)
         return NULL;
    }
 
-    stmt = apr_hash_get(db->prepared, label, APR_HASH_KEY_STRING);
+    stmt = dbd_prepared(db, label);
 
     rv = apr_dbd_pvselect(db->driver, r->pool, db->handle, &res,
                           stmt, 0, key, NULL);
@@ -4515,6 +4516,7 @@ static int pre_config(apr_pool_t *pconf,
     }
     dbd_acquire = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_acquire);
     dbd_prepare = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_prepare);
+    dbd_prepared = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_prepared);
     return OK;
 }
 
@@ -73,6 +73,7 @@
 
 #include "apr_hash.h"
 #define APR_WANT_STRFUNC
+#define APR_WANT_IOVEC
 #include "apr_want.h"
 
 #include "httpd.h"
@@ -98,7 +99,8 @@ typedef enum {
     hdr_edit = 'r',             /* change value by regexp, match once */
     hdr_edit_r = 'R',           /* change value by regexp, everymatch */
     hdr_setifempty = 'i',       /* set value if header not already present*/
-    hdr_note = 'n'              /* set value of header in a note */
+    hdr_note = 'n',             /* set value of header in a note */
+    hdr_set_bulk = 'S'          /* set constant headers (consecutive sets) */
 } hdr_actions;
 
 /*
@@ -134,6 +136,8 @@ typedef struct {
     const char *subs;
     ap_expr_info_t *expr;
     ap_expr_info_t *expr_out;
+    const char *value;        /* constant value (or substitution), if any */
+    apr_table_t *bulk;        /* hdr_set_bulk's headers and values */
 } header_entry;
 
 /* echo_do is used for Header echo to iterate through the request headers*/
@@ -147,6 +151,7 @@ typedef struct {
     request_rec *r;
     header_entry *hdr;
     apr_table_t *t;
+    int changed;
 } edit_do;
 
 /*
@@ -392,6 +397,7 @@ static char *parse_format_string(cmd_parms *cmd, header_entry *hdr, const char *
 {
     apr_pool_t *p = cmd->pool;
     char *res;
+    int i;
 
     /* No string to parse with unset and echo commands */
     if (hdr->action == hdr_unset || hdr->action == hdr_echo) {
@@ -421,9 +427,31 @@ static char *parse_format_string(cmd_parms *cmd, header_entry *hdr, const char *
             return res;
         }
     }
+
+    /* Without format specifiers, the value is the same for all requests */
+    hdr->value = "";
+    for (i = 0; i < hdr->ta->nelts; ++i) {
+        format_tag *tag = &((format_tag *)hdr->ta->elts)[i];
+
+        if (tag->func != constant_item) {
+            hdr->value = NULL;
+            break;
+        }
+        hdr->value = apr_pstrcat(p, hdr->value, tag->arg, NULL);
+    }
     return NULL;
 }
 
+/* Whether hdr unconditionally sets a constant value, so that it can be
+ * applied along with its neighbours.
+ */
+static int is_constant_set(const header_entry *hdr)
+{
+    return hdr->action == hdr_set && hdr->value
+           && !hdr->condition_var && !hdr->expr
+           && ap_cstr_casecmp(hdr->header, "Content-Type");
+}
+
 /* handle RequestHeader and Header directive */
 static APR_INLINE const char *header_inout_cmd(cmd_parms *cmd,
                                                void *indirconf,
@@ -436,7 +464,8 @@ static APR_INLINE const char *header_inout_cmd(cmd_parms *cmd,
     headers_conf *dirconf = indirconf;
     const char *condition_var = NULL;
     const char *colon;
-    header_entry *new;
+    const char *err;
+    header_entry *new, *prev;
     ap_expr_info_t *expr = NULL;
 
     apr_array_header_t *fixup = (cmd->info == &hdr_in)
@@ -445,6 +474,8 @@ static APR_INLINE const char *header_inout_cmd(cmd_parms *cmd,
         : dirconf->fixup_out;
 
     new = (header_entry *) apr_array_push(fixup);
+    /* may be the slot of a folded entry */
+    memset(new, 0, sizeof(*new));
 
     if (!strcasecmp(action, "set"))
         new->action = hdr_set;
@@ -556,7 +587,27 @@ static APR_INLINE const char *header_inout_cmd(cmd_parms *cmd,
     new->condition_var = condition_var;
     new->expr = expr;
 
-    return parse_format_string(cmd, new, value);
+    if ((err = parse_format_string(cmd, new, value))) {
+        return err;
+    }
+
+    /* Fold consecutive constant sets into one entry, a security headers
+     * bundle is then a single list to go through.
+     */
+    if (fixup->nelts > 1 && is_constant_set(new)) {
+        prev = new - 1;
+        if (prev->action == hdr_set_bulk || is_constant_set(prev)) {
+            if (prev->action != hdr_set_bulk) {
+                prev->action = hdr_set_bulk;
+                prev->bulk = apr_table_make(cmd->pool, 8);
+                apr_table_addn(prev->bulk, prev->header, prev->value);
+            }
+            apr_table_addn(prev->bulk, new->header, new->value);
+            fixup->nelts--;
+        }
+    }
+
+    return NULL;
 }
 
 /* Handle all (xxx)Header directives */
@@ -601,13 +652,17 @@ static const char *header_cmd(cmd_parms *cmd, void *indirconf,
  * If the original value was prefixed with "expr=", processing is
  * handled instead by ap_expr.
  */
-static char* process_tags(header_entry *hdr, request_rec *r)
+static const char *process_tags(header_entry *hdr, request_rec *r)
 {
     int i;
     const char *s;
     char *str = NULL;
     format_tag *tag = NULL;
 
+    if (hdr->value) {
+        return hdr->value;
+    }
+
     if (hdr->expr_out) { 
         const char *err;
         const char *val;
@@ -635,35 +690,61 @@ static const char *process_regexp(header_entry *hdr, const char *value,
                                   request_rec *r)
 {
     ap_regmatch_t pmatch[AP_MAX_REG_MATCH];
+    const char *tags = NULL;
     const char *subs;
-    const char *remainder;
-    char *ret;
-    int diffsz;
-    if (ap_regexec(hdr->regex, value, AP_MAX_REG_MATCH, pmatch, 0)) {
+    const char *remainder = value;
+    apr_array_header_t *vec = NULL;
+    struct iovec *iov;
+
+    /* Edit the first match, or all of them with edit*, each time matching
+     * the regex against the remainder of the value.
+     */
+    while (!ap_regexec(hdr->regex, remainder, AP_MAX_REG_MATCH, pmatch, 0)) {
+        /* Process tags in the input string rather than the resulting
+         * substitution to avoid surprises
+         */
+        if (!tags) {
+            tags = process_tags(hdr, r);
+            vec = apr_array_make(r->pool, 8, sizeof(struct iovec));
+        }
+        subs = ap_pregsub(r->pool, tags, remainder, AP_MAX_REG_MATCH, pmatch);
+        if (subs == NULL)
+            return NULL;
+
+        iov = apr_array_push(vec);
+        iov->iov_base = (void *)remainder;
+        iov->iov_len = pmatch[0].rm_so;
+        iov = apr_array_push(vec);
+        iov->iov_base = (void *)subs;
+        iov->iov_len = strlen(subs);
+
+        if (pmatch[0].rm_eo == pmatch[0].rm_so) {
+            /* empty match, keep the next char as is */
+            if (!remainder[pmatch[0].rm_eo]) {
+                remainder += pmatch[0].rm_eo;
+                break;
+            }
+            iov = apr_array_push(vec);
+            iov->iov_base = (void *)(remainder + pmatch[0].rm_eo);
+            iov->iov_len = 1;
+            remainder += pmatch[0].rm_eo + 1;
+        }
+        else {
+            remainder += pmatch[0].rm_eo;
+        }
+        if (hdr->action == hdr_edit) {
+            break;
+        }
+    }
+    if (!vec) {
         /* no match, nothing to do */
         return value;
     }
-    /* Process tags in the input string rather than the resulting
-       * substitution to avoid surprises
-       */
-    subs = ap_pregsub(r->pool, process_tags(hdr, r), value, AP_MAX_REG_MATCH, pmatch);
-    if (subs == NULL)
-        return NULL;
-    diffsz = strlen(subs) - (pmatch[0].rm_eo - pmatch[0].rm_so);
-    if (hdr->action == hdr_edit) {
-        remainder = value + pmatch[0].rm_eo;
-    }
-    else { /* recurse to edit multiple matches if applicable */
-        remainder = process_regexp(hdr, value + pmatch[0].rm_eo, r);
-        if (remainder == NULL)
-            return NULL;
-        diffsz += strlen(remainder) - strlen(value + pmatch[0].rm_eo);
-    }
-    ret = apr_palloc(r->pool, strlen(value) + 1 + diffsz);
-    memcpy(ret, value, pmatch[0].rm_so);
-    strcpy(ret + pmatch[0].rm_so, subs);
-    strcat(ret, remainder);
-    return ret;
+
+    iov = apr_array_push(vec);
+    iov->iov_base = (void *)remainder;
+    iov->iov_len = strlen(remainder);
+    return apr_pstrcatv(r->pool, (struct iovec *)vec->elts, vec->nelts, NULL);
 }
 
 static int echo_header(void *v, const char *key, const char *val)
@@ -687,6 +768,9 @@ static int edit_header(void *v, const char *key, const char *val)
     if (repl == NULL)
         return 0;
 
+    if (repl != val) {
+        ed->changed = 1;
+    }
     apr_table_addn(ed->t, key, repl);
     return 1;
 }
@@ -755,7 +839,7 @@ static int do_headers_fixup(request_rec *r, apr_table_t *headers,
             if (val == NULL) {
                 apr_table_addn(headers, hdr->header, process_tags(hdr, r));
             } else {
-                char *new_val = process_tags(hdr, r);
+                const char *new_val = process_tags(hdr, r);
                 apr_size_t new_val_len = strlen(new_val);
                 int tok_found = 0;
 
@@ -824,7 +908,8 @@ static int do_headers_fixup(request_rec *r, apr_table_t *headers,
                 const char *repl = process_regexp(hdr, r->content_type, r);
                 if (repl == NULL)
                     return 0;
-                if (r->headers_in != headers) ap_set_content_type(r, repl);
+                if (r->headers_in != headers && repl != r->content_type)
+                    ap_set_content_type(r, repl);
             }
             if (apr_table_get(headers, hdr->header)) {
                 edit_do ed;
@@ -832,13 +917,27 @@ static int do_headers_fixup(request_rec *r, apr_table_t *headers,
                 ed.r = r;
                 ed.hdr = hdr;
                 ed.t = apr_table_make(r->pool, 5);
+                ed.changed = 0;
                 if (!apr_table_do(edit_header, (void *) &ed, headers,
                                   hdr->header, NULL))
                     return 0;
-                apr_table_unset(headers, hdr->header);
-                apr_table_do(add_them_all, (void *) headers, ed.t, NULL);
+                /* Leave the headers in place if no value was edited */
+                if (ed.changed) {
+                    apr_table_unset(headers, hdr->header);
+                    apr_table_do(add_them_all, (void *) headers, ed.t, NULL);
+                }
             }
             break;
+        case hdr_set_bulk: {
+            const apr_array_header_t *arr = apr_table_elts(hdr->bulk);
+            const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+            int j;
+
+            for (j = 0; j < arr->nelts; ++j) {
+                apr_table_setn(headers, elts[j].key, elts[j].val);
+            }
+            break;
+        }
         case hdr_note:
             apr_table_setn(r->notes, process_tags(hdr, r), apr_table_get(headers, hdr->header));
             break;
@@ -83,6 +83,11 @@
 #include "apr.h"
 #include "apr_strings.h"
 #include "apr_strmatch.h"
+#include "apr_hash.h"
+#include "apr_lib.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -113,6 +118,8 @@ typedef struct {
     apr_table_t *features;      /* env vars to set (or unset) */
     enum special special_type;  /* is it a "special" header ? */
     int icase;                  /* ignoring case? */
+    unsigned int id;            /* unique, 0 for expressions and .htaccess */
+    apr_uint32_t chars[8];      /* bytes of the pattern (lowercase if icase) */
 } sei_entry;
 
 typedef struct {
@@ -167,6 +174,22 @@ static void *merge_setenvif_config(apr_pool_t *p, void *basev, void *overridesv)
 
 static ap_regex_t *is_header_regex_regex;
 
+/* The id of the next entry */
+static unsigned int sei_next_id = 1;
+
+/* Add the bytes of s to set, lowercased if icase */
+static void sei_add_chars(apr_uint32_t *set, const char *s, apr_size_t len,
+                          int icase)
+{
+    const unsigned char *c = (const unsigned char *)s, *end = c + len;
+
+    for (; c < end; ++c) {
+        unsigned int b = icase ? apr_tolower(*c) : *c;
+
+        set[b >> 5] |= 1u << (b & 31);
+    }
+}
+
 static int is_header_regex(apr_pool_t *p, const char* name)
 {
     /* If a Header name contains characters other than:
@@ -335,6 +358,8 @@ static const char *add_setenvif_core(cmd_parms *cmd, void *mconfig,
         new->name = fname;
         new->regex = regex;
         new->icase = icase;
+        /* the results of .htaccess entries are not memoised */
+        new->id = (cmd->pool != cmd->temp_pool) ? sei_next_id++ : 0;
         if ((simple_pattern = non_regex_pattern(cmd->pool, regex))) {
             new->pattern = apr_strmatch_precompile(cmd->pool,
                                                    simple_pattern, !icase);
@@ -343,6 +368,8 @@ static const char *add_setenvif_core(cmd_parms *cmd, void *mconfig,
                                    " pattern could not be compiled.", NULL);
             }
             new->preg = NULL;
+            sei_add_chars(new->chars, simple_pattern, strlen(simple_pattern),
+                          icase);
         }
         else {
             new->preg = ap_pregcomp(cmd->pool, regex,
@@ -445,6 +472,7 @@ static const char *add_setenvifexpr(cmd_parms *cmd, void *mconfig,
     new->regex = NULL;
     new->pattern = NULL;
     new->preg = NULL;
+    new->id = 0;
     new->expr = ap_expr_parse_cmd(cmd, expr, 0, &err, NULL);
     if (err)
         return apr_psprintf(cmd->pool, "Could not parse expression \"%s\": %s",
@@ -479,6 +507,321 @@ static const command_rec setenvif_module_cmds[] =
     { NULL },
 };
 
+/*
+ * The results of consecutive entries matching the same value, typically
+ * long lists of BrowserMatch, are memoised per process: for the same value,
+ * the same entries always set and unset the same variables.  The entries
+ * are identified by the id of the first one and their number, which is
+ * why only the entries defined one after the other (consecutive ids) can
+ * be memoised together, the merged configurations may interleave others.
+ */
+
+/* Segments of fewer entries are not worth it */
+#ifndef SEI_MEMO_MIN
+#define SEI_MEMO_MIN 4
+#endif
+
+/* Results memoised per process, the least recently used ones are dropped */
+#ifndef SEI_MEMO_MAX
+#define SEI_MEMO_MAX 1024
+#endif
+
+/* Longer values are not memoised */
+#ifndef SEI_MEMO_MAX_LEN
+#define SEI_MEMO_MAX_LEN 512
+#endif
+
+typedef struct {
+    const char *key;
+    const char *val;            /* NULL to unset */
+} sei_memo_op;
+
+typedef struct sei_memo sei_memo;
+struct sei_memo {
+    sei_memo *prev, *next;      /* LRU list, most recently used first */
+    const void *key;
+    apr_size_t klen;
+    int nops;
+    sei_memo_op ops[1];
+};
+
+typedef struct {
+    unsigned int id, n;
+} sei_memo_key_hdr;
+
+static apr_hash_t *sei_memo_hash;
+static sei_memo *sei_memo_head, *sei_memo_tail;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *sei_memo_mutex;
+#endif
+
+static void sei_memo_lock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(sei_memo_mutex);
+#endif
+}
+
+static void sei_memo_unlock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(sei_memo_mutex);
+#endif
+}
+
+static void sei_memo_unlink(sei_memo *m)
+{
+    if (m->prev) {
+        m->prev->next = m->next;
+    }
+    else {
+        sei_memo_head = m->next;
+    }
+    if (m->next) {
+        m->next->prev = m->prev;
+    }
+    else {
+        sei_memo_tail = m->prev;
+    }
+}
+
+static void sei_memo_push(sei_memo *m)
+{
+    m->prev = NULL;
+    m->next = sei_memo_head;
+    if (sei_memo_head) {
+        sei_memo_head->prev = m;
+    }
+    else {
+        sei_memo_tail = m;
+    }
+    sei_memo_head = m;
+}
+
+/* The number of entries from i that can be memoised together */
+static int sei_segment(const sei_entry *entries, int i, int nelts)
+{
+    const sei_entry *b = &entries[i];
+    int n = 1;
+
+    if (!b->id) {
+        return 1;
+    }
+    while (i + n < nelts
+           && entries[i + n].name == b->name
+           && entries[i + n].id == b->id + n) {
+        ++n;
+    }
+    return n;
+}
+
+/* Apply the memoised result of key if any, return whether it was found */
+static int sei_memo_apply(request_rec *r, const void *key, apr_size_t klen)
+{
+    sei_memo *m;
+    int i;
+
+    sei_memo_lock();
+    m = apr_hash_get(sei_memo_hash, key, klen);
+    if (m) {
+        if (m != sei_memo_head) {
+            sei_memo_unlink(m);
+            sei_memo_push(m);
+        }
+        for (i = 0; i < m->nops; ++i) {
+            if (m->ops[i].val) {
+                apr_table_set(r->subprocess_env, m->ops[i].key,
+                              m->ops[i].val);
+            }
+            else {
+                apr_table_unset(r->subprocess_env, m->ops[i].key);
+            }
+        }
+    }
+    sei_memo_unlock();
+
+    if (m) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                      "Setting %d memoised variable(s)", m->nops);
+    }
+    return m != NULL;
+}
+
+/* Memoise the ops (sei_memo_ops) for key */
+static void sei_memo_store(const void *key, apr_size_t klen,
+                           const apr_array_header_t *ops)
+{
+    const sei_memo_op *op = (const sei_memo_op *)ops->elts;
+    apr_size_t size, len;
+    sei_memo *m, *old = NULL;
+    char *buf;
+    int i;
+
+    size = APR_OFFSETOF(sei_memo, ops)
+           + (ops->nelts ? ops->nelts : 1) * sizeof(sei_memo_op) + klen;
+    for (i = 0; i < ops->nelts; ++i) {
+        size += strlen(op[i].key) + 1;
+        if (op[i].val) {
+            size += strlen(op[i].val) + 1;
+        }
+    }
+    if (!(m = malloc(size))) {
+        return;
+    }
+
+    buf = (char *)&m->ops[ops->nelts ? ops->nelts : 1];
+    memcpy(buf, key, klen);
+    m->key = buf;
+    m->klen = klen;
+    buf += klen;
+    m->nops = ops->nelts;
+    for (i = 0; i < ops->nelts; ++i) {
+        len = strlen(op[i].key) + 1;
+        m->ops[i].key = memcpy(buf, op[i].key, len);
+        buf += len;
+        m->ops[i].val = NULL;
+        if (op[i].val) {
+            len = strlen(op[i].val) + 1;
+            m->ops[i].val = memcpy(buf, op[i].val, len);
+            buf += len;
+        }
+    }
+
+    sei_memo_lock();
+    if (apr_hash_get(sei_memo_hash, key, klen)) {
+        /* another thread was faster */
+        old = m;
+    }
+    else {
+        if (apr_hash_count(sei_memo_hash) >= SEI_MEMO_MAX) {
+            old = sei_memo_tail;
+            sei_memo_unlink(old);
+            apr_hash_set(sei_memo_hash, old->key, old->klen, NULL);
+        }
+        apr_hash_set(sei_memo_hash, m->key, m->klen, m);
+        sei_memo_push(m);
+    }
+    sei_memo_unlock();
+
+    free(old);
+}
+
+/*
+ * The bytes found in a value, computed once for all the (non-regex)
+ * patterns matched against it: a pattern with a byte not in the value
+ * can't match, without scanning the value again.
+ */
+typedef struct {
+    const char *val;
+    apr_size_t len;
+    apr_uint32_t exact[8];
+    apr_uint32_t folded[8];
+} sei_chars;
+
+static int sei_may_match(const sei_entry *b, sei_chars *vc,
+                         const char *val, apr_size_t val_len)
+{
+    const apr_uint32_t *set;
+    int k;
+
+    if (vc->val != val || vc->len != val_len) {
+        memset(vc->exact, 0, sizeof(vc->exact));
+        memset(vc->folded, 0, sizeof(vc->folded));
+        sei_add_chars(vc->exact, val, val_len, 0);
+        for (k = 0; k < 256; ++k) {
+            if (vc->exact[k >> 5] & (1u << (k & 31))) {
+                unsigned int f = apr_tolower(k);
+
+                vc->folded[f >> 5] |= 1u << (f & 31);
+            }
+        }
+        vc->val = val;
+        vc->len = val_len;
+    }
+
+    set = b->icase ? vc->folded : vc->exact;
+    for (k = 0; k < 8; ++k) {
+        if (b->chars[k] & ~set[k]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Match b against *val and set or unset its variables, recording them
+ * in ops if not NULL.
+ */
+static int sei_match(request_rec *r, sei_entry *b, const char **pval,
+                     apr_size_t val_len, sei_chars *vc,
+                     apr_array_header_t *ops)
+{
+    const apr_table_entry_t *elts;
+    const char *val = *pval, *err;
+    ap_regmatch_t regm[AP_MAX_REG_MATCH];
+    int j;
+
+    if ((b->pattern && sei_may_match(b, vc, val, val_len)
+                    && apr_strmatch(b->pattern, val, val_len)) ||
+        (b->preg && !ap_regexec(b->preg, val, AP_MAX_REG_MATCH, regm, 0)) ||
+        (b->expr && ap_expr_exec_re(r, b->expr, AP_MAX_REG_MATCH, regm, pval, &err) > 0))
+    {
+        const apr_array_header_t *arr = apr_table_elts(b->features);
+        elts = (const apr_table_entry_t *) arr->elts;
+        val = *pval;
+
+        for (j = 0; j < arr->nelts; ++j) {
+            const char *set = NULL;
+
+            if (*(elts[j].val) == '!') {
+                apr_table_unset(r->subprocess_env, elts[j].key);
+            }
+            else {
+                /*
+                 * Do regex replacement, if we did not use a pattern, so
+                 * either a regex or an expression and if we have a val
+                 * or at least we did not use an expression.
+                 * Background: We can have expressions that become true
+                 * if a regex pattern in the expression does NOT match.
+                 * In this case val is NULL and we should just set the
+                 * value for the environment variable like in the pattern
+                 * case.
+                 */
+                if (!b->pattern && (val || !b->expr)) {
+                    char *replaced = ap_pregsub(r->pool, elts[j].val, val,
+                                                AP_MAX_REG_MATCH, regm);
+                    if (replaced) {
+                        apr_table_setn(r->subprocess_env, elts[j].key,
+                                       replaced);
+                        set = replaced;
+                    }
+                    else {
+                        ap_log_rerror(APLOG_MARK, APLOG_CRIT, 0, r, APLOGNO(01505)
+                                      "Regular expression replacement "
+                                      "failed for '%s', value too long?",
+                                      elts[j].key);
+                        return HTTP_INTERNAL_SERVER_ERROR;
+                    }
+                }
+                else {
+                    apr_table_setn(r->subprocess_env, elts[j].key,
+                                   elts[j].val);
+                    set = elts[j].val;
+                }
+            }
+            if (ops) {
+                sei_memo_op *op = apr_array_push(ops);
+
+                op->key = elts[j].key;
+                op->val = set;
+            }
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "Setting %s",
+                          elts[j].key);
+        }
+    }
+
+    return OK;
+}
+
 /*
  * This routine gets called at two different points in request processing:
  * once before the URI has been translated (during the post-read-request
@@ -493,11 +836,12 @@ static int match_headers(request_rec *r)
     sei_cfg_rec *sconf;
     sei_entry *entries;
     const apr_table_entry_t *elts;
-    const char *val, *err;
+    const char *val;
     apr_size_t val_len = 0;
-    int i, j;
+    int i, j, k, n, nelts, seg_end, rv;
     char *last_name;
-    ap_regmatch_t regm[AP_MAX_REG_MATCH];
+    sei_chars vc;
+    char key[sizeof(sei_memo_key_hdr) + SEI_MEMO_MAX_LEN];
 
     if (!ap_get_module_config(r->request_config, &setenvif_module)) {
         ap_set_module_config(r->request_config, &setenvif_module,
@@ -510,9 +854,12 @@ static int match_headers(request_rec *r)
                                                      &setenvif_module);
     }
     entries = (sei_entry *) sconf->conditionals->elts;
+    nelts = sconf->conditionals->nelts;
     last_name = NULL;
     val = NULL;
-    for (i = 0; i < sconf->conditionals->nelts; ++i) {
+    vc.val = NULL;
+    seg_end = 0;
+    for (i = 0; i < nelts; ++i) {
         sei_entry *b = &entries[i];
 
         if (!b->expr) {
@@ -585,59 +932,81 @@ static int match_headers(request_rec *r)
             val_len = 0;
         }
 
-        if ((b->pattern && apr_strmatch(b->pattern, val, val_len)) ||
-            (b->preg && !ap_regexec(b->preg, val, AP_MAX_REG_MATCH, regm, 0)) ||
-            (b->expr && ap_expr_exec_re(r, b->expr, AP_MAX_REG_MATCH, regm, &val, &err) > 0))
-        {
-            const apr_array_header_t *arr = apr_table_elts(b->features);
-            elts = (const apr_table_entry_t *) arr->elts;
+        if (i >= seg_end) {
+            n = sei_segment(entries, i, nelts);
+            seg_end = i + n;
+            if (n >= SEI_MEMO_MIN && sei_memo_hash
+                && val_len <= SEI_MEMO_MAX_LEN) {
+                sei_memo_key_hdr hdr;
+                apr_size_t klen = sizeof(hdr) + val_len;
+                apr_array_header_t *ops;
 
-            for (j = 0; j < arr->nelts; ++j) {
-                if (*(elts[j].val) == '!') {
-                    apr_table_unset(r->subprocess_env, elts[j].key);
+                hdr.id = b->id;
+                hdr.n = n;
+                memcpy(key, &hdr, sizeof(hdr));
+                memcpy(key + sizeof(hdr), val, val_len);
+                if (sei_memo_apply(r, key, klen)) {
+                    i = seg_end - 1;
+                    continue;
                 }
-                else {
-                    /*
-                     * Do regex replacement, if we did not use a pattern, so
-                     * either a regex or an expression and if we have a val
-                     * or at least we did not use an expression.
-                     * Background: We can have expressions that become true
-                     * if a regex pattern in the expression does NOT match.
-                     * In this case val is NULL and we should just set the
-                     * value for the environment variable like in the pattern
-                     * case.
-                     */
-                    if (!b->pattern && (val || !b->expr)) {
-                        char *replaced = ap_pregsub(r->pool, elts[j].val, val,
-                                                    AP_MAX_REG_MATCH, regm);
-                        if (replaced) {
-                            apr_table_setn(r->subprocess_env, elts[j].key,
-                                           replaced);
-                        }
-                        else {
-                            ap_log_rerror(APLOG_MARK, APLOG_CRIT, 0, r, APLOGNO(01505)
-                                          "Regular expression replacement "
-                                          "failed for '%s', value too long?",
-                                          elts[j].key);
-                            return HTTP_INTERNAL_SERVER_ERROR;
-                        }
-                    }
-                    else {
-                        apr_table_setn(r->subprocess_env, elts[j].key,
-                                       elts[j].val);
+
+                ops = apr_array_make(r->pool, 8, sizeof(sei_memo_op));
+                for (k = i; k < seg_end; ++k) {
+                    rv = sei_match(r, &entries[k], &val, val_len, &vc, ops);
+                    if (rv != OK) {
+                        return rv;
                     }
                 }
-                ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "Setting %s",
-                              elts[j].key);
+                sei_memo_store(key, klen, ops);
+                i = seg_end - 1;
+                continue;
             }
         }
+
+        rv = sei_match(r, b, &val, val_len, &vc, NULL);
+        if (rv != OK) {
+            return rv;
+        }
     }
 
     return DECLINED;
 }
 
+static apr_status_t sei_memo_cleanup(void *dummy)
+{
+    sei_memo *m;
+
+    while ((m = sei_memo_head)) {
+        sei_memo_head = m->next;
+        free(m);
+    }
+    sei_memo_tail = NULL;
+    sei_memo_hash = NULL;
+    return APR_SUCCESS;
+}
+
+static void setenvif_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    rv = apr_thread_mutex_create(&sei_memo_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10185)
+                     "could not create the setenvif memo mutex, "
+                     "results will not be memoised");
+        return;
+    }
+#endif
+
+    sei_memo_hash = apr_hash_make(p);
+    apr_pool_cleanup_register(p, NULL, sei_memo_cleanup,
+                              apr_pool_cleanup_null);
+}
+
 static void register_hooks(apr_pool_t *p)
 {
+    ap_hook_child_init(setenvif_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_header_parser(match_headers, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_read_request(match_headers, NULL, NULL, APR_HOOK_MIDDLE);
 
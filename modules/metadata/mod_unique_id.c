@@ -21,10 +21,12 @@
  * UUencoding modified by: Alvaro Martinez Echevarria <alvaro@lander.es>
  */
 
-#define APR_WANT_BYTEFUNC   /* for htons() et al */
+#define APR_WANT_STRFUNC
 #include "apr_want.h"
-#include "apr_general.h"    /* for APR_OFFSETOF                */
-#include "apr_network_io.h"
+#include "apr_general.h"
+#include "apr_atomic.h"
+#include "apr_strings.h"
+#include "apr_thread_proc.h"
 
 #include "httpd.h"
 #include "http_config.h"
@@ -33,22 +35,22 @@
 
 #define ROOT_SIZE 10
 
-typedef struct {
-    unsigned int stamp;
-    char root[ROOT_SIZE];
-    unsigned short counter;
-    unsigned int thread_index;
-} unique_id_rec;
-
-/* We are using thread_index (the index into the scoreboard), because we
- * cannot guarantee the thread_id will be an integer.
- *
- * This code looks like it won't give a unique ID with the new thread logic.
- * It will.  The reason is, we don't increment the counter in a thread_safe
- * manner.  Because the thread_index is also in the unique ID now, this does
- * not matter.  In order for the id to not be unique, the same thread would
- * have to get the same counter twice in the same second.
+/* The state of a thread: its counter, and its number in the child which
+ * tells its identifiers from the other threads' ones.
  */
+typedef struct {
+    apr_uint32_t counter;
+    apr_uint32_t thread;
+} unique_id_thread_t;
+
+#define UNIQUE_ID_THREAD_KEY "mod_unique_id-thread"
+
+/* Formats of the identifier */
+#define UNIQUE_ID_CLASSIC 0     /* 27 chars of [A-Za-z0-9@-] */
+#define UNIQUE_ID_ULID    1     /* 26 chars of Crockford's base32 */
+#define UNIQUE_ID_TRACEID 2     /* 32 hex digits, a W3C trace-id */
+
+static int unique_id_format = UNIQUE_ID_CLASSIC;
 
 /* Comments:
  *
@@ -117,59 +119,76 @@ typedef struct {
  */
 
 /*
- * XXX: We should have a per-thread counter and not use cur_unique_id.counter
- * XXX: in all threads, because this is bad for performance on multi-processor
- * XXX: systems: Writing to the same address from several CPUs causes cache
- * XXX: thrashing.
+ * Per-thread counters:
+ * Each thread has its own counter (and number), found from
+ * c->current_thread, rather than all the threads of a child writing the
+ * same counter (which caused cache thrashing on multi-processor systems,
+ * and was not thread safe).  The thread number replaces the connection id
+ * in the classic format, so the identifiers are still unique if a thread
+ * doesn't get the same counter twice in the same second.
+ *
+ * The ULID and trace-id formats are 128 bits: the request time in
+ * milliseconds (48 bits), then 32 bits of the root, 16 bits of the thread
+ * number and a 32-bit counter.  They sort by time, and the trace-id one can
+ * be used where a W3C Trace Context trace-id is expected.
  */
-static unique_id_rec cur_unique_id;
+static unsigned char root[ROOT_SIZE];
 
-/*
- * Number of elements in the structure unique_id_rec.
- */
-#define UNIQUE_ID_REC_MAX 4
+/* The state for the threads without an apr_thread_t */
+static unique_id_thread_t main_thread;
 
-static unsigned short unique_id_rec_offset[UNIQUE_ID_REC_MAX],
-                      unique_id_rec_size[UNIQUE_ID_REC_MAX],
-                      unique_id_rec_total_size,
-                      unique_id_rec_size_uu;
+static apr_uint32_t thread_seq;
 
-static int unique_id_global_init(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *main_server)
+static int unique_id_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                apr_pool_t *ptemp)
 {
-    /*
-     * Calculate the sizes and offsets in cur_unique_id.
-     */
-    unique_id_rec_offset[0] = APR_OFFSETOF(unique_id_rec, stamp);
-    unique_id_rec_size[0] = sizeof(cur_unique_id.stamp);
-    unique_id_rec_offset[1] = APR_OFFSETOF(unique_id_rec, root);
-    unique_id_rec_size[1] = sizeof(cur_unique_id.root);
-    unique_id_rec_offset[2] = APR_OFFSETOF(unique_id_rec, counter);
-    unique_id_rec_size[2] = sizeof(cur_unique_id.counter);
-    unique_id_rec_offset[3] = APR_OFFSETOF(unique_id_rec, thread_index);
-    unique_id_rec_size[3] = sizeof(cur_unique_id.thread_index);
-    unique_id_rec_total_size = unique_id_rec_size[0] + unique_id_rec_size[1] +
-                               unique_id_rec_size[2] + unique_id_rec_size[3];
-
-    /*
-     * Calculate the size of the structure when encoded.
-     */
-    unique_id_rec_size_uu = (unique_id_rec_total_size*8+5)/6;
-
+    unique_id_format = UNIQUE_ID_CLASSIC;
     return OK;
 }
 
 static void unique_id_child_init(apr_pool_t *p, server_rec *s)
 {
-    ap_random_insecure_bytes(&cur_unique_id.root,
-                             sizeof(cur_unique_id.root));
+    ap_random_insecure_bytes(root, sizeof(root));
 
     /*
      * If we use 0 as the initial counter we have a little less protection
      * against restart problems, and a little less protection against a clock
      * going backwards in time.
      */
-    ap_random_insecure_bytes(&cur_unique_id.counter,
-                             sizeof(cur_unique_id.counter));
+    ap_random_insecure_bytes(&main_thread.counter,
+                             sizeof(main_thread.counter));
+    main_thread.thread = 0;
+    thread_seq = 0;
+}
+
+static unique_id_thread_t *get_thread_state(const conn_rec *c)
+{
+#if APR_HAS_THREADS
+    apr_thread_t *thd = c->current_thread;
+
+    if (thd) {
+        unique_id_thread_t *t = NULL;
+
+        apr_thread_data_get((void **)&t, UNIQUE_ID_THREAD_KEY, thd);
+        if (!t) {
+            t = apr_palloc(apr_thread_pool_get(thd), sizeof(*t));
+            ap_random_insecure_bytes(&t->counter, sizeof(t->counter));
+            t->thread = apr_atomic_inc32(&thread_seq) + 1;
+            apr_thread_data_set(t, UNIQUE_ID_THREAD_KEY, NULL, thd);
+        }
+        return t;
+    }
+#endif
+    return &main_thread;
+}
+
+static APR_INLINE unsigned char *put_uint32(unsigned char *x, apr_uint32_t n)
+{
+    x[0] = (unsigned char)(n >> 24);
+    x[1] = (unsigned char)(n >> 16);
+    x[2] = (unsigned char)(n >> 8);
+    x[3] = (unsigned char)n;
+    return x + 4;
 }
 
 /* NOTE: This is *NOT* the same encoding used by base64encode ... the last two
@@ -185,61 +204,77 @@ static const char uuencoder[64] = {
     '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '@', '-',
 };
 
+static const char crockford[32] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D',
+    'E', 'F', 'G', 'H', 'J', 'K', 'M', 'N', 'P', 'Q', 'R', 'S', 'T', 'V',
+    'W', 'X', 'Y', 'Z'
+};
+
 static const char *gen_unique_id(const request_rec *r)
 {
+    unique_id_thread_t *t = get_thread_state(r->connection);
+    apr_uint32_t counter = t->counter++;
+    /* the identifier, padded with two final bytes for the uuencoding */
+    unsigned char x[22], *y;
     char *str;
-    /*
-     * Buffer padded with two final bytes, used to copy the unique_id_red
-     * structure without the internal paddings that it could have.
-     */
-    unique_id_rec new_unique_id;
-    struct {
-        unique_id_rec foo;
-        unsigned char pad[2];
-    } paddedbuf;
-    unsigned char *x,*y;
-    unsigned short counter;
-    int i,j,k;
-
-    memcpy(&new_unique_id.root, &cur_unique_id.root, ROOT_SIZE);
-    new_unique_id.counter = cur_unique_id.counter;
-    new_unique_id.stamp = htonl((unsigned int)apr_time_sec(r->request_time));
-    new_unique_id.thread_index = htonl((unsigned int)r->connection->id);
-
-    /* we'll use a temporal buffer to avoid uuencoding the possible internal
-     * paddings of the original structure */
-    x = (unsigned char *) &paddedbuf;
-    k = 0;
-    for (i = 0; i < UNIQUE_ID_REC_MAX; i++) {
-        y = ((unsigned char *) &new_unique_id) + unique_id_rec_offset[i];
-        for (j = 0; j < unique_id_rec_size[i]; j++, k++) {
-            x[k] = y[j];
+    int i, k;
+
+    if (unique_id_format == UNIQUE_ID_CLASSIC) {
+        /* stamp, root, counter (16 bits) and thread, 27 chars */
+        y = put_uint32(x, (apr_uint32_t)apr_time_sec(r->request_time));
+        memcpy(y, root, ROOT_SIZE);
+        y += ROOT_SIZE;
+        *y++ = (unsigned char)(counter >> 8);
+        *y++ = (unsigned char)counter;
+        y = put_uint32(y, t->thread);
+        y[0] = y[1] = '\0';
+
+        str = apr_palloc(r->pool, 28);
+        for (i = 0, k = 0; i < 20; i += 3) {
+            y = x + i;
+            str[k++] = uuencoder[y[0] >> 2];
+            str[k++] = uuencoder[((y[0] & 0x03) << 4) | ((y[1] & 0xf0) >> 4)];
+            if (k == 27) break;
+            str[k++] = uuencoder[((y[1] & 0x0f) << 2) | ((y[2] & 0xc0) >> 6)];
+            if (k == 27) break;
+            str[k++] = uuencoder[y[2] & 0x3f];
         }
+        str[k] = '\0';
     }
-    /*
-     * We reset two more bytes just in case padding is needed for the uuencoding.
-     */
-    x[k++] = '\0';
-    x[k++] = '\0';
-
-    /* alloc str and do the uuencoding */
-    str = (char *)apr_palloc(r->pool, unique_id_rec_size_uu + 1);
-    k = 0;
-    for (i = 0; i < unique_id_rec_total_size; i += 3) {
-        y = x + i;
-        str[k++] = uuencoder[y[0] >> 2];
-        str[k++] = uuencoder[((y[0] & 0x03) << 4) | ((y[1] & 0xf0) >> 4)];
-        if (k == unique_id_rec_size_uu) break;
-        str[k++] = uuencoder[((y[1] & 0x0f) << 2) | ((y[2] & 0xc0) >> 6)];
-        if (k == unique_id_rec_size_uu) break;
-        str[k++] = uuencoder[y[2] & 0x3f];
+    else {
+        /* milliseconds (48 bits), root (32), thread (16) and counter */
+        apr_uint64_t ms = (apr_uint64_t)apr_time_as_msec(r->request_time);
+
+        y = put_uint32(x, (apr_uint32_t)(ms >> 16));
+        *y++ = (unsigned char)(ms >> 8);
+        *y++ = (unsigned char)ms;
+        memcpy(y, root, 4);
+        y += 4;
+        *y++ = (unsigned char)(t->thread >> 8);
+        *y++ = (unsigned char)t->thread;
+        put_uint32(y, counter);
+
+        if (unique_id_format == UNIQUE_ID_ULID) {
+            /* 128 bits in 26 chars of 5 bits, the first one has 3 */
+            apr_uint32_t acc = 0;
+            int bits = 2;
+
+            str = apr_palloc(r->pool, 27);
+            for (i = 0, k = 0; k < 26; ) {
+                if (bits < 5) {
+                    acc = (acc << 8) | x[i++];
+                    bits += 8;
+                }
+                bits -= 5;
+                str[k++] = crockford[(acc >> bits) & 0x1f];
+            }
+            str[k] = '\0';
+        }
+        else {
+            str = apr_palloc(r->pool, 33);
+            ap_bin2hex(x, 16, str);
+        }
     }
-    str[k++] = '\0';
-
-    /* and increment the identifier for the next call */
-
-    counter = ntohs(new_unique_id.counter) + 1;
-    cur_unique_id.counter = htons(counter);
 
     return str;
 }
@@ -253,31 +288,16 @@ static const char *gen_unique_id(const request_rec *r)
  *   has been called, or not at all.
  */
 
-static int generate_log_id(const conn_rec *c, const request_rec *r,
-                           const char **id)
+static const char *get_unique_id(const request_rec *r)
 {
-    /* we do not care about connection ids */
-    if (r == NULL)
-        return DECLINED;
-
-    /* XXX: do we need special handling for internal redirects? */
-
     /* if set_unique_id() has been called for this request, use it */
-    *id = apr_table_get(r->subprocess_env, "UNIQUE_ID");
+    const char *id = apr_table_get(r->subprocess_env, "UNIQUE_ID");
 
-    if (!*id)
-        *id = gen_unique_id(r);
-    return OK;
-}
-
-static int set_unique_id(request_rec *r)
-{
-    const char *id = NULL;
     /* copy the unique_id if this is an internal redirect (we're never
      * actually called for sub requests, so we don't need to test for
      * them) */
-    if (r->prev) {
-       id = apr_table_get(r->subprocess_env, "REDIRECT_UNIQUE_ID");
+    if (!id && r->prev) {
+        id = apr_table_get(r->subprocess_env, "REDIRECT_UNIQUE_ID");
     }
 
     if (!id) {
@@ -290,16 +310,61 @@ static int set_unique_id(request_rec *r)
     if (!id) {
         id = gen_unique_id(r);
     }
+    return id;
+}
+
+static int generate_log_id(const conn_rec *c, const request_rec *r,
+                           const char **id)
+{
+    /* we do not care about connection ids */
+    if (r == NULL)
+        return DECLINED;
 
+    *id = get_unique_id(r);
+    return OK;
+}
+
+static int set_unique_id(request_rec *r)
+{
     /* set the environment variable */
-    apr_table_setn(r->subprocess_env, "UNIQUE_ID", id);
+    apr_table_setn(r->subprocess_env, "UNIQUE_ID", get_unique_id(r));
 
     return DECLINED;
 }
 
+static const char *set_unique_id_format(cmd_parms *cmd, void *dummy,
+                                        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (!ap_cstr_casecmp(arg, "classic")) {
+        unique_id_format = UNIQUE_ID_CLASSIC;
+    }
+    else if (!ap_cstr_casecmp(arg, "ulid")) {
+        unique_id_format = UNIQUE_ID_ULID;
+    }
+    else if (!ap_cstr_casecmp(arg, "traceid")) {
+        unique_id_format = UNIQUE_ID_TRACEID;
+    }
+    else {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " must be Classic, ULID or TraceId", NULL);
+    }
+    return NULL;
+}
+
+static const command_rec unique_id_cmds[] = {
+    AP_INIT_TAKE1("UniqueIdFormat", set_unique_id_format, NULL, RSRC_CONF,
+                  "Format of UNIQUE_ID: Classic (default), ULID or TraceId"),
+    {NULL}
+};
+
 static void register_hooks(apr_pool_t *p)
 {
-    ap_hook_post_config(unique_id_global_init, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_pre_config(unique_id_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_child_init(unique_id_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_read_request(set_unique_id, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_generate_log_id(generate_log_id, NULL, NULL, APR_HOOK_MIDDLE);
@@ -311,6 +376,6 @@ AP_DECLARE_MODULE(unique_id) = {
     NULL,                       /* dir merger --- default is to override */
     NULL,                       /* server config */
     NULL,                       /* merge server configs */
-    NULL,                       /* command apr_table_t */
+    unique_id_cmds,             /* command apr_table_t */
     register_hooks              /* register hooks */
 };
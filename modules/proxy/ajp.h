@@ -410,13 +410,14 @@ apr_status_t ajp_ilink_receive(apr_socket_t *sock, ajp_msg_t *msg);
  * Build the ajp header message and send it
  * @param sock      backend socket
  * @param r         current request
- * @param buffsize  max size of the AJP packet.
+ * @param msg       AJP message to serialize into, its max_size bounds
+ *                  the AJP packet.
  * @param uri       requested uri
  * @param secret    authentication secret
  * @return          APR_SUCCESS or error
  */
 apr_status_t ajp_send_header(apr_socket_t *sock, request_rec *r,
-                             apr_size_t buffsize,
+                             ajp_msg_t *msg,
                              apr_uri_t *uri,
                              const char *secret);
 
@@ -425,7 +426,10 @@ apr_status_t ajp_send_header(apr_socket_t *sock, request_rec *r,
  * @param sock      backend socket
  * @param r         current request
  * @param buffsize  size of the buffer.
- * @param msg       returned AJP message
+ * @param msg       returned AJP message, created if *msg is NULL, else
+ *                  reused. If (*msg)->buf is NULL a buffer of (*msg)->max_size
+ *                  bytes is taken from the bucket allocator of the client
+ *                  connection.
  * @return          APR_SUCCESS or error
  */
 apr_status_t ajp_read_header(apr_socket_t *sock,
@@ -434,15 +438,25 @@ apr_status_t ajp_read_header(apr_socket_t *sock,
                              ajp_msg_t **msg);
 
 /**
- * Allocate a msg to send data
- * @param pool      pool to allocate from
+ * Prepare a msg to send data, reusing its buffer
+ * @param msg       AJP message
  * @param ptr       data buffer
- * @param len       the length of allocated data buffer
- * @param msg       returned AJP message
- * @return          APR_SUCCESS or error
+ * @param len       the length of the data buffer
+ */
+void ajp_reset_data_msg(ajp_msg_t *msg, char **ptr, apr_size_t *len);
+
+/**
+ * Hand the data of a CMD_AJP13_SEND_BODY_CHUNK message over to a heap bucket,
+ * with the message buffer when they fill most of it, or else a copy
+ * @param msg       AJP message whose buffer comes from list, it is left
+ *                  without buffer if the bucket takes it
+ * @param ptr       data address returned by ajp_parse_data()
+ * @param len       data length returned by ajp_parse_data()
+ * @param list      bucket allocator
+ * @return          the bucket
  */
-apr_status_t  ajp_alloc_data_msg(apr_pool_t *pool, char **ptr,
-                                 apr_size_t *len, ajp_msg_t **msg);
+apr_bucket *ajp_data_to_bucket(ajp_msg_t *msg, const char *ptr,
+                               apr_size_t len, apr_bucket_alloc_t *list);
 
 /**
  * Send the data message
@@ -46,92 +46,99 @@ static const char *long_res_header_for_sc(int sc)
 
 #define UNKNOWN_METHOD (-1)
 
-static int sc_for_req_header(const char *header_name)
+/* Frequent request headers, coded as numbers instead of strings, indexed
+ * by the length of their name (ACCEPT-LANGUAGE is the longest of interest).
+ */
+typedef struct {
+    const char *name;
+    int sc;
+} sc_req_header_t;
+
+#define SC_REQ_HEADER_MAXLEN 15
+
+static const sc_req_header_t sc_req_headers[SC_REQ_HEADER_MAXLEN + 1][4] = {
+    /* 0 - 3 */
+    {{NULL, 0}}, {{NULL, 0}}, {{NULL, 0}}, {{NULL, 0}},
+    /* 4 */
+    {{"Host", SC_HOST}, {NULL, 0}},
+    /* 5 */
+    {{NULL, 0}},
+    /* 6 */
+    {{"Accept", SC_ACCEPT}, {"Cookie", SC_COOKIE},
+     {"Pragma", SC_PRAGMA}, {NULL, 0}},
+    /* 7 */
+    {{"Referer", SC_REFERER}, {"Cookie2", SC_COOKIE2}, {NULL, 0}},
+    /* 8 - 9 */
+    {{NULL, 0}}, {{NULL, 0}},
+    /* 10 */
+    {{"Connection", SC_CONNECTION}, {"User-Agent", SC_USER_AGENT},
+     {NULL, 0}},
+    /* 11 */
+    {{NULL, 0}},
+    /* 12 */
+    {{"Content-Type", SC_CONTENT_TYPE}, {NULL, 0}},
+    /* 13 */
+    {{"Authorization", SC_AUTHORIZATION}, {NULL, 0}},
+    /* 14 */
+    {{"Accept-Charset", SC_ACCEPT_CHARSET},
+     {"Content-Length", SC_CONTENT_LENGTH}, {NULL, 0}},
+    /* 15 */
+    {{"Accept-Encoding", SC_ACCEPT_ENCODING},
+     {"Accept-Language", SC_ACCEPT_LANGUAGE}, {NULL, 0}}
+};
+
+static int sc_for_req_header(const char *header_name, apr_size_t len)
 {
-    char header[16];
-    apr_size_t len = strlen(header_name);
-    const char *p = header_name;
-    int i = 0;
+    const sc_req_header_t *h;
 
-    /* ACCEPT-LANGUAGE is the longest header
-     * that is of interest.
-     */
-    if (len < 4 || len > 15)
+    if (len > SC_REQ_HEADER_MAXLEN)
         return UNKNOWN_METHOD;
 
-    memset(header, 0, sizeof header);
-    while (*p)
-        header[i++] = apr_toupper(*p++);
-    header[i] = '\0';
-    p = &header[1];
-
-    switch (header[0]) {
-        case 'A':
-            if (memcmp(p, "CCEPT", 5) == 0) {
-                if (!header[6])
-                    return SC_ACCEPT;
-                else if (header[6] == '-') {
-                    p += 6;
-                    if (strcmp(p, "CHARSET") == 0)
-                        return SC_ACCEPT_CHARSET;
-                    else if (strcmp(p,  "ENCODING") == 0)
-                        return SC_ACCEPT_ENCODING;
-                    else if (strcmp(p, "LANGUAGE") == 0)
-                        return SC_ACCEPT_LANGUAGE;
-                    else
-                        return UNKNOWN_METHOD;
-                }
-                else
-                    return UNKNOWN_METHOD;
-            }
-            else if (strcmp(p, "UTHORIZATION") == 0)
-                return SC_AUTHORIZATION;
-            else
-                return UNKNOWN_METHOD;
-        break;
-        case 'C':
-            if (strcmp(p, "OOKIE2") == 0)
-                return SC_COOKIE2;
-            else if (strcmp(p, "OOKIE") == 0)
-                return SC_COOKIE;
-            else if (strcmp(p, "ONNECTION") == 0)
-                return SC_CONNECTION;
-            else if (strcmp(p, "ONTENT-TYPE") == 0)
-                return SC_CONTENT_TYPE;
-            else if (strcmp(p, "ONTENT-LENGTH") == 0)
-                return SC_CONTENT_LENGTH;
-            else
-                return UNKNOWN_METHOD;
-        break;
-        case 'H':
-            if (strcmp(p, "OST") == 0)
-                return SC_HOST;
-            else
-                return UNKNOWN_METHOD;
-        break;
-        case 'P':
-            if (strcmp(p, "RAGMA") == 0)
-                return SC_PRAGMA;
-            else
-                return UNKNOWN_METHOD;
-        break;
-        case 'R':
-            if (strcmp(p, "EFERER") == 0)
-                return SC_REFERER;
-            else
-                return UNKNOWN_METHOD;
-        break;
-        case 'U':
-            if (strcmp(p, "SER-AGENT") == 0)
-                return SC_USER_AGENT;
-            else
-                return UNKNOWN_METHOD;
-        break;
-        default:
-            return UNKNOWN_METHOD;
-    }
-
-    /* NOTREACHED */
+    for (h = sc_req_headers[len]; h->name; h++) {
+        if (ap_cstr_casecmp(header_name, h->name) == 0)
+            return h->sc;
+    }
+    return UNKNOWN_METHOD;
+}
+
+/*
+ * Append a request header, its code or its name followed by its value,
+ * with a single bounds check.
+ */
+static apr_status_t ajp_msg_append_header(ajp_msg_t *msg,
+                                          const char *key, const char *val)
+{
+    apr_size_t klen = strlen(key);
+    apr_size_t vlen = strlen(val);
+    int sc = sc_for_req_header(key, klen);
+    apr_size_t need;
+    apr_byte_t *p;
+
+    need = (sc != UNKNOWN_METHOD ? 2 : 2 + klen + 1) + 2 + vlen + 1;
+    if (msg->len + need > msg->max_size) {
+        return AJP_EOVERFLOW;
+    }
+
+    p = msg->buf + msg->len;
+    if (sc != UNKNOWN_METHOD) {
+        *p++ = (apr_byte_t)((sc >> 8) & 0xFF);
+        *p++ = (apr_byte_t)(sc & 0xFF);
+    }
+    else {
+        *p++ = (apr_byte_t)((klen >> 8) & 0xFF);
+        *p++ = (apr_byte_t)(klen & 0xFF);
+        memcpy(p, key, klen + 1);
+        ap_xlate_proto_to_ascii((char *)p, klen + 1);
+        p += klen + 1;
+    }
+    *p++ = (apr_byte_t)((vlen >> 8) & 0xFF);
+    *p++ = (apr_byte_t)(vlen & 0xFF);
+    memcpy(p, val, vlen + 1);
+    ap_xlate_proto_to_ascii((char *)p, vlen + 1);
+
+    msg->len += need;
+
+    return APR_SUCCESS;
 }
 
 /* Apache method number to SC methods transform table */
@@ -224,6 +231,7 @@ static apr_status_t ajp_marshal_into_msgb(ajp_msg_t *msg,
     const char *session_route, *envvar;
     const apr_array_header_t *arr = apr_table_elts(r->subprocess_env);
     const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    const apr_table_entry_t *hdrs = NULL;
 
     ap_log_rerror(APLOG_MARK, APLOG_TRACE8, 0, r, "Into ajp_marshal_into_msgb");
 
@@ -239,6 +247,7 @@ static apr_status_t ajp_marshal_into_msgb(ajp_msg_t *msg,
     if (r->headers_in && apr_table_elts(r->headers_in)) {
         const apr_array_header_t *t = apr_table_elts(r->headers_in);
         num_headers = t->nelts;
+        hdrs = (const apr_table_entry_t *)t->elts;
     }
 
     remote_host = (char *)ap_get_useragent_host(r, REMOTE_HOST, NULL);
@@ -263,36 +272,15 @@ static apr_status_t ajp_marshal_into_msgb(ajp_msg_t *msg,
     }
 
     for (i = 0 ; i < num_headers ; i++) {
-        int sc;
-        const apr_array_header_t *t = apr_table_elts(r->headers_in);
-        const apr_table_entry_t *elts = (apr_table_entry_t *)t->elts;
-
-        if ((sc = sc_for_req_header(elts[i].key)) != UNKNOWN_METHOD) {
-            if (ajp_msg_append_uint16(msg, (apr_uint16_t)sc)) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00969)
-                       "ajp_marshal_into_msgb: "
-                       "Error appending the header name");
-                return AJP_EOVERFLOW;
-            }
-        }
-        else {
-            if (ajp_msg_append_string(msg, elts[i].key)) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00970)
-                       "ajp_marshal_into_msgb: "
-                       "Error appending the header name");
-                return AJP_EOVERFLOW;
-            }
-        }
-
-        if (ajp_msg_append_string(msg, elts[i].val)) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00971)
+        if (ajp_msg_append_header(msg, hdrs[i].key, hdrs[i].val)) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00969)
                    "ajp_marshal_into_msgb: "
-                   "Error appending the header value");
+                   "Error appending the header %s", hdrs[i].key);
             return AJP_EOVERFLOW;
         }
         ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r,
                    "ajp_marshal_into_msgb: Header[%d] [%s] = [%s]",
-                   i, elts[i].key, elts[i].val);
+                   i, hdrs[i].key, hdrs[i].val);
     }
 
     if (secret) {
@@ -670,20 +658,12 @@ static apr_status_t ajp_unmarshal_response(ajp_msg_t *msg,
  */
 apr_status_t ajp_send_header(apr_socket_t *sock,
                              request_rec *r,
-                             apr_size_t buffsize,
+                             ajp_msg_t *msg,
                              apr_uri_t *uri,
                              const char *secret)
 {
-    ajp_msg_t *msg;
     apr_status_t rc;
 
-    rc = ajp_msg_create(r->pool, buffsize, &msg);
-    if (rc != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00987)
-               "ajp_send_header: ajp_msg_create failed");
-        return rc;
-    }
-
     rc = ajp_marshal_into_msgb(msg, r, uri, secret);
     if (rc != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00988)
@@ -729,6 +709,14 @@ apr_status_t ajp_read_header(apr_socket_t *sock,
             return rc;
         }
     }
+    if (!(*msg)->buf) {
+        /* The buffer was handed over to a bucket by ajp_data_to_bucket() */
+        (*msg)->buf = apr_bucket_alloc((*msg)->max_size,
+                                       r->connection->bucket_alloc);
+        if (!(*msg)->buf) {
+            return APR_ENOMEM;
+        }
+    }
     ajp_msg_reset(*msg);
     rc = ajp_ilink_receive(sock, *msg);
     if (rc != APR_SUCCESS) {
@@ -853,20 +841,39 @@ apr_status_t ajp_parse_reuse(request_rec *r, ajp_msg_t *msg,
 }
 
 /*
- * Allocate a msg to send data
+ * Prepare a msg to send data, reusing its buffer
  */
-apr_status_t  ajp_alloc_data_msg(apr_pool_t *pool, char **ptr, apr_size_t *len,
-                                 ajp_msg_t **msg)
+void ajp_reset_data_msg(ajp_msg_t *msg, char **ptr, apr_size_t *len)
 {
-    apr_status_t rc;
+    ajp_msg_reset(msg);
+    *ptr = (char *)&(msg->buf[AJP_HEADER_SZ]);
+    *len = msg->max_size - AJP_HEADER_SZ;
+}
 
-    if ((rc = ajp_msg_create(pool, *len, msg)) != APR_SUCCESS)
-        return rc;
-    ajp_msg_reset(*msg);
-    *ptr = (char *)&((*msg)->buf[6]);
-    *len =  *len - 6;
+/*
+ * Move the data of a CMD_AJP13_SEND_BODY_CHUNK message, as located by
+ * ajp_parse_data(), to a heap bucket. When the data fill most of the
+ * message buffer, the bucket takes the ownership of the buffer, which must
+ * come from the given bucket allocator, and a new one is allocated by the
+ * next ajp_read_header(). Smaller data are copied, so that a bucket set
+ * aside downstream never holds a whole buffer for a few bytes.
+ */
+apr_bucket *ajp_data_to_bucket(ajp_msg_t *msg, const char *ptr,
+                               apr_size_t len, apr_bucket_alloc_t *list)
+{
+    apr_bucket *e;
 
-    return APR_SUCCESS;
+    if (len < msg->max_size / 2) {
+        return apr_bucket_heap_create(ptr, len, NULL, list);
+    }
+
+    e = apr_bucket_heap_create((const char *)msg->buf, msg->max_size,
+                               apr_bucket_free, list);
+    e->start = (const apr_byte_t *)ptr - msg->buf;
+    e->length = len;
+    msg->buf = NULL;
+
+    return e;
 }
 
 /*
@@ -1313,6 +1313,110 @@ PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
                                                        apr_off_t bsize,
                                                        int after);
 
+/* Opaque state of ap_proxy_splice_between_connections() */
+typedef struct proxy_splice_t proxy_splice_t;
+
+/*
+ * Zero-copy variant of ap_proxy_transfer_between_connections(): moves all the
+ * data that can be read non blocking from the socket of c_i to the socket of
+ * c_o with splice(2) through a pipe, without copying it to user space.
+ * This is only possible when no filter other than the core network ones sit
+ * on the way (e.g. no TLS) and they hold no pending data, otherwise (or if
+ * the platform lacks splice(2)) APR_ENOTIMPL is returned and the caller is
+ * expected to use ap_proxy_transfer_between_connections() instead. The two
+ * can be mixed freely on the same connections.
+ *
+ * @param r      request_rec of the actual request, whose pool holds the state
+ * @param c_i    inbound connection conn_rec
+ * @param c_o    outbound connection conn_rec
+ * @param splice state for this direction, initialize to NULL before the
+ *               first call
+ * @param name   string for logging from where data was pulled
+ * @param sent   if not NULL will be set to 1 if data was sent through c_o
+ * @param bsize  maximum amount of data spliced in one iteration from c_i
+ * @return       APR_ENOTIMPL if the data must go through the filters, else
+ *               as ap_proxy_transfer_between_connections().
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_between_connections(
+                                                       request_rec *r,
+                                                       conn_rec *c_i,
+                                                       conn_rec *c_o,
+                                                       proxy_splice_t **splice,
+                                                       const char *name,
+                                                       int *sent,
+                                                       apr_off_t bsize);
+
+/*
+ * Return the number of bytes moved by ap_proxy_splice_between_connections()
+ * for the given state (0 if NULL).
+ */
+PROXY_DECLARE(apr_off_t) ap_proxy_splice_bytes(const proxy_splice_t *splice);
+
+typedef struct proxy_tunnel_conn proxy_tunnel_conn_t;
+typedef struct proxy_tunnel_rec proxy_tunnel_rec;
+
+/*
+ * Called when an asynchronous tunnel ends (i.e. after ap_proxy_tunnel_run()
+ * returned SUSPENDED), before the request is finalized and destroyed. This is
+ * where the origin connection should be released or closed.
+ */
+typedef void proxy_tunnel_done_fn(proxy_tunnel_rec *tunnel, int status);
+
+/* A bidirectional tunnel between the client and an origin connection */
+struct proxy_tunnel_rec {
+    request_rec *r;
+    conn_rec *origin;
+    const char *scheme;                 /* for logging */
+    apr_interval_time_t timeout;        /* idle timeout, unlimited if < 0 */
+    apr_interval_time_t async_delay;    /* poll time before suspending */
+    int async;                          /* suspend in the MPM when idle */
+    proxy_tunnel_done_fn *done;         /* end of an asynchronous tunnel */
+    void *baton;                        /* for the caller's use */
+    apr_off_t client_bytes;             /* read from the client */
+    apr_off_t origin_bytes;             /* read from the origin */
+
+    /* private */
+    proxy_tunnel_conn_t *client_conn;
+    proxy_tunnel_conn_t *origin_conn;
+    apr_pollset_t *pollset;
+    apr_pool_t *async_pool;
+    int replied;
+};
+
+/*
+ * Create a tunnel between r->connection and origin. The client connection is
+ * set up for tunneling (non HTTP) data: the request filters are replaced by
+ * the connection ones, mod_reqtimeout is removed and keepalive disabled.
+ * The idle timeout defaults to the shortest of both sockets' timeouts, and
+ * the tunnel is asynchronous if the MPM supports it (and r->connection is not
+ * a secondary connection); the caller may change these before running it.
+ *
+ * @param r      request_rec of the request being tunneled
+ * @param origin origin (backend) connection
+ * @param scheme string for logging
+ * @return       the tunnel, allocated from r->pool
+ */
+PROXY_DECLARE(proxy_tunnel_rec *) ap_proxy_tunnel_create(request_rec *r,
+                                                         conn_rec *origin,
+                                                         const char *scheme);
+
+/*
+ * Forward data both ways until either side closes the connection, the idle
+ * timeout expires, or an error occurs. Data are spliced when possible, see
+ * ap_proxy_splice_between_connections().
+ * In asynchronous mode, no thread is held while the tunnel is idle: once both
+ * sides are drained (and tunnel->async_delay elapsed with no activity) the
+ * sockets are handed to the MPM and SUSPENDED is returned, which the handler
+ * must return too. The tunnel then runs from MPM callbacks and when it ends
+ * tunnel->done is called and the request is finalized.
+ *
+ * @param tunnel the tunnel
+ * @return       SUSPENDED, OK, HTTP_REQUEST_TIME_OUT if the tunnel timed out,
+ *               HTTP_BAD_GATEWAY if the origin never sent anything, or
+ *               HTTP_INTERNAL_SERVER_ERROR.
+ */
+PROXY_DECLARE(int) ap_proxy_tunnel_run(proxy_tunnel_rec *tunnel);
+
 extern module PROXY_DECLARE_DATA proxy_module;
 
 #endif /*MOD_PROXY_H*/
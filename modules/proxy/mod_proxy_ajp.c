@@ -154,6 +154,50 @@ static apr_off_t get_content_length(request_rec * r)
  * http://issues.apache.org/bugzilla/show_bug.cgi?id=37100
  */
 
+/*
+ * The AJP messages of a backend connection, allocated from its pool and
+ * reused by all the requests it serves. The buffer of the response message
+ * is taken from the client connection's bucket allocator so that the data
+ * of CMD_AJP13_SEND_BODY_CHUNK messages can be passed down the filters as
+ * heap buckets without copying; what is left of it must be given back by
+ * ajp_release_conn_msgs() before the backend connection is released.
+ */
+typedef struct {
+    ajp_msg_t *send;        /* forward request and request body data */
+    ajp_msg_t *recv;        /* backend responses */
+    apr_size_t send_size;   /* allocated size of send->buf */
+} ajp_conn_msgs;
+
+static ajp_conn_msgs *ajp_get_conn_msgs(proxy_conn_rec *conn,
+                                        apr_size_t maxsize)
+{
+    ajp_conn_msgs *msgs = conn->data;
+
+    if (!msgs) {
+        msgs = apr_pcalloc(conn->pool, sizeof(*msgs));
+        msgs->recv = apr_pcalloc(conn->pool, sizeof(ajp_msg_t));
+        conn->data = msgs;
+    }
+    if (msgs->send_size < maxsize) {
+        ajp_msg_create(conn->pool, maxsize, &msgs->send);
+        msgs->send_size = maxsize;
+    }
+    msgs->send->max_size = maxsize;
+    msgs->recv->max_size = maxsize;
+
+    return msgs;
+}
+
+static void ajp_release_conn_msgs(proxy_conn_rec *conn)
+{
+    ajp_conn_msgs *msgs = conn->data;
+
+    if (msgs && msgs->recv->buf) {
+        apr_bucket_free(msgs->recv->buf);
+        msgs->recv->buf = NULL;
+    }
+}
+
 /*
  * process the request and write the response.
  */
@@ -169,6 +213,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
     apr_bucket *e;
     apr_bucket_brigade *input_brigade;
     apr_bucket_brigade *output_brigade;
+    ajp_conn_msgs *msgs;
     ajp_msg_t *msg;
     apr_size_t bufsiz = 0;
     char *buff;
@@ -203,6 +248,9 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
        maxsize = AJP_MSG_BUFFER_SZ;
     maxsize = APR_ALIGN(maxsize, 1024);
 
+    msgs = ajp_get_conn_msgs(conn, maxsize);
+    msg = msgs->send;
+
     if (*conn->worker->s->secret)
         secret = conn->worker->s->secret;
 
@@ -211,7 +259,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
      */
 
     /* send request headers */
-    status = ajp_send_header(conn->sock, r, maxsize, uri, secret);
+    status = ajp_send_header(conn->sock, r, msg, uri, secret);
     if (status != APR_SUCCESS) {
         conn->close = 1;
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00868)
@@ -233,16 +281,8 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
         }
     }
 
-    /* allocate an AJP message to store the data of the buckets */
-    bufsiz = maxsize;
-    status = ajp_alloc_data_msg(r->pool, &buff, &bufsiz, &msg);
-    if (status != APR_SUCCESS) {
-        /* We had a failure: Close connection to backend */
-        conn->close = 1;
-        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00869)
-                      "ajp_alloc_data_msg failed");
-        return HTTP_INTERNAL_SERVER_ERROR;
-    }
+    /* reuse the AJP message to store the data of the buckets */
+    ajp_reset_data_msg(msg, &buff, &bufsiz);
 
     /* read the first bloc of data */
     input_brigade = apr_brigade_create(p, r->connection->bucket_alloc);
@@ -330,9 +370,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
     }
 
     /* read the response */
-    conn->data = NULL;
-    status = ajp_read_header(conn->sock, r, maxsize,
-                             (ajp_msg_t **)&(conn->data));
+    status = ajp_read_header(conn->sock, r, maxsize, &msgs->recv);
     if (status != APR_SUCCESS) {
         /* We had a failure: Close connection to backend */
         conn->close = 1;
@@ -364,7 +402,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
         return HTTP_INTERNAL_SERVER_ERROR;
     }
     /* parse the response */
-    result = ajp_parse_type(r, conn->data);
+    result = ajp_parse_type(r, msgs->recv);
     output_brigade = apr_brigade_create(p, r->connection->bucket_alloc);
 
     /*
@@ -405,7 +443,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                             client_failed = 1;
                             break;
                         }
-                        bufsiz = maxsize;
+                        bufsiz = maxsize - AJP_HEADER_SZ;
                         status = apr_brigade_flatten(input_brigade, buff,
                                                      &bufsiz);
                         apr_brigade_cleanup(input_brigade);
@@ -450,7 +488,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                     break;
                 }
                 /* AJP13_SEND_HEADERS: process them */
-                status = ajp_parse_header(r, conf, conn->data);
+                status = ajp_parse_header(r, conf, msgs->recv);
                 if (status != APR_SUCCESS) {
                     backend_failed = 1;
                 }
@@ -469,7 +507,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                 break;
             case CMD_AJP13_SEND_BODY_CHUNK:
                 /* AJP13_SEND_BODY_CHUNK: piece of data */
-                status = ajp_parse_data(r, conn->data, &size, &send_body_chunk_buff);
+                status = ajp_parse_data(r, msgs->recv, &size, &send_body_chunk_buff);
                 if (status == APR_SUCCESS) {
                     /* If we are overriding the errors, we can't put the content
                      * of the page into the brigade.
@@ -503,8 +541,9 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                                 r->status_line = original_status_line;
                             }
 
-                            e = apr_bucket_transient_create(send_body_chunk_buff, size,
-                                                        r->connection->bucket_alloc);
+                            e = ajp_data_to_bucket(msgs->recv,
+                                                   send_body_chunk_buff, size,
+                                                   r->connection->bucket_alloc);
                             APR_BRIGADE_INSERT_TAIL(output_brigade, e);
 
                             if ((conn->worker->s->flush_packets == flush_on) ||
@@ -543,7 +582,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                  * the client, especially as the brigade already contains headers.
                  * So do nothing here, and it will be cleaned up below.
                  */
-                status = ajp_parse_reuse(r, conn->data, &conn_reuse);
+                status = ajp_parse_reuse(r, msgs->recv, &conn_reuse);
                 if (status != APR_SUCCESS) {
                     backend_failed = 1;
                 }
@@ -592,15 +631,14 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
             break;
 
         /* read the response */
-        status = ajp_read_header(conn->sock, r, maxsize,
-                                 (ajp_msg_t **)&(conn->data));
+        status = ajp_read_header(conn->sock, r, maxsize, &msgs->recv);
         if (status != APR_SUCCESS) {
             backend_failed = 1;
             ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, r, APLOGNO(00889)
                           "ajp_read_header failed");
             break;
         }
-        result = ajp_parse_type(r, conn->data);
+        result = ajp_parse_type(r, msgs->recv);
     }
     apr_brigade_destroy(input_brigade);
 
@@ -823,6 +861,7 @@ static int proxy_ajp_handler(request_rec *r, proxy_worker *worker,
     }
 
     /* Do not close the socket */
+    ajp_release_conn_msgs(backend);
     ap_proxy_release_connection(scheme, backend, r->server);
     return status;
 }
@@ -15,18 +15,54 @@
  */
 
 #include "mod_proxy.h"
+#include "mod_status.h"
 #include "apr_dbm.h"
+#include "apr_atomic.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_rwlock.h"
+#endif
 
 module AP_MODULE_DECLARE_DATA proxy_express_module;
 
 static int proxy_available = 0;
 
+/* How often the DBM file is checked for changes */
+#define EXPRESS_MAP_CHECK_INTERVAL apr_time_from_sec(1)
+
+/*
+ * The content of a DBM file, loaded in each child and reloaded when the
+ * file changes.
+ */
+typedef struct {
+    const char *dbmfile;
+    const char *dbmtype;
+    const char *statfile;       /* the file whose mtime is checked */
+    apr_pool_t *pool;           /* parent of the hosts' pools */
+    apr_pool_t *hosts_pool;
+    apr_hash_t *hosts;          /* server name -> backend URL */
+    apr_time_t mtime;
+    apr_time_t checked;
+    apr_time_t loaded;
+#if APR_HAS_THREADS
+    apr_thread_rwlock_t *lock;  /* protects hosts */
+    apr_thread_mutex_t *reload_mutex;
+#endif
+    apr_uint32_t hits;
+    apr_uint32_t misses;
+    apr_uint32_t reloads;
+} express_map_t;
+
 typedef struct {
     const char *dbmfile;
     const char *dbmtype;
     int enabled;
+    express_map_t *map;         /* per child */
 } express_server_conf;
 
+/* Per child: all the maps */
+static apr_array_header_t *express_maps;
+
 static const char *set_dbmfile(cmd_parms *cmd,
                                void *dconf,
                                const char *arg)
@@ -103,21 +139,263 @@ static int post_config(apr_pool_t *p,
     return OK;
 }
 
+/* Load the whole DBM file in a new pool, to be swapped in */
+static apr_status_t express_map_load(express_map_t *map, server_rec *s,
+                                     apr_pool_t **ppool, apr_hash_t **phosts)
+{
+    apr_pool_t *p;
+    apr_hash_t *hosts;
+    apr_dbm_t *db;
+    apr_datum_t key, val;
+    apr_status_t rv;
 
-static int xlate_name(request_rec *r)
+    apr_pool_create(&p, map->pool);
+    apr_pool_tag(p, "proxy_express_hosts");
+
+    rv = apr_dbm_open_ex(&db, map->dbmtype, map->dbmfile, APR_DBM_READONLY,
+                         APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10177)
+                     "proxy_express: can't open DBM file: %s (%s)",
+                     map->dbmfile, map->dbmtype);
+        apr_pool_destroy(p);
+        return rv;
+    }
+
+    hosts = apr_hash_make(p);
+    for (rv = apr_dbm_firstkey(db, &key);
+         rv == APR_SUCCESS && key.dptr;
+         rv = apr_dbm_nextkey(db, &key)) {
+        rv = apr_dbm_fetch(db, key, &val);
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        if (val.dptr) {
+            apr_hash_set(hosts, apr_pstrmemdup(p, key.dptr, key.dsize),
+                         key.dsize, apr_pstrmemdup(p, val.dptr, val.dsize));
+        }
+    }
+    apr_dbm_close(db);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10178)
+                     "proxy_express: error reading DBM file: %s (%s)",
+                     map->dbmfile, map->dbmtype);
+        apr_pool_destroy(p);
+        return rv;
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10179)
+                 "proxy_express: loaded %u entries from DBM file: %s (%s)",
+                 apr_hash_count(hosts), map->dbmfile, map->dbmtype);
+
+    *ppool = p;
+    *phosts = hosts;
+    return APR_SUCCESS;
+}
+
+/* (Re)load the map if the file changed, at most once per check interval */
+static void express_map_refresh(express_map_t *map, request_rec *r)
+{
+    apr_time_t now = r->request_time;
+    apr_finfo_t finfo;
+    apr_pool_t *p, *old = NULL;
+    apr_hash_t *hosts;
+    int first;
+
+    if (map->checked && now - map->checked < EXPRESS_MAP_CHECK_INTERVAL) {
+        return;
+    }
+#if APR_HAS_THREADS
+    /* Only one thread checks, the others use the current map meanwhile */
+    if (apr_thread_mutex_trylock(map->reload_mutex) != APR_SUCCESS) {
+        if (map->hosts) {
+            return;
+        }
+        apr_thread_mutex_lock(map->reload_mutex);
+    }
+#endif
+
+    if (map->checked && now - map->checked < EXPRESS_MAP_CHECK_INTERVAL) {
+        goto unlock;
+    }
+    first = !map->checked;
+    map->checked = now;
+
+    if (apr_stat(&finfo, map->statfile, APR_FINFO_MTIME,
+                 r->pool) != APR_SUCCESS) {
+        finfo.mtime = 0;
+    }
+    if (!first && finfo.mtime == map->mtime) {
+        goto unlock;
+    }
+    /* Don't retry (and log) before the file changes again on failure */
+    map->mtime = finfo.mtime;
+    if (express_map_load(map, r->server, &p, &hosts) != APR_SUCCESS) {
+        goto unlock;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_rwlock_wrlock(map->lock);
+#endif
+    old = map->hosts_pool;
+    map->hosts_pool = p;
+    map->hosts = hosts;
+#if APR_HAS_THREADS
+    apr_thread_rwlock_unlock(map->lock);
+#endif
+    map->loaded = now;
+    apr_atomic_inc32(&map->reloads);
+
+    if (old) {
+        apr_pool_destroy(old);
+    }
+
+unlock:
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(map->reload_mutex);
+#endif
+    return;
+}
+
+/* Return the backend for name (allocated from r->pool), or NULL */
+static char *express_map_lookup(express_map_t *map, request_rec *r,
+                                const char *name)
+{
+    const char *val = NULL;
+    char *backend = NULL;
+
+    express_map_refresh(map, r);
+
+#if APR_HAS_THREADS
+    apr_thread_rwlock_rdlock(map->lock);
+#endif
+    if (map->hosts) {
+        val = apr_hash_get(map->hosts, name, APR_HASH_KEY_STRING);
+        if (val) {
+            backend = apr_pstrdup(r->pool, val);
+        }
+    }
+#if APR_HAS_THREADS
+    apr_thread_rwlock_unlock(map->lock);
+#endif
+
+    apr_atomic_inc32(backend ? &map->hits : &map->misses);
+    return backend;
+}
+
+static void child_init(apr_pool_t *p, server_rec *main_s)
+{
+    apr_hash_t *maps = apr_hash_make(p);
+    server_rec *s;
+
+    express_maps = apr_array_make(p, 1, sizeof(express_map_t *));
+
+    /* One map per DBM file, shared by the vhosts using it */
+    for (s = main_s; s; s = s->next) {
+        express_server_conf *sconf;
+        const char *key, *used1, *used2;
+        express_map_t *map;
+
+        sconf = ap_get_module_config(s->module_config, &proxy_express_module);
+        if (!sconf->enabled || !sconf->dbmfile) {
+            continue;
+        }
+
+        key = apr_pstrcat(p, sconf->dbmtype, ":", sconf->dbmfile, NULL);
+        map = apr_hash_get(maps, key, APR_HASH_KEY_STRING);
+        if (!map) {
+            map = apr_pcalloc(p, sizeof(*map));
+            map->dbmfile = sconf->dbmfile;
+            map->dbmtype = sconf->dbmtype;
+            map->statfile = sconf->dbmfile;
+            if (apr_dbm_get_usednames_ex(p, map->dbmtype, map->dbmfile,
+                                         &used1, &used2) == APR_SUCCESS
+                && used1) {
+                map->statfile = used1;
+            }
+            apr_pool_create(&map->pool, p);
+            apr_pool_tag(map->pool, "proxy_express_map");
+#if APR_HAS_THREADS
+            apr_thread_rwlock_create(&map->lock, p);
+            apr_thread_mutex_create(&map->reload_mutex,
+                                    APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+            apr_hash_set(maps, key, APR_HASH_KEY_STRING, map);
+            APR_ARRAY_PUSH(express_maps, express_map_t *) = map;
+        }
+        sconf->map = map;
+    }
+}
+
+static int express_status_hook(request_rec *r, int flags)
 {
     int i;
+
+    if (!express_maps || express_maps->nelts == 0) {
+        return OK;
+    }
+
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("<hr />\n<h1>Proxy Express Maps (this child)</h1>\n\n"
+                 "<table border=\"0\"><tr><th>File</th><th>Type</th>"
+                 "<th>Entries</th><th>Hits</th><th>Misses</th>"
+                 "<th>Reloads</th><th>Loaded</th></tr>\n", r);
+    }
+    for (i = 0; i < express_maps->nelts; i++) {
+        express_map_t *map = APR_ARRAY_IDX(express_maps, i, express_map_t *);
+        unsigned int entries;
+        char date[APR_RFC822_DATE_LEN];
+
+#if APR_HAS_THREADS
+        apr_thread_rwlock_rdlock(map->lock);
+#endif
+        entries = map->hosts ? apr_hash_count(map->hosts) : 0;
+#if APR_HAS_THREADS
+        apr_thread_rwlock_unlock(map->lock);
+#endif
+        if (map->loaded) {
+            apr_rfc822_date(date, map->loaded);
+        }
+        else {
+            apr_cpystrn(date, "-", sizeof(date));
+        }
+
+        if (!(flags & AP_STATUS_SHORT)) {
+            ap_rprintf(r, "<tr><td>%s</td><td>%s</td><td>%u</td><td>%u</td>"
+                       "<td>%u</td><td>%u</td><td>%s</td></tr>\n",
+                       ap_escape_html(r->pool, map->dbmfile),
+                       ap_escape_html(r->pool, map->dbmtype), entries,
+                       apr_atomic_read32(&map->hits),
+                       apr_atomic_read32(&map->misses),
+                       apr_atomic_read32(&map->reloads), date);
+        }
+        else {
+            ap_rprintf(r, "ProxyExpress[%d]File: %s\n"
+                       "ProxyExpress[%d]Entries: %u\n"
+                       "ProxyExpress[%d]Hits: %u\n"
+                       "ProxyExpress[%d]Misses: %u\n"
+                       "ProxyExpress[%d]Reloads: %u\n",
+                       i, map->dbmfile, i, entries,
+                       i, apr_atomic_read32(&map->hits),
+                       i, apr_atomic_read32(&map->misses),
+                       i, apr_atomic_read32(&map->reloads));
+        }
+    }
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("</table>\n", r);
+    }
+
+    return OK;
+}
+
+
+static int xlate_name(request_rec *r)
+{
     const char *name;
     char *backend = NULL;
-    apr_dbm_t *db;
-    apr_status_t rv;
-    apr_datum_t key, val;
-    struct proxy_alias *ralias;
-    proxy_dir_conf *dconf;
     express_server_conf *sconf;
 
     sconf = ap_get_module_config(r->server->module_config, &proxy_express_module);
-    dconf = ap_get_module_config(r->per_dir_config, &proxy_module);
 
     if (!sconf->enabled) {
         return DECLINED;
@@ -129,27 +407,16 @@ static int xlate_name(request_rec *r)
         return DECLINED;
     }
 
-    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01002)
-                  "proxy_express: Opening DBM file: %s (%s)",
-                  sconf->dbmfile, sconf->dbmtype);
-    rv = apr_dbm_open_ex(&db, sconf->dbmtype, sconf->dbmfile, APR_DBM_READONLY,
-                         APR_OS_DEFAULT, r->pool);
-    if (rv != APR_SUCCESS) {
+    if (!sconf->map) {
         return DECLINED;
     }
 
     name = ap_get_server_name(r);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01003)
                   "proxy_express: looking for %s", name);
-    key.dptr = (char *)name;
-    key.dsize = strlen(key.dptr);
 
-    rv = apr_dbm_fetch(db, key, &val);
-    if (rv == APR_SUCCESS) {
-        backend = apr_pstrmemdup(r->pool, val.dptr, val.dsize);
-    }
-    apr_dbm_close(db);
-    if (rv != APR_SUCCESS || !backend) {
+    backend = express_map_lookup(sconf->map, r, name);
+    if (!backend) {
         return DECLINED;
     }
 
@@ -162,33 +429,56 @@ static int xlate_name(request_rec *r)
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01005)
                   "proxy_express: rewritten as: %s", r->filename);
 
-    ralias = (struct proxy_alias *)dconf->raliases->elts;
-    /*
-     * See if we have already added a ProxyPassReverse entry
-     * for this host... If so, don't do it again.
-     */
-    /*
-     * NOTE: dconf is process specific so this will only
-     *       work as long as we maintain that this process
-     *       or thread is handling the backend
-     */
-    for (i = 0; i < dconf->raliases->nelts; i++, ralias++) {
+    /* The ProxyPassReverse entry is added by fixup() */
+    ap_set_module_config(r->request_config, &proxy_express_module, backend);
+    return OK;
+}
+
+/*
+ * Add a ProxyPassReverse entry for the backend, unless one is configured
+ * already.  The dir config is shared by the threads and not touched, the
+ * entry goes to the per-request copy of the reverse proxy config (created
+ * by mod_proxy's own fixup when ProxyPassInterpolateEnv is on).
+ */
+static int fixup(request_rec *r)
+{
+    const char *backend;
+    struct proxy_alias *ralias;
+    proxy_dir_conf *dconf;
+    proxy_req_conf *rconf;
+    apr_array_header_t *raliases;
+    int i;
+
+    backend = ap_get_module_config(r->request_config, &proxy_express_module);
+    if (!backend || r->proxyreq != PROXYREQ_REVERSE) {
+        return DECLINED;
+    }
+
+    dconf = ap_get_module_config(r->per_dir_config, &proxy_module);
+    rconf = ap_get_module_config(r->request_config, &proxy_module);
+    raliases = rconf ? rconf->raliases : dconf->raliases;
+
+    ralias = (struct proxy_alias *)raliases->elts;
+    for (i = 0; i < raliases->nelts; i++, ralias++) {
         if (strcasecmp(backend, ralias->real) == 0) {
-            ralias = NULL;
-            break;
+            return DECLINED;
         }
     }
 
-    /* Didn't find one... add it */
-    if (!ralias) {
-        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01006)
-                      "proxy_express: adding PPR entry");
-        ralias = apr_array_push(dconf->raliases);
-        ralias->fake = "/";
-        ralias->real = apr_pstrdup(dconf->raliases->pool, backend);
-        ralias->flags = 0;
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01006)
+                  "proxy_express: adding PPR entry");
+    if (!rconf) {
+        rconf = apr_palloc(r->pool, sizeof(proxy_req_conf));
+        rconf->cookie_paths = dconf->cookie_paths;
+        rconf->cookie_domains = dconf->cookie_domains;
+        ap_set_module_config(r->request_config, &proxy_module, rconf);
     }
-    return OK;
+    rconf->raliases = apr_array_copy(r->pool, raliases);
+    ralias = apr_array_push(rconf->raliases);
+    ralias->fake = "/";
+    ralias->real = backend;
+    ralias->flags = 0;
+    return DECLINED;
 }
 
 static const command_rec command_table[] = {
@@ -205,6 +495,10 @@ static void register_hooks(apr_pool_t *p)
 {
     ap_hook_post_config(post_config, NULL, NULL, APR_HOOK_LAST);
     ap_hook_translate_name(xlate_name, NULL, NULL, APR_HOOK_FIRST);
+    ap_hook_fixups(fixup, NULL, NULL, APR_HOOK_LAST);
+    ap_hook_child_init(child_init, NULL, NULL, APR_HOOK_MIDDLE);
+    APR_OPTIONAL_HOOK(ap, status_hook, express_status_hook, NULL, NULL,
+                      APR_HOOK_MIDDLE);
 }
 
 /* the main config structure */
@@ -254,6 +254,9 @@ typedef struct {
 
     rb_methods rb_method;
 
+    /* The span of the backend call, up to the response header */
+    ap_trace_span_t span;
+
     int expecting_100;
     unsigned int do_100_continue:1,
                  prefetch_nonblocking:1;
@@ -1613,6 +1616,9 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
             continue;
         }
 
+        /* The backend call's span ends with the final response header */
+        ap_trace_span_end(r, &req->span, proxy_status);
+
         /* Moved the fixups of Date headers and those affected by
          * ProxyPassReverse/etc from here to ap_proxy_read_headers
          */
@@ -2065,6 +2071,12 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
      */
     req->input_brigade = apr_brigade_create(p, req->bucket_alloc);
     req->header_brigade = apr_brigade_create(p, req->bucket_alloc);
+
+    /* Begun before the header is built, for its traceparent */
+    ap_trace_span_begin(r, &req->span, NULL, "proxy backend",
+                        AP_TRACE_SPAN_CLIENT);
+    req->span.target = url;
+
     if ((status = ap_proxy_http_prefetch(req, uri, locurl)) != OK)
         goto cleanup;
 
@@ -2096,14 +2108,24 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
 
         /* Step Two: Make the Connection */
         if (ap_proxy_check_connection(proxy_function, backend, r->server, 1,
-                                      PROXY_CHECK_CONN_EMPTY)
-                && ap_proxy_connect_backend(proxy_function, backend, worker,
-                                            r->server)) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01114)
-                          "HTTP: failed to make connection to backend: %s",
-                          backend->hostname);
-            status = HTTP_SERVICE_UNAVAILABLE;
-            break;
+                                      PROXY_CHECK_CONN_EMPTY)) {
+            ap_trace_span_t span;
+            int failed;
+
+            ap_trace_span_begin(r, &span, &req->span, "proxy connect",
+                                AP_TRACE_SPAN_INTERNAL);
+            span.target = backend->hostname;
+            failed = ap_proxy_connect_backend(proxy_function, backend, worker,
+                                              r->server);
+            span.outcome = failed ? "failed" : NULL;
+            ap_trace_span_end(r, &span, 0);
+            if (failed) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01114)
+                              "HTTP: failed to make connection to backend: %s",
+                              backend->hostname);
+                status = HTTP_SERVICE_UNAVAILABLE;
+                break;
+            }
         }
 
         /* Step Three: Create conn_rec */
@@ -2147,6 +2169,8 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
 
     /* Step Six: Clean Up */
 cleanup:
+    /* Noop if the response header was received */
+    ap_trace_span_end(r, &req->span, status == OK ? 0 : status);
     if (req->backend) {
         if (status != OK)
             req->backend->close = 1;
@@ -29,6 +29,9 @@
 #if APR_HAVE_UNISTD_H
 #include <unistd.h>         /* for getpid() */
 #endif
+#ifdef HAVE_SPLICE
+#include <fcntl.h>          /* for splice() */
+#endif
 
 #if (APR_MAJOR_VERSION < 1)
 #undef apr_socket_create
@@ -204,16 +207,9 @@ PROXY_DECLARE(void) ap_proxy_c2hex(int ch, char *x)
  * and encodes those which must be encoded, and does not touch
  * those which must not be touched.
  */
-PROXY_DECLARE(char *)ap_proxy_canonenc(apr_pool_t *p, const char *x, int len,
-                                       enum enctype t, int forcedec,
-                                       int proxyreq)
-{
-    int i, j, ch;
-    char *y;
-    char *allowed;  /* characters which should not be encoded */
-    char *reserved; /* characters which much not be en/de-coded */
-
-/*
+/* Characters which should not be encoded by ap_proxy_canonenc(), one bit
+ * per enctype, initialized by proxy_util_register_hooks().
+ *
  * N.B. in addition to :@&=, this allows ';' in an http path
  * and '?' in an ftp path -- this may be revised
  *
@@ -221,38 +217,61 @@ PROXY_DECLARE(char *)ap_proxy_canonenc(apr_pool_t *p, const char *x, int len,
  * it may be form-encoded. (Although RFC 1738 doesn't allow this -
  * it only permits ; / ? : @ = & as reserved chars.)
  */
-    if (t == enc_path) {
-        allowed = "~$-_.+!*'(),;:@&=";
-    }
-    else if (t == enc_search) {
-        allowed = "$-_.!*'(),;:@&=";
-    }
-    else if (t == enc_user) {
-        allowed = "$-_.+!*'(),;@&=";
-    }
-    else if (t == enc_fpath) {
-        allowed = "$-_.+!*'(),?:@&=";
-    }
-    else {            /* if (t == enc_parm) */
-        allowed = "$-_.+!*'(),?/:@&=";
+static unsigned char canonenc_allowed[256];
+
+static void init_canonenc_allowed(void)
+{
+    static const char *const allowed[] = {
+        "~$-_.+!*'(),;:@&=",    /* enc_path */
+        "$-_.!*'(),;:@&=",      /* enc_search */
+        "$-_.+!*'(),;@&=",      /* enc_user */
+        "$-_.+!*'(),?:@&=",     /* enc_fpath */
+        "$-_.+!*'(),?/:@&="     /* enc_parm */
+    };
+    int c, t;
+
+    for (c = 0; c < 256; ++c) {
+        for (t = enc_path; t <= enc_parm; ++t) {
+            /* strchr() finds the NUL too, which is thus "allowed" */
+            if (apr_isalnum(c) || strchr(allowed[t], c)) {
+                canonenc_allowed[c] |= 1 << t;
+            }
+        }
     }
+}
+
+/*
+ * Convert a URL-encoded string to canonical form.
+ * It decodes characters which need not be encoded,
+ * and encodes those which must be encoded, and does not touch
+ * those which must not be touched.
+ */
+PROXY_DECLARE(char *)ap_proxy_canonenc(apr_pool_t *p, const char *x, int len,
+                                       enum enctype t, int forcedec,
+                                       int proxyreq)
+{
+    int i, j, ch;
+    char *y;
+    unsigned char allowed = 1 << t; /* characters which should not be encoded */
+    char reserved;  /* character which much not be en/de-coded */
+    int decode = (forcedec || (proxyreq && proxyreq != PROXYREQ_REVERSE));
 
     if (t == enc_path) {
-        reserved = "/";
+        reserved = '/';
     }
     else if (t == enc_search) {
-        reserved = "+";
+        reserved = '+';
     }
     else {
-        reserved = "";
+        reserved = '\0';
     }
 
     y = apr_palloc(p, 3 * len + 1);
 
     for (i = 0, j = 0; i < len; i++, j++) {
 /* always handle '/' first */
-        ch = x[i];
-        if (strchr(reserved, ch)) {
+        ch = (unsigned char)x[i];
+        if (ch == reserved || ch == '\0') {
             y[j] = ch;
             continue;
         }
@@ -260,20 +279,20 @@ PROXY_DECLARE(char *)ap_proxy_canonenc(apr_pool_t *p, const char *x, int len,
  * decode it if not already done. do not decode reverse proxied URLs
  * unless specifically forced
  */
-        if ((forcedec || (proxyreq && proxyreq != PROXYREQ_REVERSE)) && ch == '%') {
+        if (decode && ch == '%') {
             if (!apr_isxdigit(x[i + 1]) || !apr_isxdigit(x[i + 2])) {
                 return NULL;
             }
-            ch = ap_proxy_hex2c(&x[i + 1]);
+            ch = (unsigned char)ap_proxy_hex2c(&x[i + 1]);
             i += 2;
-            if (ch != 0 && strchr(reserved, ch)) {  /* keep it encoded */
+            if (ch != 0 && ch == reserved) {  /* keep it encoded */
                 ap_proxy_c2hex(ch, &y[j]);
                 j += 2;
                 continue;
             }
         }
 /* recode it, if necessary */
-        if (!apr_isalnum(ch) && !strchr(allowed, ch)) {
+        if (!(canonenc_allowed[ch] & allowed)) {
             ap_proxy_c2hex(ch, &y[j]);
             j += 2;
         }
@@ -829,6 +848,7 @@ PROXY_DECLARE(const char *) ap_proxy_location_reverse_map(request_rec *r,
                               proxy_dir_conf *conf, const char *url)
 {
     proxy_req_conf *rconf;
+    apr_array_header_t *raliases;
     struct proxy_alias *ent;
     int i, l1, l1_orig, l2;
     char *u;
@@ -843,14 +863,16 @@ PROXY_DECLARE(const char *) ap_proxy_location_reverse_map(request_rec *r,
     }
 
     l1_orig = strlen(url);
-    if (conf->interpolate_env == 1) {
-        rconf = ap_get_module_config(r->request_config, &proxy_module);
-        ent = (struct proxy_alias *)rconf->raliases->elts;
+    /* Per-request copy, interpolated or with entries added at runtime */
+    rconf = ap_get_module_config(r->request_config, &proxy_module);
+    if (rconf && rconf->raliases) {
+        raliases = rconf->raliases;
     }
     else {
-        ent = (struct proxy_alias *)conf->raliases->elts;
+        raliases = conf->raliases;
     }
-    for (i = 0; i < conf->raliases->nelts; i++) {
+    ent = (struct proxy_alias *)raliases->elts;
+    for (i = 0; i < raliases->nelts; i++) {
         proxy_server_conf *sconf = (proxy_server_conf *)
             ap_get_module_config(r->server->module_config, &proxy_module);
         proxy_balancer *balancer;
@@ -3656,7 +3678,8 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
     apr_bucket *e;
     int do_100_continue;
     conn_rec *origin = p_conn->connection;
-    const char *fpr1;
+    const char *fpr1, *traceparent;
+    int drop_tracestate = 0;
     proxy_dir_conf *dconf = ap_get_module_config(r->per_dir_config, &proxy_module);
 
     /*
@@ -3830,6 +3853,15 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
         }
     }
 
+    /* With TraceContext on, the backend's spans are children of this
+     * request's (or of the client span of this call); the tracestate is
+     * forwarded as received, unless this request began a new trace.
+     */
+    if ((traceparent = ap_trace_traceparent(r))) {
+        apr_table_setn(r->headers_in, "traceparent", traceparent);
+        drop_tracestate = !ap_trace_get(r)->remote;
+    }
+
     proxy_run_fixups(r);
     if (ap_proxy_clear_connection(r, r->headers_in) < 0) {
         return HTTP_BAD_REQUEST;
@@ -3853,6 +3885,10 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
             || !ap_cstr_casecmp(headers_in[counter].key, "Trailer")
             || !ap_cstr_casecmp(headers_in[counter].key, "Upgrade")
 
+            /* The tracestate of another trace than ours */
+            || (drop_tracestate
+                && !ap_cstr_casecmp(headers_in[counter].key, "tracestate"))
+
             ) {
             continue;
         }
@@ -4022,16 +4058,16 @@ PROXY_DECLARE(apr_status_t) ap_proxy_buckets_lifetime_transform(request_rec *r,
     return rv;
 }
 
-PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
-                                                       request_rec *r,
-                                                       conn_rec *c_i,
-                                                       conn_rec *c_o,
-                                                       apr_bucket_brigade *bb_i,
-                                                       apr_bucket_brigade *bb_o,
-                                                       const char *name,
-                                                       int *sent,
-                                                       apr_off_t bsize,
-                                                       int after)
+static apr_status_t proxy_transfer(request_rec *r,
+                                   conn_rec *c_i,
+                                   conn_rec *c_o,
+                                   apr_bucket_brigade *bb_i,
+                                   apr_bucket_brigade *bb_o,
+                                   const char *name,
+                                   int *sent,
+                                   apr_off_t bsize,
+                                   int after,
+                                   apr_off_t *bytes)
 {
     apr_status_t rv;
 #ifdef DEBUGGING
@@ -4060,6 +4096,13 @@ PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
             if (sent) {
                 *sent = 1;
             }
+            if (bytes) {
+                apr_off_t n = -1;
+                apr_brigade_length(bb_i, 0, &n);
+                if (n > 0) {
+                    *bytes += n;
+                }
+            }
             ap_proxy_buckets_lifetime_transform(r, bb_i, bb_o);
             if (!after) {
                 apr_bucket *b;
@@ -4106,6 +4149,597 @@ PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
     return rv;
 }
 
+PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
+                                                       request_rec *r,
+                                                       conn_rec *c_i,
+                                                       conn_rec *c_o,
+                                                       apr_bucket_brigade *bb_i,
+                                                       apr_bucket_brigade *bb_o,
+                                                       const char *name,
+                                                       int *sent,
+                                                       apr_off_t bsize,
+                                                       int after)
+{
+    return proxy_transfer(r, c_i, c_o, bb_i, bb_o, name, sent, bsize, after,
+                          NULL);
+}
+
+struct proxy_splice_t {
+    int fds[2];                 /* pipe, or -1 if not usable */
+    apr_off_t bytes;            /* total spliced */
+#ifdef HAVE_SPLICE
+    APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_in) *logio_add_bytes_in;
+    APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_out) *logio_add_bytes_out;
+#endif
+};
+
+#ifdef HAVE_SPLICE
+
+static apr_status_t proxy_splice_cleanup(void *data)
+{
+    proxy_splice_t *sp = data;
+
+    if (sp->fds[0] >= 0) {
+        close(sp->fds[0]);
+        close(sp->fds[1]);
+        sp->fds[0] = sp->fds[1] = -1;
+    }
+    return APR_SUCCESS;
+}
+
+static proxy_splice_t *proxy_splice_create(request_rec *r)
+{
+    proxy_splice_t *sp = apr_pcalloc(r->pool, sizeof(*sp));
+
+    if (pipe2(sp->fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        ap_log_rerror(APLOG_MARK, APLOG_INFO, errno, r, APLOGNO(10164)
+                      "can't create pipe for splicing, "
+                      "tunneling through the filters");
+        sp->fds[0] = sp->fds[1] = -1;
+        return sp;
+    }
+    apr_pool_cleanup_register(r->pool, sp, proxy_splice_cleanup,
+                              apr_pool_cleanup_null);
+
+    sp->logio_add_bytes_in = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_in);
+    sp->logio_add_bytes_out = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_out);
+
+    return sp;
+}
+
+/*
+ * Splicing bypasses the filters, so it can only be used when the only ones
+ * on the way are the core network filters (and mod_logio's input filter,
+ * whose accounting we do by ourselves), with nothing pending in them.
+ */
+static int proxy_splice_usable(conn_rec *c_i, conn_rec *c_o)
+{
+    ap_filter_t *f;
+    apr_interval_time_t timeout;
+
+    f = c_i->input_filters;
+    if (f && f->frec->name
+          && ap_cstr_casecmp(f->frec->name, "LOG_INPUT_OUTPUT") == 0) {
+        f = f->next;
+    }
+    if (!f || f->frec != ap_core_input_filter_handle) {
+        return 0;
+    }
+    f = c_o->output_filters;
+    if (!f || f->frec != ap_core_output_filter_handle) {
+        return 0;
+    }
+
+    /* Reading must not block once the socket is drained */
+    apr_socket_timeout_get(ap_get_conn_socket(c_i), &timeout);
+    if (timeout < 0) {
+        return 0;
+    }
+
+    return (ap_filter_input_pending(c_i) != OK
+            && ap_filter_output_pending(c_o) != OK);
+}
+
+/* Move len bytes from the pipe to the outgoing socket */
+static apr_status_t proxy_splice_out(request_rec *r, proxy_splice_t *sp,
+                                     apr_socket_t *s_o, int fd_o,
+                                     apr_size_t len)
+{
+    apr_status_t rv;
+
+    while (len > 0) {
+        ssize_t n = splice(sp->fds[0], NULL, fd_o, NULL, len,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            len -= n;
+        }
+        else if (n == 0) {
+            return APR_EPIPE;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            apr_interval_time_t timeout;
+            apr_pollfd_t pfd;
+            apr_int32_t nfds;
+
+            memset(&pfd, 0, sizeof(pfd));
+            pfd.p = r->pool;
+            pfd.desc_type = APR_POLL_SOCKET;
+            pfd.desc.s = s_o;
+            pfd.reqevents = APR_POLLOUT;
+            apr_socket_timeout_get(s_o, &timeout);
+            do {
+                rv = apr_poll(&pfd, 1, &nfds, timeout);
+            } while (APR_STATUS_IS_EINTR(rv));
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+        }
+        else if (errno != EINTR) {
+            return errno;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+#endif /* HAVE_SPLICE */
+
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_between_connections(
+                                                       request_rec *r,
+                                                       conn_rec *c_i,
+                                                       conn_rec *c_o,
+                                                       proxy_splice_t **splice,
+                                                       const char *name,
+                                                       int *sent,
+                                                       apr_off_t bsize)
+{
+#ifdef HAVE_SPLICE
+    proxy_splice_t *sp = *splice;
+    apr_socket_t *s_i, *s_o;
+    apr_os_sock_t fd_i, fd_o;
+    apr_status_t rv;
+    apr_off_t total = 0;
+
+    if (!sp) {
+        sp = *splice = proxy_splice_create(r);
+    }
+    if (sp->fds[0] < 0 || !proxy_splice_usable(c_i, c_o)) {
+        return APR_ENOTIMPL;
+    }
+    if (c_o->aborted) {
+        return APR_EPIPE;
+    }
+
+    s_i = ap_get_conn_socket(c_i);
+    s_o = ap_get_conn_socket(c_o);
+    apr_os_sock_get(&fd_i, s_i);
+    apr_os_sock_get(&fd_o, s_o);
+
+    do {
+        ssize_t n = splice(fd_i, NULL, sp->fds[1], NULL, (apr_size_t)bsize,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            if (sent) {
+                *sent = 1;
+            }
+            /* Always leave the pipe empty, so that the caller can switch
+             * to ap_proxy_transfer_between_connections() at any time.
+             */
+            rv = proxy_splice_out(r, sp, s_o, fd_o, n);
+            if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10165)
+                              "ap_proxy_splice_between_connections: "
+                              "error on %s - splice to socket", name);
+                break;
+            }
+            total += n;
+        }
+        else if (n == 0) {
+            rv = APR_EOF;
+        }
+        else {
+            rv = errno;
+            if (APR_STATUS_IS_EINTR(rv)) {
+                rv = APR_SUCCESS;
+            }
+            else if (!APR_STATUS_IS_EAGAIN(rv)) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(10166)
+                              "ap_proxy_splice_between_connections: "
+                              "error on %s - splice from socket", name);
+            }
+        }
+    } while (rv == APR_SUCCESS);
+
+    if (total) {
+        sp->bytes += total;
+        if (sp->logio_add_bytes_in) {
+            sp->logio_add_bytes_in(c_i, total);
+        }
+        if (sp->logio_add_bytes_out) {
+            sp->logio_add_bytes_out(c_o, total);
+        }
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, rv, r,
+                  "ap_proxy_splice_between_connections complete: "
+                  "%" APR_OFF_T_FMT " bytes from %s", total, name);
+
+    if (APR_STATUS_IS_EAGAIN(rv)) {
+        rv = APR_SUCCESS;
+    }
+
+    return rv;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
+PROXY_DECLARE(apr_off_t) ap_proxy_splice_bytes(const proxy_splice_t *splice)
+{
+    return splice ? splice->bytes : 0;
+}
+
+/*
+ * Tunnels (CONNECT, upgraded connections)
+ */
+
+/* Splice up to a (default) pipe's capacity at once */
+#define PROXY_TUNNEL_SPLICE_SIZE (64 * 1024)
+
+/* One side of a tunnel, reading from c and writing to the other side */
+struct proxy_tunnel_conn {
+    conn_rec *c;
+    const char *name;
+    apr_bucket_brigade *bb;
+    proxy_splice_t *splice;
+    apr_off_t *bytes;
+    struct proxy_tunnel_conn *other;
+};
+
+static proxy_tunnel_conn_t *proxy_tunnel_conn_make(request_rec *r,
+                                                   conn_rec *c,
+                                                   const char *name,
+                                                   apr_off_t *bytes)
+{
+    proxy_tunnel_conn_t *tc = apr_pcalloc(r->pool, sizeof(*tc));
+
+    tc->c = c;
+    tc->name = name;
+    tc->bb = apr_brigade_create(r->pool, c->bucket_alloc);
+    tc->bytes = bytes;
+
+    return tc;
+}
+
+PROXY_DECLARE(proxy_tunnel_rec *) ap_proxy_tunnel_create(request_rec *r,
+                                                         conn_rec *origin,
+                                                         const char *scheme)
+{
+    conn_rec *c = r->connection;
+    proxy_tunnel_rec *tunnel = apr_pcalloc(r->pool, sizeof(*tunnel));
+    apr_interval_time_t timeout;
+    int mpm_can_poll = 0;
+
+    tunnel->r = r;
+    tunnel->origin = origin;
+    tunnel->scheme = scheme;
+    tunnel->client_conn = proxy_tunnel_conn_make(r, c, "client",
+                                                 &tunnel->client_bytes);
+    tunnel->origin_conn = proxy_tunnel_conn_make(r, origin, "backend",
+                                                 &tunnel->origin_bytes);
+    tunnel->client_conn->other = tunnel->origin_conn;
+    tunnel->origin_conn->other = tunnel->client_conn;
+
+    /* Idle timeout defaults to the shortest of the sockets' */
+    apr_socket_timeout_get(ap_get_conn_socket(c), &tunnel->timeout);
+    apr_socket_timeout_get(ap_get_conn_socket(origin), &timeout);
+    if (timeout >= 0 && (tunnel->timeout < 0 || timeout < tunnel->timeout)) {
+        tunnel->timeout = timeout;
+    }
+
+    /* Secondary connections (e.g. HTTP/2 streams) can't be polled by
+     * the MPM, they share their master's socket.
+     */
+    if (!c->master) {
+        ap_mpm_query(AP_MPMQ_CAN_POLL, &mpm_can_poll);
+        tunnel->async = mpm_can_poll;
+    }
+
+    /* The tunneled stream is not HTTP, request timeouts don't apply */
+    ap_remove_input_filter_byhandle(c->input_filters, "reqtimeout");
+
+    /* We are now acting as a tunnel - the input/output filter stacks should
+     * not contain any non-connection filters.
+     */
+    r->output_filters = c->output_filters;
+    r->proto_output_filters = c->output_filters;
+    r->input_filters = c->input_filters;
+    r->proto_input_filters = c->input_filters;
+
+    /* This handler takes care of the entire connection; make it so that
+     * nothing else is attempted on the connection after returning.
+     */
+    c->keepalive = AP_CONN_CLOSE;
+
+    return tunnel;
+}
+
+/* Forward everything readable from in to the other side, non-zero when
+ * the tunnel is done (closed or in error).
+ */
+static int proxy_tunnel_forward(proxy_tunnel_rec *tunnel,
+                                proxy_tunnel_conn_t *in)
+{
+    request_rec *r = tunnel->r;
+    proxy_tunnel_conn_t *out = in->other;
+    int *sent = (in == tunnel->origin_conn) ? &tunnel->replied : NULL;
+    apr_off_t spliced = ap_proxy_splice_bytes(in->splice);
+    apr_status_t rv;
+
+    rv = ap_proxy_splice_between_connections(r, in->c, out->c, &in->splice,
+                                             in->name, sent,
+                                             PROXY_TUNNEL_SPLICE_SIZE);
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        rv = proxy_transfer(r, in->c, out->c, in->bb, out->bb, in->name,
+                            sent, AP_IOBUFSIZE, 1, in->bytes);
+    }
+    *in->bytes += ap_proxy_splice_bytes(in->splice) - spliced;
+
+    return rv != APR_SUCCESS;
+}
+
+/* Poll and forward until the tunnel is done or nothing happened for the
+ * given timeout; in the latter case *idle is set if not NULL, otherwise
+ * the tunnel is done (timed out).
+ */
+static int proxy_tunnel_pump(proxy_tunnel_rec *tunnel,
+                             apr_interval_time_t timeout, int *idle)
+{
+    request_rec *r = tunnel->r;
+    const apr_pollfd_t *signalled;
+    apr_int32_t pollcnt, pi;
+    apr_status_t rv;
+    int done = 0;
+
+    if (!tunnel->pollset) {
+        apr_pollfd_t pfd;
+
+        rv = apr_pollset_create(&tunnel->pollset, 2, r->pool, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10169)
+                          "error apr_pollset_create()");
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        memset(&pfd, 0, sizeof(pfd));
+        pfd.p = r->pool;
+        pfd.desc_type = APR_POLL_SOCKET;
+        pfd.reqevents = APR_POLLIN | APR_POLLHUP;
+        pfd.desc.s = ap_get_conn_socket(tunnel->client_conn->c);
+        pfd.client_data = tunnel->client_conn;
+        apr_pollset_add(tunnel->pollset, &pfd);
+
+        pfd.desc.s = ap_get_conn_socket(tunnel->origin_conn->c);
+        pfd.client_data = tunnel->origin_conn;
+        apr_pollset_add(tunnel->pollset, &pfd);
+    }
+
+    do {
+        rv = apr_pollset_poll(tunnel->pollset, timeout, &pollcnt, &signalled);
+        if (rv != APR_SUCCESS) {
+            if (APR_STATUS_IS_EINTR(rv)) {
+                continue;
+            }
+            if (APR_STATUS_IS_TIMEUP(rv)) {
+                if (idle) {
+                    *idle = 1;
+                    return OK;
+                }
+                ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, APLOGNO(10170)
+                              "Closing idle tunnel");
+                return HTTP_REQUEST_TIME_OUT;
+            }
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10171)
+                          "error apr_pollset_poll()");
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                      "woke from poll(), i=%d", pollcnt);
+
+        for (pi = 0; pi < pollcnt && !done; pi++) {
+            const apr_pollfd_t *cur = &signalled[pi];
+            proxy_tunnel_conn_t *tc = cur->client_data;
+
+            if (cur->rtnevents & (APR_POLLIN | APR_POLLHUP)) {
+                ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                              "%s was readable", tc->name);
+                done = proxy_tunnel_forward(tunnel, tc);
+            }
+            else if (cur->rtnevents & APR_POLLERR) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10172)
+                              "error on %s connection", tc->name);
+                tc->c->aborted = 1;
+                done = 1;
+            }
+            else {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10173)
+                              "unknown event on %s connection %d",
+                              tc->name, cur->rtnevents);
+                done = 1;
+            }
+        }
+    } while (!done);
+
+    return tunnel->replied ? OK : HTTP_BAD_GATEWAY;
+}
+
+/* Nothing may be readable on the sockets while some data are already
+ * pending in the filters, so always try to read both sides first.
+ */
+static int proxy_tunnel_forward_all(proxy_tunnel_rec *tunnel)
+{
+    return (proxy_tunnel_forward(tunnel, tunnel->client_conn)
+            || proxy_tunnel_forward(tunnel, tunnel->origin_conn));
+}
+
+static void proxy_tunnel_callback(void *baton);
+static void proxy_tunnel_timeout_callback(void *baton);
+
+/* Have the MPM call us back when either side is readable */
+static apr_status_t proxy_tunnel_suspend(proxy_tunnel_rec *tunnel)
+{
+    apr_array_header_t *pfds;
+    apr_pollfd_t *pfd;
+
+    if (!tunnel->async_pool) {
+        apr_pool_create(&tunnel->async_pool, tunnel->r->pool);
+        apr_pool_tag(tunnel->async_pool, "proxy_tunnel_async");
+    }
+    else {
+        apr_pool_clear(tunnel->async_pool);
+    }
+
+    pfds = apr_array_make(tunnel->async_pool, 2, sizeof(apr_pollfd_t));
+
+    pfd = apr_array_push(pfds);
+    memset(pfd, 0, sizeof(*pfd));
+    pfd->p = tunnel->async_pool;
+    pfd->desc_type = APR_POLL_SOCKET;
+    pfd->reqevents = APR_POLLIN | APR_POLLERR | APR_POLLHUP;
+    pfd->desc.s = ap_get_conn_socket(tunnel->client_conn->c);
+
+    pfd = apr_array_push(pfds);
+    memset(pfd, 0, sizeof(*pfd));
+    pfd->p = tunnel->async_pool;
+    pfd->desc_type = APR_POLL_SOCKET;
+    pfd->reqevents = APR_POLLIN | APR_POLLERR | APR_POLLHUP;
+    pfd->desc.s = ap_get_conn_socket(tunnel->origin_conn->c);
+
+    return ap_mpm_register_poll_callback_timeout(pfds,
+                                                 proxy_tunnel_callback,
+                                                 proxy_tunnel_timeout_callback,
+                                                 tunnel, tunnel->timeout);
+}
+
+/* Forward what's available both ways, then suspend until there's more */
+static int proxy_tunnel_step(proxy_tunnel_rec *tunnel)
+{
+    request_rec *r = tunnel->r;
+    apr_status_t rv;
+    int status, idle = 0;
+
+    if (proxy_tunnel_forward_all(tunnel)) {
+        return tunnel->replied ? OK : HTTP_BAD_GATEWAY;
+    }
+
+    if (tunnel->async_delay > 0) {
+        status = proxy_tunnel_pump(tunnel, tunnel->async_delay, &idle);
+        if (!idle) {
+            return status;
+        }
+    }
+
+    rv = proxy_tunnel_suspend(tunnel);
+    if (rv == APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                      "tunnel suspended");
+        return SUSPENDED;
+    }
+    if (!APR_STATUS_IS_ENOTIMPL(rv)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10174)
+                      "error suspending the tunnel");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "no async support, pumping the tunnel synchronously");
+    tunnel->async = 0;
+    return proxy_tunnel_pump(tunnel, tunnel->timeout, NULL);
+}
+
+static void proxy_tunnel_log_done(proxy_tunnel_rec *tunnel, int status)
+{
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, tunnel->r, APLOGNO(10175)
+                  "%s tunnel closed (%d): %" APR_OFF_T_FMT " bytes from "
+                  "client (%" APR_OFF_T_FMT " spliced), %" APR_OFF_T_FMT
+                  " bytes from backend (%" APR_OFF_T_FMT " spliced)",
+                  tunnel->scheme, status,
+                  tunnel->client_bytes,
+                  ap_proxy_splice_bytes(tunnel->client_conn->splice),
+                  tunnel->origin_bytes,
+                  ap_proxy_splice_bytes(tunnel->origin_conn->splice));
+}
+
+/* End of an asynchronous tunnel, finish the request */
+static void proxy_tunnel_finish(proxy_tunnel_rec *tunnel, int status)
+{
+    request_rec *r = tunnel->r;
+    conn_rec *c = r->connection;
+
+    proxy_tunnel_log_done(tunnel, status);
+
+    if (tunnel->done) {
+        tunnel->done(tunnel, status);
+    }
+
+    /* Avoid sending error pages down an upgraded connection */
+    if (status != OK && status != HTTP_REQUEST_TIME_OUT) {
+        r->status = status;
+    }
+
+    c->keepalive = AP_CONN_CLOSE;
+    ap_finalize_request_protocol(r);
+    ap_lingering_close(c);
+    apr_socket_close(ap_get_conn_socket(c));
+    ap_mpm_resume_suspended(c);
+    ap_process_request_after_handler(r); /* don't touch tunnel or r after here */
+}
+
+/* Invoked by the MPM when either side is readable. We don't need the
+ * invoke_mtx since a single callback is ever registered.
+ */
+static void proxy_tunnel_callback(void *baton)
+{
+    proxy_tunnel_rec *tunnel = baton;
+    int status;
+
+    status = proxy_tunnel_step(tunnel);
+    if (status != SUSPENDED) {
+        proxy_tunnel_finish(tunnel, status);
+    }
+}
+
+/* Invoked by the MPM when neither side was readable for tunnel->timeout */
+static void proxy_tunnel_timeout_callback(void *baton)
+{
+    proxy_tunnel_rec *tunnel = baton;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, tunnel->r, APLOGNO(10176)
+                  "Closing idle tunnel");
+    proxy_tunnel_finish(tunnel, HTTP_REQUEST_TIME_OUT);
+}
+
+PROXY_DECLARE(int) ap_proxy_tunnel_run(proxy_tunnel_rec *tunnel)
+{
+    int status;
+
+    if (tunnel->async) {
+        status = proxy_tunnel_step(tunnel);
+    }
+    else if (proxy_tunnel_forward_all(tunnel)) {
+        status = tunnel->replied ? OK : HTTP_BAD_GATEWAY;
+    }
+    else {
+        status = proxy_tunnel_pump(tunnel, tunnel->timeout, NULL);
+    }
+    if (status != SUSPENDED) {
+        proxy_tunnel_log_done(tunnel, status);
+    }
+
+    return status;
+}
+
 PROXY_DECLARE (const char *) ap_proxy_show_hcmethod(hcmethod_t method)
 {
     proxy_hcmethods_t *m = proxy_hcmethods;
@@ -4119,6 +4753,8 @@ PROXY_DECLARE (const char *) ap_proxy_show_hcmethod(hcmethod_t method)
 
 void proxy_util_register_hooks(apr_pool_t *p)
 {
+    init_canonenc_allowed();
+
     APR_REGISTER_OPTIONAL_FN(ap_proxy_retry_worker);
     APR_REGISTER_OPTIONAL_FN(ap_proxy_clear_connection);
     APR_REGISTER_OPTIONAL_FN(proxy_balancer_get_best_worker);
@@ -316,25 +316,21 @@ static apr_status_t ap_session_set(request_rec * r, session_rec * z,
 
 static int identity_count(void *v, const char *key, const char *val)
 {
-    int *count = v;
-    *count += strlen(key) * 3 + strlen(val) * 3 + 1;
+    apr_size_t *count = v;
+    *count += strlen(key) * 3 + strlen(val) * 3 + 2;
     return 1;
 }
 
 static int identity_concat(void *v, const char *key, const char *val)
 {
-    char *slider = v;
-    int length = strlen(slider);
-    slider += length;
-    if (length) {
-        *slider = '&';
-        slider++;
-    }
-    ap_escape_urlencoded_buffer(slider, key);
-    slider += strlen(slider);
-    *slider = '=';
-    slider++;
-    ap_escape_urlencoded_buffer(slider, val);
+    char **slider = v;
+    char *d = *slider;
+    *d++ = '&';
+    ap_escape_urlencoded_buffer(d, key);
+    d += strlen(d);
+    *d++ = '=';
+    ap_escape_urlencoded_buffer(d, val);
+    *slider = d + strlen(d);
     return 1;
 }
 
@@ -354,16 +350,19 @@ static int identity_concat(void *v, const char *key, const char *val)
 static apr_status_t session_identity_encode(request_rec * r, session_rec * z)
 {
 
-    char *buffer = NULL;
-    int length = 0;
+    char *buffer, *slider;
+    apr_size_t length = 0;
     if (z->expiry) {
         char *expiry = apr_psprintf(z->pool, "%" APR_INT64_T_FMT, z->expiry);
         apr_table_setn(z->entries, SESSION_EXPIRY, expiry);
     }
+
+    /* each pair is written after an '&', skip the first one */
     apr_table_do(identity_count, &length, z->entries, NULL);
-    buffer = apr_pcalloc(r->pool, length + 1);
-    apr_table_do(identity_concat, buffer, z->entries, NULL);
-    z->encoded = buffer;
+    slider = buffer = apr_palloc(r->pool, length + 1);
+    *slider = '\0';
+    apr_table_do(identity_concat, &slider, z->entries, NULL);
+    z->encoded = (slider != buffer) ? buffer + 1 : buffer;
     return OK;
 
 }
@@ -397,8 +396,8 @@ static apr_status_t session_identity_decode(request_rec * r, session_rec * z)
         return OK;
     }
 
-    /* decode what we have */
-    encoded = apr_pstrdup(r->pool, z->encoded);
+    /* decode what we have, in a copy the session entries can point to */
+    encoded = apr_pstrdup(z->pool, z->encoded);
     pair = apr_strtok(encoded, sep, &last);
     while (pair && pair[0]) {
         char *plast = NULL;
@@ -414,7 +413,7 @@ static apr_status_t session_identity_decode(request_rec * r, session_rec * z)
                     z->expiry = (apr_time_t) apr_atoi64(val);
                 }
                 else {
-                    apr_table_set(z->entries, key, val);
+                    apr_table_setn(z->entries, key, val);
                 }
             }
         }
@@ -20,6 +20,7 @@
 #include "apr_lib.h"
 #include "apr_md5.h"
 #include "apr_strings.h"
+#include "apr_thread_mutex.h"
 #include "http_log.h"
 #include "http_core.h"
 
@@ -198,6 +199,121 @@ static void compute_auth(const void *src, apr_size_t len,
     ap_siphash24_auth(auth, src, len, key);
 }
 
+/*
+ * Deriving a key from a passphrase (PBKDF2, 4096 iterations) costs far more
+ * than encrypting or decrypting a session, so the keys are derived once per
+ * process and cipher/passphrase/salt, and kept for the lifetime of the
+ * process.  Sessions are encrypted with a salt chosen at startup (the IV
+ * is still random for each encryption), so that the same few keys serve
+ * all the sessions; sessions encrypted with another salt (before a
+ * restart) get their keys cached too, up to SESSION_CRYPTO_KEYS_MAX keys,
+ * beyond which they are derived for the request only.  Keys are never
+ * evicted, requests may still be using them.
+ */
+#ifndef SESSION_CRYPTO_KEYS_MAX
+#define SESSION_CRYPTO_KEYS_MAX 128
+#endif
+
+typedef struct {
+    apr_crypto_key_t *key;
+    apr_size_t ivSize;
+} session_crypto_key;
+
+static apr_uuid_t crypto_salt;
+static apr_hash_t *crypto_keys;
+static apr_pool_t *crypto_keys_pool;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *crypto_keys_mutex;
+#endif
+
+static apr_status_t crypt_key_pool_cleanup(void *data)
+{
+    apr_pool_destroy(data);
+    return APR_SUCCESS;
+}
+
+static apr_status_t crypt_passphrase(request_rec *r, const apr_crypto_t *f,
+        apr_crypto_block_key_type_e *cipher, session_crypto_dir_conf *dconf,
+        const char *passphrase, apr_size_t passlen, const unsigned char *salt,
+        const apr_crypto_key_t **key, apr_size_t *ivSize)
+{
+    session_crypto_key *entry = NULL;
+    apr_pool_t *pool = r->pool;
+    apr_size_t cipherlen = strlen(dconf->cipher);
+    apr_size_t klen = cipherlen + 1 + passlen + sizeof(apr_uuid_t);
+    char *kbuf = NULL;
+    apr_crypto_key_t *newkey = NULL;
+    apr_status_t res;
+
+    if (crypto_keys) {
+        kbuf = apr_palloc(r->pool, klen);
+        memcpy(kbuf, dconf->cipher, cipherlen + 1);
+        memcpy(kbuf + cipherlen + 1, passphrase, passlen);
+        memcpy(kbuf + cipherlen + 1 + passlen, salt, sizeof(apr_uuid_t));
+
+#if APR_HAS_THREADS
+        apr_thread_mutex_lock(crypto_keys_mutex);
+#endif
+        entry = apr_hash_get(crypto_keys, kbuf, klen);
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(crypto_keys_mutex);
+#endif
+        if (entry) {
+            *key = entry->key;
+            *ivSize = entry->ivSize;
+            return APR_SUCCESS;
+        }
+
+        /* Derive the key outside of the mutex, in its own pool below
+         * crypto_keys_pool, whose allocator is thread safe.
+         */
+        if (apr_hash_count(crypto_keys) < SESSION_CRYPTO_KEYS_MAX
+                && apr_pool_create(&pool, crypto_keys_pool) != APR_SUCCESS) {
+            pool = r->pool;
+        }
+    }
+
+    res = apr_crypto_passphrase(&newkey, ivSize, passphrase, passlen,
+            salt, sizeof(apr_uuid_t), *cipher, APR_MODE_CBC, 1, 4096,
+            f, pool);
+    if (res != APR_SUCCESS) {
+        if (pool != r->pool) {
+            apr_pool_destroy(pool);
+        }
+        return res;
+    }
+    *key = newkey;
+
+    if (pool != r->pool) {
+        entry = apr_palloc(pool, sizeof(*entry));
+        entry->key = newkey;
+        entry->ivSize = *ivSize;
+        kbuf = apr_pmemdup(pool, kbuf, klen);
+
+#if APR_HAS_THREADS
+        apr_thread_mutex_lock(crypto_keys_mutex);
+#endif
+        if (!apr_hash_get(crypto_keys, kbuf, klen)
+                && apr_hash_count(crypto_keys) < SESSION_CRYPTO_KEYS_MAX) {
+            apr_hash_set(crypto_keys, kbuf, klen, entry);
+            pool = NULL;
+        }
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(crypto_keys_mutex);
+#endif
+
+        /* Lost the race (or the cache filled up meanwhile), keep the key
+         * for this request only.
+         */
+        if (pool) {
+            apr_pool_cleanup_register(r->pool, pool, crypt_key_pool_cleanup,
+                                      apr_pool_cleanup_null);
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
 /**
  * Initialise the encryption as per the current config.
  *
@@ -264,33 +380,31 @@ static apr_status_t encrypt_string(request_rec * r, const apr_crypto_t *f,
         session_crypto_dir_conf *dconf, const char *in, char **out)
 {
     apr_status_t res;
-    apr_crypto_key_t *key = NULL;
+    const apr_crypto_key_t *key = NULL;
     apr_size_t ivSize = 0;
     apr_crypto_block_t *block = NULL;
     unsigned char *encrypt = NULL;
     unsigned char *combined = NULL;
-    apr_size_t encryptlen, tlen, combinedlen;
+    apr_size_t inlen, encryptlen, tlen, combinedlen;
     char *base64;
     apr_size_t blockSize = 0;
     const unsigned char *iv = NULL;
-    apr_uuid_t salt;
     apr_crypto_block_key_type_e *cipher;
     const char *passphrase;
     apr_size_t passlen;
 
-    /* use a uuid as a salt value, and prepend it to our result */
-    apr_uuid_get(&salt);
     res = crypt_init(r, f, &cipher, dconf);
     if (res != APR_SUCCESS) {
         return res;
     }
 
-    /* encrypt using the first passphrase in the list */
+    /* encrypt using the first passphrase in the list, and the salt of
+     * this process (prepended to our result)
+     */
     passphrase = APR_ARRAY_IDX(dconf->passphrases, 0, const char *);
     passlen = strlen(passphrase);
-    res = apr_crypto_passphrase(&key, &ivSize, passphrase, passlen,
-            (unsigned char *) (&salt), sizeof(apr_uuid_t),
-            *cipher, APR_MODE_CBC, 1, 4096, f, r->pool);
+    res = crypt_passphrase(r, f, cipher, dconf, passphrase, passlen,
+                           (unsigned char *)&crypto_salt, &key, &ivSize);
     if (APR_STATUS_IS_ENOKEY(res)) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, res, r, APLOGNO(01825)
                 "the passphrase '%s' was empty", passphrase);
@@ -316,9 +430,18 @@ static apr_status_t encrypt_string(request_rec * r, const apr_crypto_t *f,
         return res;
     }
 
-    /* encrypt the given string */
+    /* lay out the MAC, the salt and the iv, and encrypt the given string
+     * right after them (the padding may add up to a block)
+     */
+    inlen = strlen(in);
+    combinedlen = AP_SIPHASH_DSIZE + sizeof(apr_uuid_t) + ivSize;
+    combined = apr_palloc(r->pool, combinedlen + inlen + blockSize);
+    memcpy(combined + AP_SIPHASH_DSIZE, &crypto_salt, sizeof(apr_uuid_t));
+    memcpy(combined + AP_SIPHASH_DSIZE + sizeof(apr_uuid_t), iv, ivSize);
+    encrypt = combined + combinedlen;
+
     res = apr_crypto_block_encrypt(&encrypt, &encryptlen,
-                                   (const unsigned char *)in, strlen(in),
+                                   (const unsigned char *)in, inlen,
                                    block);
     if (APR_SUCCESS != res) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, res, r, APLOGNO(01830)
@@ -331,15 +454,8 @@ static apr_status_t encrypt_string(request_rec * r, const apr_crypto_t *f,
                 "apr_crypto_block_encrypt_finish failed");
         return res;
     }
-    encryptlen += tlen;
+    combinedlen += encryptlen + tlen;
 
-    /* prepend the salt and the iv to the result (keep room for the MAC) */
-    combinedlen = AP_SIPHASH_DSIZE + sizeof(apr_uuid_t) + ivSize + encryptlen;
-    combined = apr_palloc(r->pool, combinedlen);
-    memcpy(combined + AP_SIPHASH_DSIZE, &salt, sizeof(apr_uuid_t));
-    memcpy(combined + AP_SIPHASH_DSIZE + sizeof(apr_uuid_t), iv, ivSize);
-    memcpy(combined + AP_SIPHASH_DSIZE + sizeof(apr_uuid_t) + ivSize,
-           encrypt, encryptlen);
     /* authenticate the whole salt+IV+ciphertext with a leading MAC */
     compute_auth(combined + AP_SIPHASH_DSIZE, combinedlen - AP_SIPHASH_DSIZE,
                  passphrase, passlen, combined);
@@ -362,7 +478,7 @@ static apr_status_t decrypt_string(request_rec * r, const apr_crypto_t *f,
         session_crypto_dir_conf *dconf, const char *in, char **out)
 {
     apr_status_t res;
-    apr_crypto_key_t *key = NULL;
+    const apr_crypto_key_t *key = NULL;
     apr_size_t ivSize = 0;
     apr_crypto_block_t *block = NULL;
     unsigned char *decrypted = NULL;
@@ -408,11 +524,9 @@ static apr_status_t decrypt_string(request_rec * r, const apr_crypto_t *f,
             continue;
         }
 
-        /* encrypt using the first passphrase in the list */
-        res = apr_crypto_passphrase(&key, &ivSize, passphrase, passlen,
-                                    slider, sizeof(apr_uuid_t),
-                                    *cipher, APR_MODE_CBC, 1, 4096,
-                                    f, r->pool);
+        /* derive (or find) the key of this passphrase and salt */
+        res = crypt_passphrase(r, f, cipher, dconf, passphrase, passlen,
+                               slider, &key, &ivSize);
         if (APR_STATUS_IS_ENOKEY(res)) {
             ap_log_rerror(APLOG_MARK, APLOG_DEBUG, res, r, APLOGNO(01832)
                     "the passphrase '%s' was empty", passphrase);
@@ -617,9 +731,61 @@ static int session_crypto_init(apr_pool_t *p, apr_pool_t *plog,
 
     }
 
+    /* a new salt for the sessions encrypted by this generation */
+    apr_uuid_get(&crypto_salt);
+
     return OK;
 }
 
+/**
+ * Create the cache of the derived keys in the child.
+ */
+static void session_crypto_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv;
+#if APR_HAS_THREADS
+    apr_allocator_t *allocator;
+    apr_thread_mutex_t *mutex;
+#endif
+
+    crypto_keys = NULL;
+
+#if APR_HAS_THREADS
+    /* The pools of the keys are created by the request threads, so their
+     * parent gets an allocator of its own, with a mutex.
+     */
+    rv = apr_allocator_create(&allocator);
+    if (rv == APR_SUCCESS) {
+        rv = apr_pool_create_ex(&crypto_keys_pool, p, NULL, allocator);
+        if (rv == APR_SUCCESS) {
+            apr_allocator_owner_set(allocator, crypto_keys_pool);
+            rv = apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT,
+                                         crypto_keys_pool);
+        }
+        else {
+            apr_allocator_destroy(allocator);
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        apr_allocator_mutex_set(allocator, mutex);
+        rv = apr_thread_mutex_create(&crypto_keys_mutex,
+                                     APR_THREAD_MUTEX_DEFAULT,
+                                     crypto_keys_pool);
+    }
+#else
+    rv = apr_pool_create(&crypto_keys_pool, p);
+#endif
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10183)
+                     "could not create the cache of the session keys, "
+                     "keys will not be cached");
+        return;
+    }
+    apr_pool_tag(crypto_keys_pool, "session_crypto_keys");
+
+    crypto_keys = apr_hash_make(crypto_keys_pool);
+}
+
 static void *create_session_crypto_config(apr_pool_t * p, server_rec *s)
 {
     session_crypto_conf *new =
@@ -782,6 +948,7 @@ static void register_hooks(apr_pool_t * p)
     ap_hook_session_encode(session_crypto_encode, NULL, NULL, APR_HOOK_LAST);
     ap_hook_session_decode(session_crypto_decode, NULL, NULL, APR_HOOK_FIRST);
     ap_hook_post_config(session_crypto_init, NULL, NULL, APR_HOOK_LAST);
+    ap_hook_child_init(session_crypto_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(session_crypto) =
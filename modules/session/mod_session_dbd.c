@@ -50,6 +50,7 @@ typedef struct {
 /* optional function - look it up once in post_config */
 static ap_dbd_t *(*session_dbd_acquire_fn) (request_rec *) = NULL;
 static void (*session_dbd_prepare_fn) (server_rec *, const char *, const char *) = NULL;
+static apr_dbd_prepared_t *(*session_dbd_prepared_fn) (ap_dbd_t *, const char *) = NULL;
 
 /**
  * Initialise the database.
@@ -62,10 +63,13 @@ static apr_status_t dbd_init(request_rec *r, const char *query, ap_dbd_t **dbdp,
     ap_dbd_t *dbd;
     apr_dbd_prepared_t *statement;
 
-    if (!session_dbd_prepare_fn || !session_dbd_acquire_fn) {
+    if (!session_dbd_prepare_fn || !session_dbd_acquire_fn
+        || !session_dbd_prepared_fn) {
         session_dbd_prepare_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_prepare);
         session_dbd_acquire_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_acquire);
-        if (!session_dbd_prepare_fn || !session_dbd_acquire_fn) {
+        session_dbd_prepared_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_prepared);
+        if (!session_dbd_prepare_fn || !session_dbd_acquire_fn
+            || !session_dbd_prepared_fn) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01850)
                           "You must load mod_dbd to enable AuthDBD functions");
             return APR_EGENERAL;
@@ -79,7 +83,7 @@ static apr_status_t dbd_init(request_rec *r, const char *query, ap_dbd_t **dbdp,
         return APR_EGENERAL;
     }
 
-    statement = apr_hash_get(dbd->prepared, query, APR_HASH_KEY_STRING);
+    statement = session_dbd_prepared_fn(dbd, query);
     if (!statement) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01852)
                       "failed to find the prepared statement called '%s'", query);
@@ -198,6 +198,129 @@ static apr_status_t modssl_fips_cleanup(void *data)
 }
 #endif
 
+/* prevent OpenSSL from showing its "Enter PEM pass phrase:" prompt */
+static int ssl_no_passwd_prompt_cb(char *buf, int size, int rwflag,
+                                   void *userdata) {
+   return 0;
+}
+
+#if !MODSSL_USE_OPENSSL_PRE_1_1_API && defined(SSL_CTX_add1_chain_cert)
+#define MODSSL_SHARE_CERT_CHAINS
+/*
+ * The certificate (with chain) files parsed during this init round, by
+ * filename, so that vhosts sharing the same SSLCertificateFile (e.g. a
+ * wildcard certificate) don't parse it again and again.  Only used while
+ * ssl_init_Module() runs, the X509s are refcounted by the SSL_CTXs using
+ * them.
+ */
+static apr_hash_t *cert_chains = NULL;
+static int cert_chains_shared = 0;
+
+static apr_status_t cert_chains_cleanup(void *data)
+{
+    apr_hash_index_t *hi;
+    void *val;
+
+    for (hi = apr_hash_first(NULL, cert_chains); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        sk_X509_pop_free((STACK_OF(X509) *)val, X509_free);
+    }
+    cert_chains = NULL;
+    return APR_SUCCESS;
+}
+
+static void cert_chains_init(apr_pool_t *ptemp)
+{
+    cert_chains = apr_hash_make(ptemp);
+    cert_chains_shared = 0;
+    apr_pool_cleanup_register(ptemp, NULL, cert_chains_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+/*
+ * Read the server certificate followed by its (optional) chain from a
+ * PEM file, like SSL_CTX_use_certificate_chain_file() does.
+ */
+static STACK_OF(X509) *load_cert_chain(const char *file)
+{
+    STACK_OF(X509) *chain;
+    X509 *x509;
+    unsigned long err;
+    BIO *bio;
+
+    if (!(bio = BIO_new(BIO_s_file()))) {
+        return NULL;
+    }
+    if (BIO_read_filename(bio, file) <= 0
+        || !(chain = sk_X509_new_null())) {
+        BIO_free(bio);
+        return NULL;
+    }
+
+    x509 = PEM_read_bio_X509_AUX(bio, NULL, ssl_no_passwd_prompt_cb, NULL);
+    while (x509) {
+        if (!sk_X509_push(chain, x509)) {
+            X509_free(x509);
+            goto failed;
+        }
+        x509 = PEM_read_bio_X509(bio, NULL, ssl_no_passwd_prompt_cb, NULL);
+    }
+    if (!sk_X509_num(chain)) {
+        goto failed;
+    }
+
+    /* Make sure that only the error is just an EOF */
+    if ((err = ERR_peek_last_error()) > 0) {
+        if (!(   ERR_GET_LIB(err) == ERR_LIB_PEM
+              && ERR_GET_REASON(err) == PEM_R_NO_START_LINE)) {
+            goto failed;
+        }
+        ERR_clear_error();
+    }
+
+    BIO_free(bio);
+    return chain;
+
+failed:
+    sk_X509_pop_free(chain, X509_free);
+    BIO_free(bio);
+    return NULL;
+}
+
+static int use_shared_certificate_chain_file(SSL_CTX *ctx, const char *file)
+{
+    STACK_OF(X509) *chain;
+    int i;
+
+    if (!cert_chains) {
+        return SSL_CTX_use_certificate_chain_file(ctx, file);
+    }
+
+    chain = apr_hash_get(cert_chains, file, APR_HASH_KEY_STRING);
+    if (chain) {
+        cert_chains_shared++;
+    }
+    else {
+        if (!(chain = load_cert_chain(file))) {
+            return 0;
+        }
+        /* file lives in the config pool, longer than cert_chains */
+        apr_hash_set(cert_chains, file, APR_HASH_KEY_STRING, chain);
+    }
+
+    if (SSL_CTX_use_certificate(ctx, sk_X509_value(chain, 0)) < 1
+        || !SSL_CTX_clear_chain_certs(ctx)) {
+        return 0;
+    }
+    for (i = 1; i < sk_X509_num(chain); ++i) {
+        if (!SSL_CTX_add1_chain_cert(ctx, sk_X509_value(chain, i))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+#endif /* !MODSSL_USE_OPENSSL_PRE_1_1_API && SSL_CTX_add1_chain_cert */
+
 /*
  *  Per-module initialization
  */
@@ -210,6 +333,10 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
     server_rec *s;
     apr_status_t rv;
     apr_array_header_t *pphrases;
+    apr_time_t init_start, servers_start, servers_end, init_end;
+    int servers_count = 0;
+
+    init_start = apr_time_now();
 
     if (SSLeay() < MODSSL_LIBRARY_VERSION) {
         ap_log_error(APLOG_MARK, APLOG_WARNING, 0, base_server, APLOGNO(01882)
@@ -368,6 +495,11 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, base_server, APLOGNO(01887)
                  "Init: Initializing (virtual) servers for SSL");
 
+    servers_start = apr_time_now();
+#ifdef MODSSL_SHARE_CERT_CHAINS
+    cert_chains_init(ptemp);
+#endif
+
     for (s = base_server; s; s = s->next) {
         sc = mySrvConfig(s);
         /*
@@ -375,6 +507,10 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
          * it or give out some information about what we're
          * configuring.
          */
+        if (sc->enabled == SSL_ENABLED_TRUE
+            || sc->enabled == SSL_ENABLED_OPTIONAL) {
+            servers_count++;
+        }
 
         /*
          * Read the server certificate and key
@@ -385,6 +521,8 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
         }
     }
 
+    servers_end = apr_time_now();
+
     if (pphrases->nelts > 0) {
         memset(pphrases->elts, 0, pphrases->elt_size * pphrases->nelts);
         pphrases->nelts = 0;
@@ -431,6 +569,26 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
     init_bio_methods();
 #endif
 
+    init_end = apr_time_now();
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, base_server, APLOGNO(10163)
+                 "Init: %s initialized in %" APR_TIME_T_FMT "ms "
+                 "(setup: %" APR_TIME_T_FMT "ms, "
+                 "%d SSL server(s): %" APR_TIME_T_FMT "ms, "
+                 "checks and hooks: %" APR_TIME_T_FMT "ms, "
+                 "certificate files shared: %d)",
+                 MODSSL_LIBRARY_NAME,
+                 apr_time_as_msec(init_end - init_start),
+                 apr_time_as_msec(servers_start - init_start),
+                 servers_count,
+                 apr_time_as_msec(servers_end - servers_start),
+                 apr_time_as_msec(init_end - servers_end),
+#ifdef MODSSL_SHARE_CERT_CHAINS
+                 cert_chains_shared
+#else
+                 0
+#endif
+                 );
+
     return OK;
 }
 
@@ -1229,12 +1387,6 @@ static void ssl_check_public_cert(server_rec *s,
     }
 }
 
-/* prevent OpenSSL from showing its "Enter PEM pass phrase:" prompt */
-static int ssl_no_passwd_prompt_cb(char *buf, int size, int rwflag,
-                                   void *userdata) {
-   return 0;
-}
-
 static apr_status_t ssl_init_server_certs(server_rec *s,
                                           apr_pool_t *p,
                                           apr_pool_t *ptemp,
@@ -1284,8 +1436,13 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
                 return APR_EGENERAL;
             }
         } else {
+#ifdef MODSSL_SHARE_CERT_CHAINS
+            if ((use_shared_certificate_chain_file(mctx->ssl_ctx,
+                                                   certfile) < 1)) {
+#else
             if ((SSL_CTX_use_certificate_chain_file(mctx->ssl_ctx,
                                                     certfile) < 1)) {
+#endif
                 ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02562)
                              "Failed to configure certificate %s (with chain),"
                              " check %s", key_id, certfile);
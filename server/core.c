@@ -56,6 +56,7 @@
 #include "util_ebcdic.h"
 #include "util_mutex.h"
 #include "util_time.h"
+#include "util_trace.h"
 #include "mpm_common.h"
 #include "scoreboard.h"
 #include "mod_core.h"
@@ -529,6 +530,8 @@ static void *create_core_server_config(apr_pool_t *a, server_rec *s)
     conf->async_filter = 0;
     conf->strict_host_check= AP_CORE_CONFIG_UNSET; 
     conf->merge_slashes    = AP_CORE_CONFIG_UNSET; 
+    conf->trace_context = AP_CORE_CONFIG_UNSET;
+    conf->trace_sample = -1;
 
     return (void *)conf;
 }
@@ -630,6 +633,10 @@ static void *merge_core_server_configs(apr_pool_t *p, void *basev, void *virtv)
 
     AP_CORE_MERGE_FLAG(strict_host_check, conf, base, virt);
     AP_CORE_MERGE_FLAG(merge_slashes, conf, base, virt);
+    AP_CORE_MERGE_FLAG(trace_context, conf, base, virt);
+    conf->trace_sample = (virt->trace_sample >= 0)
+                         ? virt->trace_sample
+                         : base->trace_sample;
 
     return conf;
 }
@@ -4165,6 +4172,54 @@ static const char *set_trace_enable(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_trace_sample(cmd_parms *cmd, void *dummy,
+                                    const char *arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    char *end;
+    double ratio = strtod(arg, &end);
+
+    if (end == arg || *end || ratio < 0 || ratio > 1) {
+        return "TraceSampleRatio must be a number between 0 and 1";
+    }
+    conf->trace_sample = (int)(ratio * 1000000 + 0.5);
+
+    return NULL;
+}
+
+static const char *set_piped_log_buffer(cmd_parms *cmd, void *dummy,
+                                        const char *size, const char *policy)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_off_t bytes;
+    char *end;
+
+    if (err != NULL) {
+        return err;
+    }
+    if (apr_strtoff(&bytes, size, &end, 10) != APR_SUCCESS || *end
+        || (bytes && (bytes < 65536 || bytes > 67108864))) {
+        return "PipedLogBuffer size must be 0 (no buffer), or between "
+               "65536 and 67108864 bytes";
+    }
+    conf->piped_log_buffer = (apr_size_t)bytes;
+
+    if (!policy || !strcasecmp(policy, "block")) {
+        conf->piped_log_drop = 0;
+    }
+    else if (!strcasecmp(policy, "drop")) {
+        conf->piped_log_drop = 1;
+    }
+    else {
+        return "PipedLogBuffer policy must be 'block' or 'drop'";
+    }
+
+    return NULL;
+}
+
 static const char *set_protocols(cmd_parms *cmd, void *dummy,
                                  const char *arg)
 {
@@ -4931,6 +4986,18 @@ AP_INIT_FLAG("MergeSlashes", set_core_server_flag,
              (void *)APR_OFFSETOF(core_server_config, merge_slashes),  
              RSRC_CONF,
              "Controls whether consecutive slashes in the URI path are merged"),
+AP_INIT_FLAG("TraceContext", set_core_server_flag,
+             (void *)APR_OFFSETOF(core_server_config, trace_context),
+             RSRC_CONF,
+             "Controls whether W3C Trace Context headers are handled and "
+             "request spans recorded"),
+AP_INIT_TAKE1("TraceSampleRatio", set_trace_sample, NULL, RSRC_CONF,
+              "The ratio of the new traces to sample, between 0 and 1 "
+              "(default 1)"),
+AP_INIT_TAKE12("PipedLogBuffer", set_piped_log_buffer, NULL, RSRC_CONF,
+               "The size of the children's buffers of the piped logs (0 for "
+               "none), and whether the lines are waited for ('block', the "
+               "default) or dropped ('drop') when they are full"),
 
 { NULL }
 };
@@ -5418,6 +5485,18 @@ static int core_create_req(request_rec *r)
     return OK;
 }
 
+static int core_post_read_request(request_rec *r)
+{
+    ap_trace_request_begin(r);
+    return DECLINED;
+}
+
+static int core_log_transaction(request_rec *r)
+{
+    ap_trace_request_end(r);
+    return DECLINED;
+}
+
 static int core_create_proxy_req(request_rec *r, request_rec *pr)
 {
     return core_create_req(pr);
@@ -5642,6 +5721,8 @@ static void core_child_init(apr_pool_t *pchild, server_rec *s)
 #endif
     apr_random_after_fork(&proc);
 #endif /* USE_APR_CRYPTO_PRNG */
+
+    ap_request_child_init(pchild, s);
 }
 
 static void core_optional_fn_retrieve(void)
@@ -5909,6 +5990,10 @@ static void register_hooks(apr_pool_t *p)
     ap_hook_type_checker(do_nothing,NULL,NULL,APR_HOOK_REALLY_LAST);
     ap_hook_fixups(core_override_type,NULL,NULL,APR_HOOK_REALLY_FIRST);
     ap_hook_create_request(core_create_req, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_read_request(core_post_read_request, NULL, NULL,
+                              APR_HOOK_REALLY_FIRST);
+    ap_hook_log_transaction(core_log_transaction, NULL, NULL,
+                            APR_HOOK_REALLY_FIRST);
     APR_OPTIONAL_HOOK(proxy, create_req, core_create_proxy_req, NULL, NULL,
                       APR_HOOK_MIDDLE);
     ap_hook_pre_mpm(ap_create_scoreboard, NULL, NULL, APR_HOOK_MIDDLE);
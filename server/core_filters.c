@@ -88,8 +88,77 @@ struct core_output_filter_ctx {
 struct core_filter_ctx {
     apr_bucket_brigade *bb;
     apr_bucket_brigade *tmpbb;
+    /* the size of the next read from the socket, and its limit */
+    apr_size_t readahead;
+    apr_size_t readahead_max;
 };
 
+/* The reads from the socket start at the size of the socket buckets' ones,
+ * double while they fill the buffer (an upload, or pipelined requests) up
+ * to the server's ReadBufferSize capped at CORE_READAHEAD_MAX (the limit
+ * too if not set), and get back to the start once they come short. A large
+ * ReadBufferSize thus won't make each connection hold a large buffer while
+ * it reads a body. The buffers are refcounted heap buckets, sliced (not
+ * copied) by the GETLINE and READBYTES modes, so they return to the bucket
+ * allocator when the last slice is consumed and the connection holds none
+ * while it is idle.
+ */
+#define CORE_READAHEAD_MIN APR_BUCKET_BUFF_SIZE
+#define CORE_READAHEAD_MAX (64 * 1024)
+
+/* Read from the socket bucket *pe like apr_bucket_read() does, but for
+ * ctx->readahead bytes. On success *pe is the bucket of the data read,
+ * inserted before the socket bucket, or the socket bucket itself turned
+ * into an empty one at EOF.
+ */
+static apr_status_t core_socket_read(core_ctx_t *ctx, apr_bucket **pe,
+                                     apr_read_type_e block)
+{
+    apr_bucket *e = *pe;
+    apr_socket_t *sock = e->data;
+    apr_interval_time_t timeout = 0;
+    apr_size_t size = ctx->readahead, len = size;
+    apr_status_t rv;
+    char *buf;
+
+    if (block == APR_NONBLOCK_READ) {
+        apr_socket_timeout_get(sock, &timeout);
+        apr_socket_timeout_set(sock, 0);
+    }
+    buf = apr_bucket_alloc(size, e->list);
+    rv = apr_socket_recv(sock, buf, &len);
+    if (block == APR_NONBLOCK_READ) {
+        apr_socket_timeout_set(sock, timeout);
+    }
+    if (rv != APR_SUCCESS && rv != APR_EOF) {
+        apr_bucket_free(buf);
+        return rv;
+    }
+
+    if (len > 0) {
+        apr_bucket *h = apr_bucket_heap_create(buf, len, apr_bucket_free,
+                                               e->list);
+
+        ((apr_bucket_heap *)h->data)->alloc_len = size;
+        APR_BUCKET_INSERT_BEFORE(e, h);
+        *pe = h;
+
+        if (len < size) {
+            ctx->readahead = CORE_READAHEAD_MIN;
+        }
+        else if (size < ctx->readahead_max) {
+            ctx->readahead = (size < ctx->readahead_max / 2)
+                             ? size * 2 : ctx->readahead_max;
+        }
+    }
+    else {
+        /* Like the socket bucket, keep the socket for the response */
+        apr_bucket_free(buf);
+        apr_bucket_immortal_make(e, "", 0);
+    }
+    return APR_SUCCESS;
+}
+
 
 apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
                                   ap_input_mode_t mode, apr_read_type_e block,
@@ -100,6 +169,7 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
     core_ctx_t *ctx = net->in_ctx;
     const char *str;
     apr_size_t len;
+    apr_bucket *e;
 
     if (mode == AP_MODE_INIT) {
         /*
@@ -117,9 +187,21 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
 
     if (!ctx)
     {
+        core_dir_config *dconf =
+            ap_get_core_module_config(f->c->base_server->lookup_defaults);
+
         net->in_ctx = ctx = apr_palloc(f->c->pool, sizeof(*ctx));
         ctx->bb = apr_brigade_create(f->c->pool, f->c->bucket_alloc);
         ctx->tmpbb = apr_brigade_create(f->c->pool, f->c->bucket_alloc);
+        ctx->readahead = CORE_READAHEAD_MIN;
+        ctx->readahead_max = dconf->read_buf_size ? dconf->read_buf_size
+                                                  : CORE_READAHEAD_MAX;
+        if (ctx->readahead_max > CORE_READAHEAD_MAX) {
+            ctx->readahead_max = CORE_READAHEAD_MAX;
+        }
+        else if (ctx->readahead_max < CORE_READAHEAD_MIN) {
+            ctx->readahead_max = CORE_READAHEAD_MIN;
+        }
         /* seed the brigade with the client socket. */
         rv = ap_run_insert_network_bucket(f->c, ctx->bb, net->client_socket);
         if (rv != APR_SUCCESS)
@@ -145,6 +227,22 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
         return APR_EOF;
     }
 
+    /* Nothing buffered, read from the socket ourselves (the EATCRLF mode
+     * never blocks), for the errors the modes' own reads would return.
+     */
+    e = APR_BRIGADE_FIRST(ctx->bb);
+    if (APR_BUCKET_IS_SOCKET(e) && mode != AP_MODE_EXHAUSTIVE) {
+        rv = core_socket_read(ctx, &e, (mode == AP_MODE_EATCRLF)
+                                       ? APR_NONBLOCK_READ : block);
+        if (rv != APR_SUCCESS) {
+            if (APR_STATUS_IS_EAGAIN(rv) && block == APR_NONBLOCK_READ
+                && mode != AP_MODE_EATCRLF) {
+                rv = APR_SUCCESS;
+            }
+            goto cleanup;
+        }
+    }
+
     if (mode == AP_MODE_GETLINE) {
         /* we are reading a single LF line, e.g. the HTTP headers */
         rv = apr_brigade_split_line(b, ctx->bb, block, HUGE_STRING_LEN);
@@ -162,7 +260,6 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
      * eat any CRLFs that we see.  That's not the obvious intention of
      * this mode.  Determine whether anyone actually uses this or not. */
     if (mode == AP_MODE_EATCRLF) {
-        apr_bucket *e;
         const char *c;
 
         /* The purpose of this loop is to ignore any CRLF (or LF) at the end
@@ -217,8 +314,6 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
      * read, which means that it can pass it to the correct child process.
      */
     if (mode == AP_MODE_EXHAUSTIVE) {
-        apr_bucket *e;
-
         /* Tack on any buckets that were set aside. */
         APR_BRIGADE_CONCAT(b, ctx->bb);
 
@@ -236,8 +331,6 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
 
     /* read up to the amount they specified. */
     if (mode == AP_MODE_READBYTES || mode == AP_MODE_SPECULATIVE) {
-        apr_bucket *e;
-
         AP_DEBUG_ASSERT(readbytes > 0);
 
         e = APR_BRIGADE_FIRST(ctx->bb);
@@ -281,6 +374,10 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
                     len += e->length;
                     e = APR_BUCKET_NEXT(e);
                 }
+                else if (APR_BUCKET_IS_SOCKET(e)) {
+                    /* Same as below, with the read-ahead size */
+                    rv = core_socket_read(ctx, &e, APR_NONBLOCK_READ);
+                }
                 else {
                     /*
                      * Read from bucket, but non blocking. If there isn't any
@@ -30,6 +30,11 @@
 #include "apr_signal.h"
 #include "apr_portable.h"
 #include "apr_base64.h"
+#include "apr_atomic.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#endif
 
 #define APR_WANT_STDIO
 #define APR_WANT_STRFUNC
@@ -44,6 +49,12 @@
 #if APR_HAVE_PROCESS_H
 #include <process.h>            /* for getpid() on Win32 */
 #endif
+#if APR_HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#if APR_HAVE_LIMITS_H
+#include <limits.h>
+#endif
 
 #include "ap_config.h"
 #include "httpd.h"
@@ -55,6 +66,7 @@
 #include "ap_mpm.h"
 #include "ap_provider.h"
 #include "ap_listen.h"
+#include "scoreboard.h"
 
 #if HAVE_GETTID
 #include <sys/syscall.h>
@@ -109,6 +121,10 @@ typedef struct read_handle_t {
 
 static read_handle_t *read_handles;
 
+#if APR_HAS_THREADS
+typedef struct piped_log_buffer piped_log_buffer;
+#endif
+
 /**
  * @brief The piped logging structure.
  *
@@ -127,6 +143,16 @@ struct piped_log {
     apr_proc_t *pid;
     /** How to reinvoke program when it must be replaced */
     apr_cmdtype_e cmdtype;
+#endif
+    /** The next piped log opened, for the children to set up the buffers */
+    piped_log *next;
+    /** The size of the children's buffer of lines (PipedLogBuffer), or 0 */
+    apr_size_t bufsize;
+    /** Whether the lines which don't fit in the buffer are dropped */
+    int drop;
+#if APR_HAS_THREADS
+    /** The buffer and its writer thread, in a child */
+    piped_log_buffer *buffer;
 #endif
 };
 
@@ -162,14 +188,347 @@ static void close_handle_in_child(apr_pool_t *p, apr_file_t *f)
 #endif
 }
 
+/* piped logs opened in this generation, whose buffers the children set up */
+static piped_log *piped_logs;
+
+#ifdef PIPE_BUF
+#define PIPED_LOG_ATOMIC PIPE_BUF
+#else
+#define PIPED_LOG_ATOMIC 512
+#endif
+
+static void piped_log_register(piped_log *pl)
+{
+    core_server_config *conf = NULL;
+
+    if (ap_server_conf) {
+        conf = ap_get_core_module_config(ap_server_conf->module_config);
+    }
+    pl->bufsize = conf ? conf->piped_log_buffer : 0;
+    pl->drop = conf ? conf->piped_log_drop : 0;
+#if APR_HAS_THREADS
+    pl->buffer = NULL;
+#endif
+    pl->next = piped_logs;
+    piped_logs = pl;
+
+#ifdef F_SETPIPE_SZ
+    /* A larger pipe absorbs the short stalls of the logger before the
+     * buffers even fill up (best effort, up to the default limit of
+     * /proc/sys/fs/pipe-max-size).
+     */
+    if (pl->bufsize) {
+        apr_os_file_t fd;
+
+        if (apr_os_file_get(&fd, pl->write_fd) == APR_SUCCESS) {
+            fcntl(fd, F_SETPIPE_SZ,
+                  (int)(pl->bufsize < 1048576 ? pl->bufsize : 1048576));
+        }
+    }
+#endif
+}
+
+static void piped_log_unregister(piped_log *pl)
+{
+    piped_log **cur;
+
+    for (cur = &piped_logs; *cur; cur = &(*cur)->next) {
+        if (*cur == pl) {
+            *cur = pl->next;
+            break;
+        }
+    }
+}
+
+#if APR_HAS_THREADS
+/*
+ * The buffer of a piped log in a child: the threads serving the requests
+ * copy their lines in, a writer thread of its own moves them to the pipe,
+ * in writes of as many lines as PIPE_BUF allows (beyond that, the writes
+ * of the children could interleave in the pipe). When the logger stalls,
+ * only the writer blocks, until the buffer is full.
+ */
+struct piped_log_buffer {
+    apr_thread_mutex_t *mutex;
+    /** Signaled when a line is added to the empty buffer */
+    apr_thread_cond_t *filled;
+    /** Broadcast when room is made, if some threads wait for it */
+    apr_thread_cond_t *drained;
+    apr_thread_t *thread;
+    char *data;
+    apr_size_t size;
+    /** The lines are in [tail, head), or [tail, wrap) then [0, head) once
+     *  head went back to the start for a line which did not fit at the end
+     *  (lines are never split, head never catches up with tail).
+     */
+    apr_size_t head, tail, wrap;
+    int waiters;
+    int exiting;
+};
+
+/* Where to copy a line of len bytes, or NULL if there is no room for it */
+static char *piped_log_reserve(piped_log_buffer *b, apr_size_t len)
+{
+    char *dst = b->data + b->head;
+
+    if (b->head >= b->tail) {
+        if (b->size - b->head >= len) {
+            b->head += len;
+            return dst;
+        }
+        if (len < b->tail) {
+            b->wrap = b->head;
+            b->head = len;
+            return b->data;
+        }
+        return NULL;
+    }
+    if (b->tail - b->head > len) {
+        b->head += len;
+        return dst;
+    }
+    return NULL;
+}
+
+/* How much of the len bytes at data to write at once: the lines which fit
+ * in PIPED_LOG_ATOMIC bytes, or the first one alone if it does not.
+ */
+static apr_size_t piped_log_chunk(const char *data, apr_size_t len)
+{
+    const char *nl;
+    apr_size_t n;
+
+    if (len <= PIPED_LOG_ATOMIC) {
+        return len;
+    }
+    for (n = PIPED_LOG_ATOMIC; n > 0; --n) {
+        if (data[n - 1] == '\n') {
+            return n;
+        }
+    }
+    nl = memchr(data, '\n', len);
+    return nl ? nl + 1 - data : len;
+}
+
+static void *APR_THREAD_FUNC piped_log_writer(apr_thread_t *thd, void *data)
+{
+    piped_log *pl = data;
+    piped_log_buffer *b = pl->buffer;
+    apr_status_t rv, last = APR_SUCCESS;
+
+    apr_thread_mutex_lock(b->mutex);
+    for (;;) {
+        apr_size_t end, len;
+
+        while (b->head == b->tail && !b->exiting) {
+            apr_thread_cond_wait(b->filled, b->mutex);
+        }
+        if (b->head == b->tail) {
+            break;
+        }
+        if (b->head < b->tail && b->tail == b->wrap) {
+            b->tail = 0;
+            continue;
+        }
+        end = (b->head > b->tail) ? b->head : b->wrap;
+        len = piped_log_chunk(b->data + b->tail, end - b->tail);
+
+        /* The lines being written are out of reach of the producers until
+         * tail moves past them.
+         */
+        apr_thread_mutex_unlock(b->mutex);
+        rv = apr_file_write_full(pl->write_fd, b->data + b->tail, len, NULL);
+        if (rv != APR_SUCCESS && last == APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                         APLOGNO(10189) "error writing to a piped log, "
+                         "its lines are lost until it is writable again");
+        }
+        last = rv;
+        apr_thread_mutex_lock(b->mutex);
+
+        b->tail += len;
+        if (b->tail == b->head) {
+            b->head = b->tail = 0;
+        }
+        if (b->waiters) {
+            apr_thread_cond_broadcast(b->drained);
+        }
+    }
+    apr_thread_mutex_unlock(b->mutex);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+/* Pre-cleanup of the child's pool, the writer must be done with the
+ * buffer before the pools of the threads are destroyed.
+ */
+static apr_status_t piped_log_buffer_cleanup(void *data)
+{
+    piped_log *pl = data;
+    piped_log_buffer *b = pl->buffer;
+    apr_status_t rv;
+
+    /* The writer exits once the buffer is drained */
+    apr_thread_mutex_lock(b->mutex);
+    b->exiting = 1;
+    apr_thread_cond_signal(b->filled);
+    apr_thread_cond_broadcast(b->drained);
+    apr_thread_mutex_unlock(b->mutex);
+    apr_thread_join(&rv, b->thread);
+
+    pl->buffer = NULL;
+    return APR_SUCCESS;
+}
+
+/* The writer must not take the signals sent to the child: in a child
+ * with no other thread (prefork), the handler would run the child's exit,
+ * and so piped_log_buffer_cleanup() joining the writer, in the writer
+ * itself.  It is created with all the signals blocked (but those its own
+ * faults would raise), and inherits that.
+ */
+static apr_status_t piped_log_writer_create(apr_pool_t *p, piped_log *pl)
+{
+    apr_status_t rv;
+#ifdef SIG_BLOCK
+    sigset_t sig_mask, saved_mask;
+
+    sigfillset(&sig_mask);
+    sigdelset(&sig_mask, SIGSEGV);
+    sigdelset(&sig_mask, SIGFPE);
+    sigdelset(&sig_mask, SIGILL);
+#ifdef SIGBUS
+    sigdelset(&sig_mask, SIGBUS);
+#endif
+#if defined(SIGPROCMASK_SETS_THREAD_MASK)
+    sigprocmask(SIG_BLOCK, &sig_mask, &saved_mask);
+#else
+    pthread_sigmask(SIG_BLOCK, &sig_mask, &saved_mask);
+#endif
+#endif
+
+    rv = apr_thread_create(&pl->buffer->thread, NULL, piped_log_writer, pl,
+                           p);
+
+#ifdef SIG_BLOCK
+#if defined(SIGPROCMASK_SETS_THREAD_MASK)
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+#else
+    pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+#endif
+#endif
+    return rv;
+}
+
+static void piped_log_buffer_start(apr_pool_t *p, piped_log *pl)
+{
+    piped_log_buffer *b;
+    apr_status_t rv;
+
+    b = apr_pcalloc(p, sizeof(*b));
+    b->size = pl->bufsize;
+    b->data = apr_palloc(p, b->size);
+    if ((rv = apr_thread_mutex_create(&b->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                      p)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&b->filled, p)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&b->drained, p)) != APR_SUCCESS) {
+        goto failed;
+    }
+    pl->buffer = b;
+    rv = piped_log_writer_create(p, pl);
+    if (rv != APR_SUCCESS) {
+        pl->buffer = NULL;
+        goto failed;
+    }
+    apr_pool_pre_cleanup_register(p, pl, piped_log_buffer_cleanup);
+    return;
+
+failed:
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(10190)
+                 "could not set up the buffer of a piped log, "
+                 "its lines are written directly");
+}
+
+/* Count a line waited for or dropped, in the scoreboard for mod_status */
+static void piped_log_count(int dropped)
+{
+    if (ap_scoreboard_image) {
+        global_score *g = ap_scoreboard_image->global;
+
+        apr_atomic_inc32(dropped ? &g->piped_log_drops
+                                 : &g->piped_log_stalls);
+    }
+}
+#endif /* APR_HAS_THREADS */
+
+AP_DECLARE(apr_status_t) ap_piped_log_write(piped_log *pl, const char *str,
+                                            apr_size_t len)
+{
+#if APR_HAS_THREADS
+    piped_log_buffer *b = pl->buffer;
+
+    /* The lines too long for the buffer are written directly, and thus
+     * before the lines of the child still in the buffer.
+     */
+    if (b && len <= b->size / 4) {
+        int empty, stalled = 0;
+        char *dst;
+
+        apr_thread_mutex_lock(b->mutex);
+        for (;;) {
+            empty = (b->head == b->tail);
+            if ((dst = piped_log_reserve(b, len)) || pl->drop || b->exiting) {
+                break;
+            }
+            if (!stalled) {
+                piped_log_count(0);
+                stalled = 1;
+            }
+            ++b->waiters;
+            apr_thread_cond_wait(b->drained, b->mutex);
+            --b->waiters;
+        }
+        if (dst) {
+            memcpy(dst, str, len);
+            if (empty) {
+                apr_thread_cond_signal(b->filled);
+            }
+        }
+        apr_thread_mutex_unlock(b->mutex);
+
+        if (dst) {
+            return APR_SUCCESS;
+        }
+        if (pl->drop && !b->exiting) {
+            /* Counted, not reported: the error log would not keep up */
+            piped_log_count(1);
+            return APR_SUCCESS;
+        }
+    }
+#endif
+
+    return apr_file_write_full(pl->write_fd, str, len, NULL);
+}
+
 void ap_logs_child_init(apr_pool_t *p, server_rec *s)
 {
     read_handle_t *cur = read_handles;
+#if APR_HAS_THREADS
+    piped_log *pl;
+#endif
 
     while (cur) {
         apr_file_close(cur->handle);
         cur = cur->next;
     }
+
+#if APR_HAS_THREADS
+    for (pl = piped_logs; pl; pl = pl->next) {
+        if (pl->bufsize) {
+            piped_log_buffer_start(p, pl);
+        }
+    }
+#endif
 }
 
 AP_DECLARE(void) ap_open_stderr_log(apr_pool_t *p)
@@ -1758,6 +2117,7 @@ static apr_status_t piped_log_cleanup(void *data)
 {
     piped_log *pl = data;
 
+    piped_log_unregister(pl);
     if (pl->pid != NULL) {
         apr_proc_kill(pl->pid, SIGTERM);
     }
@@ -1789,6 +2149,7 @@ AP_DECLARE(piped_log *) ap_open_piped_log_ex(apr_pool_t *p,
         apr_file_close(pl->write_fd);
         return NULL;
     }
+    piped_log_register(pl);
     return pl;
 }
 
@@ -1798,6 +2159,7 @@ static apr_status_t piped_log_cleanup(void *data)
 {
     piped_log *pl = data;
 
+    piped_log_unregister(pl);
     apr_file_close(pl->write_fd);
     return APR_SUCCESS;
 }
@@ -1822,6 +2184,7 @@ AP_DECLARE(piped_log *) ap_open_piped_log_ex(apr_pool_t *p,
     pl->p = p;
     pl->read_fd = NULL;
     pl->write_fd = dummy;
+    piped_log_register(pl);
     apr_pool_cleanup_register(p, pl, piped_log_cleanup, piped_log_cleanup);
 
     return pl;
@@ -320,6 +320,59 @@ static void reset_process_pconf(process_rec *process)
     apr_pool_pre_cleanup_register(process->pconf, NULL, deregister_all_hooks);
 }
 
+/* Timing of the (re)load phases, reported once the configuration of each
+ * generation is loaded, to see where the time goes with large configs.
+ */
+typedef enum {
+    config_phase_read,
+    config_phase_pre_config,
+    config_phase_process,
+    config_phase_check_config,
+    config_phase_open_logs,
+    config_phase_post_config,
+    config_phase_count
+} config_phase_e;
+
+static const char *const config_phase_names[config_phase_count] = {
+    "read", "pre_config", "process", "check_config", "open_logs",
+    "post_config"
+};
+
+typedef struct {
+    apr_time_t start;
+    apr_time_t last;
+    apr_interval_time_t phase[config_phase_count];
+} config_timing_t;
+
+static void config_timing_start(config_timing_t *timing)
+{
+    memset(timing, 0, sizeof(*timing));
+    timing->start = timing->last = apr_time_now();
+}
+
+static void config_timing_mark(config_timing_t *timing, config_phase_e phase)
+{
+    apr_time_t now = apr_time_now();
+    timing->phase[phase] = now - timing->last;
+    timing->last = now;
+}
+
+static void config_timing_log(config_timing_t *timing, apr_pool_t *p)
+{
+    char *phases = "";
+    int i;
+
+    for (i = 0; i < config_phase_count; ++i) {
+        phases = apr_psprintf(p, "%s%s%s: %" APR_TIME_T_FMT "ms", phases,
+                              i ? ", " : "", config_phase_names[i],
+                              apr_time_as_msec(timing->phase[i]));
+    }
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, ap_server_conf, APLOGNO(10162)
+                 "Configuration generation %d loaded in %" APR_TIME_T_FMT
+                 "ms (%s)", ap_config_generation,
+                 apr_time_as_msec(timing->last - timing->start), phases);
+}
+
 static process_rec *init_process(int *argc, const char * const * *argv)
 {
     process_rec *process;
@@ -507,6 +560,7 @@ static void usage(process_rec *process)
     module **mod;
     const char *opt_arg;
     APR_OPTIONAL_FN_TYPE(ap_signal_server) *signal_server;
+    config_timing_t timing;
     int rc = OK;
 
     AP_MONCONTROL(0); /* turn off profiling of startup */
@@ -789,12 +843,15 @@ static void usage(process_rec *process)
         apr_pool_create(&ptemp, pconf);
         apr_pool_tag(ptemp, "ptemp");
         ap_server_root = def_server_root;
+        config_timing_start(&timing);
         ap_server_conf = ap_read_config(process, ptemp, confname, &ap_conftree);
         if (!ap_server_conf) {
             destroy_and_exit_process(process, 1);
         }
         apr_pool_cleanup_register(pconf, &ap_server_conf,
                                   ap_pool_cleanup_set_null, apr_pool_cleanup_null);
+        config_timing_mark(&timing, config_phase_read);
+
         /* sort hooks here to make sure pre_config hooks are sorted properly */
         apr_hook_sort_all();
 
@@ -803,6 +860,7 @@ static void usage(process_rec *process)
                          APLOGNO(00017) "Pre-configuration failed, exiting");
             destroy_and_exit_process(process, 1);
         }
+        config_timing_mark(&timing, config_phase_pre_config);
 
         if (ap_process_config_tree(ap_server_conf, ap_conftree, process->pconf,
                                    ptemp) != OK) {
@@ -816,12 +874,14 @@ static void usage(process_rec *process)
          * perl.
          */
         apr_hook_sort_all();
+        config_timing_mark(&timing, config_phase_process);
 
         if (ap_run_check_config(pconf, plog, ptemp, ap_server_conf) != OK) {
             ap_log_error(APLOG_MARK, APLOG_EMERG, 0, NULL,
                          APLOGNO(00018) "Configuration check failed, exiting");
             destroy_and_exit_process(process, 1);
         }
+        config_timing_mark(&timing, config_phase_check_config);
 
         apr_pool_clear(plog);
         if (ap_run_open_logs(pconf, plog, ptemp, ap_server_conf) != OK) {
@@ -829,12 +889,15 @@ static void usage(process_rec *process)
                          APLOGNO(00019) "Unable to open logs, exiting");
             destroy_and_exit_process(process, 1);
         }
+        config_timing_mark(&timing, config_phase_open_logs);
 
         if (ap_run_post_config(pconf, plog, ptemp, ap_server_conf) != OK) {
             ap_log_error(APLOG_MARK, APLOG_EMERG, 0, NULL,
                          APLOGNO(00020) "Configuration Failed, exiting");
             destroy_and_exit_process(process, 1);
         }
+        config_timing_mark(&timing, config_phase_post_config);
+        config_timing_log(&timing, ptemp);
 
         apr_pool_destroy(ptemp);
         apr_pool_lock(pconf, 1);
@@ -28,6 +28,10 @@
 #include "apr_strings.h"
 #include "apr_file_io.h"
 #include "apr_fnmatch.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -41,6 +45,7 @@
 #include "http_protocol.h"
 #include "http_log.h"
 #include "http_main.h"
+#include "ap_mpm.h"
 #include "util_filter.h"
 #include "util_charset.h"
 #include "util_script.h"
@@ -390,6 +395,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
 typedef struct walk_walked_t {
     ap_conf_vector_t *matched; /* A dir_conf sections we matched */
     ap_conf_vector_t *merged;  /* The dir_conf merged result */
+    int shared;                /* merged lives as long as the child */
 } walk_walked_t;
 
 typedef struct walk_cache_t {
@@ -454,6 +460,128 @@ static walk_cache_t *prep_walk_cache(apr_size_t t, request_rec *r)
     return cache;
 }
 
+/* Per-child memoisation of the <Location > and <If > section merges.
+ *
+ * These walks merge the matching sections together (starting from the
+ * first one) before merging the result onto r->per_dir_config, so the
+ * intermediate results only depend on the sequence of matched sections,
+ * not on the request.  Each step is keyed by the pair (merged-so-far,
+ * section), where merged-so-far is either a config section itself or a
+ * previous cache entry, hence both live as long as the child and uniquely
+ * identify the sequence.
+ *
+ * This only holds for the sections of the server config: <If > sections
+ * read from an .htaccess file live in the request pool, and their addresses
+ * may be reused by a later request for different sections. So the <If >
+ * walk of a request tainted by .htaccess never uses the cache.
+ *
+ * Entries are never evicted since requests in flight may still refer to
+ * them; once AP_WALK_MERGE_CACHE_MAX entries are reached, new sequences
+ * are merged in the request pool as before.
+ */
+#ifndef AP_WALK_MERGE_CACHE_MAX
+#define AP_WALK_MERGE_CACHE_MAX 1024
+#endif
+
+typedef struct walk_merge_key_t {
+    const ap_conf_vector_t *base;
+    const ap_conf_vector_t *add;
+} walk_merge_key_t;
+
+typedef struct walk_merge_entry_t {
+    walk_merge_key_t key;
+    ap_conf_vector_t *merged;
+} walk_merge_entry_t;
+
+static apr_pool_t *merge_cache_pool = NULL;
+static apr_hash_t *merge_cache = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *merge_cache_mutex = NULL;
+#endif
+
+static apr_status_t merge_cache_cleanup(void *dummy)
+{
+    merge_cache_pool = NULL;
+    merge_cache = NULL;
+#if APR_HAS_THREADS
+    merge_cache_mutex = NULL;
+#endif
+    return APR_SUCCESS;
+}
+
+void ap_request_child_init(apr_pool_t *p, server_rec *s)
+{
+    if (AP_WALK_MERGE_CACHE_MAX <= 0) {
+        return;
+    }
+
+#if APR_HAS_THREADS
+    {
+        int threaded_mpm;
+        if (ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded_mpm) == APR_SUCCESS
+            && threaded_mpm
+            && apr_thread_mutex_create(&merge_cache_mutex,
+                                       APR_THREAD_MUTEX_DEFAULT,
+                                       p) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10161)
+                         "could not create the walk merge cache mutex, "
+                         "<Location > and <If > merges won't be cached");
+            return;
+        }
+    }
+#endif
+
+    apr_pool_create(&merge_cache_pool, p);
+    apr_pool_tag(merge_cache_pool, "walk_merge_cache");
+    merge_cache = apr_hash_make(merge_cache_pool);
+    apr_pool_cleanup_register(p, NULL, merge_cache_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+/* Merge add onto base, reusing (or recording) the result in the per-child
+ * cache if base is itself a child-lifetime vector, as told by *shared.
+ * On return *shared tells whether the result is a child-lifetime vector.
+ */
+static ap_conf_vector_t *walk_merge(request_rec *r, ap_conf_vector_t *base,
+                                    ap_conf_vector_t *add, int *shared)
+{
+    walk_merge_entry_t *entry;
+    walk_merge_key_t key;
+
+    if (!*shared || !merge_cache) {
+        *shared = 0;
+        return ap_merge_per_dir_configs(r->pool, base, add);
+    }
+
+    key.base = base;
+    key.add = add;
+
+#if APR_HAS_THREADS
+    if (merge_cache_mutex) {
+        apr_thread_mutex_lock(merge_cache_mutex);
+    }
+#endif
+    entry = apr_hash_get(merge_cache, &key, sizeof(key));
+    if (!entry && apr_hash_count(merge_cache) < AP_WALK_MERGE_CACHE_MAX) {
+        entry = apr_palloc(merge_cache_pool, sizeof(*entry));
+        entry->key = key;
+        entry->merged = ap_merge_per_dir_configs(merge_cache_pool, base, add);
+        apr_hash_set(merge_cache, &entry->key, sizeof(entry->key), entry);
+    }
+#if APR_HAS_THREADS
+    if (merge_cache_mutex) {
+        apr_thread_mutex_unlock(merge_cache_mutex);
+    }
+#endif
+
+    if (entry) {
+        return entry->merged;
+    }
+
+    *shared = 0;
+    return ap_merge_per_dir_configs(r->pool, base, add);
+}
+
 /*****************************************************************
  *
  * Getting and checking directory configuration.  Also checks the
@@ -1455,6 +1583,7 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
         int cached_matches = matches;
         walk_walked_t *last_walk = (walk_walked_t*)cache->walked->elts;
         apr_pool_t *rxpool = NULL;
+        int shared = 1;
 
         cached &= auth_internal_per_conf;
         cache->cached = entry_uri;
@@ -1525,6 +1654,7 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
             if (matches) {
                 if (last_walk->matched == sec_ent[sec_idx]) {
                     now_merged = last_walk->merged;
+                    shared = last_walk->shared;
                     ++last_walk;
                     --matches;
                     continue;
@@ -1539,9 +1669,8 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
             }
 
             if (now_merged) {
-                now_merged = ap_merge_per_dir_configs(r->pool,
-                                                      now_merged,
-                                                      sec_ent[sec_idx]);
+                now_merged = walk_merge(r, now_merged, sec_ent[sec_idx],
+                                        &shared);
             }
             else {
                 now_merged = sec_ent[sec_idx];
@@ -1550,6 +1679,7 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
             last_walk = (walk_walked_t*)apr_array_push(cache->walked);
             last_walk->matched = sec_ent[sec_idx];
             last_walk->merged = now_merged;
+            last_walk->shared = shared;
         }
 
         if (rxpool) {
@@ -1798,6 +1928,7 @@ static int ap_if_walk_sub(request_rec *r, core_dir_config* dconf)
     int matches;
     int cached_matches;
     int prev_result = -1;
+    int shared, htaccess;
     walk_walked_t *last_walk;
 
     if (dconf && dconf->sec_if) {
@@ -1813,6 +1944,12 @@ static int ap_if_walk_sub(request_rec *r, core_dir_config* dconf)
         return OK;
     }
 
+    /* sec_if may contain sections from .htaccess (request pool lifetime),
+     * which must not be memoised by walk_merge().
+     */
+    htaccess = ap_request_tainted(r, AP_TAINT_HTACCESS);
+    shared = !htaccess;
+
     cache = prep_walk_cache(AP_NOTE_IF_WALK, r);
     cached = (cache->cached != NULL);
     cache->cached = (void *)1;
@@ -1857,6 +1994,7 @@ static int ap_if_walk_sub(request_rec *r, core_dir_config* dconf)
         if (matches) {
             if (last_walk->matched == sec_ent[sec_idx]) {
                 now_merged = last_walk->merged;
+                shared = last_walk->shared && !htaccess;
                 ++last_walk;
                 --matches;
                 continue;
@@ -1871,9 +2009,7 @@ static int ap_if_walk_sub(request_rec *r, core_dir_config* dconf)
         }
 
         if (now_merged) {
-            now_merged = ap_merge_per_dir_configs(r->pool,
-                                                  now_merged,
-                                                  sec_ent[sec_idx]);
+            now_merged = walk_merge(r, now_merged, sec_ent[sec_idx], &shared);
         }
         else {
             now_merged = sec_ent[sec_idx];
@@ -1882,6 +2018,7 @@ static int ap_if_walk_sub(request_rec *r, core_dir_config* dconf)
         last_walk = (walk_walked_t*)apr_array_push(cache->walked);
         last_walk->matched = sec_ent[sec_idx];
         last_walk->merged = now_merged;
+        last_walk->shared = shared;
     }
 
     /* Everything matched in sequence, but it may be that the original
@@ -76,6 +76,31 @@
  */
 #include "test_char.h"
 
+/* Length of the initial run of s with none of the test_char_table flags f
+ * (and no NUL), which the escaping functions can copy as is in one go, or
+ * return as is when it is the whole string.
+ */
+static APR_INLINE apr_size_t test_char_span(const unsigned char *s,
+                                            unsigned f)
+{
+    const unsigned char *p = s;
+
+    for (;; p += 4) {
+        if (!p[0] || TEST_CHAR(p[0], f)) {
+            return p - s;
+        }
+        if (!p[1] || TEST_CHAR(p[1], f)) {
+            return p - s + 1;
+        }
+        if (!p[2] || TEST_CHAR(p[2], f)) {
+            return p - s + 2;
+        }
+        if (!p[3] || TEST_CHAR(p[3], f)) {
+            return p - s + 3;
+        }
+    }
+}
+
 /* Win32/NetWare/OS2 need to check for both forward and back slashes
  * in ap_getparents() and ap_escape_url.
  */
@@ -1961,16 +1986,17 @@ AP_DECLARE(char *) ap_escape_path_segment_buffer(char *copy, const char *segment
 {
     const unsigned char *s = (const unsigned char *)segment;
     unsigned char *d = (unsigned char *)copy;
-    unsigned c;
+    apr_size_t n;
 
-    while ((c = *s)) {
-        if (TEST_CHAR(c, T_ESCAPE_PATH_SEGMENT)) {
-            d = c2x(c, '%', d);
-        }
-        else {
-            *d++ = c;
+    for (;;) {
+        n = test_char_span(s, T_ESCAPE_PATH_SEGMENT);
+        memcpy(d, s, n);
+        d += n;
+        s += n;
+        if (!*s) {
+            break;
         }
-        ++s;
+        d = c2x(*s++, '%', d);
     }
     *d = '\0';
     return copy;
@@ -1978,37 +2004,59 @@ AP_DECLARE(char *) ap_escape_path_segment_buffer(char *copy, const char *segment
 
 AP_DECLARE(char *) ap_escape_path_segment(apr_pool_t *p, const char *segment)
 {
-    return ap_escape_path_segment_buffer(apr_palloc(p, 3 * strlen(segment) + 1), segment);
+    apr_size_t n = test_char_span((const unsigned char *)segment,
+                                  T_ESCAPE_PATH_SEGMENT);
+    char *copy;
+
+    /* Fast path: nothing to escape */
+    if (!segment[n]) {
+        return apr_pmemdup(p, segment, n + 1);
+    }
+    copy = apr_palloc(p, n + 3 * strlen(segment + n) + 1);
+    memcpy(copy, segment, n);
+    ap_escape_path_segment_buffer(copy + n, segment + n);
+    return copy;
 }
 
 AP_DECLARE(char *) ap_os_escape_path(apr_pool_t *p, const char *path, int partial)
 {
-    /* Allocate +3 for potential "./" and trailing NULL.
-     * Allocate another +1 to allow the caller to add a trailing '/' (see
-     * comment in 'ap_sub_req_lookup_dirent')
-     */
-    char *copy = apr_palloc(p, 3 * strlen(path) + 3 + 1);
     const unsigned char *s = (const unsigned char *)path;
-    unsigned char *d = (unsigned char *)copy;
-    unsigned c;
+    unsigned char *d;
+    char *copy;
+    apr_size_t n, len;
+    int dotslash = 0;
 
     if (!partial) {
         const char *colon = ap_strchr_c(path, ':');
         const char *slash = ap_strchr_c(path, '/');
 
         if (colon && (!slash || colon < slash)) {
-            *d++ = '.';
-            *d++ = '/';
+            dotslash = 2;
         }
     }
-    while ((c = *s)) {
-        if (TEST_CHAR(c, T_OS_ESCAPE_PATH)) {
-            d = c2x(c, '%', d);
-        }
-        else {
-            *d++ = c;
+
+    /* Allocate +2 for potential "./" and +1 for the trailing NULL, or 3
+     * times the length from the first char to escape (if any).
+     * Allocate another +1 to allow the caller to add a trailing '/' (see
+     * comment in 'ap_sub_req_lookup_dirent')
+     */
+    n = test_char_span(s, T_OS_ESCAPE_PATH);
+    len = s[n] ? n + 3 * strlen(path + n) : n;
+    copy = apr_palloc(p, dotslash + len + 1 + 1);
+    d = (unsigned char *)copy;
+    if (dotslash) {
+        *d++ = '.';
+        *d++ = '/';
+    }
+    for (;;) {
+        memcpy(d, s, n);
+        d += n;
+        s += n;
+        if (!*s) {
+            break;
         }
-        ++s;
+        d = c2x(*s++, '%', d);
+        n = test_char_span(s, T_OS_ESCAPE_PATH);
     }
     *d = '\0';
     return copy;
@@ -2043,13 +2091,35 @@ AP_DECLARE(char *) ap_escape_urlencoded(apr_pool_t *p, const char *buffer)
 
 /* ap_escape_uri is now a macro for os_escape_path */
 
+/* Length of the initial run of s with nothing to escape for html */
+static APR_INLINE apr_size_t html_span(const char *s, int toasc)
+{
+    const char *p;
+
+    if (!toasc) {
+        return strcspn(s, "<>&\"");
+    }
+    for (p = s; *p; ++p) {
+        if (*p == '<' || *p == '>' || *p == '&' || *p == '"'
+            || !apr_isascii(*p)) {
+            break;
+        }
+    }
+    return p - s;
+}
+
 AP_DECLARE(char *) ap_escape_html2(apr_pool_t *p, const char *s, int toasc)
 {
-    int i, j;
+    apr_size_t i, j, n;
     char *x;
 
-    /* first, count the number of extra characters */
-    for (i = 0, j = 0; s[i] != '\0'; i++)
+    /* first, look for something to escape */
+    n = html_span(s, toasc);
+    if (s[n] == '\0')
+        return apr_pmemdup(p, s, n + 1);
+
+    /* then count the number of extra characters from there */
+    for (i = n, j = 0; s[i] != '\0'; i++)
         if (s[i] == '<' || s[i] == '>')
             j += 3;
         else if (s[i] == '&')
@@ -2059,11 +2129,9 @@ AP_DECLARE(char *) ap_escape_html2(apr_pool_t *p, const char *s, int toasc)
         else if (toasc && !apr_isascii(s[i]))
             j += 5;
 
-    if (j == 0)
-        return apr_pstrmemdup(p, s, i);
-
     x = apr_palloc(p, i + j + 1);
-    for (i = 0, j = 0; s[i] != '\0'; i++, j++)
+    memcpy(x, s, n);
+    for (i = n, j = n; s[i] != '\0'; i++, j++)
         if (s[i] == '<') {
             memcpy(&x[j], "&lt;", 4);
             j += 3;
@@ -2081,8 +2149,14 @@ AP_DECLARE(char *) ap_escape_html2(apr_pool_t *p, const char *s, int toasc)
             j += 5;
         }
         else if (toasc && !apr_isascii(s[i])) {
-            char *esc = apr_psprintf(p, "&#%3.3d;", (unsigned char)s[i]);
-            memcpy(&x[j], esc, 6);
+            /* "&#nnn;", the code is always 3 digits (128 to 255) */
+            unsigned char c = (unsigned char)s[i];
+            x[j] = '&';
+            x[j + 1] = '#';
+            x[j + 2] = '0' + c / 100;
+            x[j + 3] = '0' + c / 10 % 10;
+            x[j + 4] = '0' + c % 10;
+            x[j + 5] = ';';
             j += 5;
         }
         else
@@ -2096,63 +2170,67 @@ AP_DECLARE(char *) ap_escape_logitem(apr_pool_t *p, const char *str)
     char *ret;
     unsigned char *d;
     const unsigned char *s;
-    apr_size_t length, escapes = 0;
+    apr_size_t length, n, escapes = 0;
 
     if (!str) {
         return NULL;
     }
 
-    /* Compute how many characters need to be escaped */
+    /* Fast path: nothing to escape */
     s = (const unsigned char *)str;
-    for (; *s; ++s) {
+    n = test_char_span(s, T_ESCAPE_LOGITEM);
+    if (!s[n]) {
+        return apr_pmemdup(p, str, n + 1);
+    }
+
+    /* Compute how many characters need to be escaped, from the first one */
+    for (s += n; *s; ++s) {
         if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
             escapes++;
         }
     }
-    
+
     /* Compute the length of the input string, including NULL */
     length = s - (const unsigned char *)str + 1;
-    
-    /* Fast path: nothing to escape */
-    if (escapes == 0) {
-        return apr_pmemdup(p, str, length);
-    }
-    
+
     /* Each escaped character needs up to 3 extra bytes (0 --> \x00) */
     ret = apr_palloc(p, length + 3 * escapes);
     d = (unsigned char *)ret;
     s = (const unsigned char *)str;
-    for (; *s; ++s) {
-        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
-            *d++ = '\\';
-            switch(*s) {
-            case '\b':
-                *d++ = 'b';
-                break;
-            case '\n':
-                *d++ = 'n';
-                break;
-            case '\r':
-                *d++ = 'r';
-                break;
-            case '\t':
-                *d++ = 't';
-                break;
-            case '\v':
-                *d++ = 'v';
-                break;
-            case '\\':
-            case '"':
-                *d++ = *s;
-                break;
-            default:
-                c2x(*s, 'x', d);
-                d += 3;
-            }
+    for (;;) {
+        memcpy(d, s, n);
+        d += n;
+        s += n;
+        if (!*s) {
+            break;
         }
-        else {
+        *d++ = '\\';
+        switch(*s) {
+        case '\b':
+            *d++ = 'b';
+            break;
+        case '\n':
+            *d++ = 'n';
+            break;
+        case '\r':
+            *d++ = 'r';
+            break;
+        case '\t':
+            *d++ = 't';
+            break;
+        case '\v':
+            *d++ = 'v';
+            break;
+        case '\\':
+        case '"':
             *d++ = *s;
+            break;
+        default:
+            c2x(*s, 'x', d);
+            d += 3;
         }
+        ++s;
+        n = test_char_span(s, T_ESCAPE_LOGITEM);
     }
     *d = '\0';
 
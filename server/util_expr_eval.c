@@ -79,6 +79,8 @@ static const char *ap_expr_regexec(const char *subject,
 static apr_array_header_t *ap_expr_list_make(ap_expr_eval_ctx_t *ctx,
                                              const ap_expr_t *node);
 
+static int ap_expr_func_is_foldable(const void *func);
+
 /* define AP_EXPR_DEBUG to log the parse tree when parsing an expression */
 #ifdef AP_EXPR_DEBUG
 static void expr_dump_tree(const ap_expr_t *e, const server_rec *s,
@@ -570,6 +572,239 @@ static int ssl_expr_eval_comp(ap_expr_eval_ctx_t *ctx, const ap_expr_t *node)
     }
 }
 
+/*
+ * Constant folding, applied once to the parse tree after parsing.
+ *
+ * Subtrees which only depend on literals are evaluated at config time
+ * and replaced by an op_String, op_True or op_False node, so that the
+ * evaluation at request time does not have to recompute (and allocate)
+ * them again and again. Constant conditions are only folded away when
+ * they come first in an op_And/op_Or, such that non-constant operands
+ * with side effects (like adding to the Vary header) are still evaluated
+ * as before.
+ */
+#define EXPR_IS_CONST_WORD(e) ((e)->node_op == op_String \
+                               || (e)->node_op == op_Digit)
+#define EXPR_IS_CONST_COND(e) ((e)->node_op == op_True \
+                               || (e)->node_op == op_False)
+
+static ap_expr_t *expr_fold_string(ap_expr_parse_ctx_t *ctx, const char *str)
+{
+    return ap_expr_make(op_String, str, NULL, ctx);
+}
+
+static ap_expr_t *expr_fold_cond(ap_expr_parse_ctx_t *ctx, int result)
+{
+    return ap_expr_make(result ? op_True : op_False, NULL, NULL, ctx);
+}
+
+static ap_expr_t *expr_fold(ap_expr_parse_ctx_t *ctx, ap_expr_t *node);
+
+static int expr_fold_list(ap_expr_parse_ctx_t *ctx, ap_expr_t *node)
+{
+    int all_const = 1;
+
+    for (; node; node = (ap_expr_t *)node->node_arg2) {
+        node->node_arg1 = expr_fold(ctx, (ap_expr_t *)node->node_arg1);
+        if (!EXPR_IS_CONST_WORD((const ap_expr_t *)node->node_arg1)) {
+            all_const = 0;
+        }
+    }
+    return all_const;
+}
+
+static ap_expr_t *expr_fold_comp(ap_expr_parse_ctx_t *ctx, ap_expr_t *node)
+{
+    ap_expr_t *e1 = (ap_expr_t *)node->node_arg1;
+    ap_expr_t *e2 = (ap_expr_t *)node->node_arg2;
+    const char *s1, *s2;
+    int rc;
+
+    node->node_arg1 = e1 = expr_fold(ctx, e1);
+    if (node->node_op == op_REG || node->node_op == op_NRE) {
+        /* matching may set backreferences at runtime, leave it alone */
+        return node;
+    }
+    if (node->node_op == op_IN) {
+        if (e2->node_op == op_ListElement) {
+            if (expr_fold_list(ctx, e2) && EXPR_IS_CONST_WORD(e1)) {
+                s1 = e1->node_arg1;
+                for (; e2; e2 = (ap_expr_t *)e2->node_arg2) {
+                    s2 = ((const ap_expr_t *)e2->node_arg1)->node_arg1;
+                    if (strcmp(s1, s2) == 0) {
+                        return expr_fold_cond(ctx, 1);
+                    }
+                }
+                return expr_fold_cond(ctx, 0);
+            }
+        }
+        else {
+            node->node_arg2 = expr_fold(ctx, e2);
+        }
+        return node;
+    }
+
+    node->node_arg2 = e2 = expr_fold(ctx, e2);
+    if (!EXPR_IS_CONST_WORD(e1) || !EXPR_IS_CONST_WORD(e2)) {
+        return node;
+    }
+
+    s1 = e1->node_arg1;
+    s2 = e2->node_arg1;
+    if (ctx->flags & AP_EXPR_FLAG_SSL_EXPR_COMPAT) {
+        rc = strcmplex(s1, s2);
+    }
+    else if (node->node_op >= op_EQ && node->node_op <= op_GE) {
+        rc = intstrcmp(s1, s2);
+    }
+    else {
+        rc = strcmp(s1, s2);
+    }
+
+    switch (node->node_op) {
+    case op_EQ:
+    case op_STR_EQ:
+        return expr_fold_cond(ctx, rc == 0);
+    case op_NE:
+    case op_STR_NE:
+        return expr_fold_cond(ctx, rc != 0);
+    case op_LT:
+    case op_STR_LT:
+        return expr_fold_cond(ctx, rc < 0);
+    case op_LE:
+    case op_STR_LE:
+        return expr_fold_cond(ctx, rc <= 0);
+    case op_GT:
+    case op_STR_GT:
+        return expr_fold_cond(ctx, rc > 0);
+    case op_GE:
+    case op_STR_GE:
+        return expr_fold_cond(ctx, rc >= 0);
+    default:
+        return node;
+    }
+}
+
+static ap_expr_t *expr_fold(ap_expr_parse_ctx_t *ctx, ap_expr_t *node)
+{
+    ap_expr_t *e1, *e2;
+
+    if (!node) {
+        return node;
+    }
+
+    e1 = (ap_expr_t *)node->node_arg1;
+    e2 = (ap_expr_t *)node->node_arg2;
+    switch (node->node_op) {
+    case op_Not:
+        e1 = expr_fold(ctx, e1);
+        if (EXPR_IS_CONST_COND(e1)) {
+            return expr_fold_cond(ctx, e1->node_op == op_False);
+        }
+        node->node_arg1 = e1;
+        break;
+
+    case op_And:
+    case op_Or:
+        e1 = expr_fold(ctx, e1);
+        e2 = expr_fold(ctx, e2);
+        if (EXPR_IS_CONST_COND(e1)) {
+            /* true && x, false || x => x
+             * false && x, true || x => e1 (x is never evaluated)
+             */
+            if ((e1->node_op == op_True) == (node->node_op == op_And)) {
+                return e2;
+            }
+            return e1;
+        }
+        if (EXPR_IS_CONST_COND(e2)
+                && (e2->node_op == op_True) == (node->node_op == op_And)) {
+            /* x && true, x || false => x */
+            return e1;
+        }
+        node->node_arg1 = e1;
+        node->node_arg2 = e2;
+        break;
+
+    case op_Comp:
+        e1 = expr_fold_comp(ctx, e1);
+        if (EXPR_IS_CONST_COND(e1)) {
+            return e1;
+        }
+        node->node_arg1 = e1;
+        break;
+
+    case op_Word:
+        e1 = expr_fold(ctx, e1);
+        if (EXPR_IS_CONST_WORD(e1)) {
+            return e1;
+        }
+        node->node_arg1 = e1;
+        break;
+
+    case op_Bool:
+        e1 = expr_fold(ctx, e1);
+        if (EXPR_IS_CONST_COND(e1)) {
+            return expr_fold_string(ctx, e1->node_op == op_True ? "true"
+                                                                : "false");
+        }
+        node->node_arg1 = e1;
+        break;
+
+    case op_Concat:
+        e1 = expr_fold(ctx, e1);
+        e2 = expr_fold(ctx, e2);
+        if (EXPR_IS_CONST_WORD(e1) && EXPR_IS_CONST_WORD(e2)) {
+            return expr_fold_string(ctx, apr_pstrcat(ctx->pool, e1->node_arg1,
+                                                     e2->node_arg1, NULL));
+        }
+        node->node_arg1 = e1;
+        node->node_arg2 = e2;
+        break;
+
+    case op_StringFuncCall:
+        if (e2->node_op == op_ListElement) {
+            (void)expr_fold_list(ctx, e2);
+            break;
+        }
+        e2 = expr_fold(ctx, e2);
+        node->node_arg2 = e2;
+        if (EXPR_IS_CONST_WORD(e2) && ap_expr_func_is_foldable(e1->node_arg1)) {
+            ap_expr_string_func_t *func = (ap_expr_string_func_t *)e1->node_arg1;
+            ap_expr_eval_ctx_t ectx;
+            const char *err = NULL;
+            const char *result;
+
+            memset(&ectx, 0, sizeof(ectx));
+            ectx.p = ctx->pool;
+            ectx.err = &err;
+            result = (*func)(&ectx, e1->node_arg2, e2->node_arg1);
+            if (!err) {
+                return expr_fold_string(ctx, result ? result : "");
+            }
+        }
+        break;
+
+    case op_ListElement:
+        (void)expr_fold_list(ctx, node);
+        break;
+
+    case op_UnaryOpCall:
+        node->node_arg2 = expr_fold(ctx, e2);
+        break;
+
+    case op_BinaryOpCall:
+        e2->node_arg1 = expr_fold(ctx, (ap_expr_t *)e2->node_arg1);
+        e2->node_arg2 = expr_fold(ctx, (ap_expr_t *)e2->node_arg2);
+        break;
+
+    default:
+        break;
+    }
+
+    return node;
+}
+
 AP_DECLARE_NONSTD(int) ap_expr_lookup_default(ap_expr_lookup_parms *parms)
 {
     return ap_run_expr_lookup(parms);
@@ -614,6 +849,8 @@ AP_DECLARE(const char *) ap_expr_parse(apr_pool_t *pool, apr_pool_t *ptemp,
     if (rc) /* XXX can this happen? */
         return "syntax error";
 
+    ctx.expr = expr_fold(&ctx, ctx.expr);
+
 #ifdef AP_EXPR_DEBUG
     if (ctx.expr)
         expr_dump_tree(ctx.expr, NULL, APLOG_NOTICE, 2);
@@ -2072,6 +2309,24 @@ static const struct expr_provider_single string_func_providers[] = {
     { NULL, NULL, NULL}
 };
 
+/* String functions without side effects, which only depend on their
+ * argument, and can thus be evaluated at parse time for constant arguments.
+ */
+static int ap_expr_func_is_foldable(const void *func)
+{
+    return (func == (const void *)tolower_func
+            || func == (const void *)toupper_func
+            || func == (const void *)escape_func
+            || func == (const void *)base64_func
+            || func == (const void *)unbase64_func
+            || func == (const void *)sha1_func
+            || func == (const void *)md5_func
+#if APR_VERSION_AT_LEAST(1,6,0)
+            || func == (const void *)ldap_func
+#endif
+            );
+}
+
 static const struct expr_provider_single unary_op_providers[] = {
     { op_nz,        "n", NULL,             0 },
     { op_nz,        "z", NULL,             0 },
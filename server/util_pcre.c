@@ -53,6 +53,7 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "httpd.h"
+#include "http_core.h"
 #include "apr_strings.h"
 #include "apr_tables.h"
 
@@ -238,6 +239,18 @@ AP_DECLARE(int) ap_regcomp(ap_regex_t * preg, const char *pattern, int cflags)
     }
 
 #ifdef HAVE_PCRE2
+    /* Use the JIT compiler if it's available for the patterns compiled
+     * while reading the configuration, which are matched on every request.
+     * Those compiled at runtime (.htaccess, ap_expr runtime regexes, ...)
+     * are usually matched a few times only, not worth the JIT cost.
+     * On failure (e.g. JIT not supported on this platform) pcre2_match()
+     * simply falls back to the interpreter.
+     */
+    if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_RUN_MPM) {
+        (void)pcre2_jit_compile((pcre2_code *)preg->re_pcre,
+                                PCRE2_JIT_COMPLETE);
+    }
+
     pcre2_pattern_info((const pcre2_code *)preg->re_pcre,
                        PCRE2_INFO_CAPTURECOUNT, &capcount);
     preg->re_nsub = capcount;
@@ -309,6 +322,14 @@ AP_DECLARE(int) ap_regexec_len(const ap_regex_t *preg, const char *buff,
     rc = pcre2_match((const pcre2_code *)preg->re_pcre,
                      (const unsigned char *)buff, len,
                      0, options, matchdata, NULL);
+    if (rc == PCRE2_ERROR_JIT_STACKLIMIT) {
+        /* The JIT stack (32K by default) is too small for this pattern
+         * and subject, the interpreter has its own (heap) limits.
+         */
+        rc = pcre2_match((const pcre2_code *)preg->re_pcre,
+                         (const unsigned char *)buff, len,
+                         0, options | PCRE2_NO_JIT, matchdata, NULL);
+    }
     if (rc == 0)
         rc = nlim;            /* All captured slots were filled in */
 #else
@@ -51,6 +51,17 @@ struct exploded_time_cache_element {
 static struct exploded_time_cache_element exploded_cache_localtime[TIME_CACHE_SIZE];
 static struct exploded_time_cache_element exploded_cache_gmt[TIME_CACHE_SIZE];
 
+/* Cache for the RFC 822 format of recent timestamps (the Date field of
+ * each response), same design as the exploded_time_cache
+ */
+struct rfc822_date_cache_element {
+    apr_int64_t t;
+    char date[APR_RFC822_DATE_LEN];
+    apr_int64_t t_validate;
+};
+
+static struct rfc822_date_cache_element rfc822_date_cache[TIME_CACHE_SIZE];
+
 
 static apr_status_t cached_explode(apr_time_exp_t *xt, apr_time_t t,
                                    struct exploded_time_cache_element *cache,
@@ -261,10 +272,29 @@ AP_DECLARE(apr_status_t) ap_recent_rfc822_date(char *date_str, apr_time_t t)
     /* ### This code is a clone of apr_rfc822_date(), except that it
      * uses ap_explode_recent_gmt() instead of apr_time_exp_gmt().
      */
+    apr_int64_t seconds = apr_time_sec(t);
+    struct rfc822_date_cache_element *cache_element =
+        &(rfc822_date_cache[seconds & TIME_CACHE_MASK]);
+    struct rfc822_date_cache_element cache_element_snapshot;
+    char *date_start = date_str;
     apr_time_exp_t xt;
     const char *s;
     int real_year;
 
+    /* Formatted once per second, see cached_explode() for the (lock free)
+     * validation of the snapshot.
+     */
+    if (cache_element->t == seconds) {
+        memcpy(&cache_element_snapshot, cache_element,
+               sizeof(struct rfc822_date_cache_element));
+        if (seconds == cache_element_snapshot.t
+            && seconds == cache_element_snapshot.t_validate) {
+            memcpy(date_str, cache_element_snapshot.date,
+                   APR_RFC822_DATE_LEN);
+            return APR_SUCCESS;
+        }
+    }
+
     ap_explode_recent_gmt(&xt, t);
 
     /* example: "Sat, 08 Jan 2000 18:31:41 GMT" */
@@ -304,6 +334,12 @@ AP_DECLARE(apr_status_t) ap_recent_rfc822_date(char *date_str, apr_time_t t)
     *date_str++ = 'M';
     *date_str++ = 'T';
     *date_str++ = 0;
+
+    if (cache_element->t < seconds) {
+        cache_element->t = seconds;
+        memcpy(cache_element->date, date_start, APR_RFC822_DATE_LEN);
+        cache_element->t_validate = seconds;
+    }
     return APR_SUCCESS;
 }
 
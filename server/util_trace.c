@@ -0,0 +1,331 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * util_trace.c: W3C Trace Context (traceparent/tracestate) handling, and
+ * the spans of a request.
+ *
+ * The trace context lives in the core's request config of the initial
+ * request, and the spans are provided by their callers, so a request that
+ * is not sampled costs no allocation: only its ids, drawn from a per-thread
+ * generator, and the traceparent formatted for the outgoing calls, in a
+ * buffer of the context.
+ */
+
+#include "apr.h"
+#include "apr_thread_proc.h"
+
+#define APR_WANT_STRFUNC
+#define APR_WANT_MEMFUNC
+#include "apr_want.h"
+
+#include "httpd.h"
+#include "http_config.h"
+#include "http_core.h"
+#include "util_trace.h"
+
+APR_HOOK_STRUCT(
+    APR_HOOK_LINK(trace_span)
+)
+
+AP_IMPLEMENT_HOOK_VOID(trace_span,
+                       (request_rec *r, const ap_trace_span_t *span),
+                       (r, span))
+
+#define TRACE_RNG_KEY "ap_trace-rng"
+
+/* Fill buf with random bytes, from the thread's xorshift64* generator
+ * (seeded once from ap_random_insecure_bytes(), which takes a mutex).
+ */
+static void trace_random(const request_rec *r, unsigned char *buf,
+                         apr_size_t len)
+{
+#if APR_HAS_THREADS
+    apr_thread_t *thd = r->connection->current_thread;
+    apr_uint64_t *state = NULL, x;
+
+    if (!thd) {
+        ap_random_insecure_bytes(buf, len);
+        return;
+    }
+    apr_thread_data_get((void **)&state, TRACE_RNG_KEY, thd);
+    if (!state) {
+        state = apr_palloc(apr_thread_pool_get(thd), sizeof(*state));
+        do {
+            ap_random_insecure_bytes(state, sizeof(*state));
+        } while (!*state);
+        apr_thread_data_set(state, TRACE_RNG_KEY, NULL, thd);
+    }
+#else
+    static apr_uint64_t seed;
+    apr_uint64_t *state = &seed, x;
+
+    while (!seed) {
+        ap_random_insecure_bytes(&seed, sizeof(seed));
+    }
+#endif
+
+    while (len) {
+        apr_size_t n = len < sizeof(x) ? len : sizeof(x);
+
+        x = *state;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        *state = x;
+        x *= ((apr_uint64_t)0x2545F491 << 32) | 0x4F6CDD1D;
+        memcpy(buf, &x, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* A random id, which must not be all zeros */
+static void trace_new_id(const request_rec *r, unsigned char *id,
+                         apr_size_t len)
+{
+    apr_size_t i;
+    unsigned char any = 0;
+
+    trace_random(r, id, len);
+    for (i = 0; i < len; ++i) {
+        any |= id[i];
+    }
+    if (!any) {
+        id[len - 1] = 1;
+    }
+}
+
+/* Lowercase hex only, per the specification */
+static APR_INLINE int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/* Parse len bytes from 2 * len hex digits, return -1 if they are not,
+ * 0 if they are all zeros and 1 otherwise.
+ */
+static int parse_hex(const char *s, unsigned char *out, apr_size_t len)
+{
+    unsigned char any = 0;
+    apr_size_t i;
+
+    for (i = 0; i < len; ++i) {
+        int hi = hex_digit(s[2 * i]), lo = hex_digit(s[2 * i + 1]);
+
+        if (hi < 0 || lo < 0) {
+            return -1;
+        }
+        out[i] = (unsigned char)((hi << 4) | lo);
+        any |= out[i];
+    }
+    return any != 0;
+}
+
+AP_DECLARE(int) ap_trace_parse_traceparent(const char *val,
+                                           unsigned char *trace_id,
+                                           unsigned char *parent_id,
+                                           unsigned char *flags)
+{
+    unsigned char version;
+    apr_size_t len = strlen(val);
+
+    /* version "-" trace-id "-" parent-id "-" trace-flags */
+    if (len < AP_TRACEPARENT_LEN
+        || val[2] != '-' || val[35] != '-' || val[52] != '-'
+        || parse_hex(val, &version, 1) < 0 || version == 0xff
+        || parse_hex(val + 3, trace_id, AP_TRACE_ID_LEN) <= 0
+        || parse_hex(val + 36, parent_id, AP_TRACE_SPAN_ID_LEN) <= 0
+        || parse_hex(val + 53, flags, 1) < 0) {
+        return 0;
+    }
+    /* Later versions may append fields, version 00 may not */
+    if (len > AP_TRACEPARENT_LEN
+        && (version == 0 || val[AP_TRACEPARENT_LEN] != '-')) {
+        return 0;
+    }
+    return 1;
+}
+
+AP_DECLARE(void) ap_trace_format_traceparent(char *buf,
+                                             const unsigned char *trace_id,
+                                             const unsigned char *span_id,
+                                             unsigned char flags)
+{
+    buf[0] = '0';
+    buf[1] = '0';
+    buf[2] = '-';
+    ap_bin2hex(trace_id, AP_TRACE_ID_LEN, buf + 3);
+    buf[35] = '-';
+    ap_bin2hex(span_id, AP_TRACE_SPAN_ID_LEN, buf + 36);
+    buf[52] = '-';
+    ap_bin2hex(&flags, 1, buf + 53);
+}
+
+AP_DECLARE(ap_trace_t *) ap_trace_get(request_rec *r)
+{
+    core_request_config *req_cfg;
+
+    while (r->main || r->prev) {
+        r = r->main ? r->main : r->prev;
+    }
+    req_cfg = ap_get_core_module_config(r->request_config);
+    if (!req_cfg || !req_cfg->trace.active) {
+        return NULL;
+    }
+    return &req_cfg->trace;
+}
+
+/* The new traces are sampled from the 56 rightmost bits of their id
+ * (random ones, as level 2 of the specification requires them), so
+ * that the decision is the same wherever the ratio is the same.
+ */
+static int trace_sampled(const unsigned char *trace_id, int ppm)
+{
+    apr_uint64_t bits = 0;
+    int i;
+
+    if (ppm >= 1000000) {
+        return 1;
+    }
+    for (i = AP_TRACE_ID_LEN - 7; i < AP_TRACE_ID_LEN; ++i) {
+        bits = (bits << 8) | trace_id[i];
+    }
+    /* bits / 2^56 < ppm / 10^6, in 56 bits */
+    return (bits >> 20) * 1000000 < ((apr_uint64_t)ppm << 36);
+}
+
+AP_CORE_DECLARE(void) ap_trace_request_begin(request_rec *r)
+{
+    core_server_config *conf;
+    core_request_config *req_cfg;
+    ap_trace_t *t;
+    const char *val;
+
+    if (r->main || r->prev) {
+        return;
+    }
+    conf = ap_get_core_module_config(r->server->module_config);
+    if (conf->trace_context != AP_CORE_CONFIG_ON) {
+        return;
+    }
+    req_cfg = ap_get_core_module_config(r->request_config);
+    t = &req_cfg->trace;
+
+    val = apr_table_get(r->headers_in, "traceparent");
+    if (val && ap_trace_parse_traceparent(val, t->span.trace_id,
+                                          t->span.parent_id, &t->flags)) {
+        /* Honor the caller's decision, and forward its tracestate (the
+         * flags unknown to version 00 are not forwarded).
+         */
+        t->remote = 1;
+        t->flags &= AP_TRACE_FLAG_SAMPLED;
+        t->tracestate = apr_table_get(r->headers_in, "tracestate");
+    }
+    else {
+        /* A new trace, the caller's tracestate (if any) belongs to another
+         * one: it is left in the headers, but not forwarded (see
+         * ap_proxy_create_hdrbrgd()).
+         */
+        trace_new_id(r, t->span.trace_id, AP_TRACE_ID_LEN);
+        memset(t->span.parent_id, 0, AP_TRACE_SPAN_ID_LEN);
+        t->flags = trace_sampled(t->span.trace_id,
+                                 conf->trace_sample < 0 ? 1000000
+                                                        : conf->trace_sample)
+                   ? AP_TRACE_FLAG_SAMPLED : 0;
+    }
+
+    trace_new_id(r, t->span.span_id, AP_TRACE_SPAN_ID_LEN);
+    t->span.name = r->method;
+    t->span.target = r->unparsed_uri;
+    t->span.kind = AP_TRACE_SPAN_SERVER;
+    t->span.start = r->request_time;
+    t->span.sampled = (t->flags & AP_TRACE_FLAG_SAMPLED) != 0;
+    t->active = 1;
+}
+
+AP_CORE_DECLARE(void) ap_trace_request_end(request_rec *r)
+{
+    ap_trace_t *t = ap_trace_get(r);
+
+    if (t) {
+        ap_trace_span_end(r, &t->span, r->status);
+    }
+}
+
+AP_DECLARE(int) ap_trace_span_begin(request_rec *r, ap_trace_span_t *span,
+                                    const ap_trace_span_t *parent,
+                                    const char *name, int kind)
+{
+    ap_trace_t *t = ap_trace_get(r);
+
+    span->sampled = 0;
+    if (!t || (!t->span.sampled && kind != AP_TRACE_SPAN_CLIENT)) {
+        return 0;
+    }
+
+    memcpy(span->trace_id, t->span.trace_id, AP_TRACE_ID_LEN);
+    memcpy(span->parent_id, parent ? parent->span_id : t->span.span_id,
+           AP_TRACE_SPAN_ID_LEN);
+    trace_new_id(r, span->span_id, AP_TRACE_SPAN_ID_LEN);
+    span->name = name;
+    span->target = NULL;
+    span->outcome = NULL;
+    span->kind = kind;
+    span->status = 0;
+    span->end = 0;
+    span->sampled = t->span.sampled;
+    span->start = span->sampled ? apr_time_now() : 0;
+
+    /* The backend's spans are children of this one */
+    if (kind == AP_TRACE_SPAN_CLIENT) {
+        ap_trace_format_traceparent(t->traceparent, span->trace_id,
+                                    span->span_id, t->flags);
+    }
+
+    return span->sampled;
+}
+
+AP_DECLARE(void) ap_trace_span_end(request_rec *r, ap_trace_span_t *span,
+                                   int status)
+{
+    if (!span->sampled || span->end) {
+        return;
+    }
+    span->end = apr_time_now();
+    span->status = status;
+    ap_run_trace_span(r, span);
+}
+
+AP_DECLARE(const char *) ap_trace_traceparent(request_rec *r)
+{
+    ap_trace_t *t = ap_trace_get(r);
+
+    if (!t) {
+        return NULL;
+    }
+    if (!t->traceparent[0]) {
+        ap_trace_format_traceparent(t->traceparent, t->span.trace_id,
+                                    t->span.span_id, t->flags);
+    }
+    return t->traceparent;
+}
@@ -25,6 +25,7 @@
 #include "apr_getopt.h"
 #include "apr_thread_proc.h"
 #include "apr_signal.h"
+#include "apr_portable.h"
 #if APR_FILES_AS_SOCKETS
 #include "apr_poll.h"
 #endif
@@ -32,10 +33,18 @@
 #if APR_HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#if APR_HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 #define APR_WANT_STRFUNC
+#define APR_WANT_MEMFUNC
 #include "apr_want.h"
 
-#define BUFSIZE         65536
+/* What is read from the pipe at once, and written at once: under load
+ * the pipe fills up while the previous block is written, so the blocks
+ * grow up to this size, and the pipe is enlarged to match where possible.
+ */
+#define BUFSIZE         (1024 * 1024)
 
 #define ROTATE_NONE     0
 #define ROTATE_NEW      1
@@ -67,6 +76,7 @@ struct rotate_config {
     int truncate;
     const char *linkfile;
     const char *postrotate_prog;
+    const char *compress_prog;
 #if APR_FILES_AS_SOCKETS
     int create_empty;
 #endif
@@ -82,11 +92,13 @@ typedef struct rotate_status rotate_status_t;
  * used since this type is similar to time_t, but different. */
 typedef long adjusted_time_t;
 
-/* Structure to contain relevant logfile state: fd, pool and
+/* Structure to contain relevant logfile state: fd, pool, size
+ * (maintained as it is written, rather than asked each time) and
  * filename. */
 struct logfile {
     apr_pool_t *pool;
     apr_file_t *fd;
+    apr_off_t size;
     char name[APR_PATH_MAX];
 };
 
@@ -109,9 +121,9 @@ static void usage(const char *argv0, const char *reason)
     }
     fprintf(stderr,
 #if APR_FILES_AS_SOCKETS
-            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-c] [-n number] <logfile> "
+            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-Z prog] [-f] [-D] [-t] [-e] [-c] [-n number] <logfile> "
 #else
-            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-n number] <logfile> "
+            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-Z prog] [-f] [-D] [-t] [-e] [-n number] <logfile> "
 #endif
             "{<rotation time in seconds>|<rotation size>(B|K|M|G)} "
             "[offset minutes from UTC]\n\n",
@@ -142,6 +154,8 @@ static void usage(const char *argv0, const char *reason)
             "  -l       Base rotation on local time instead of UTC.\n"
             "  -L path  Create hard link from current log to specified path.\n"
             "  -p prog  Run specified program after opening a new log file. See below.\n"
+            "  -Z prog  Compress the previous log file with the specified program\n"
+            "           (e.g. \"gzip\" or \"zstd -q --rm\") after a rotation.\n"
             "  -f       Force opening of log on program start.\n"
             "  -D       Create parent directories of log file.\n" 
             "  -t       Truncate logfile instead of rotating, tail friendly.\n"
@@ -215,6 +229,7 @@ static void dumpConfig (rotate_config_t *config)
 #endif
     fprintf(stderr, "Rotation file name: %21s\n", config->szLogRoot);
     fprintf(stderr, "Post-rotation prog: %21s\n", config->postrotate_prog ? config->postrotate_prog : "not used");
+    fprintf(stderr, "Compression prog:   %21s\n", config->compress_prog ? config->compress_prog : "not used");
 }
 
 /*
@@ -235,14 +250,7 @@ static void checkRotate(rotate_config_t *config, rotate_status_t *status)
         status->rotateReason = ROTATE_NEW;
     }
     else if (config->sRotation) {
-        apr_finfo_t finfo;
-        apr_off_t current_size = -1;
-
-        if (apr_file_info_get(&finfo, APR_FINFO_SIZE, status->current.fd) == APR_SUCCESS) {
-            current_size = finfo.size;
-        }
-
-        if (current_size > config->sRotation) {
+        if (status->current.size > config->sRotation) {
             status->rotateReason = ROTATE_SIZE;
         }
         else if (config->tRotation) {
@@ -358,6 +366,48 @@ static void truncate_and_write_error(rotate_status_t *status, const char *messag
                 message, status->current.name);
         exit(2);
     }
+    status->current.size = buflen;
+}
+
+/*
+ * Compress a finished log file with the -Z program, in the background:
+ * the program is expected to remove the file once compressed, as gzip
+ * does (or zstd with --rm).
+ */
+static void compress_logfile(rotate_config_t *config, rotate_status_t *status,
+                             const char *name)
+{
+    apr_pool_t *pool;
+    apr_procattr_t *pattr;
+    apr_proc_t proc;
+    const char **argv;
+    char **args;
+    int argc;
+    apr_status_t rv;
+
+    apr_pool_create(&pool, status->pool);
+    apr_tokenize_to_argv(config->compress_prog, &args, pool);
+    for (argc = 0; args[argc]; ++argc)
+        /* noop */;
+    argv = apr_palloc(pool, (argc + 2) * sizeof(*argv));
+    memcpy(argv, args, argc * sizeof(*argv));
+    argv[argc] = name;
+    argv[argc + 1] = NULL;
+
+    if (config->verbose)
+        fprintf(stderr, "Compressing file %s with %s\n", name, argv[0]);
+
+    if ((rv = apr_procattr_create(&pattr, pool)) != APR_SUCCESS
+        || (rv = apr_procattr_error_check_set(pattr, 1)) != APR_SUCCESS
+        || (rv = apr_procattr_cmdtype_set(pattr, APR_PROGRAM_PATH)) != APR_SUCCESS
+        || (rv = apr_proc_create(&proc, argv[0], argv, NULL, pattr,
+                                 pool)) != APR_SUCCESS) {
+        char *error = apr_psprintf(pool, "Could not spawn compression process " \
+                                   "'%s' for %s: %pm\n", config->compress_prog,
+                                   name, &rv);
+        fputs(error, stderr);
+    }
+    apr_pool_destroy(pool);
 }
 
 /*
@@ -461,13 +511,28 @@ static void doRotate(rotate_config_t *config, rotate_status_t *status)
                        | (config->truncate || (config->num_files > 0 && status->current.fd) ? APR_TRUNCATE : 0), 
                        APR_OS_DEFAULT, newlog.pool);
     if (rv == APR_SUCCESS) {
+        apr_finfo_t finfo;
+
+        /* Appending to an existing file maybe. */
+        newlog.size = 0;
+        if (apr_file_info_get(&finfo, APR_FINFO_SIZE, newlog.fd) == APR_SUCCESS) {
+            newlog.size = finfo.size;
+        }
+
         /* Handle post-rotate processing. */
         post_rotate(newlog.pool, &newlog, config, status);
 
         status->fileNum = thisLogNum;
-        /* Close out old (previously 'current') logfile, if any. */
+        /* Close out old (previously 'current') logfile, if any, and
+         * compress it unless it is reopened (same name with a strftime
+         * format).
+         */
         if (status->current.fd) {
             close_logfile(config, &status->current);
+            if (config->compress_prog
+                && strcmp(status->current.name, newlog.name)) {
+                compress_logfile(config, status, status->current.name);
+            }
         }
 
         /* New log file is now 'current'. */
@@ -558,7 +623,7 @@ static const char *get_time_or_size(rotate_config_t *config,
 
 int main (int argc, const char * const argv[])
 {
-    char buf[BUFSIZE];
+    char *buf;
     apr_size_t nRead, nWrite;
     apr_file_t *f_stdin;
     apr_file_t *f_stdout;
@@ -583,9 +648,9 @@ int main (int argc, const char * const argv[])
     apr_pool_create(&status.pool, NULL);
     apr_getopt_init(&opt, status.pool, argc, argv);
 #if APR_FILES_AS_SOCKETS
-    while ((rv = apr_getopt(opt, "lL:p:fDtvecn:", &c, &opt_arg)) == APR_SUCCESS) {
+    while ((rv = apr_getopt(opt, "lL:p:Z:fDtvecn:", &c, &opt_arg)) == APR_SUCCESS) {
 #else
-    while ((rv = apr_getopt(opt, "lL:p:fDtven:", &c, &opt_arg)) == APR_SUCCESS) {
+    while ((rv = apr_getopt(opt, "lL:p:Z:fDtven:", &c, &opt_arg)) == APR_SUCCESS) {
 #endif
         switch (c) {
         case 'l':
@@ -599,6 +664,12 @@ int main (int argc, const char * const argv[])
 #ifdef SIGCHLD
             /* Prevent creation of zombies (on modern Unix systems). */
             apr_signal(SIGCHLD, SIG_IGN);
+#endif
+            break;
+        case 'Z':
+            config.compress_prog = opt_arg;
+#ifdef SIGCHLD
+            apr_signal(SIGCHLD, SIG_IGN);
 #endif
             break;
         case 'f':
@@ -667,6 +738,11 @@ int main (int argc, const char * const argv[])
         exit(1);
     }
 
+    if (config.compress_prog && (config.truncate || config.num_files > 0)) {
+        fprintf(stderr, "Cannot use -Z with -t or -n\n");
+        exit(1);
+    }
+
     if (apr_file_open_stdin(&f_stdin, status.pool) != APR_SUCCESS) {
         fprintf(stderr, "Unable to open stdin\n");
         exit(1);
@@ -677,6 +753,21 @@ int main (int argc, const char * const argv[])
         exit(1);
     }
 
+#ifdef F_SETPIPE_SZ
+    /* Let the pipe hold as much as is read at once (best effort, this is
+     * limited by /proc/sys/fs/pipe-max-size for unprivileged users).
+     */
+    {
+        apr_os_file_t fd;
+
+        if (apr_os_file_get(&fd, f_stdin) == APR_SUCCESS) {
+            fcntl(fd, F_SETPIPE_SZ, BUFSIZE);
+        }
+    }
+#endif
+
+    buf = apr_palloc(status.pool, BUFSIZE);
+
     /*
      * Write out result of config parsing if verbose is set.
      */
@@ -702,7 +793,7 @@ int main (int argc, const char * const argv[])
     }
 
     for (;;) {
-        nRead = sizeof(buf);
+        nRead = BUFSIZE;
 #if APR_FILES_AS_SOCKETS
         if (config.create_empty && config.tRotation) {
             polltimeout = status.tLogEnd ? status.tLogEnd - get_now(&config, NULL) : config.tRotation;
@@ -746,6 +837,7 @@ int main (int argc, const char * const argv[])
 
         nWrite = nRead;
         rv = apr_file_write_full(status.current.fd, buf, nWrite, &nWrite);
+        status.current.size += nWrite;
         if (nWrite != nRead) {
             apr_off_t cur_offset;
             apr_pool_t *pool;
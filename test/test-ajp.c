@@ -0,0 +1,309 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    test-ajp: a minimal AJP/1.3 backend, standing in for Tomcat when
+    benchmarking mod_proxy_ajp.
+
+    Every forward request is answered with a 200 response carrying a body of
+    the given size, sent in SEND_BODY_CHUNK messages as large as an 8K AJP
+    packet allows. A request body announced by Content-Length is read (and
+    discarded) with GET_BODY_CHUNK messages first; chunked request bodies are
+    not supported. CPING is answered with CPONG and connections are kept
+    alive, one process per connection.
+
+    Build with "cc -O2 -o test-ajp test-ajp.c", run "test-ajp 8009 65536",
+    then point httpd to it with
+
+        ProxyPass /ajp ajp://127.0.0.1:8009/
+
+    and load it with "ab -k -c 16 -n 100000 http://127.0.0.1/ajp/".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define PACKET_SIZE 8192
+#define MAX_CHUNK   (PACKET_SIZE - 4 - 4)
+
+#define FORWARD_REQUEST   2
+#define SEND_BODY_CHUNK   3
+#define SEND_HEADERS      4
+#define END_RESPONSE      5
+#define GET_BODY_CHUNK    6
+#define CPONG_REPLY       9
+#define CPING_REQUEST     10
+
+#define SC_CONTENT_LENGTH 0xA008
+
+static unsigned char in[65536 + 4], out[PACKET_SIZE];
+static long body_size;
+
+static int read_full(int fd, unsigned char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        if ((n = read(fd, buf, len)) <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const unsigned char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Read a packet from httpd, return its payload length or -1 */
+static long read_packet(int fd)
+{
+    long len;
+
+    if (read_full(fd, in, 4) || in[0] != 0x12 || in[1] != 0x34) {
+        return -1;
+    }
+    len = (in[2] << 8) | in[3];
+    if (read_full(fd, in + 4, len)) {
+        return -1;
+    }
+    return len;
+}
+
+/* Send the payload of out[4..4+len) as a packet to httpd */
+static int send_packet(int fd, size_t len)
+{
+    out[0] = 'A';
+    out[1] = 'B';
+    out[2] = (len >> 8) & 0xFF;
+    out[3] = len & 0xFF;
+    return write_full(fd, out, len + 4);
+}
+
+static unsigned get16(const unsigned char **p, const unsigned char *end)
+{
+    unsigned v;
+
+    if (*p + 2 > end) {
+        *p = end;
+        return 0;
+    }
+    v = ((*p)[0] << 8) | (*p)[1];
+    *p += 2;
+    return v;
+}
+
+/* Skip an AJP string, return it (NULL if null or truncated) */
+static const char *getstr(const unsigned char **p, const unsigned char *end)
+{
+    unsigned len = get16(p, end);
+    const char *s = (const char *)*p;
+
+    if (len == 0xFFFF || *p + len + 1 > end) {
+        return NULL;
+    }
+    *p += len + 1;
+    return s;
+}
+
+/* Return the Content-Length of the forward request in in[] */
+static long request_length(long len)
+{
+    const unsigned char *p = in + 5, *end = in + 4 + len;
+    unsigned i, n, name;
+    const char *value;
+
+    p++;                          /* method */
+    for (i = 0; i < 5; i++) {     /* protocol, uri, addr, host, server */
+        getstr(&p, end);
+    }
+    p += 3;                       /* port, is_ssl */
+    n = get16(&p, end);
+    for (i = 0; i < n && p < end; i++) {
+        if (p[0] == 0xA0) {
+            name = get16(&p, end);
+        }
+        else {
+            name = 0;
+            getstr(&p, end);
+        }
+        value = getstr(&p, end);
+        if (name == SC_CONTENT_LENGTH && value) {
+            return atol(value);
+        }
+    }
+    return 0;
+}
+
+static int serve_request(int fd, long len)
+{
+    static const char clen[] = "Content-Length";
+    long left, n;
+    unsigned char *p;
+    char value[32];
+
+    /* Read the request body, the first chunk comes unsolicited */
+    left = request_length(len);
+    while (left > 0) {
+        if ((n = read_packet(fd)) < 2) {
+            return -1;
+        }
+        n = (in[4] << 8) | in[5];
+        if (n == 0) {
+            break;
+        }
+        left -= n;
+        if (left > 0) {
+            out[4] = GET_BODY_CHUNK;
+            out[5] = (MAX_CHUNK >> 8) & 0xFF;
+            out[6] = MAX_CHUNK & 0xFF;
+            if (send_packet(fd, 3)) {
+                return -1;
+            }
+        }
+    }
+
+    /* Headers: 200 OK, Content-Length */
+    p = out + 4;
+    *p++ = SEND_HEADERS;
+    *p++ = 0;
+    *p++ = 200;
+    *p++ = 0;
+    *p++ = 2;
+    memcpy(p, "OK", 3);
+    p += 3;
+    *p++ = 0;
+    *p++ = 1;
+    *p++ = 0;
+    *p++ = sizeof(clen) - 1;
+    memcpy(p, clen, sizeof(clen));
+    p += sizeof(clen);
+    n = snprintf(value, sizeof(value), "%ld", body_size);
+    *p++ = 0;
+    *p++ = (unsigned char)n;
+    memcpy(p, value, n + 1);
+    p += n + 1;
+    if (send_packet(fd, p - (out + 4))) {
+        return -1;
+    }
+
+    /* Body */
+    for (left = body_size; left > 0; left -= n) {
+        n = left < MAX_CHUNK ? left : MAX_CHUNK;
+        out[4] = SEND_BODY_CHUNK;
+        out[5] = (n >> 8) & 0xFF;
+        out[6] = n & 0xFF;
+        out[7 + n] = 0;
+        if (send_packet(fd, n + 4)) {
+            return -1;
+        }
+        out[7 + n] = 'x';
+    }
+
+    out[4] = END_RESPONSE;
+    out[5] = 1;                   /* reuse */
+    return send_packet(fd, 2);
+}
+
+static void serve(int fd)
+{
+    long len;
+
+    memset(out + 7, 'x', MAX_CHUNK);
+    while ((len = read_packet(fd)) > 0) {
+        switch (in[4]) {
+        case FORWARD_REQUEST:
+            if (serve_request(fd, len)) {
+                return;
+            }
+            break;
+        case CPING_REQUEST:
+            out[4] = CPONG_REPLY;
+            if (send_packet(fd, 1)) {
+                return;
+            }
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in sa;
+    int l, fd, one = 1;
+
+    if (argc != 3 || atoi(argv[1]) <= 0 || (body_size = atol(argv[2])) < 0) {
+        fprintf(stderr, "usage: test-ajp port body_size\n");
+        exit(1);
+    }
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = htons(atoi(argv[1]));
+    if ((l = socket(AF_INET, SOCK_STREAM, 0)) < 0
+        || setsockopt(l, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+        || bind(l, (struct sockaddr *)&sa, sizeof(sa)) < 0
+        || listen(l, 128) < 0) {
+        perror("listen");
+        exit(1);
+    }
+
+    for (;;) {
+        if ((fd = accept(l, NULL, NULL)) < 0) {
+            continue;
+        }
+        if (fork() == 0) {
+            close(l);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            serve(fd);
+            exit(0);
+        }
+        close(fd);
+    }
+    return 0;
+}
@@ -0,0 +1,297 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    test-chunk: measure the throughput of the chunked transfer coding of
+    the server, on a body of chunks of varied sizes (mostly tiny, like IoT
+    devices and streaming clients send them, some of a few KB).
+
+    "decode" reads the body through the HTTP_IN filter (ap_http_filter()),
+    as a handler does with 8KB AP_MODE_READBYTES reads, above a network
+    filter which returns what the client sent in 8KB reads like the core
+    input filter.  "encode" passes each chunk in a brigade of its own, as a
+    streaming handler does, through the CHUNK filter
+    (ap_http_chunk_filter()) to a network filter which discards it.
+
+    Build from the top of a configured tree with "make test/test-chunk"
+    and run "test-chunk decode|encode [iterations]", and compare two
+    builds.
+*/
+
+#include "httpd.h"
+#include "http_core.h"
+#include "http_protocol.h"
+#include "mod_core.h"
+#include "util_filter.h"
+
+#include "apr_general.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NCHUNKS  1000
+#define NET_READ 8192
+
+static apr_size_t chunk_lens[NCHUNKS];
+
+/* 9 chunks out of 10 of 1 to 64 bytes, the others up to 8KB */
+static void make_chunks(void)
+{
+    unsigned int seed = 1;
+    int i;
+
+    for (i = 0; i < NCHUNKS; ++i) {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 10) {
+            chunk_lens[i] = 1 + (seed >> 8) % 64;
+        }
+        else {
+            chunk_lens[i] = 1 + (seed >> 8) % 8192;
+        }
+    }
+}
+
+/* The body as the client sends it */
+static const char *make_body(apr_pool_t *p, const char *data,
+                             apr_size_t *body_len)
+{
+    apr_array_header_t *parts = apr_array_make(p, NCHUNKS * 3 + 1,
+                                               sizeof(char *));
+    const char *body;
+    int i;
+
+    for (i = 0; i < NCHUNKS; ++i) {
+        APR_ARRAY_PUSH(parts, const char *) =
+            apr_psprintf(p, "%" APR_SIZE_T_FMT "\r\n", chunk_lens[i]);
+        APR_ARRAY_PUSH(parts, const char *) =
+            apr_pstrmemdup(p, data, chunk_lens[i]);
+        APR_ARRAY_PUSH(parts, const char *) = "\r\n";
+    }
+    APR_ARRAY_PUSH(parts, const char *) = "0\r\n\r\n";
+
+    body = apr_array_pstrcat(p, parts, 0);
+    *body_len = strlen(body);
+    return body;
+}
+
+/* The network below HTTP_IN: what's left of the body, returned at most
+ * NET_READ bytes (or a line) at a time. */
+typedef struct {
+    const char *data;
+    apr_size_t len;
+} net_ctx_t;
+
+static apr_status_t net_in(ap_filter_t *f, apr_bucket_brigade *bb,
+                           ap_input_mode_t mode, apr_read_type_e block,
+                           apr_off_t readbytes)
+{
+    net_ctx_t *ctx = f->ctx;
+    apr_size_t len = ctx->len;
+
+    if (!len) {
+        return APR_EOF;
+    }
+    if (len > NET_READ) {
+        len = NET_READ;
+    }
+    if (mode == AP_MODE_GETLINE) {
+        const char *lf = memchr(ctx->data, '\n', len);
+        if (lf) {
+            len = lf + 1 - ctx->data;
+        }
+    }
+    else if ((apr_off_t)len > readbytes) {
+        len = (apr_size_t)readbytes;
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_transient_create(ctx->data, len,
+                                                            bb->bucket_alloc));
+    if (mode != AP_MODE_SPECULATIVE) {
+        ctx->data += len;
+        ctx->len -= len;
+    }
+    return APR_SUCCESS;
+}
+
+/* The network below CHUNK: counts and discards */
+static apr_status_t net_out(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    apr_off_t *sent = f->ctx;
+    apr_off_t len;
+
+    apr_brigade_length(bb, 1, &len);
+    *sent += len;
+    apr_brigade_cleanup(bb);
+    return APR_SUCCESS;
+}
+
+int main(int argc, const char * const *argv)
+{
+    apr_pool_t *pool, *rpool;
+    apr_bucket_alloc_t *alloc;
+    apr_bucket_brigade *bb;
+    void *server_config[1], *dir_config[1];
+    core_server_config *core_server;
+    core_dir_config *core_dir;
+    server_rec server;
+    conn_rec conn;
+    request_rec r;
+    ap_filter_rec_t net_rec, filter_rec;
+    ap_filter_t net, filter;
+    net_ctx_t net_ctx;
+    const char *body;
+    char *data;
+    apr_size_t body_len;
+    apr_off_t total = 0, sent = 0;
+    apr_time_t start;
+    apr_interval_time_t elapsed;
+    long iterations = 10000, i;
+    int decode, j;
+
+    if (argc < 2 || (strcmp(argv[1], "decode") && strcmp(argv[1], "encode"))) {
+        fprintf(stderr, "usage: test-chunk decode|encode [iterations]\n");
+        exit(1);
+    }
+    decode = !strcmp(argv[1], "decode");
+    if (argc > 2) {
+        iterations = atol(argv[2]);
+    }
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+    apr_pool_create(&rpool, pool);
+    alloc = apr_bucket_alloc_create(pool);
+
+    make_chunks();
+    data = apr_palloc(pool, 8192);
+    memset(data, 'x', 8192);
+    body = make_body(pool, data, &body_len);
+
+    /* Stub out what the filters need of the server, the connection and
+     * the request */
+    core_module.module_index = 0;
+    core_server = apr_pcalloc(pool, sizeof(*core_server));
+    core_dir = apr_pcalloc(pool, sizeof(*core_dir));
+    ap_set_core_module_config(server_config, core_server);
+    ap_set_core_module_config(dir_config, core_dir);
+
+    memset(&server, 0, sizeof(server));
+    server.module_config = (ap_conf_vector_t *)server_config;
+    server.limit_req_fieldsize = DEFAULT_LIMIT_REQUEST_FIELDSIZE;
+    server.limit_req_fields = DEFAULT_LIMIT_REQUEST_FIELDS;
+
+    memset(&conn, 0, sizeof(conn));
+    conn.pool = pool;
+    conn.bucket_alloc = alloc;
+
+    memset(&net_rec, 0, sizeof(net_rec));
+    memset(&filter_rec, 0, sizeof(filter_rec));
+    if (decode) {
+        net_rec.filter_func.in_func = net_in;
+        filter_rec.filter_func.in_func = ap_http_filter;
+    }
+    else {
+        net_rec.filter_func.out_func = net_out;
+        filter_rec.filter_func.out_func = ap_http_chunk_filter;
+    }
+
+    bb = apr_brigade_create(pool, alloc);
+    start = apr_time_now();
+    for (i = 0; i < iterations; ++i) {
+        apr_pool_clear(rpool);
+        memset(&r, 0, sizeof(r));
+        r.pool = rpool;
+        r.server = &server;
+        r.log = &server.log;
+        r.connection = &conn;
+        r.per_dir_config = (ap_conf_vector_t *)dir_config;
+        r.proto_num = HTTP_VERSION(1,1);
+        r.headers_in = apr_table_make(rpool, 5);
+        r.trailers_in = apr_table_make(rpool, 5);
+        r.notes = apr_table_make(rpool, 5);
+        apr_table_setn(r.headers_in, "Transfer-Encoding", "chunked");
+
+        memset(&net, 0, sizeof(net));
+        net.frec = &net_rec;
+        net.c = &conn;
+        memset(&filter, 0, sizeof(filter));
+        filter.frec = &filter_rec;
+        filter.next = &net;
+        filter.r = &r;
+        filter.c = &conn;
+
+        if (decode) {
+            int eos = 0;
+
+            net_ctx.data = body;
+            net_ctx.len = body_len;
+            net.ctx = &net_ctx;
+            r.proto_input_filters = &filter;
+
+            do {
+                apr_off_t len;
+
+                if (ap_get_brigade(&filter, bb, AP_MODE_READBYTES,
+                                   APR_BLOCK_READ, 8192) != APR_SUCCESS) {
+                    fprintf(stderr, "failed to decode the body\n");
+                    exit(1);
+                }
+                eos = !APR_BRIGADE_EMPTY(bb)
+                      && APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb));
+                apr_brigade_length(bb, 1, &len);
+                total += len;
+                apr_brigade_cleanup(bb);
+            } while (!eos);
+        }
+        else {
+            net.ctx = &sent;
+
+            for (j = 0; j < NCHUNKS; ++j) {
+                APR_BRIGADE_INSERT_TAIL(bb,
+                    apr_bucket_transient_create(data, chunk_lens[j], alloc));
+                total += chunk_lens[j];
+                if (ap_pass_brigade(&filter, bb) != APR_SUCCESS) {
+                    fprintf(stderr, "failed to encode the body\n");
+                    exit(1);
+                }
+                apr_brigade_cleanup(bb);
+            }
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(alloc));
+            ap_pass_brigade(&filter, bb);
+            apr_brigade_cleanup(bb);
+        }
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%s: %ld bodies of %d chunks in %" APR_TIME_T_FMT "ms, "
+           "%.1f MB/s of data (%" APR_OFF_T_FMT " bytes", argv[1],
+           iterations, NCHUNKS, apr_time_as_msec(elapsed),
+           elapsed ? (double)total / elapsed : 0.0, total);
+    if (decode) {
+        printf(" from %" APR_OFF_T_FMT " bytes of body)\n",
+               (apr_off_t)body_len * iterations);
+    }
+    else {
+        printf(" to %" APR_OFF_T_FMT " bytes of body)\n", sent);
+    }
+
+    apr_bucket_alloc_destroy(alloc);
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,210 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    test-escape: compare the ways server/util.c and proxy_util.c used to
+    escape strings, and how they do it now.
+
+    "logitem" escapes strings for the access log (ap_escape_logitem()):
+    the old way counts the chars to escape in a first pass and copies char
+    by char in a second one, the new way skips the runs of chars to keep as
+    is with test_char_span() and copies them in one go, and returns a plain
+    copy when there is nothing to escape.
+
+    "canonenc" canonicalises URL paths (ap_proxy_canonenc()): the old way
+    looks each char up in the "allowed" and "reserved" strings with strchr(),
+    the new way uses a table.
+
+    The samples are typical request lines, URLs and User-Agents. Build from
+    a configured tree with "cc -O2 -I../server -o test-escape test-escape.c"
+    (test_char.h is generated there by gen_test_char) and run
+    "test-escape logitem|canonenc old|new [iterations]".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/time.h>
+
+#include "test_char.h"
+
+static const char *const samples[] = {
+    "GET /index.html HTTP/1.1",
+    "/static/js/vendor/jquery-3.5.1.min.js",
+    "/api/v2/users/12345/profile;jsessionid=0123456789ABCDEF",
+    "/search/hello%20world/caf\xc3\xa9/t\xc3\xa9t\xc3\xa9",
+    "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/86.0.4240.75 Safari/537.36",
+    "curl/7.68.0 \"quoted\"\n"
+};
+#define NSAMPLES (sizeof(samples) / sizeof(samples[0]))
+
+static const char c2x_table[] = "0123456789abcdef";
+
+static char out[4096];
+
+static unsigned char *logitem_one(unsigned char *d, unsigned c)
+{
+    *d++ = '\\';
+    switch (c) {
+    case '\b': *d++ = 'b'; break;
+    case '\n': *d++ = 'n'; break;
+    case '\r': *d++ = 'r'; break;
+    case '\t': *d++ = 't'; break;
+    case '\v': *d++ = 'v'; break;
+    case '\\':
+    case '"':  *d++ = c; break;
+    default:
+        *d++ = 'x';
+        *d++ = c2x_table[c >> 4];
+        *d++ = c2x_table[c & 0xf];
+    }
+    return d;
+}
+
+static size_t logitem_old(const char *str)
+{
+    const unsigned char *s = (const unsigned char *)str;
+    unsigned char *d = (unsigned char *)out;
+    size_t escapes = 0;
+
+    for (; *s; ++s) {
+        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
+            escapes++;
+        }
+    }
+    if (escapes == 0) {
+        memcpy(out, str, s - (const unsigned char *)str + 1);
+        return s - (const unsigned char *)str;
+    }
+    for (s = (const unsigned char *)str; *s; ++s) {
+        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
+            d = logitem_one(d, *s);
+        }
+        else {
+            *d++ = *s;
+        }
+    }
+    *d = '\0';
+    return d - (unsigned char *)out;
+}
+
+static size_t test_char_span(const unsigned char *s, unsigned f)
+{
+    const unsigned char *p = s;
+
+    for (;; p += 4) {
+        if (!p[0] || TEST_CHAR(p[0], f)) return p - s;
+        if (!p[1] || TEST_CHAR(p[1], f)) return p - s + 1;
+        if (!p[2] || TEST_CHAR(p[2], f)) return p - s + 2;
+        if (!p[3] || TEST_CHAR(p[3], f)) return p - s + 3;
+    }
+}
+
+static size_t logitem_new(const char *str)
+{
+    const unsigned char *s = (const unsigned char *)str;
+    unsigned char *d = (unsigned char *)out;
+    size_t n = test_char_span(s, T_ESCAPE_LOGITEM);
+
+    if (!s[n]) {
+        memcpy(out, str, n + 1);
+        return n;
+    }
+    for (;;) {
+        memcpy(d, s, n);
+        d += n;
+        s += n;
+        if (!*s) {
+            break;
+        }
+        d = logitem_one(d, *s++);
+        n = test_char_span(s, T_ESCAPE_LOGITEM);
+    }
+    *d = '\0';
+    return d - (unsigned char *)out;
+}
+
+static const char canon_allowed[] = "~$-_.+!*'(),;:@&=";
+static unsigned char canon_table[256];
+
+static size_t canonenc(const char *x, int use_table)
+{
+    size_t i, j, len = strlen(x);
+    int ch;
+
+    for (i = 0, j = 0; i < len; i++, j++) {
+        ch = (unsigned char)x[i];
+        if (use_table ? (ch == '/') : (strchr("/", ch) != NULL)) {
+            out[j] = ch;
+            continue;
+        }
+        if (use_table ? !canon_table[ch]
+                      : (!isalnum(ch) && !strchr(canon_allowed, ch))) {
+            out[j++] = '%';
+            out[j++] = "0123456789ABCDEF"[ch >> 4];
+            out[j] = "0123456789ABCDEF"[ch & 0xf];
+        }
+        else {
+            out[j] = ch;
+        }
+    }
+    out[j] = '\0';
+    return j;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = 1000000, i;
+    size_t k, total = 0;
+    int canon, new;
+    struct timeval start, end;
+    double secs;
+
+    if (argc < 3 || argc > 4
+        || (strcmp(argv[1], "logitem") && strcmp(argv[1], "canonenc"))
+        || (strcmp(argv[2], "old") && strcmp(argv[2], "new"))
+        || (argc == 4 && (iterations = atol(argv[3])) <= 0)) {
+        fprintf(stderr,
+                "usage: test-escape logitem|canonenc old|new [iterations]\n");
+        exit(1);
+    }
+    canon = !strcmp(argv[1], "canonenc");
+    new = !strcmp(argv[2], "new");
+    for (k = 0; k < 256; ++k) {
+        canon_table[k] = k && (isalnum(k) || strchr(canon_allowed, (int)k));
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; ++i) {
+        for (k = 0; k < NSAMPLES; ++k) {
+            if (canon) {
+                total += canonenc(samples[k], new);
+            }
+            else {
+                total += new ? logitem_new(samples[k])
+                             : logitem_old(samples[k]);
+            }
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    printf("%s %s: %.1f ns per string (%lu bytes out)\n", argv[1], argv[2],
+           secs * 1e9 / iterations / NSAMPLES, (unsigned long)total);
+    return 0;
+}
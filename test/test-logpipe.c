@@ -0,0 +1,176 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    test-logpipe: measure the sustained throughput of a piped logging
+    program (rotatelogs or any other), fed with access log lines as fast
+    as it takes them.
+
+    The lines (of 120 to 370 bytes) are written to the program's stdin the
+    way the children of httpd do, "line": one write() per line, or
+    "batch": as many whole lines per write() as PIPE_BUF allows (the
+    buffered piped logs, see PipedLogBuffer). The time counted runs until
+    the program exits, after it read everything.
+
+    Build with "cc -O2 -o test-logpipe test-logpipe.c" and run
+    "test-logpipe line|batch megabytes program [args...]", for instance
+    "test-logpipe batch 4096 ./rotatelogs /tmp/access_log 100M", and
+    compare two builds of the program.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#ifndef PIPE_BUF
+#define PIPE_BUF 512
+#endif
+
+#define NLINES 4096
+
+static char *lines[NLINES];
+static size_t lens[NLINES];
+
+static void make_lines(void)
+{
+    unsigned int seed = 1;
+    size_t i;
+
+    for (i = 0; i < NLINES; ++i) {
+        char *l = malloc(512);
+        int n;
+
+        seed = seed * 1103515245 + 12345;
+        n = sprintf(l, "192.0.2.%u - - [18/Oct/2026:12:00:00 +0000] "
+                       "\"GET /static/%08x/", (seed >> 8) % 256, seed);
+        n += (int)((seed >> 16) % 250);
+        memset(l + strlen(l), 'a', n - strlen(l));
+        n += sprintf(l + n, ".js HTTP/1.1\" 200 %u \"-\" \"Mozilla/5.0\"\n",
+                     (seed >> 4) % 100000);
+        lines[i] = l;
+        lens[i] = (size_t)n;
+    }
+}
+
+static int write_full(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long long limit, total = 0;
+    struct timeval start, end;
+    char batch[PIPE_BUF];
+    size_t batched = 0, i = 0;
+    long writes = 0;
+    int fds[2], status, line;
+    double secs;
+    pid_t pid;
+
+    if (argc < 4
+        || (strcmp(argv[1], "line") && strcmp(argv[1], "batch"))
+        || (limit = atoll(argv[2])) <= 0) {
+        fprintf(stderr,
+                "usage: test-logpipe line|batch megabytes program [args...]\n");
+        exit(1);
+    }
+    line = !strcmp(argv[1], "line");
+    limit *= 1024 * 1024;
+    make_lines();
+
+    signal(SIGPIPE, SIG_IGN);
+    if (pipe(fds)) {
+        perror("pipe");
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (!pid) {
+        dup2(fds[0], 0);
+        close(fds[0]);
+        close(fds[1]);
+        execvp(argv[3], argv + 3);
+        perror(argv[3]);
+        _exit(1);
+    }
+    close(fds[0]);
+
+    gettimeofday(&start, NULL);
+    while (total < limit) {
+        size_t k = i++ % NLINES;
+        const char *l = lines[k];
+        size_t len = lens[k];
+
+        if (!line && batched + len <= sizeof(batch)) {
+            memcpy(batch + batched, l, len);
+            batched += len;
+            total += len;
+            continue;
+        }
+        if (batched) {
+            if (write_full(fds[1], batch, batched)) {
+                break;
+            }
+            ++writes;
+            batched = 0;
+        }
+        if (line) {
+            if (write_full(fds[1], l, len)) {
+                break;
+            }
+            ++writes;
+        }
+        else {
+            memcpy(batch, l, len);
+            batched = len;
+        }
+        total += len;
+    }
+    if (batched && !write_full(fds[1], batch, batched)) {
+        ++writes;
+    }
+    close(fds[1]);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+        || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s failed\n", argv[3]);
+        exit(1);
+    }
+    gettimeofday(&end, NULL);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    printf("%s: %.1f MB/s, %.0f lines/s (%lld bytes in %ld writes)\n",
+           argv[1], total / secs / (1024 * 1024), i / secs, total, writes);
+    return 0;
+}
@@ -0,0 +1,229 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    test-range: measure how fast a server answers range requests on a large
+    file, the way video players and download managers do ("single": one
+    range of a few hundred KB at a random offset per request, "multi": a
+    multipart/byteranges response of several small ranges per request).
+
+    The requests are sent one after the other on a keep-alive connection
+    (reopened when the server closes it), the responses are read entirely
+    and checked for their status (206) and length.
+
+    Build with "cc -O2 -o test-range test-range.c" and run
+    "test-range single|multi host port path size [requests]", where size is
+    the size of the file at path (the ranges are drawn within it).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define SINGLE_LEN  (256 * 1024)
+#define MULTI_LEN   (16 * 1024)
+#define MULTI_COUNT 8
+
+static char buf[64 * 1024];
+static size_t buflen, bufpos;
+
+static int connect_to(const char *host, const char *port)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        fprintf(stderr, "could not resolve %s:%s\n", host, port);
+        exit(1);
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "could not connect to %s:%s\n", host, port);
+        exit(1);
+    }
+    buflen = bufpos = 0;
+    return fd;
+}
+
+static int fill(int fd)
+{
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n <= 0) {
+        return 0;
+    }
+    buflen = (size_t)n;
+    bufpos = 0;
+    return 1;
+}
+
+/* Read a header line (without its CRLF) into line, 0 at EOF */
+static int read_line(int fd, char *line, size_t size)
+{
+    size_t n = 0;
+
+    for (;;) {
+        char c;
+
+        if (bufpos == buflen && !fill(fd)) {
+            return 0;
+        }
+        c = buf[bufpos++];
+        if (c == '\n') {
+            break;
+        }
+        if (c != '\r' && n < size - 1) {
+            line[n++] = c;
+        }
+    }
+    line[n] = '\0';
+    return 1;
+}
+
+/* Read the response, return the length of its body or -1 */
+static long long read_response(int fd, int *closed)
+{
+    char line[1024];
+    long long clen = -1, left;
+    int status;
+
+    if (!read_line(fd, line, sizeof(line))
+        || sscanf(line, "HTTP/%*d.%*d %d", &status) != 1) {
+        return -1;
+    }
+    *closed = 0;
+    while (read_line(fd, line, sizeof(line)) && *line) {
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            clen = atoll(line + 15);
+        }
+        else if (!strncasecmp(line, "Connection:", 11)
+                 && strstr(line + 11, "close")) {
+            *closed = 1;
+        }
+    }
+    if (status != 206 || clen < 0) {
+        fprintf(stderr, "unexpected response: status %d, length %lld\n",
+                status, clen);
+        exit(1);
+    }
+    for (left = clen; left > 0; ) {
+        size_t n;
+
+        if (bufpos == buflen && !fill(fd)) {
+            return -1;
+        }
+        n = buflen - bufpos;
+        if ((long long)n > left) {
+            n = (size_t)left;
+        }
+        bufpos += n;
+        left -= n;
+    }
+    return clen;
+}
+
+int main(int argc, char **argv)
+{
+    long requests = 10000, i;
+    long long size, total = 0;
+    unsigned int seed = 1;
+    struct timeval start, end;
+    char req[2048];
+    double secs;
+    int fd, multi;
+
+    if (argc < 6 || argc > 7
+        || (strcmp(argv[1], "single") && strcmp(argv[1], "multi"))
+        || (size = atoll(argv[5])) < SINGLE_LEN * 2
+        || (argc == 7 && (requests = atol(argv[6])) <= 0)) {
+        fprintf(stderr, "usage: test-range single|multi host port path size "
+                        "[requests]\n"
+                        "       (size of at least %d bytes)\n",
+                SINGLE_LEN * 2);
+        exit(1);
+    }
+    multi = !strcmp(argv[1], "multi");
+
+    fd = connect_to(argv[2], argv[3]);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < requests; ++i) {
+        char ranges[1024];
+        long long len;
+        size_t n = 0;
+        int closed, k;
+
+        /* ascending ranges, as players and download managers ask them */
+        for (k = 0; k < (multi ? MULTI_COUNT : 1); ++k) {
+            long long part = (size - SINGLE_LEN) / (multi ? MULTI_COUNT : 1);
+            long long from;
+
+            seed = seed * 1103515245 + 12345;
+            from = part * k + (long long)(seed >> 4) % part;
+            n += snprintf(ranges + n, sizeof(ranges) - n, "%s%lld-%lld",
+                          k ? "," : "", from,
+                          from + (multi ? MULTI_LEN : SINGLE_LEN) - 1);
+        }
+        snprintf(req, sizeof(req),
+                 "GET %s HTTP/1.1\r\n"
+                 "Host: %s\r\n"
+                 "Range: bytes=%s\r\n"
+                 "\r\n", argv[4], argv[2], ranges);
+
+        if (write(fd, req, strlen(req)) != (ssize_t)strlen(req)
+            || (len = read_response(fd, &closed)) < 0) {
+            /* the server closed the keep-alive connection, retry */
+            close(fd);
+            fd = connect_to(argv[2], argv[3]);
+            if (write(fd, req, strlen(req)) != (ssize_t)strlen(req)
+                || (len = read_response(fd, &closed)) < 0) {
+                fprintf(stderr, "request %ld failed\n", i);
+                exit(1);
+            }
+        }
+        total += len;
+        if (closed) {
+            close(fd);
+            fd = connect_to(argv[2], argv[3]);
+        }
+    }
+    gettimeofday(&end, NULL);
+    close(fd);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    printf("%s: %.0f requests/s, %.1f MB/s (%lld bytes)\n", argv[1],
+           requests / secs, total / secs / (1024 * 1024), total);
+    return 0;
+}
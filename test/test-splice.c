@@ -0,0 +1,186 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    test-splice: measure the throughput of a TCP relay like the one of
+    mod_proxy_connect or mod_proxy_wstunnel, either copying the data through
+    user space with read()/write() or moving it with splice() through a pipe
+    (as ap_proxy_splice_between_connections() does).
+
+    A child process sends the given number of megabytes to the relay over
+    loopback, the relay forwards them to another child which discards them.
+    The relay's wall clock and CPU times are printed.
+
+    Build on Linux with "cc -O2 -o test-splice test-splice.c", then compare
+    "test-splice copy 4096" with "test-splice splice 4096".
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define CHUNK (64 * 1024)
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+/* Return two connected loopback TCP sockets */
+static void tcp_pair(int fds[2])
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    int l;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((l = socket(AF_INET, SOCK_STREAM, 0)) < 0
+        || bind(l, (struct sockaddr *)&sa, sizeof(sa)) < 0
+        || listen(l, 1) < 0
+        || getsockname(l, (struct sockaddr *)&sa, &len) < 0) {
+        die("listen");
+    }
+    if ((fds[0] = socket(AF_INET, SOCK_STREAM, 0)) < 0
+        || connect(fds[0], (struct sockaddr *)&sa, sizeof(sa)) < 0
+        || (fds[1] = accept(l, NULL, NULL)) < 0) {
+        die("connect");
+    }
+    close(l);
+}
+
+static void relay_copy(int in, int out)
+{
+    static char buf[CHUNK];
+    ssize_t n, w, off;
+
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        for (off = 0; off < n; off += w) {
+            if ((w = write(out, buf + off, n - off)) < 0) {
+                die("write");
+            }
+        }
+    }
+    if (n < 0) {
+        die("read");
+    }
+}
+
+static void relay_splice(int in, int out)
+{
+    int p[2];
+    ssize_t n, w;
+
+    if (pipe(p) < 0) {
+        die("pipe");
+    }
+    while ((n = splice(in, NULL, p[1], NULL, CHUNK, SPLICE_F_MOVE)) > 0) {
+        while (n > 0) {
+            if ((w = splice(p[0], NULL, out, NULL, n, SPLICE_F_MOVE)) < 0) {
+                die("splice out");
+            }
+            n -= w;
+        }
+    }
+    if (n < 0) {
+        die("splice in");
+    }
+    close(p[0]);
+    close(p[1]);
+}
+
+static double tv2sec(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    static char buf[CHUNK];
+    int use_splice, front[2], back[2];
+    long long mb, left;
+    struct timeval start, end;
+    struct rusage ru;
+    double secs;
+    pid_t sender, receiver;
+
+    if (argc != 3 || (strcmp(argv[1], "copy") && strcmp(argv[1], "splice"))
+        || (mb = atoll(argv[2])) <= 0) {
+        fprintf(stderr, "usage: test-splice copy|splice megabytes\n");
+        exit(1);
+    }
+    use_splice = (strcmp(argv[1], "splice") == 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    tcp_pair(front);
+    tcp_pair(back);
+
+    if ((sender = fork()) == 0) {
+        close(front[1]);
+        close(back[0]);
+        close(back[1]);
+        memset(buf, 'x', sizeof(buf));
+        for (left = mb * 1024 * 1024; left > 0; left -= sizeof(buf)) {
+            if (write(front[0], buf, sizeof(buf)) < 0) {
+                die("sender");
+            }
+        }
+        exit(0);
+    }
+    if ((receiver = fork()) == 0) {
+        close(front[0]);
+        close(front[1]);
+        close(back[0]);
+        while (read(back[1], buf, sizeof(buf)) > 0)
+            ;
+        exit(0);
+    }
+    close(front[0]);
+    close(back[1]);
+
+    gettimeofday(&start, NULL);
+    if (use_splice) {
+        relay_splice(front[1], back[0]);
+    }
+    else {
+        relay_copy(front[1], back[0]);
+    }
+    close(back[0]);
+    gettimeofday(&end, NULL);
+    waitpid(sender, NULL, 0);
+    waitpid(receiver, NULL, 0);
+
+    getrusage(RUSAGE_SELF, &ru);
+    secs = tv2sec(&end) - tv2sec(&start);
+    printf("%s: %lld MB in %.3fs (%.2f Gbit/s), relay cpu user %.3fs sys %.3fs\n",
+           argv[1], mb, secs, mb * 8.0 / 1024 / secs,
+           tv2sec(&ru.ru_utime), tv2sec(&ru.ru_stime));
+    return 0;
+}
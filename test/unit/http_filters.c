@@ -0,0 +1,518 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+#include "httpd.h"
+#include "http_core.h"
+#include "http_protocol.h"
+#include "mod_core.h"
+#include "util_filter.h"
+
+/* Thu, 15 Oct 2026 08:00:00 GMT */
+#define BASE_TIME apr_time_from_sec(APR_INT64_C(1792051200))
+#define BASE_DATE "Thu, 15 Oct 2026 08:00:00 GMT"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t         *g_pool;
+static apr_bucket_alloc_t *g_alloc;
+static apr_bucket_brigade *g_bb;
+static request_rec        *g_request;
+
+static core_server_config *g_core_server;
+static core_dir_config    *g_core_dir;
+static void               *g_server_config[1];
+static void               *g_dir_config[1];
+
+/* A network filter below HTTP_IN, see net_in() */
+typedef struct {
+    const char *const *segs;    /* NULL terminated */
+    int next;                   /* next segment to arrive */
+    const char *data;           /* arrived, not read yet */
+    apr_size_t len;
+} net_ctx_t;
+
+static net_ctx_t       g_net_ctx;
+static ap_filter_rec_t g_net_rec, g_http_in_rec;
+static ap_filter_t     g_net, g_http_in;
+
+/* An empty segment makes a nonblocking read return EAGAIN */
+#define WOULDBLOCK ""
+
+/* Return what arrived, at most readbytes of it or a line, like the core
+ * input filter.  The next segment arrives only once everything before it
+ * was read.
+ */
+static apr_status_t net_in(ap_filter_t *f, apr_bucket_brigade *bb,
+                           ap_input_mode_t mode, apr_read_type_e block,
+                           apr_off_t readbytes)
+{
+    net_ctx_t *ctx = f->ctx;
+    apr_size_t len;
+
+    while (!ctx->len) {
+        const char *seg = ctx->segs[ctx->next];
+
+        if (!seg) {
+            return APR_EOF;
+        }
+        ctx->next++;
+        if (*seg) {
+            ctx->data = seg;
+            ctx->len = strlen(seg);
+        }
+        else if (block == APR_NONBLOCK_READ) {
+            return APR_EAGAIN;
+        }
+    }
+
+    len = ctx->len;
+    if (mode == AP_MODE_GETLINE) {
+        const char *lf = memchr(ctx->data, '\n', len);
+        if (lf) {
+            len = lf + 1 - ctx->data;
+        }
+    }
+    else if ((apr_off_t)len > readbytes) {
+        len = (apr_size_t)readbytes;
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_heap_create(ctx->data, len, NULL,
+                                                       bb->bucket_alloc));
+
+    if (mode != AP_MODE_SPECULATIVE) {
+        ctx->data += len;
+        ctx->len -= len;
+    }
+    return APR_SUCCESS;
+}
+
+static void http_filters_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    g_alloc = apr_bucket_alloc_create(g_pool);
+    g_bb = apr_brigade_create(g_pool, g_alloc);
+
+    /* Stub out just enough of a request_rec for ap_basic_http_header() */
+    g_request = apr_pcalloc(g_pool, sizeof(*g_request));
+    g_request->pool = g_pool;
+    g_request->server = apr_pcalloc(g_pool, sizeof(server_rec));
+    g_request->log = &g_request->server->log;
+    g_request->connection = apr_pcalloc(g_pool, sizeof(conn_rec));
+    g_request->connection->keepalive = AP_CONN_KEEPALIVE;
+    g_request->headers_out = apr_table_make(g_pool, 5);
+    g_request->subprocess_env = apr_table_make(g_pool, 5);
+    g_request->proto_num = HTTP_VERSION(1,1);
+    g_request->status = HTTP_OK;
+    g_request->request_time = BASE_TIME;
+
+    /* What ap_http_filter() needs for a chunked request body */
+    core_module.module_index = 0;
+    g_core_server = apr_pcalloc(g_pool, sizeof(*g_core_server));
+    g_core_dir = apr_pcalloc(g_pool, sizeof(*g_core_dir));
+    ap_set_core_module_config(g_server_config, g_core_server);
+    ap_set_core_module_config(g_dir_config, g_core_dir);
+    g_request->server->module_config = (ap_conf_vector_t *)g_server_config;
+    g_request->server->limit_req_fieldsize = DEFAULT_LIMIT_REQUEST_FIELDSIZE;
+    g_request->server->limit_req_fields = DEFAULT_LIMIT_REQUEST_FIELDS;
+    g_request->per_dir_config = (ap_conf_vector_t *)g_dir_config;
+    g_request->connection->pool = g_pool;
+    g_request->connection->bucket_alloc = g_alloc;
+    g_request->headers_in = apr_table_make(g_pool, 5);
+    g_request->trailers_in = apr_table_make(g_pool, 5);
+    g_request->notes = apr_table_make(g_pool, 5);
+    apr_table_setn(g_request->headers_in, "Transfer-Encoding", "chunked");
+
+    memset(&g_net_ctx, 0, sizeof(g_net_ctx));
+    g_net_rec.filter_func.in_func = net_in;
+    g_http_in_rec.filter_func.in_func = ap_http_filter;
+    memset(&g_net, 0, sizeof(g_net));
+    g_net.frec = &g_net_rec;
+    g_net.ctx = &g_net_ctx;
+    g_net.c = g_request->connection;
+    memset(&g_http_in, 0, sizeof(g_http_in));
+    g_http_in.frec = &g_http_in_rec;
+    g_http_in.next = &g_net;
+    g_http_in.r = g_request;
+    g_http_in.c = g_request->connection;
+    g_request->proto_input_filters = &g_http_in;
+}
+
+static void http_filters_teardown(void)
+{
+    apr_brigade_destroy(g_bb);
+    apr_bucket_alloc_destroy(g_alloc);
+    apr_pool_destroy(g_pool);
+}
+
+/* The header written to g_bb, which must be a single bucket */
+static const char *header_string(void)
+{
+    apr_bucket *e;
+    const char *data;
+    apr_size_t len;
+
+    ck_assert(!APR_BRIGADE_EMPTY(g_bb));
+    e = APR_BRIGADE_FIRST(g_bb);
+    ck_assert(APR_BUCKET_NEXT(e) == APR_BRIGADE_SENTINEL(g_bb));
+
+    ck_assert_int_eq(apr_bucket_read(e, &data, &len, APR_BLOCK_READ),
+                     APR_SUCCESS);
+    return apr_pstrmemdup(g_pool, data, len);
+}
+
+/*
+ * ap_basic_http_header()
+ */
+
+START_TEST(basic_header_is_a_single_buffer)
+{
+    ap_basic_http_header(g_request, g_bb);
+
+    ck_assert_str_eq(header_string(),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Date: " BASE_DATE "\r\n"
+                     "Server: " AP_SERVER_BASEVERSION "\r\n");
+}
+END_TEST
+
+struct status_line_case {
+    int status;
+    const char *status_line;
+    const char *expected;
+};
+
+static const struct status_line_case status_line_cases[] = {
+    { HTTP_OK,                    NULL,               "200 OK"           },
+    { HTTP_NOT_FOUND,             NULL,               "404 Not Found"    },
+    { HTTP_NOT_FOUND,             "404 Gone Fishing", "404 Gone Fishing" },
+    { HTTP_NOT_FOUND,             "404",              "404 Not Found"    },
+    { HTTP_INTERNAL_SERVER_ERROR, "200 OK",
+                                  "500 Internal Server Error"            },
+};
+
+static const size_t status_line_cases_len = sizeof(status_line_cases)
+                                            / sizeof(status_line_cases[0]);
+
+HTTPD_START_LOOP_TEST(basic_header_status_line, status_line_cases_len)
+{
+    const struct status_line_case *tc = &status_line_cases[_i];
+
+    g_request->status = tc->status;
+    g_request->status_line = tc->status_line;
+    ap_basic_http_header(g_request, g_bb);
+
+    ck_assert_str_eq(header_string(),
+                     apr_pstrcat(g_pool, "HTTP/1.1 ", tc->expected, "\r\n"
+                                 "Date: " BASE_DATE "\r\n"
+                                 "Server: " AP_SERVER_BASEVERSION "\r\n",
+                                 NULL));
+}
+END_TEST
+
+START_TEST(basic_header_forced_to_1_0)
+{
+    g_request->proto_num = HTTP_VERSION(1,0);
+    apr_table_setn(g_request->subprocess_env, "force-response-1.0", "1");
+    ap_basic_http_header(g_request, g_bb);
+
+    ck_assert_str_eq(header_string(),
+                     "HTTP/1.0 200 OK\r\n"
+                     "Date: " BASE_DATE "\r\n"
+                     "Server: " AP_SERVER_BASEVERSION "\r\n");
+    ck_assert_int_eq(g_request->connection->keepalive, AP_CONN_CLOSE);
+}
+END_TEST
+
+/* The Date and Server fields of the origin server are kept, but only once */
+START_TEST(basic_header_of_a_proxied_response)
+{
+    g_request->proxyreq = PROXYREQ_REVERSE;
+    apr_table_setn(g_request->headers_out, "Date",
+                   "Sat, 08 Jan 2000 18:31:41 GMT");
+    apr_table_setn(g_request->headers_out, "Server", "origin/1.0");
+    apr_table_setn(g_request->headers_out, "X-Other", "kept");
+    ap_basic_http_header(g_request, g_bb);
+
+    ck_assert_str_eq(header_string(),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Date: Sat, 08 Jan 2000 18:31:41 GMT\r\n"
+                     "Server: origin/1.0\r\n");
+    ck_assert(apr_table_get(g_request->headers_out, "Date") == NULL);
+    ck_assert(apr_table_get(g_request->headers_out, "Server") == NULL);
+    ck_assert_str_eq(apr_table_get(g_request->headers_out, "X-Other"),
+                     "kept");
+}
+END_TEST
+
+START_TEST(basic_header_of_a_proxied_response_without_date)
+{
+    g_request->proxyreq = PROXYREQ_REVERSE;
+    ap_basic_http_header(g_request, g_bb);
+
+    ck_assert_str_eq(header_string(),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Date: " BASE_DATE "\r\n"
+                     "Server: " AP_SERVER_BASEVERSION "\r\n");
+}
+END_TEST
+
+START_TEST(basic_header_of_http_0_9_is_empty)
+{
+    g_request->assbackwards = 1;
+    ap_basic_http_header(g_request, g_bb);
+
+    ck_assert(APR_BRIGADE_EMPTY(g_bb));
+}
+END_TEST
+
+/*
+ * ap_http_filter(), chunked request body
+ */
+
+#define PIPELINED "GET /next HTTP/1.1\r\n"
+
+/* Read the body with AP_MODE_READBYTES until EOS or an error */
+static apr_status_t read_body(const char *const *segs, apr_off_t readbytes,
+                              const char **body)
+{
+    apr_bucket_brigade *bb = apr_brigade_create(g_pool, g_alloc);
+    apr_status_t rv;
+    int eos = 0;
+
+    g_net_ctx.segs = segs;
+    *body = "";
+    do {
+        char *data;
+        apr_size_t len;
+
+        rv = ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                            APR_BLOCK_READ, readbytes);
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        eos = !APR_BRIGADE_EMPTY(bb)
+              && APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb));
+        apr_brigade_pflatten(bb, &data, &len, g_pool);
+        *body = apr_pstrcat(g_pool, *body,
+                            apr_pstrmemdup(g_pool, data, len), NULL);
+        apr_brigade_cleanup(bb);
+    } while (!eos);
+
+    return rv;
+}
+
+/* What the network has left after the body, not read yet */
+static const char *net_left(void)
+{
+    const char *left = apr_pstrmemdup(g_pool, g_net_ctx.data, g_net_ctx.len);
+    int i;
+
+    for (i = g_net_ctx.next; g_net_ctx.segs[i]; ++i) {
+        left = apr_pstrcat(g_pool, left, g_net_ctx.segs[i], NULL);
+    }
+    return left;
+}
+
+START_TEST(chunked_body_chunks_are_read_at_once)
+{
+    static const char *const segs[] = {
+        "5\r\nhello\r\n1\r\n \r\n5\r\nworld\r\n0\r\n\r\n" PIPELINED, NULL
+    };
+    apr_bucket_brigade *bb = apr_brigade_create(g_pool, g_alloc);
+    char data[32];
+    apr_size_t len = sizeof(data);
+
+    g_net_ctx.segs = segs;
+    ck_assert_int_eq(ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                                    APR_BLOCK_READ, 8192), APR_SUCCESS);
+    ck_assert_int_eq(apr_brigade_flatten(bb, data, &len), APR_SUCCESS);
+    ck_assert_int_eq(len, 11);
+    ck_assert(!memcmp(data, "hello world", 11));
+    ck_assert(APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb)));
+
+    /* The input after the body is left to the next request */
+    ck_assert_str_eq(net_left(), PIPELINED);
+}
+END_TEST
+
+#define CHUNKED_BODY "5;name=value\r\nhello\r\n" \
+                     "6;a;b=\"c d\"\r\n world\r\n" \
+                     "0\r\nX-Trailer: yes\r\n\r\n"
+
+/* Split anywhere, chunk lines, data and CRLFs take several reads */
+HTTPD_START_LOOP_TEST(chunked_body_split_anywhere, sizeof(CHUNKED_BODY) - 2)
+{
+    const char *segs[3];
+    const char *body;
+
+    segs[0] = apr_pstrndup(g_pool, CHUNKED_BODY, _i + 1);
+    segs[1] = CHUNKED_BODY PIPELINED + _i + 1;
+    segs[2] = NULL;
+
+    ck_assert_int_eq(read_body(segs, 8192, &body), APR_SUCCESS);
+    ck_assert_str_eq(body, "hello world");
+    ck_assert_str_eq(apr_table_get(g_request->trailers_in, "X-Trailer"),
+                     "yes");
+    ck_assert(apr_table_get(g_request->headers_in, "X-Trailer") == NULL);
+    ck_assert_str_eq(net_left(), PIPELINED);
+}
+END_TEST
+
+HTTPD_START_LOOP_TEST(chunked_body_in_small_reads, 12)
+{
+    static const char *const segs[] = { CHUNKED_BODY PIPELINED, NULL };
+    const char *body;
+
+    ck_assert_int_eq(read_body(segs, _i + 1, &body), APR_SUCCESS);
+    ck_assert_str_eq(body, "hello world");
+    ck_assert_str_eq(net_left(), PIPELINED);
+}
+END_TEST
+
+START_TEST(chunked_body_trailers_are_merged_when_asked)
+{
+    static const char *const segs[] = { CHUNKED_BODY, NULL };
+    const char *body;
+
+    g_core_server->merge_trailers = AP_MERGE_TRAILERS_ENABLE;
+    ck_assert_int_eq(read_body(segs, 8192, &body), APR_SUCCESS);
+    ck_assert_str_eq(apr_table_get(g_request->headers_in, "X-Trailer"),
+                     "yes");
+}
+END_TEST
+
+struct chunked_error_case {
+    const char *input;
+    apr_status_t expected;
+};
+
+static const struct chunked_error_case chunked_error_cases[] = {
+    /* malformed */
+    { "x\r\n",                                       APR_EINVAL     },
+    { "\r\n",                                        APR_EINVAL     },
+    { "5\nhello\r\n0\r\n\r\n",                       APR_EINVAL     },
+    { "5\r\nhelloX\r\n0\r\n\r\n",                    APR_EINVAL     },
+    { "5;ext\x01\r\nhello\r\n0\r\n\r\n",             APR_EINVAL     },
+    { "5 x\r\nhello\r\n0\r\n\r\n",                   APR_EINVAL     },
+    /* oversize */
+    { "8000000000000000\r\n",                        APR_ENOSPC     },
+    { "ffffffffffffffffff\r\n",                      APR_ENOSPC     },
+    /* truncated */
+    { "5\r\nhel",                                    APR_INCOMPLETE },
+    { "5\r\nhello\r\n",                              APR_INCOMPLETE },
+    { "5",                                           APR_INCOMPLETE },
+};
+
+static const size_t chunked_error_cases_len = sizeof(chunked_error_cases)
+                                              / sizeof(chunked_error_cases[0]);
+
+HTTPD_START_LOOP_TEST(chunked_body_errors, chunked_error_cases_len)
+{
+    const struct chunked_error_case *tc = &chunked_error_cases[_i];
+    const char *segs[2];
+    const char *body;
+
+    segs[0] = tc->input;
+    segs[1] = NULL;
+    ck_assert_int_eq(read_body(segs, 8192, &body), tc->expected);
+}
+END_TEST
+
+/* A chunk line longer than LimitRequestFieldSize (extensions included) */
+START_TEST(chunked_body_chunk_line_over_limit)
+{
+    static const char *const segs[] = {
+        "5;name=a-long-extension-value\r\nhello\r\n0\r\n\r\n", NULL
+    };
+    const char *body;
+
+    g_request->server->limit_req_fieldsize = 16;
+    ck_assert_int_eq(read_body(segs, 8192, &body), APR_ENOSPC);
+}
+END_TEST
+
+START_TEST(chunked_body_over_limit_request_body)
+{
+    static const char *const segs[] = {
+        "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", NULL
+    };
+    const char *body;
+
+    g_core_dir->limit_req_body = 8;
+    ck_assert_int_eq(read_body(segs, 8192, &body), APR_ENOSPC);
+}
+END_TEST
+
+START_TEST(chunked_body_nonblocking_reads)
+{
+    static const char *const segs[] = {
+        WOULDBLOCK, "5\r\nhel", WOULDBLOCK, "lo\r", WOULDBLOCK,
+        "\n0\r\n\r\n" PIPELINED, NULL
+    };
+    apr_bucket_brigade *bb = apr_brigade_create(g_pool, g_alloc);
+    char data[32];
+    apr_size_t len;
+
+    g_net_ctx.segs = segs;
+
+    /* nothing yet */
+    ck_assert_int_eq(ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                                    APR_NONBLOCK_READ, 8192), APR_EAGAIN);
+    ck_assert(APR_BRIGADE_EMPTY(bb));
+
+    len = sizeof(data);
+    ck_assert_int_eq(ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                                    APR_NONBLOCK_READ, 8192), APR_SUCCESS);
+    ck_assert_int_eq(apr_brigade_flatten(bb, data, &len), APR_SUCCESS);
+    ck_assert_int_eq(len, 3);
+    ck_assert(!memcmp(data, "hel", 3));
+    apr_brigade_cleanup(bb);
+
+    ck_assert_int_eq(ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                                    APR_NONBLOCK_READ, 8192), APR_EAGAIN);
+    ck_assert(APR_BRIGADE_EMPTY(bb));
+
+    len = sizeof(data);
+    ck_assert_int_eq(ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                                    APR_NONBLOCK_READ, 8192), APR_SUCCESS);
+    ck_assert_int_eq(apr_brigade_flatten(bb, data, &len), APR_SUCCESS);
+    ck_assert_int_eq(len, 2);
+    ck_assert(!memcmp(data, "lo", 2));
+    apr_brigade_cleanup(bb);
+
+    /* the CRLF after the data is split by a would-block */
+    ck_assert_int_eq(ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                                    APR_NONBLOCK_READ, 8192), APR_EAGAIN);
+    ck_assert(APR_BRIGADE_EMPTY(bb));
+
+    ck_assert_int_eq(ap_get_brigade(&g_http_in, bb, AP_MODE_READBYTES,
+                                    APR_NONBLOCK_READ, 8192), APR_SUCCESS);
+    ck_assert(APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb)));
+    ck_assert_str_eq(net_left(), PIPELINED);
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(http_filters, http_filters_setup, http_filters_teardown)
+#include "test/unit/http_filters.tests"
+HTTPD_END_TEST_CASE
@@ -0,0 +1,305 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+/* Same caveats as in mod_auth_digest.c; the module structure is renamed so
+ * that it doesn't clash with a statically linked mod_headers.
+ */
+#define headers_module test_headers_module
+#include "../../modules/metadata/mod_headers.c"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t   *g_pool;
+static headers_conf *g_conf;
+static request_rec  *g_request;
+
+static void mod_headers_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+
+    header_pre_config(g_pool, g_pool, g_pool);
+    g_conf = create_headers_dir_config(g_pool, NULL);
+
+    /* Stub out just enough of a request_rec for do_headers_fixup() */
+    g_request = apr_pcalloc(g_pool, sizeof(*g_request));
+    g_request->pool = g_pool;
+    g_request->server = apr_pcalloc(g_pool, sizeof(server_rec));
+    g_request->log = &g_request->server->log;
+    g_request->headers_in = apr_table_make(g_pool, 5);
+    g_request->headers_out = apr_table_make(g_pool, 5);
+    g_request->subprocess_env = apr_table_make(g_pool, 5);
+    g_request->notes = apr_table_make(g_pool, 5);
+}
+
+static void mod_headers_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/* Add a "Header ..." directive to the config, as if read from httpd.conf */
+static void add_header(const char *args)
+{
+    cmd_parms cmd;
+    const char *err;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.pool = g_pool;
+    cmd.temp_pool = g_pool;
+    cmd.cmd = &headers_cmds[0];
+    cmd.info = headers_cmds[0].cmd_data;
+
+    err = header_cmd(&cmd, g_conf, args);
+    ck_assert_msg(err == NULL, "Header %s: %s", args, err);
+}
+
+static void run_fixup(void)
+{
+    ck_assert_int_eq(do_headers_fixup(g_request, g_request->headers_out,
+                                      g_conf->fixup_out, 0), 1);
+}
+
+/* The values of the header in headers_out, "|"-separated */
+static const char *values(const char *header)
+{
+    const apr_array_header_t *arr = apr_table_elts(g_request->headers_out);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    const char *res = NULL;
+    int i;
+
+    for (i = 0; i < arr->nelts; ++i) {
+        if (!strcasecmp(elts[i].key, header)) {
+            res = res ? apr_pstrcat(g_pool, res, "|", elts[i].val, NULL)
+                      : elts[i].val;
+        }
+    }
+    return res ? res : "";
+}
+
+/* The names of the headers in headers_out, in order, "|"-separated */
+static const char *names(void)
+{
+    const apr_array_header_t *arr = apr_table_elts(g_request->headers_out);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    const char *res = "";
+    int i;
+
+    for (i = 0; i < arr->nelts; ++i) {
+        res = apr_pstrcat(g_pool, res, i ? "|" : "", elts[i].key, NULL);
+    }
+    return res;
+}
+
+/*
+ * Header set
+ */
+
+START_TEST(constant_sets_are_folded)
+{
+    header_entry *hdr;
+
+    add_header("set X-Frame-Options DENY");
+    add_header("set X-Content-Type-Options nosniff");
+    add_header("set Referrer-Policy \"same-origin\"");
+
+    ck_assert_int_eq(g_conf->fixup_out->nelts, 1);
+    hdr = (header_entry *)g_conf->fixup_out->elts;
+    ck_assert_int_eq(hdr->action, hdr_set_bulk);
+}
+END_TEST
+
+START_TEST(folded_sets_replace_only_their_headers)
+{
+    apr_table_addn(g_request->headers_out, "X-Frame-Options", "SAMEORIGIN");
+    apr_table_addn(g_request->headers_out, "Set-Cookie", "a=1");
+    apr_table_addn(g_request->headers_out, "X-Frame-Options", "ALLOW");
+    apr_table_addn(g_request->headers_out, "Set-Cookie", "b=2");
+
+    add_header("set X-Frame-Options DENY");
+    add_header("set X-Content-Type-Options nosniff");
+    add_header("set Referrer-Policy same-origin");
+    add_header("set Referrer-Policy no-referrer");
+    run_fixup();
+
+    ck_assert_str_eq(values("X-Frame-Options"), "DENY");
+    ck_assert_str_eq(values("X-Content-Type-Options"), "nosniff");
+    ck_assert_str_eq(values("Referrer-Policy"), "no-referrer");
+    ck_assert_str_eq(values("Set-Cookie"), "a=1|b=2");
+}
+END_TEST
+
+START_TEST(sets_are_folded_only_when_consecutive_and_unconditional)
+{
+    add_header("set X-A 1");
+    add_header("unset X-B");
+    add_header("set X-C 3");
+    add_header("set X-D 4 env=DO_D");
+    add_header("set X-E 5");
+    add_header("set Content-Type text/plain");
+    add_header("set X-F 6");
+    add_header("set X-G %{G}e");
+    add_header("set X-H 8");
+    add_header("add X-I 9");
+    add_header("set X-J 10");
+
+    ck_assert_int_eq(g_conf->fixup_out->nelts, 11);
+
+    apr_table_setn(g_request->headers_out, "X-B", "2");
+    apr_table_setn(g_request->headers_out, "X-I", "0");
+    apr_table_setn(g_request->subprocess_env, "G", "7");
+    g_request->content_type = "text/html";
+    run_fixup();
+
+    ck_assert_str_eq(names(),
+                     "X-I|X-A|X-C|X-E|Content-Type|X-F|X-G|X-H|X-I|X-J");
+    ck_assert_str_eq(g_request->content_type, "text/plain");
+    ck_assert_str_eq(values("X-G"), "7");
+    ck_assert_str_eq(values("X-I"), "0|9");
+}
+END_TEST
+
+/* A set after a folded entry joins it */
+START_TEST(sets_after_a_folded_entry_are_folded)
+{
+    add_header("set X-A 1");
+    add_header("set X-B 2");
+    add_header("set X-C 3");
+    add_header("set X-A 4");
+
+    ck_assert_int_eq(g_conf->fixup_out->nelts, 1);
+
+    run_fixup();
+    ck_assert_str_eq(names(), "X-A|X-B|X-C");
+    ck_assert_str_eq(values("X-A"), "4");
+}
+END_TEST
+
+START_TEST(constant_values_are_unescaped_once)
+{
+    header_entry *hdr;
+
+    add_header("set X-A \"100%% a\\tb\"");
+
+    hdr = (header_entry *)g_conf->fixup_out->elts;
+    ck_assert_str_eq(hdr->value, "100% a\tb");
+
+    run_fixup();
+    ck_assert_str_eq(values("X-A"), "100% a\tb");
+}
+END_TEST
+
+START_TEST(format_values_are_computed_per_request)
+{
+    header_entry *hdr;
+
+    add_header("set X-Env \"v=%{FOO}e\"");
+
+    hdr = (header_entry *)g_conf->fixup_out->elts;
+    ck_assert(hdr->value == NULL);
+
+    apr_table_setn(g_request->subprocess_env, "FOO", "bar");
+    run_fixup();
+    ck_assert_str_eq(values("X-Env"), "v=bar");
+
+    apr_table_setn(g_request->subprocess_env, "FOO", "baz");
+    run_fixup();
+    ck_assert_str_eq(values("X-Env"), "v=baz");
+}
+END_TEST
+
+/*
+ * Header edit / edit*
+ */
+
+struct edit_case {
+    const char *action;
+    const char *regex;
+    const char *subs;
+    const char *value;
+    const char *expected;
+};
+
+static const struct edit_case edit_cases[] = {
+    { "edit",  "^foo",              "bar",   "foofoo",  "barfoo"  },
+    { "edit*", "foo",               "bar",   "foofoo",  "barbar"  },
+    { "edit*", "o",                 "0",     "foo boo", "f00 b00" },
+    { "edit",  "(\\w+)-(\\w+)",     "$2-$1", "ab-cd",   "cd-ab"   },
+    { "edit*", "([a-z])([0-9])",    "$2$1",  "a1b2c3",  "1a2b3c"  },
+    { "edit*", "b",                 "",      "abcb",    "ac"      },
+    { "edit",  "zzz",               "yyy",   "abc",     "abc"     },
+
+    /* Empty matches: the char that follows is kept, the edit goes on */
+    { "edit",  "x*",                "-",     "abc",     "-abc"    },
+    { "edit*", "x*",                "-",     "abc",     "-a-b-c-" },
+    { "edit*", "$",                 "!",     "abc",     "abc!"    },
+    { "edit*", "^",                 ">",     "",        ">"       },
+    { "edit*", "b*",                "-",     "abbc",    "-a--c-"  },
+};
+
+static const size_t edit_cases_len = sizeof(edit_cases) / sizeof(edit_cases[0]);
+
+HTTPD_START_LOOP_TEST(edit_replaces_matches, edit_cases_len)
+{
+    const struct edit_case *tc = &edit_cases[_i];
+
+    add_header(apr_psprintf(g_pool, "%s X-Test \"%s\" \"%s\"",
+                            tc->action, tc->regex, tc->subs));
+    apr_table_addn(g_request->headers_out, "X-Test", tc->value);
+    run_fixup();
+
+    ck_assert_str_eq(values("X-Test"), tc->expected);
+}
+END_TEST
+
+START_TEST(edit_applies_to_all_values)
+{
+    apr_table_addn(g_request->headers_out, "X-Test", "foo1");
+    apr_table_addn(g_request->headers_out, "Other", "foo");
+    apr_table_addn(g_request->headers_out, "X-Test", "foo2");
+
+    add_header("edit* X-Test foo bar");
+    run_fixup();
+
+    ck_assert_str_eq(values("X-Test"), "bar1|bar2");
+    ck_assert_str_eq(values("Other"), "foo");
+}
+END_TEST
+
+START_TEST(edit_without_match_keeps_headers_in_place)
+{
+    apr_table_addn(g_request->headers_out, "A", "1");
+    apr_table_addn(g_request->headers_out, "X-Test", "foo");
+    apr_table_addn(g_request->headers_out, "B", "2");
+
+    add_header("edit X-Test zzz yyy");
+    run_fixup();
+
+    ck_assert_str_eq(names(), "A|X-Test|B");
+    ck_assert_str_eq(values("X-Test"), "foo");
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(mod_headers, mod_headers_setup, mod_headers_teardown)
+#include "test/unit/mod_headers.tests"
+HTTPD_END_TEST_CASE
@@ -0,0 +1,150 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+/* Same caveats as in mod_auth_digest.c; the module structure is renamed so
+ * that it doesn't clash with a statically linked mod_logio.
+ */
+#define logio_module test_logio_module
+#include "../../modules/loggers/mod_logio.c"
+
+#include "util_filter.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t         *g_pool;
+static apr_bucket_alloc_t *g_alloc;
+static apr_bucket_brigade *g_bb;
+static request_rec        *g_request;
+static void               *g_conn_config[1];
+
+static ap_filter_rec_t g_net_rec, g_logio_rec;
+static ap_filter_t     g_net, g_logio;
+
+/* What the network has, returned at most readbytes at a time */
+static const char *g_net_data;
+
+static apr_status_t net_in(ap_filter_t *f, apr_bucket_brigade *bb,
+                           ap_input_mode_t mode, apr_read_type_e block,
+                           apr_off_t readbytes)
+{
+    apr_size_t len = strlen(g_net_data);
+
+    if (!len) {
+        return APR_EOF;
+    }
+    if ((apr_off_t)len > readbytes) {
+        len = (apr_size_t)readbytes;
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_heap_create(g_net_data, len, NULL,
+                                                       bb->bucket_alloc));
+    if (mode != AP_MODE_SPECULATIVE) {
+        g_net_data += len;
+    }
+    return APR_SUCCESS;
+}
+
+static void mod_logio_setup(void)
+{
+    conn_rec *c;
+
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    g_alloc = apr_bucket_alloc_create(g_pool);
+    g_bb = apr_brigade_create(g_pool, g_alloc);
+
+    /* Stub out the connection, the module being the only one its config
+     * vector holds, and what logio_pre_conn() sets up. */
+    test_logio_module.module_index = 0;
+    c = apr_pcalloc(g_pool, sizeof(*c));
+    c->pool = g_pool;
+    c->bucket_alloc = g_alloc;
+    c->conn_config = (ap_conf_vector_t *)g_conn_config;
+    ap_set_module_config(c->conn_config, &logio_module,
+                         apr_pcalloc(g_pool, sizeof(logio_config_t)));
+
+    g_request = apr_pcalloc(g_pool, sizeof(*g_request));
+    g_request->pool = g_pool;
+    g_request->connection = c;
+
+    g_net_data = "";
+    g_net_rec.filter_func.in_func = net_in;
+    g_logio_rec.filter_func.in_func = logio_in_filter;
+    memset(&g_net, 0, sizeof(g_net));
+    g_net.frec = &g_net_rec;
+    g_net.c = c;
+    memset(&g_logio, 0, sizeof(g_logio));
+    g_logio.frec = &g_logio_rec;
+    g_logio.next = &g_net;
+    g_logio.c = c;
+}
+
+static void mod_logio_teardown(void)
+{
+    apr_brigade_destroy(g_bb);
+    apr_bucket_alloc_destroy(g_alloc);
+    apr_pool_destroy(g_pool);
+}
+
+static apr_status_t read_input(ap_input_mode_t mode, apr_off_t readbytes)
+{
+    apr_status_t rv;
+
+    rv = ap_get_brigade(&g_logio, g_bb, mode, APR_BLOCK_READ, readbytes);
+    apr_brigade_cleanup(g_bb);
+    return rv;
+}
+
+/*
+ * logio_in_filter(), %I
+ */
+
+START_TEST(input_read_is_counted)
+{
+    g_net_data = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    ck_assert_int_eq(read_input(AP_MODE_READBYTES, 16), APR_SUCCESS);
+    ck_assert_str_eq(log_bytes_in(g_request, NULL), "16");
+    ck_assert_int_eq(read_input(AP_MODE_READBYTES, 8192), APR_SUCCESS);
+    ck_assert_str_eq(log_bytes_in(g_request, NULL), "35");
+}
+END_TEST
+
+/* Peeked input is counted once, when it is read */
+START_TEST(input_peeked_is_not_counted)
+{
+    g_net_data = "5\r\nhello\r\n0\r\n\r\n";
+
+    ck_assert_int_eq(read_input(AP_MODE_SPECULATIVE, 8192), APR_SUCCESS);
+    ck_assert_str_eq(log_bytes_in(g_request, NULL), "0");
+    ck_assert_int_eq(read_input(AP_MODE_READBYTES, 10), APR_SUCCESS);
+    ck_assert_str_eq(log_bytes_in(g_request, NULL), "10");
+    ck_assert_int_eq(read_input(AP_MODE_SPECULATIVE, 8192), APR_SUCCESS);
+    ck_assert_int_eq(read_input(AP_MODE_READBYTES, 8192), APR_SUCCESS);
+    ck_assert_str_eq(log_bytes_in(g_request, NULL), "15");
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(mod_logio, mod_logio_setup, mod_logio_teardown)
+#include "test/unit/mod_logio.tests"
+HTTPD_END_TEST_CASE
@@ -0,0 +1,205 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+/* Same caveats as in mod_auth_digest.c; the module structure and the
+ * functions of the hooks which mod_session implements are renamed so that
+ * they don't clash with a statically linked mod_session.
+ */
+#define session_module test_session_module
+#define ap_hook_session_load        test_ap_hook_session_load
+#define ap_hook_get_session_load    test_ap_hook_get_session_load
+#define ap_run_session_load         test_ap_run_session_load
+#define ap_hook_session_save        test_ap_hook_session_save
+#define ap_hook_get_session_save    test_ap_hook_get_session_save
+#define ap_run_session_save         test_ap_run_session_save
+#define ap_hook_session_encode      test_ap_hook_session_encode
+#define ap_hook_get_session_encode  test_ap_hook_get_session_encode
+#define ap_run_session_encode       test_ap_run_session_encode
+#define ap_hook_session_decode      test_ap_hook_session_decode
+#define ap_hook_get_session_decode  test_ap_hook_get_session_decode
+#define ap_run_session_decode       test_ap_run_session_decode
+#include "../../modules/session/mod_session.c"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t  *g_pool;
+static request_rec *g_request;
+static session_rec *g_session;
+
+static void mod_session_setup(void)
+{
+    apr_pool_t *rpool;
+
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    if (apr_pool_create(&rpool, g_pool) != APR_SUCCESS) {
+        exit(1);
+    }
+
+    /* The request gets a pool of its own, so that the tests can check what
+     * outlives it. */
+    g_request = apr_pcalloc(g_pool, sizeof(*g_request));
+    g_request->pool = rpool;
+
+    g_session = apr_pcalloc(g_pool, sizeof(*g_session));
+    g_session->pool = g_pool;
+    g_session->entries = apr_table_make(g_pool, 10);
+}
+
+static void mod_session_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * session_identity_encode()
+ */
+
+START_TEST(identity_encode_of_empty_session_is_empty)
+{
+    session_identity_encode(g_request, g_session);
+
+    ck_assert_str_eq(g_session->encoded, "");
+}
+END_TEST
+
+START_TEST(identity_encode_urlencodes_and_joins_pairs)
+{
+    apr_table_set(g_session->entries, "user", "jdoe");
+    apr_table_set(g_session->entries, "full name", "J. Doe");
+    apr_table_set(g_session->entries, "next", "/a?b=c&d");
+
+    session_identity_encode(g_request, g_session);
+
+    ck_assert_str_eq(g_session->encoded,
+                     "user=jdoe&full+name=J.+Doe&next=%2fa%3fb%3dc%26d");
+}
+END_TEST
+
+START_TEST(identity_encode_adds_expiry)
+{
+    apr_table_set(g_session->entries, "user", "jdoe");
+    g_session->expiry = APR_INT64_C(1603092811000000);
+
+    session_identity_encode(g_request, g_session);
+
+    ck_assert_str_eq(g_session->encoded,
+                     "user=jdoe&" SESSION_EXPIRY "=1603092811000000");
+}
+END_TEST
+
+/* Every byte escaped takes three, the buffer must be sized for the worst */
+START_TEST(identity_encode_fits_fully_escaped_pairs)
+{
+    char key[256], val[256];
+    int i;
+
+    for (i = 0; i < 255; ++i) {
+        key[i] = '&';
+        val[i] = (char)(i + 1);
+    }
+    key[255] = val[255] = '\0';
+    apr_table_set(g_session->entries, key, val);
+    apr_table_set(g_session->entries, "a", "b");
+
+    session_identity_encode(g_request, g_session);
+
+    ck_assert_int_eq(strlen(g_session->encoded),
+                     255 * 3 + 1 + strlen(ap_escape_urlencoded(g_pool, val))
+                     + strlen("&a=b"));
+    ck_assert_str_eq(g_session->encoded
+                     + strlen(g_session->encoded) - strlen("&a=b"), "&a=b");
+}
+END_TEST
+
+/*
+ * session_identity_decode()
+ */
+
+START_TEST(identity_decode_sets_entries_and_expiry)
+{
+    g_session->encoded = "user=jdoe&full+name=J.+Doe&next=%2fa%3fb%3dc%26d"
+                         "&" SESSION_EXPIRY "=1603092811000000";
+
+    session_identity_decode(g_request, g_session);
+
+    ck_assert(g_session->encoded == NULL);
+    ck_assert_int_eq(apr_table_elts(g_session->entries)->nelts, 3);
+    ck_assert_str_eq(apr_table_get(g_session->entries, "user"), "jdoe");
+    ck_assert_str_eq(apr_table_get(g_session->entries, "full name"), "J. Doe");
+    ck_assert_str_eq(apr_table_get(g_session->entries, "next"), "/a?b=c&d");
+    ck_assert(g_session->expiry == APR_INT64_C(1603092811000000));
+}
+END_TEST
+
+START_TEST(identity_decode_unsets_empty_values_and_skips_bad_pairs)
+{
+    apr_table_set(g_session->entries, "gone", "soon");
+    g_session->encoded = "gone=&=nokey&bad=%zz&ok=1&&";
+
+    session_identity_decode(g_request, g_session);
+
+    ck_assert_int_eq(apr_table_elts(g_session->entries)->nelts, 1);
+    ck_assert_str_eq(apr_table_get(g_session->entries, "ok"), "1");
+}
+END_TEST
+
+/* The entries point into the session's pool, not the request's */
+START_TEST(identity_decode_entries_outlive_request_pool)
+{
+    const char *encoded = apr_pstrdup(g_request->pool, "user=jdoe&lang=en");
+
+    g_session->encoded = encoded;
+    session_identity_decode(g_request, g_session);
+    apr_pool_destroy(g_request->pool);
+
+    ck_assert_str_eq(apr_table_get(g_session->entries, "user"), "jdoe");
+    ck_assert_str_eq(apr_table_get(g_session->entries, "lang"), "en");
+}
+END_TEST
+
+START_TEST(identity_encode_then_decode_round_trips)
+{
+    session_rec *z = apr_pcalloc(g_pool, sizeof(*z));
+
+    apr_table_set(g_session->entries, "a b", "1+1=2");
+    apr_table_set(g_session->entries, "c%d", "\xc3\xa9t\xc3\xa9");
+    g_session->expiry = 42;
+    session_identity_encode(g_request, g_session);
+
+    z->pool = g_pool;
+    z->entries = apr_table_make(g_pool, 10);
+    z->encoded = g_session->encoded;
+    session_identity_decode(g_request, z);
+
+    ck_assert_int_eq(apr_table_elts(z->entries)->nelts, 2);
+    ck_assert_str_eq(apr_table_get(z->entries, "a b"), "1+1=2");
+    ck_assert_str_eq(apr_table_get(z->entries, "c%d"), "\xc3\xa9t\xc3\xa9");
+    ck_assert(z->expiry == 42);
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(mod_session, mod_session_setup, mod_session_teardown)
+#include "test/unit/mod_session.tests"
+HTTPD_END_TEST_CASE
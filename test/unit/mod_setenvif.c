@@ -0,0 +1,311 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+/* Same caveats as in mod_auth_digest.c; the module structure is renamed so
+ * that it doesn't clash with a statically linked mod_setenvif.
+ */
+#define setenvif_module test_setenvif_module
+#include "../../modules/metadata/mod_setenvif.c"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t  *g_pool;
+static apr_pool_t  *g_ptemp;
+static server_rec  *g_server;
+static sei_cfg_rec *g_conf;
+static void        *g_server_config[1];
+
+static void mod_setenvif_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    if (apr_pool_create(&g_ptemp, g_pool) != APR_SUCCESS) {
+        exit(1);
+    }
+
+    /* Stub out the server and what register_hooks() would do, the module
+     * being the only one its config vectors hold. */
+    test_setenvif_module.module_index = 0;
+    is_header_regex_regex = ap_pregcomp(g_pool, "^[-A-Za-z0-9_]*$",
+                                        (AP_REG_EXTENDED | AP_REG_NOSUB));
+
+    g_server = apr_pcalloc(g_pool, sizeof(*g_server));
+    g_server->module_config = (ap_conf_vector_t *)g_server_config;
+    g_conf = create_setenvif_config_svr(g_pool, g_server);
+    ap_set_module_config(g_server->module_config, &setenvif_module, g_conf);
+
+    /* The memo of the results, released with g_pool */
+    setenvif_child_init(g_pool, g_server);
+}
+
+static void mod_setenvif_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/* Add a directive to the server config, as if read from httpd.conf */
+static void add_directive(const char *name, const char *args)
+{
+    const command_rec *c;
+    cmd_parms cmd;
+    const char *err;
+
+    for (c = setenvif_module_cmds; c->name; ++c) {
+        if (!strcasecmp(c->name, name)) {
+            break;
+        }
+    }
+    ck_assert_msg(c->name != NULL, "unknown directive %s", name);
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.pool = g_pool;
+    cmd.temp_pool = g_ptemp;
+    cmd.server = g_server;
+    cmd.cmd = c;
+    cmd.info = c->cmd_data;
+
+    err = c->AP_RAW_ARGS(&cmd, NULL, args);
+    ck_assert_msg(err == NULL, "%s %s: %s", name, args, err);
+}
+
+/* Run match_headers() for a new request with that User-Agent, and return
+ * its subprocess_env. */
+static apr_table_t *run_request(const char *user_agent)
+{
+    request_rec *r = apr_pcalloc(g_pool, sizeof(*r));
+    void **request_config = apr_pcalloc(g_pool, sizeof(void *));
+
+    r->pool = g_pool;
+    r->server = g_server;
+    r->log = &g_server->log;
+    r->request_config = (ap_conf_vector_t *)request_config;
+    r->headers_in = apr_table_make(g_pool, 5);
+    r->subprocess_env = apr_table_make(g_pool, 5);
+    r->uri = "/index.html";
+    r->method = "GET";
+    if (user_agent) {
+        apr_table_setn(r->headers_in, "User-Agent", user_agent);
+    }
+
+    ck_assert_int_eq(match_headers(r), DECLINED);
+    return r->subprocess_env;
+}
+
+/* The usual list of BrowserMatch, one memoised segment */
+static void add_browser_list(void)
+{
+    add_directive("BrowserMatch", "Mozilla/2 nokeepalive");
+    add_directive("BrowserMatch", "\"MSIE 4\\.0b2;\" nokeepalive "
+                                  "downgrade-1.0 force-response-1.0");
+    add_directive("BrowserMatch", "\"RealPlayer 4\\.0\" force-response-1.0");
+    add_directive("BrowserMatch", "Java/1\\.0 force-response-1.0");
+    add_directive("BrowserMatch", "JDK/1\\.0 force-response-1.0");
+    add_directive("BrowserMatch", "^Mozilla/([0-9]+) mozilla=$1 !legacy");
+    add_directive("BrowserMatchNoCase", "googlebot bot");
+}
+
+static const char *const user_agents[] = {
+    "Mozilla/2.02Gold (Win95; I)",
+    "Mozilla/4.0 (compatible; MSIE 4.0b2; Windows 95)",
+    "RealPlayer 4.0",
+    "Java/1.0.2",
+    "Mozilla/5.0 (compatible; Googlebot/2.1; +http://www.google.com/bot.html)",
+    "GOOGLEBOT",
+    "curl/7.68.0",
+    "",
+    NULL
+};
+
+/* What each of the user_agents above must set, sorted, "|"-separated */
+static const char *const user_agents_env[] = {
+    "mozilla=2|nokeepalive=1",
+    "downgrade-1.0=1|force-response-1.0=1|mozilla=4|nokeepalive=1",
+    "force-response-1.0=1",
+    "force-response-1.0=1",
+    "bot=1|mozilla=5",
+    "bot=1",
+    "",
+    "",
+    ""
+};
+
+static int env_compare(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+static const char *env_string(apr_table_t *env)
+{
+    const apr_array_header_t *arr = apr_table_elts(env);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    apr_array_header_t *strs = apr_array_make(g_pool, arr->nelts,
+                                              sizeof(char *));
+    int i;
+
+    for (i = 0; i < arr->nelts; ++i) {
+        APR_ARRAY_PUSH(strs, char *) = apr_pstrcat(g_pool, elts[i].key, "=",
+                                                   elts[i].val, NULL);
+    }
+    qsort(strs->elts, strs->nelts, sizeof(char *), env_compare);
+    return apr_array_pstrcat(g_pool, strs, '|');
+}
+
+/*
+ * match_headers()
+ */
+
+HTTPD_START_LOOP_TEST(browser_match_sets_variables, 9)
+{
+    add_browser_list();
+
+    ck_assert_str_eq(env_string(run_request(user_agents[_i])),
+                     user_agents_env[_i]);
+}
+END_TEST
+
+/* The second time, the results come from the memo and must be the same */
+HTTPD_START_LOOP_TEST(memoised_results_are_the_same, 9)
+{
+    add_browser_list();
+
+    run_request(user_agents[_i]);
+    ck_assert_int_eq(apr_hash_count(sei_memo_hash), 1);
+
+    ck_assert_str_eq(env_string(run_request(user_agents[_i])),
+                     user_agents_env[_i]);
+    ck_assert_int_eq(apr_hash_count(sei_memo_hash), 1);
+}
+END_TEST
+
+START_TEST(memoised_results_depend_on_the_value)
+{
+    int i;
+
+    add_browser_list();
+
+    for (i = 0; i < 9; ++i) {
+        run_request(user_agents[i]);
+    }
+    /* one result per User-Agent, a missing one is memoised as "" */
+    ck_assert_int_eq(apr_hash_count(sei_memo_hash), 8);
+
+    for (i = 8; i >= 0; --i) {
+        ck_assert_str_eq(env_string(run_request(user_agents[i])),
+                         user_agents_env[i]);
+    }
+    ck_assert_int_eq(apr_hash_count(sei_memo_hash), 8);
+}
+END_TEST
+
+/* Unsetting is memoised too, not only setting */
+START_TEST(memoised_results_unset_variables)
+{
+    apr_table_t *env;
+    int i;
+
+    add_directive("SetEnvIf", "Request_URI ^/ legacy");
+    add_browser_list();
+
+    for (i = 0; i < 2; ++i) {
+        env = run_request("Mozilla/5.0");
+        ck_assert(apr_table_get(env, "legacy") == NULL);
+        ck_assert_str_eq(apr_table_get(env, "mozilla"), "5");
+
+        env = run_request("curl/7.68.0");
+        ck_assert_str_eq(apr_table_get(env, "legacy"), "1");
+    }
+}
+END_TEST
+
+/* Short lists are not memoised */
+START_TEST(short_segments_are_not_memoised)
+{
+    add_directive("BrowserMatch", "Mozilla/2 nokeepalive");
+    add_directive("BrowserMatch", "Java/1\\.0 force-response-1.0");
+    add_directive("SetEnvIf", "Request_Method GET get");
+
+    ck_assert_str_eq(env_string(run_request("Java/1.0.2")),
+                     "force-response-1.0=1|get=1");
+    ck_assert_int_eq(apr_hash_count(sei_memo_hash), 0);
+}
+END_TEST
+
+/*
+ * The byte prefilter of the non-regex patterns
+ */
+
+struct prefilter_case {
+    const char *directive;
+    const char *pattern;
+    const char *value;
+    int matches;
+};
+
+static const struct prefilter_case prefilter_cases[] = {
+    { "SetEnvIf",       "abc",          "xxabcxx",      1 },
+    { "SetEnvIf",       "abc",          "xxabxcx",      0 },
+    { "SetEnvIf",       "abc",          "xxABCxx",      0 },
+    { "SetEnvIf",       "abc",          "cba",          0 },
+    { "SetEnvIfNoCase", "abc",          "xxABCxx",      1 },
+    { "SetEnvIfNoCase", "ABC",          "xxabcxx",      1 },
+    { "SetEnvIfNoCase", "ABC",          "xxaBxCx",      0 },
+    /* escaped metacharacters are matched as is */
+    { "SetEnvIf",       "a\\.b",        "a.b",          1 },
+    { "SetEnvIf",       "a\\.b",        "axb",          0 },
+    { "SetEnvIf",       "\\[x\\]",      "[x]",          1 },
+    /* bytes above 127 */
+    { "SetEnvIf",       "\xc3\xa9",     "caf\xc3\xa9",  1 },
+    { "SetEnvIfNoCase", "\xc3\xa9",     "CAF\xc3\xa9",  1 },
+    { "SetEnvIf",       "\xc3\xa9",     "cafe",         0 },
+};
+
+static const size_t prefilter_cases_len = sizeof(prefilter_cases)
+                                          / sizeof(prefilter_cases[0]);
+
+HTTPD_START_LOOP_TEST(prefilter_does_not_change_matches, prefilter_cases_len)
+{
+    const struct prefilter_case *tc = &prefilter_cases[_i];
+    apr_table_t *env;
+    int i;
+
+    add_directive(tc->directive,
+                  apr_psprintf(g_pool, "User-Agent \"%s\" v", tc->pattern));
+    /* more entries that don't match, so that the segment is memoised */
+    for (i = 1; i < SEI_MEMO_MIN; ++i) {
+        add_directive(tc->directive,
+                      apr_psprintf(g_pool, "User-Agent zzz%d v%d", i, i));
+    }
+
+    /* computed, then memoised */
+    for (i = 0; i < 2; ++i) {
+        env = run_request(tc->value);
+        ck_assert_str_eq(env_string(env), tc->matches ? "v=1" : "");
+        ck_assert_int_eq(apr_hash_count(sei_memo_hash), 1);
+    }
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(mod_setenvif, mod_setenvif_setup, mod_setenvif_teardown)
+#include "test/unit/mod_setenvif.tests"
+HTTPD_END_TEST_CASE
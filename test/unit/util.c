@@ -79,6 +79,59 @@ HTTPD_START_LOOP_TEST(find_token_correctly_parses_token_list, ap_test_token_case
 }
 END_TEST
 
+/*
+ * ap_escape_logitem(), ap_escape_html2(), ap_escape_path_segment(),
+ * ap_os_escape_path()
+ */
+
+struct ap_escape_case {
+    const char *in;
+    const char *logitem;
+    const char *html;
+    const char *html_toasc;
+    const char *path_segment;
+    const char *uri;
+};
+
+static const struct ap_escape_case ap_escape_cases[] = {
+    { "", "", "", "", "", "" },
+    { "plain", "plain", "plain", "plain", "plain", "plain" },
+    { "/a/b.html", "/a/b.html", "/a/b.html", "/a/b.html",
+      "%2fa%2fb.html", "/a/b.html" },
+    { "a b\"c\\d\n", "a b\\\"c\\\\d\\n", "a b&quot;c\\d\n",
+      "a b&quot;c\\d\n", "a%20b%22c%5cd%0a", "a%20b%22c%5cd%0a" },
+    { "<&>\x01", "<&>\\x01", "&lt;&amp;&gt;\x01", "&lt;&amp;&gt;\x01",
+      "%3c&%3e%01", "%3c&%3e%01" },
+    { "caf\xc3\xa9", "caf\\xc3\\xa9", "caf\xc3\xa9", "caf&#195;&#169;",
+      "caf%c3%a9", "caf%c3%a9" },
+    { "0123456789abcdef%", "0123456789abcdef%", "0123456789abcdef%",
+      "0123456789abcdef%", "0123456789abcdef%25", "0123456789abcdef%25" },
+};
+
+static const size_t ap_escape_cases_len = sizeof(ap_escape_cases) /
+                                          sizeof(ap_escape_cases[0]);
+
+HTTPD_START_LOOP_TEST(escape_functions_escape_correctly, ap_escape_cases_len)
+{
+    const struct ap_escape_case *c = &ap_escape_cases[_i];
+
+    ck_assert_str_eq(ap_escape_logitem(g_pool, c->in), c->logitem);
+    ck_assert_str_eq(ap_escape_html2(g_pool, c->in, 0), c->html);
+    ck_assert_str_eq(ap_escape_html2(g_pool, c->in, 1), c->html_toasc);
+    ck_assert_str_eq(ap_escape_path_segment(g_pool, c->in), c->path_segment);
+    ck_assert_str_eq(ap_escape_uri(g_pool, c->in), c->uri);
+}
+END_TEST
+
+START_TEST(os_escape_path_prefixes_colon)
+{
+    ck_assert_str_eq(ap_os_escape_path(g_pool, "a:b/c", 0), "./a:b/c");
+    ck_assert_str_eq(ap_os_escape_path(g_pool, "a:b c", 0), "./a:b%20c");
+    ck_assert_str_eq(ap_os_escape_path(g_pool, "a/b:c", 0), "a/b:c");
+    ck_assert_str_eq(ap_os_escape_path(g_pool, "a:b/c", 1), "a:b/c");
+}
+END_TEST
+
 /*
  * Test Case Boilerplate
  */
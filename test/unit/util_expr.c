@@ -0,0 +1,266 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+#include "apr_hooks.h"
+#include "apr_strings.h"
+
+#include "httpd.h"
+#include "ap_expr.h"
+#include "../../server/util_expr_private.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t  *g_pool;
+static request_rec *g_request;
+
+static void util_expr_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+
+    /* The lookup of the functions and operators is a hook */
+    apr_hook_global_pool = g_pool;
+    ap_expr_init(g_pool);
+
+    /* Stub out just enough of a request_rec for ap_expr_exec() */
+    g_request = apr_pcalloc(g_pool, sizeof(*g_request));
+    g_request->pool = g_pool;
+    g_request->server = apr_pcalloc(g_pool, sizeof(server_rec));
+    g_request->connection = apr_pcalloc(g_pool, sizeof(conn_rec));
+    g_request->headers_in = apr_table_make(g_pool, 5);
+    g_request->headers_out = apr_table_make(g_pool, 5);
+    g_request->subprocess_env = apr_table_make(g_pool, 5);
+}
+
+static void util_expr_teardown(void)
+{
+    apr_hook_deregister_all();
+    apr_pool_destroy(g_pool);
+}
+
+/* The word which stands for each "@" of the expressions below: a literal,
+ * which lets the expression be folded at parse time, or the same value
+ * read from the request, which doesn't. */
+#define LITERAL  0
+#define VARIABLE 1
+
+static const char *expand(const char *expr, const char *value, int how)
+{
+    const char *word = (how == LITERAL)
+                       ? apr_pstrcat(g_pool, "'", value, "'", NULL)
+                       : "reqenv('V')";
+    const char *res = "";
+    const char *at;
+
+    while ((at = strchr(expr, '@')) != NULL) {
+        res = apr_pstrcat(g_pool, res, apr_pstrmemdup(g_pool, expr, at - expr),
+                          word, NULL);
+        expr = at + 1;
+    }
+    apr_table_setn(g_request->subprocess_env, "V", value);
+    return apr_pstrcat(g_pool, res, expr, NULL);
+}
+
+static ap_expr_info_t *parse(const char *expr, unsigned int flags)
+{
+    ap_expr_info_t *info = apr_pcalloc(g_pool, sizeof(*info));
+    const char *err;
+
+    info->flags = flags;
+    err = ap_expr_parse(g_pool, g_pool, info, expr, NULL);
+    ck_assert_msg(err == NULL, "%s: %s", expr, err);
+    return info;
+}
+
+static int is_const(const ap_expr_info_t *info)
+{
+    switch (info->root_node->node_op) {
+    case op_String:
+    case op_True:
+    case op_False:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Boolean expressions
+ */
+
+struct cond_case {
+    const char *expr;
+    const char *value;
+    int folded;
+    int expected;
+};
+
+static const struct cond_case cond_cases[] = {
+    { "@ == 'abc'",                         "abc",  1, 1 },
+    { "@ != 'abc'",                         "abc",  1, 0 },
+    { "@ -lt 10",                           "9",    1, 1 },
+    { "@ -ge 10",                           "9",    1, 0 },
+    { "@ < 'abd'",                          "abc",  1, 1 },
+    { "@ . 'def' == 'abcdef'",              "abc",  1, 1 },
+    { "'x' . @ . 'y' == 'xaby'",            "ab",   1, 1 },
+    { "@ in {'x', 'abc', 'y'}",             "abc",  1, 1 },
+    { "@ in {'x', 'y'}",                    "abc",  1, 0 },
+    { "!(@ == 'abc')",                      "abc",  1, 0 },
+    { "true && @ == 'abc'",                 "abc",  1, 1 },
+    { "false || @ == 'x'",                  "abc",  1, 0 },
+    { "@ == 'x' || @ == 'abc'",             "abc",  1, 1 },
+    { "tolower(@) == 'abc'",                "AbC",  1, 1 },
+    { "toupper(@) == 'ABC'",                "aBc",  1, 1 },
+    { "escape(@) == 'a%20b'",               "a b",  1, 1 },
+    { "base64(@) == 'YWJj'",                "abc",  1, 1 },
+    { "unbase64(@) == 'abc'",               "YWJj", 1, 1 },
+    { "md5(@) == '900150983cd24fb0d6963f7d28e17f72'",
+                                            "abc",  1, 1 },
+    { "sha1(@) == 'a9993e364706816aba3e25717850c26c9cd0d89d'",
+                                            "abc",  1, 1 },
+    { "tolower(toupper(@) . 'D') == 'abcd'", "abc", 1, 1 },
+    /* matching is done at runtime, what it matches may be folded */
+    { "@ =~ /^a(b+)c$/",                    "abbc", 0, 1 },
+    { "@ . 'c' !~ /b/",                     "ab",   0, 0 },
+    { "tolower(@) =~ /^abc$/",              "ABC",  0, 1 },
+    { "-n @",                               "",     0, 0 },
+    { "-z @ && true",                       "",     0, 1 },
+};
+
+static const size_t cond_cases_len = sizeof(cond_cases) / sizeof(cond_cases[0]);
+
+HTTPD_START_LOOP_TEST(folded_conditions_evaluate_the_same, cond_cases_len)
+{
+    const struct cond_case *tc = &cond_cases[_i];
+    ap_expr_info_t *folded, *unfolded;
+    const char *err;
+
+    folded = parse(expand(tc->expr, tc->value, LITERAL), 0);
+    ck_assert_int_eq(is_const(folded), tc->folded);
+    ck_assert_int_eq(ap_expr_exec(g_request, folded, &err), tc->expected);
+    ck_assert(err == NULL);
+
+    unfolded = parse(expand(tc->expr, tc->value, VARIABLE), 0);
+    ck_assert(!is_const(unfolded));
+    ck_assert_int_eq(ap_expr_exec(g_request, unfolded, &err), tc->expected);
+    ck_assert(err == NULL);
+}
+END_TEST
+
+/* The ssl_expr compat mode compares as strings, also when folded */
+START_TEST(folded_comparisons_follow_ssl_expr_compat)
+{
+    const char *err;
+    int how;
+
+    for (how = LITERAL; how <= VARIABLE; ++how) {
+        ap_expr_info_t *info = parse(expand("@ < 10", "9", how),
+                                     AP_EXPR_FLAG_SSL_EXPR_COMPAT);
+
+        ck_assert_int_eq(ap_expr_exec(g_request, info, &err), 1);
+        ck_assert(err == NULL);
+        info = parse(expand("@ < 10", "11", how),
+                     AP_EXPR_FLAG_SSL_EXPR_COMPAT);
+        ck_assert_int_eq(ap_expr_exec(g_request, info, &err), 0);
+        ck_assert(err == NULL);
+    }
+}
+END_TEST
+
+/*
+ * String expressions
+ */
+
+struct string_case {
+    const char *expr;
+    const char *value;
+    int folded;
+    const char *expected;
+};
+
+static const struct string_case string_cases[] = {
+    { "x-%{:@:}-y",                         "abc",  1, "x-abc-y"    },
+    { "%{:@ . 'def':}",                     "abc",  1, "abcdef"     },
+    { "<%{:tolower(@):}>",                  "ABC",  1, "<abc>"      },
+    { "%{:base64(toupper(@)):}",            "abc",  1, "QUJD"       },
+    { "%{:md5(@):}",                        "",     1,
+                                            "d41d8cd98f00b204e9800998ecf8427e" },
+    { "%{: @ == 'abc' :}/%{: @ != 'abc' :}", "abc", 1, "true/false" },
+    { "%{: @ in {'a', 'b'} :}",             "b",    1, "true"       },
+    { "%{: @ =~ /b/ :}",                    "abc",  0, "true"       },
+};
+
+static const size_t string_cases_len = sizeof(string_cases)
+                                       / sizeof(string_cases[0]);
+
+HTTPD_START_LOOP_TEST(folded_strings_evaluate_the_same, string_cases_len)
+{
+    const struct string_case *tc = &string_cases[_i];
+    ap_expr_info_t *folded, *unfolded;
+    const char *err;
+
+    folded = parse(expand(tc->expr, tc->value, LITERAL),
+                   AP_EXPR_FLAG_STRING_RESULT);
+    ck_assert_int_eq(is_const(folded), tc->folded);
+    ck_assert_str_eq(ap_expr_str_exec(g_request, folded, &err), tc->expected);
+    ck_assert(err == NULL);
+
+    unfolded = parse(expand(tc->expr, tc->value, VARIABLE),
+                     AP_EXPR_FLAG_STRING_RESULT);
+    ck_assert(!is_const(unfolded));
+    ck_assert_str_eq(ap_expr_str_exec(g_request, unfolded, &err),
+                     tc->expected);
+    ck_assert(err == NULL);
+}
+END_TEST
+
+/* The backreferences of a match are the same whether its subject was
+ * folded or not */
+START_TEST(folded_subjects_set_the_same_backreferences)
+{
+    ap_expr_info_t *backrefs = parse("$2-$1", AP_EXPR_FLAG_STRING_RESULT);
+    int how;
+
+    for (how = LITERAL; how <= VARIABLE; ++how) {
+        ap_expr_info_t *info = parse(expand("'x' . @ =~ /^x(a)(b+)c$/",
+                                            "abbc", how), 0);
+        ap_regmatch_t pmatch[AP_MAX_REG_MATCH];
+        const char *source = NULL;
+        const char *err;
+
+        ck_assert_int_eq(ap_expr_exec_re(g_request, info, AP_MAX_REG_MATCH,
+                                         pmatch, &source, &err), 1);
+        ck_assert(err == NULL);
+        ck_assert_str_eq(source, "xabbc");
+        ck_assert_str_eq(ap_expr_str_exec_re(g_request, backrefs,
+                                             AP_MAX_REG_MATCH, pmatch,
+                                             &source, &err), "bb-a");
+        ck_assert(err == NULL);
+    }
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(util_expr, util_expr_setup, util_expr_teardown)
+#include "test/unit/util_expr.tests"
+HTTPD_END_TEST_CASE
@@ -0,0 +1,106 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+#include "httpd.h"
+#include "util_time.h"
+
+#include "apr_date.h"
+
+/* Thu, 15 Oct 2026 08:00:00 GMT */
+#define BASE_TIME apr_time_from_sec(APR_INT64_C(1792051200))
+
+/*
+ * ap_recent_rfc822_date()
+ */
+
+static void check_date(apr_time_t t)
+{
+    char expected[APR_RFC822_DATE_LEN];
+    char date[APR_RFC822_DATE_LEN];
+
+    ck_assert_int_eq(apr_rfc822_date(expected, t), APR_SUCCESS);
+    ck_assert_int_eq(ap_recent_rfc822_date(date, t), APR_SUCCESS);
+    ck_assert_str_eq(date, expected);
+}
+
+START_TEST(recent_rfc822_date_formats_like_apr)
+{
+    char date[APR_RFC822_DATE_LEN];
+
+    ap_recent_rfc822_date(date, BASE_TIME);
+    ck_assert_str_eq(date, "Thu, 15 Oct 2026 08:00:00 GMT");
+
+    ck_assert(apr_date_parse_rfc(date) == BASE_TIME);
+}
+END_TEST
+
+/* Within a second, the cached string is returned whatever the usecs */
+START_TEST(recent_rfc822_date_is_the_same_within_a_second)
+{
+    char first[APR_RFC822_DATE_LEN];
+    char date[APR_RFC822_DATE_LEN];
+    int i;
+
+    ap_recent_rfc822_date(first, BASE_TIME + 999999);
+    for (i = 0; i < 1000000; i += 99999) {
+        ap_recent_rfc822_date(date, BASE_TIME + i);
+        ck_assert_str_eq(date, first);
+    }
+}
+END_TEST
+
+HTTPD_START_LOOP_TEST(recent_rfc822_date_matches_apr, 4 * AP_TIME_RECENT_THRESHOLD)
+{
+    /* each slot of the cache used twice, and a later second each time */
+    check_date(BASE_TIME + apr_time_from_sec(_i));
+    check_date(BASE_TIME + apr_time_from_sec(_i));
+    check_date(BASE_TIME + apr_time_from_sec(_i + 3600));
+}
+END_TEST
+
+/* An older second mapping to the slot of a newer one doesn't get the
+ * newer one's string (nor replaces it).
+ */
+START_TEST(recent_rfc822_date_of_an_older_second_in_the_same_slot)
+{
+    apr_time_t newer = BASE_TIME + apr_time_from_sec(AP_TIME_RECENT_THRESHOLD
+                                                     + 1);
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        check_date(newer);
+        check_date(BASE_TIME);
+    }
+}
+END_TEST
+
+START_TEST(recent_rfc822_date_of_dates_far_apart)
+{
+    check_date(0);
+    check_date(apr_time_from_sec(APR_INT64_C(951782400)));  /* 29 Feb 2000 */
+    check_date(apr_time_from_sec(APR_INT64_C(4102444799))); /* 31 Dec 2099 */
+    check_date(BASE_TIME);
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE(util_time)
+#include "test/unit/util_time.tests"
+HTTPD_END_TEST_CASE
@@ -0,0 +1,248 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+#include "httpd.h"
+#include "http_core.h"
+#include "mod_core.h"
+#include "util_trace.h"
+
+#define TRACE_ID  "4bf92f3577b34da6a3ce929d0e0e4736"
+#define PARENT_ID "00f067aa0ba902b7"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t          *g_pool;
+static request_rec         *g_request;
+static core_server_config  *g_core_server;
+static core_request_config *g_core_request;
+static void                *g_server_config[1];
+static void                *g_request_config[1];
+
+static void util_trace_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    /* For the ids of the new traces */
+    ap_init_rng(g_pool);
+
+    /* Stub out just enough of a request_rec for ap_trace_request_begin() */
+    core_module.module_index = 0;
+    g_core_server = apr_pcalloc(g_pool, sizeof(*g_core_server));
+    g_core_server->trace_context = AP_CORE_CONFIG_ON;
+    g_core_server->trace_sample = -1;
+    g_core_request = apr_pcalloc(g_pool, sizeof(*g_core_request));
+    ap_set_core_module_config(g_server_config, g_core_server);
+    ap_set_core_module_config(g_request_config, g_core_request);
+
+    g_request = apr_pcalloc(g_pool, sizeof(*g_request));
+    g_request->pool = g_pool;
+    g_request->server = apr_pcalloc(g_pool, sizeof(server_rec));
+    g_request->server->module_config = (ap_conf_vector_t *)g_server_config;
+    g_request->connection = apr_pcalloc(g_pool, sizeof(conn_rec));
+    g_request->request_config = (ap_conf_vector_t *)g_request_config;
+    g_request->headers_in = apr_table_make(g_pool, 5);
+    g_request->method = "GET";
+    g_request->unparsed_uri = "/";
+}
+
+static void util_trace_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+static int is_zero(const unsigned char *id, apr_size_t len)
+{
+    while (len--) {
+        if (id[len]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * ap_trace_parse_traceparent()
+ */
+
+struct traceparent_case {
+    const char *val;
+    int valid;
+};
+
+static const struct traceparent_case traceparent_cases[] = {
+    { "00-" TRACE_ID "-" PARENT_ID "-01",                       1 },
+    { "00-" TRACE_ID "-" PARENT_ID "-00",                       1 },
+    { "00-" TRACE_ID "-" PARENT_ID "-ff",                       1 },
+
+    /* versions */
+    { "01-" TRACE_ID "-" PARENT_ID "-01",                       1 },
+    { "fe-" TRACE_ID "-" PARENT_ID "-01",                       1 },
+    { "ff-" TRACE_ID "-" PARENT_ID "-01",                       0 },
+    { "0g-" TRACE_ID "-" PARENT_ID "-01",                       0 },
+    { "0-" TRACE_ID "-" PARENT_ID "-01",                        0 },
+
+    /* all zeros ids */
+    { "00-00000000000000000000000000000000-" PARENT_ID "-01",   0 },
+    { "00-" TRACE_ID "-0000000000000000-01",                    0 },
+
+    /* lowercase hex only */
+    { "0A-" TRACE_ID "-" PARENT_ID "-01",                       0 },
+    { "00-4BF92F3577B34DA6A3CE929D0E0E4736-" PARENT_ID "-01",   0 },
+    { "00-" TRACE_ID "-00F067AA0BA902B7-01",                    0 },
+    { "00-" TRACE_ID "-" PARENT_ID "-0A",                       0 },
+
+    /* fields appended: not by version 00, only as fields by later ones */
+    { "00-" TRACE_ID "-" PARENT_ID "-01-what-the-future-holds", 0 },
+    { "00-" TRACE_ID "-" PARENT_ID "-01-",                      0 },
+    { "cc-" TRACE_ID "-" PARENT_ID "-01-what-the-future-holds", 1 },
+    { "cc-" TRACE_ID "-" PARENT_ID "-01-",                      1 },
+    { "cc-" TRACE_ID "-" PARENT_ID "-01what",                   0 },
+    { "cc-" TRACE_ID "-" PARENT_ID "-010",                      0 },
+
+    /* malformed */
+    { "00-" TRACE_ID "-" PARENT_ID "-1",                        0 },
+    { "00-" TRACE_ID "-" PARENT_ID,                             0 },
+    { "00_" TRACE_ID "-" PARENT_ID "-01",                       0 },
+    { "00-" TRACE_ID "_" PARENT_ID "-01",                       0 },
+    { "00-" TRACE_ID "-" PARENT_ID "_01",                       0 },
+    { "00-" TRACE_ID "0-" PARENT_ID "-1",                       0 },
+    { "00-" TRACE_ID "-" PARENT_ID "-0x",                       0 },
+    { "",                                                       0 },
+};
+
+static const size_t traceparent_cases_len = sizeof(traceparent_cases)
+                                            / sizeof(traceparent_cases[0]);
+
+HTTPD_START_LOOP_TEST(parse_traceparent_validates, traceparent_cases_len)
+{
+    const struct traceparent_case *tc = &traceparent_cases[_i];
+    unsigned char trace_id[AP_TRACE_ID_LEN];
+    unsigned char parent_id[AP_TRACE_SPAN_ID_LEN];
+    unsigned char flags;
+
+    ck_assert_msg(ap_trace_parse_traceparent(tc->val, trace_id, parent_id,
+                                             &flags) == tc->valid,
+                  "%s should be %s", tc->val, tc->valid ? "valid" : "invalid");
+}
+END_TEST
+
+START_TEST(parse_traceparent_sets_ids_and_flags)
+{
+    static const unsigned char expected_trace_id[AP_TRACE_ID_LEN] = {
+        0x4b, 0xf9, 0x2f, 0x35, 0x77, 0xb3, 0x4d, 0xa6,
+        0xa3, 0xce, 0x92, 0x9d, 0x0e, 0x0e, 0x47, 0x36
+    };
+    static const unsigned char expected_parent_id[AP_TRACE_SPAN_ID_LEN] = {
+        0x00, 0xf0, 0x67, 0xaa, 0x0b, 0xa9, 0x02, 0xb7
+    };
+    unsigned char trace_id[AP_TRACE_ID_LEN];
+    unsigned char parent_id[AP_TRACE_SPAN_ID_LEN];
+    unsigned char flags;
+
+    ck_assert(ap_trace_parse_traceparent("00-" TRACE_ID "-" PARENT_ID "-09",
+                                         trace_id, parent_id, &flags));
+    ck_assert(!memcmp(trace_id, expected_trace_id, AP_TRACE_ID_LEN));
+    ck_assert(!memcmp(parent_id, expected_parent_id, AP_TRACE_SPAN_ID_LEN));
+    ck_assert_int_eq(flags, 0x09);
+}
+END_TEST
+
+START_TEST(format_traceparent_round_trips)
+{
+    unsigned char trace_id[AP_TRACE_ID_LEN];
+    unsigned char parent_id[AP_TRACE_SPAN_ID_LEN];
+    unsigned char flags;
+    char buf[AP_TRACEPARENT_LEN + 1];
+
+    ck_assert(ap_trace_parse_traceparent("00-" TRACE_ID "-" PARENT_ID "-01",
+                                         trace_id, parent_id, &flags));
+    ap_trace_format_traceparent(buf, trace_id, parent_id, flags);
+    buf[AP_TRACEPARENT_LEN] = '\0';
+    ck_assert_str_eq(buf, "00-" TRACE_ID "-" PARENT_ID "-01");
+}
+END_TEST
+
+/*
+ * ap_trace_request_begin()
+ */
+
+START_TEST(request_with_valid_traceparent_continues_the_trace)
+{
+    ap_trace_t *t;
+
+    apr_table_setn(g_request->headers_in, "traceparent",
+                   "00-" TRACE_ID "-" PARENT_ID "-01");
+    apr_table_setn(g_request->headers_in, "tracestate", "vendor=abc");
+    ap_trace_request_begin(g_request);
+
+    t = ap_trace_get(g_request);
+    ck_assert(t != NULL);
+    ck_assert(t->remote);
+    ck_assert(t->span.sampled);
+    ck_assert_str_eq(t->tracestate, "vendor=abc");
+    ck_assert_str_eq(apr_table_get(g_request->headers_in, "tracestate"),
+                     "vendor=abc");
+    ck_assert(!strncmp(ap_trace_traceparent(g_request), "00-" TRACE_ID "-",
+                       3 + 32 + 1));
+}
+END_TEST
+
+static const char *const invalid_traceparents[] = {
+    "ff-" TRACE_ID "-" PARENT_ID "-01",
+    "00-00000000000000000000000000000000-" PARENT_ID "-01",
+    "00-" TRACE_ID "-0000000000000000-01",
+    "00-4BF92F3577B34DA6A3CE929D0E0E4736-" PARENT_ID "-01",
+    "00-" TRACE_ID "-" PARENT_ID "-01-extra",
+    NULL
+};
+
+/* A new trace begins, the caller's tracestate is not forwarded (but left
+ * in the headers for the other modules) */
+HTTPD_START_LOOP_TEST(request_with_invalid_traceparent_drops_tracestate, 6)
+{
+    ap_trace_t *t;
+
+    if (invalid_traceparents[_i]) {
+        apr_table_setn(g_request->headers_in, "traceparent",
+                       invalid_traceparents[_i]);
+    }
+    apr_table_setn(g_request->headers_in, "tracestate", "vendor=abc");
+    ap_trace_request_begin(g_request);
+
+    t = ap_trace_get(g_request);
+    ck_assert(t != NULL);
+    ck_assert(!t->remote);
+    ck_assert(t->tracestate == NULL);
+    ck_assert_str_eq(apr_table_get(g_request->headers_in, "tracestate"),
+                     "vendor=abc");
+    ck_assert(!is_zero(t->span.trace_id, AP_TRACE_ID_LEN));
+    ck_assert(is_zero(t->span.parent_id, AP_TRACE_SPAN_ID_LEN));
+    ck_assert(strncmp(ap_trace_traceparent(g_request), "00-" TRACE_ID "-",
+                      3 + 32 + 1));
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(util_trace, util_trace_setup, util_trace_teardown)
+#include "test/unit/util_trace.tests"
+HTTPD_END_TEST_CASE